@@ -0,0 +1,59 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <federationparams.h>
+#include <key.h>
+#include <key_io.h>
+#include <primitives/block.h>
+#include <tapyrusmodes.h>
+#include <txdb.h>
+#include <validation.h>
+#include <xfieldhistory.h>
+
+#include <vector>
+
+// Number of headers signed by the same aggregate key, as in a run of headers.
+static const int BLOCK_PROOF_HEADERS = 200;
+
+// A run of headers on top of the genesis block, signed by its aggregate key.
+static void SetupHeaders(std::vector<CBlockHeader>& headers)
+{
+    const CKey key(DecodeSecret(SIGN_BLOCK_PRIVKEY));
+    assert(key.IsValid());
+
+    const CBlock& genesis = FederationParams().GenesisBlock();
+    uint256 hashPrev = genesis.GetHash();
+    for (int i = 0; i < BLOCK_PROOF_HEADERS; i++) {
+        CBlockHeader header;
+        header.nFeatures = CBlockHeader::TAPYRUS_BLOCK_FEATURES;
+        header.hashPrevBlock = hashPrev;
+        header.nTime = genesis.nTime + 15 * (i + 1);
+        assert(key.Sign_Schnorr(header.GetHashForSign(), header.proof));
+        hashPrev = header.GetHash();
+        headers.push_back(header);
+    }
+}
+
+// The proofs of a headers message, verified by PreVerifyBlockProofs before
+// cs_main is taken to accept the headers.
+static void BlockProofPreVerify(benchmark::State& state)
+{
+    writeTestGenesisBlockToFile(GetDataDir(false));
+    SelectParams(TAPYRUS_OP_MODE::DEV);
+    SelectFederationParams(TAPYRUS_OP_MODE::DEV);
+    CXFieldHistory xFieldHistory(FederationParams().GenesisBlock());
+    ::pblocktree.reset(new CBlockTreeDB(1 << 20, true));
+    LoadGenesisBlock();
+
+    std::vector<CBlockHeader> headers;
+    SetupHeaders(headers);
+
+    while (state.KeepRunning()) {
+        PreVerifyBlockProofs(headers, nullptr);
+    }
+}
+
+BENCHMARK(BlockProofPreVerify, 20);
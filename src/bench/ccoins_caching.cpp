@@ -6,6 +6,7 @@
 #include <bench/bench.h>
 #include <coins.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <wallet/crypter.h>
 
 #include <vector>
@@ -86,3 +87,29 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching, 170 * 1000);
+
+// Fill a cache with coins and look each of them up again in random order.
+// This exercises the node allocation and the cache lines touched by FetchCoin.
+static void CCoinsCacheFillAndFetch(benchmark::State& state)
+{
+    constexpr uint32_t NUM_COINS = 10000;
+    FastRandomContext rng(true);
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(NUM_COINS);
+    for (uint32_t i = 0; i < NUM_COINS; i++)
+        outpoints.emplace_back(rng.rand256(), i);
+    std::vector<COutPoint> lookups(outpoints);
+    std::shuffle(lookups.begin(), lookups.end(), rng);
+
+    CCoinsView coinsDummy;
+    while (state.KeepRunning()) {
+        CCoinsViewCache coins(&coinsDummy);
+        for (const COutPoint& outpoint : outpoints)
+            coins.AddCoin(outpoint, Coin(CTxOut(CENT, CScript() << OP_TRUE), 1, false), false);
+        for (const COutPoint& outpoint : lookups)
+            assert(!coins.AccessCoin(outpoint).IsSpent());
+        assert(coins.GetCacheSize() == NUM_COINS);
+    }
+}
+
+BENCHMARK(CCoinsCacheFillAndFetch, 50);
@@ -0,0 +1,57 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <coins.h>
+#include <consensus/validation.h>
+#include <script/standard.h>
+#include <validation.h>
+
+#include <vector>
+
+static const int TOKEN_TX_COLORS = 500;
+
+// A token distribution transaction with 1000 inputs and 1000 outputs: 500 TPC
+// inputs paying the fee come first, then one input for each of 500
+// NON_REISSUABLE tokens, each split into two outputs.
+static void SetupTokenTransaction(CCoinsViewCache& coins, CMutableTransaction& tx)
+{
+    CMutableTransaction funding;
+    std::vector<ColorIdentifier> colorIds;
+    for (int i = 0; i < TOKEN_TX_COLORS; i++) {
+        funding.vout.emplace_back(COIN, GetScriptForDestination(CKeyID(uint160())));
+    }
+    for (int i = 0; i < TOKEN_TX_COLORS; i++) {
+        colorIds.emplace_back(COutPoint(uint256(), i), TokenTypes::NON_REISSUABLE);
+        funding.vout.emplace_back(2, GetScriptForDestination(CColorKeyID(uint160(), colorIds.back())));
+    }
+    AddCoins(coins, funding, 1);
+
+    for (size_t i = 0; i < funding.vout.size(); i++) {
+        tx.vin.emplace_back(COutPoint(funding.GetHashMalFix(), i));
+    }
+    for (const ColorIdentifier& colorId : colorIds) {
+        tx.vout.emplace_back(1, GetScriptForDestination(CColorKeyID(uint160(), colorId)));
+        tx.vout.emplace_back(1, GetScriptForDestination(CColorKeyID(uint160(), colorId)));
+    }
+}
+
+static void TokenTransactionValidation(benchmark::State& state)
+{
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    CMutableTransaction mtx;
+    SetupTokenTransaction(coins, mtx);
+    const CTransaction tx(mtx);
+
+    while (state.KeepRunning()) {
+        CValidationState validation_state;
+        CTxInputColors inputColors(tx, coins);
+        bool success = CheckColorIdentifierValidity(tx, validation_state, inputColors) &&
+            VerifyTokenBalances(tx, validation_state, inputColors, 0);
+        assert(success);
+    }
+}
+
+BENCHMARK(TokenTransactionValidation, 50);
@@ -6,6 +6,11 @@
 
 #include <chain.h>
 
+#include <sync.h>
+
+#include <list>
+#include <map>
+
 /**
  * CChain implementation
  */
@@ -119,6 +124,65 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+namespace {
+
+/**
+ * Recently read header extras, so that serving the same headers again (as
+ * getheaders and header announcements do) does not hit the block tree
+ * database every time. Keyed by block hash, as the hash commits to the
+ * extra data and entries may be unloaded while still cached.
+ */
+class HeaderExtraCache
+{
+private:
+    typedef std::list<uint256> Order;
+    Mutex m_mutex;
+    Order m_order GUARDED_BY(m_mutex);
+    std::map<uint256, std::pair<std::shared_ptr<const CBlockHeaderExtra>, Order::iterator>> m_entries GUARDED_BY(m_mutex);
+
+public:
+    std::shared_ptr<const CBlockHeaderExtra> Get(const uint256& hash)
+    {
+        LOCK(m_mutex);
+        auto it = m_entries.find(hash);
+        if (it == m_entries.end())
+            return nullptr;
+        m_order.splice(m_order.end(), m_order, it->second.second);
+        return it->second.first;
+    }
+
+    void Add(const uint256& hash, std::shared_ptr<const CBlockHeaderExtra> extra)
+    {
+        LOCK(m_mutex);
+        if (m_entries.count(hash))
+            return;
+        m_entries.emplace(hash, std::make_pair(std::move(extra), m_order.insert(m_order.end(), hash)));
+        if (m_entries.size() > MAX_HEADER_EXTRA_CACHE) {
+            m_entries.erase(m_order.front());
+            m_order.pop_front();
+        }
+    }
+};
+
+HeaderExtraCache g_header_extra_cache;
+
+} // namespace
+
+std::shared_ptr<const CBlockHeaderExtra> CBlockIndex::GetHeaderExtra() const
+{
+    if (std::shared_ptr<const CBlockHeaderExtra> extra = std::atomic_load(&m_extra))
+        return extra;
+    if (!phashBlock)
+        return std::make_shared<const CBlockHeaderExtra>();
+    if (std::shared_ptr<const CBlockHeaderExtra> extra = g_header_extra_cache.Get(*phashBlock))
+        return extra;
+    auto loaded = std::make_shared<CBlockHeaderExtra>();
+    if (!ReadBlockHeaderExtra(*this, *loaded))
+        return loaded;
+    g_header_extra_cache.Add(*phashBlock, loaded);
+    return loaded;
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-nullptr. */
 const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex* pb) {
@@ -14,6 +14,9 @@
 #include <uint256.h>
 #include <utilstrencodings.h>
 
+#include <algorithm>
+#include <memory>
+#include <new>
 #include <vector>
 
 /**
@@ -162,8 +165,33 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    BLOCK_PROOF_UNVERIFIED   =   256, //!< header accepted below -assumevalidproofheight without verifying its proof
+};
+
+/** Variable-size fields of a block header, which CBlockIndex keeps out of line. */
+struct CBlockHeaderExtra
+{
+    CXField xfield;
+    std::vector<unsigned char> proof;
+
+    CBlockHeaderExtra() {}
+    CBlockHeaderExtra(const CXField& xfieldIn, const std::vector<unsigned char>& proofIn) : xfield(xfieldIn), proof(proofIn) {}
 };
 
+class CBlockIndex;
+
+/** Number of header extras read back from the block tree database that are kept in memory */
+static const unsigned int MAX_HEADER_EXTRA_CACHE = 4000;
+
+/**
+ * Read the xfield and proof of a block index entry from the block tree
+ * database. Returns false if there is no block tree database. Failing to
+ * read an entry that should be stored there aborts the node and throws, as
+ * carrying on with an empty proof would write it back on the next flush.
+ */
+bool ReadBlockHeaderExtra(const CBlockIndex& index, CBlockHeaderExtra& extra);
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -205,20 +233,26 @@ public:
     //! Verification status of this block. See enum BlockStatus
     uint32_t nStatus;
 
-    //! block header
-    int32_t nFeatures;
-    uint256 hashMerkleRoot;
-    uint256 hashImMerkleRoot;
-    uint32_t nTime;
-    CXField xfield;
-    std::vector<unsigned char> proof;
-
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     int32_t nSequenceId;
 
     //! (memory only) Maximum nTime in the chain up to and including this block.
     unsigned int nTimeMax;
 
+    //! block header, except for the fields of CBlockHeaderExtra
+    int32_t nFeatures;
+    uint32_t nTime;
+    uint256 hashMerkleRoot;
+    uint256 hashImMerkleRoot;
+
+private:
+    //! xfield and proof of the header until the entry is written to the block
+    //! tree database, after which they are read back on demand. Only accessed
+    //! with the atomic shared_ptr functions, as headers are read without cs_main.
+    std::shared_ptr<const CBlockHeaderExtra> m_extra;
+
+public:
+
     void SetNull()
     {
         phashBlock = nullptr;
@@ -237,8 +271,7 @@ public:
         nFeatures       = 0;
         hashMerkleRoot = uint256();
         nTime          = 0;
-        xfield.clear();
-        proof.clear();
+        m_extra.reset();
     }
 
     CBlockIndex()
@@ -254,8 +287,7 @@ public:
         hashMerkleRoot = block.hashMerkleRoot;
         hashImMerkleRoot = block.hashImMerkleRoot;
         nTime          = block.nTime;
-        proof          = block.proof;
-        xfield.operator=(block.xfield);
+        m_extra = std::make_shared<const CBlockHeaderExtra>(block.xfield, block.proof);
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -285,12 +317,32 @@ public:
         block.hashMerkleRoot = hashMerkleRoot;
         block.hashImMerkleRoot = hashImMerkleRoot;
         block.nTime          = nTime;
-        block.proof          = proof;
 
-        block.xfield.operator=(xfield);
+        std::shared_ptr<const CBlockHeaderExtra> extra = GetHeaderExtra();
+        block.proof          = extra->proof;
+        block.xfield.operator=(extra->xfield);
         return block;
     }
 
+    /**
+     * The xfield and proof of the header. They are read from the block tree
+     * database if they are not kept in memory, through a cache of the last
+     * MAX_HEADER_EXTRA_CACHE entries read.
+     */
+    std::shared_ptr<const CBlockHeaderExtra> GetHeaderExtra() const;
+
+    //! Keep the xfield and proof of the header in memory
+    void SetHeaderExtra(const CXField& xfield, const std::vector<unsigned char>& proof)
+    {
+        std::atomic_store(&m_extra, std::make_shared<const CBlockHeaderExtra>(xfield, proof));
+    }
+
+    //! Whether the xfield and proof of the header are in memory
+    bool HasHeaderExtra() const { return std::atomic_load(&m_extra) != nullptr; }
+
+    //! Drop the in-memory xfield and proof, once the entry is stored in the block tree database
+    void ReleaseHeaderExtra() { std::atomic_store(&m_extra, std::shared_ptr<const CBlockHeaderExtra>()); }
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -324,13 +376,14 @@ public:
 
     std::string ToString() const
     {
+        std::shared_ptr<const CBlockHeaderExtra> extra = GetHeaderExtra();
         return strprintf("CBlockIndex(pprev=%p, nHeight=%d, merkle=%s, Immerkle=%s, nTime=%u, xfield=%s, proof={%s})hashBlock=%s",
             pprev, nHeight,
             hashMerkleRoot.ToString(),
             hashImMerkleRoot.ToString(),
             nTime,
-            xfield.ToString(),
-            HexStr(proof),
+            extra->xfield.ToString(),
+            HexStr(extra->proof),
             GetBlockHash().ToString());
     }
 
@@ -374,6 +427,8 @@ class CDiskBlockIndex : public CBlockIndex
 {
 public:
     uint256 hashPrev;
+    CXField xfield;
+    std::vector<unsigned char> proof;
 
     CDiskBlockIndex() {
         hashPrev = uint256();
@@ -381,6 +436,10 @@ public:
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        std::shared_ptr<const CBlockHeaderExtra> extra = pindex->GetHeaderExtra();
+        xfield = extra->xfield;
+        proof = extra->proof;
+        ReleaseHeaderExtra();
     }
 
     ADD_SERIALIZE_METHODS;
@@ -436,6 +495,67 @@ public:
     }
 };
 
+/**
+ * Owner of the entries of the block index. Entries are constructed in place
+ * in chunks of consecutive entries, instead of one allocation per block, and
+ * are only destroyed all at once by Clear().
+ */
+class CBlockIndexArena
+{
+private:
+    struct Chunk {
+        CBlockIndex* entries;
+        size_t capacity;
+        size_t used;
+    };
+    std::vector<Chunk> m_chunks;
+    size_t m_size = 0;
+
+public:
+    //! Entries of a chunk allocated when no size was reserved
+    static constexpr size_t CHUNK_ENTRIES = 4096;
+
+    CBlockIndexArena() = default;
+    CBlockIndexArena(const CBlockIndexArena&) = delete;
+    CBlockIndexArena& operator=(const CBlockIndexArena&) = delete;
+    ~CBlockIndexArena() { Clear(); }
+
+    /** Make sure the next n entries are allocated from a single chunk. */
+    void Reserve(size_t n)
+    {
+        if (!m_chunks.empty() && m_chunks.back().capacity - m_chunks.back().used >= n)
+            return;
+        const size_t capacity = std::max(n, CHUNK_ENTRIES);
+        m_chunks.push_back(Chunk{std::allocator<CBlockIndex>().allocate(capacity), capacity, 0});
+    }
+
+    template <typename... Args>
+    CBlockIndex* New(Args&&... args)
+    {
+        Reserve(1);
+        Chunk& chunk = m_chunks.back();
+        CBlockIndex* pindex = new (chunk.entries + chunk.used) CBlockIndex(std::forward<Args>(args)...);
+        chunk.used++;
+        m_size++;
+        return pindex;
+    }
+
+    /** Destroy all entries. Pointers to them must not be used anymore. */
+    void Clear()
+    {
+        for (Chunk& chunk : m_chunks) {
+            for (size_t i = 0; i < chunk.used; i++) {
+                chunk.entries[i].~CBlockIndex();
+            }
+            std::allocator<CBlockIndex>().deallocate(chunk.entries, chunk.capacity);
+        }
+        m_chunks.clear();
+        m_size = 0;
+    }
+
+    size_t Size() const { return m_size; }
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
@@ -114,3 +114,9 @@ void UpdateChainTxData(const ChainTxData& data)
     assert(globalChainParams);
     globalChainParams->SetChainTxData(data);
 }
+
+void UpdateAssumeutxoData(const uint256& blockhash, const AssumeutxoData& data)
+{
+    assert(globalChainParams);
+    globalChainParams->AddAssumeutxo(blockhash, data);
+}
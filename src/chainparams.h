@@ -11,6 +11,8 @@
 #include <consensus/params.h>
 #include <protocol.h>
 #include <streams.h>
+#include <uint256.h>
+#include <map>
 #include <memory>
 #include <vector>
 #include <fs.h>
@@ -35,6 +37,16 @@ struct ChainTxData {
     double dTxRate;   //!< estimated number of transactions per second after that timestamp
 };
 
+/**
+ * Expected contents of a UTXO set snapshot taken at a given block. Snapshots
+ * passed to loadtxoutset / -loadsnapshot are only accepted if their
+ * txoutset hash (gettxoutsetinfo hash_serialized_3) matches.
+ */
+struct AssumeutxoData {
+    uint256 hash_serialized;
+};
+
+typedef std::map<uint256, AssumeutxoData> MapAssumeutxo;
 
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
@@ -70,6 +82,9 @@ public:
     const CCheckpointData& Checkpoints() const { return checkpointData; }
     const ChainTxData& TxData() const { return chainTxData; }
     void SetChainTxData(const ChainTxData& data) { chainTxData = data; }
+    /** Snapshot hashes trusted for loadtxoutset, keyed by the snapshot base block hash */
+    const MapAssumeutxo& Assumeutxo() const { return m_assumeutxo_data; }
+    void AddAssumeutxo(const uint256& blockhash, const AssumeutxoData& data) { m_assumeutxo_data[blockhash] = data; }
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
     int GetRPCPort() const { return rpcPort; }
     int GetDefaultPort() const { return nDefaultPort; }
@@ -87,6 +102,7 @@ protected:
     std::vector<unsigned char> base58Prefixes[MAX_BASE58_TYPES];
     CCheckpointData checkpointData;
     ChainTxData chainTxData;
+    MapAssumeutxo m_assumeutxo_data;
     bool m_fallback_fee_enabled;
     std::vector<SeedSpec6> vFixedSeeds;
 };
@@ -112,4 +128,7 @@ void SelectParams(const TAPYRUS_OP_MODE mode);
 /** Update ChainTxData for IBD progress estimation after genesis block is loaded. */
 void UpdateChainTxData(const ChainTxData& data);
 
+/** Trust a UTXO snapshot of the block blockhash (set from -assumeutxo). */
+void UpdateAssumeutxoData(const uint256& blockhash, const AssumeutxoData& data);
+
 #endif // BITCOIN_CHAINPARAMS_H
@@ -37,6 +37,7 @@ static int64_t nTimeTotal = 0;
 static int64_t nBlocksTotal = 0;
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
@@ -401,8 +402,9 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState&
 
     return true;
 }
-/** Check warning conditions and do some notifications on new chain tip set. */
-void static UpdateTip(const CBlockIndex *pindexNew)
+/** Check warning conditions and do some notifications on new chain tip set.
+ *  The xfield is logged from pblock, the block of pindexNew, if given. */
+void static UpdateTip(const CBlockIndex *pindexNew, const CBlock* pblock = nullptr)
 {
     AssertLockHeld(::cs_main);
 
@@ -417,9 +419,17 @@ void static UpdateTip(const CBlockIndex *pindexNew)
 
     RefreshChainTxDataFromTip(pindexNew);
 
-    LogPrintf("%s: new best=%s height=%d version=0x%08x xfield=%s tx=%lu date='%s' progress=%f cache=%.1fMiB(%utxo)", __func__, /* Continued */
+    // Without the block, the xfield is only logged if it is in memory: reading
+    // it from the block tree database is not worth it under cs_main.
+    std::string strXField;
+    if (pblock)
+        strXField = " xfield=" + pblock->xfield.ToString();
+    else if (pindexNew->HasHeaderExtra())
+        strXField = " xfield=" + pindexNew->GetHeaderExtra()->xfield.ToString();
+
+    LogPrintf("%s: new best=%s height=%d version=0x%08x%s tx=%lu date='%s' progress=%f cache=%.1fMiB(%utxo)", __func__, /* Continued */
       pindexNew->GetBlockHash().ToString(), pindexNew->nHeight, pindexNew->nFeatures,
-      pindexNew->xfield.ToString(),
+      strXField,
       (unsigned long)pindexNew->nChainTx, FormatISO8601DateTime(pindexNew->GetBlockTime()),
       GuessVerificationProgress(Params().TxData(), pindexNew), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), pcoinsTip->GetCacheSize());
     LogPrintf("\n");
@@ -512,11 +522,72 @@ static void UpdateMempoolForReorg(DisconnectedBlockTransactions &disconnectpool,
     LimitMempoolSize(mempool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
 }
 
+void CChainState::AddValidatedBlock(CValidatedBlock&& validated)
+{
+    AssertLockHeld(cs_main);
+    m_validated_blocks.remove_if([&validated](const CValidatedBlock& entry) { return entry.hashForSign == validated.hashForSign; });
+    m_validated_blocks.push_front(std::move(validated));
+    if (m_validated_blocks.size() > MAX_VALIDATED_BLOCKS)
+        m_validated_blocks.pop_back();
+}
+
+bool CChainState::HaveValidatedBlock(const uint256& hashForSign) const
+{
+    AssertLockHeld(cs_main);
+    for (const CValidatedBlock& entry : m_validated_blocks) {
+        if (entry.hashForSign == hashForSign) return true;
+    }
+    return false;
+}
+
+bool CChainState::TakeValidatedBlock(const CBlock& block, const uint256& hashPrevBlock, CValidatedBlock& validated)
+{
+    AssertLockHeld(cs_main);
+    if (m_validated_blocks.empty()) return false;
+    const uint256 hashForSign = block.GetHashForSign();
+    for (auto it = m_validated_blocks.begin(); it != m_validated_blocks.end(); ++it) {
+        if (it->hashForSign != hashForSign) continue;
+        // A result only holds on top of the UTXO set it was found on
+        bool found = it->hashPrevBlock == hashPrevBlock;
+        if (found) validated = std::move(*it);
+        m_validated_blocks.erase(it);
+        return found;
+    }
+    return false;
+}
+
+/** Apply the coins delta of a block found by TestBlockValidity to view: spend
+ *  the coins in its undo data, which must be those in view, and add its outputs. */
+static bool ApplyValidatedBlock(const CBlock& block, const CBlockUndo& blockundo, CCoinsViewCache& view, int nHeight)
+{
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return false;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        if (!tx.IsCoinBase()) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            if (txundo.vprevout.size() != tx.vin.size())
+                return false;
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                Coin coin;
+                if (!view.SpendCoin(tx.vin[j].prevout, &coin))
+                    return false;
+                const Coin& undo = txundo.vprevout[j];
+                if (coin.out != undo.out || coin.nHeight != undo.nHeight || coin.fCoinBase != undo.fCoinBase)
+                    return false;
+            }
+        }
+        AddCoins(view, tx, nHeight);
+    }
+    return true;
+}
+
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  With fJustCheck, pvalidated receives the effects of the block instead. */
 bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, bool fJustCheck)
+                  CCoinsViewCache& view, bool fJustCheck, CValidatedBlock* pvalidated)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -538,7 +609,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     // is enforced in ContextualCheckBlockHeader(); we wouldn't want to
     // re-enforce that rule here (at least until we make it impossible for
     // GetAdjustedTime() to go backward).
-    if (!CheckBlock(block, state, !fJustCheck, !fJustCheck, nullptr, pindex->nHeight)) {
+    if (!CheckBlock(block, state, !fJustCheck, !fJustCheck, nullptr, pindex->nHeight, IsBlockProofAssumedValid(pindex->GetBlockHash(), pindex->nHeight))) {
         if (state.CorruptionPossible()) {
             // We don't write down blocks to disk if they may have been
             // corrupted, so this should be impossible unless we're having hardware
@@ -615,7 +686,28 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     // failure cannot leave the global set or the DB in a dirty state.
     std::set<ColorIdentifier> allNewIssuances;
 
-    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    // The transactions of a block checked by TestBlockValidity on top of the
+    // same parent are not checked again: the block is applied from the result.
+    // If the result does not apply, the block is validated in full instead.
+    CValidatedBlock validated;
+    bool fValidated = !fJustCheck && TakeValidatedBlock(block, hashPrevBlock, validated);
+    if (fValidated) {
+        CCoinsViewCache viewValidated(&view);
+        fValidated = ApplyValidatedBlock(block, validated.blockundo, viewValidated, pindex->nHeight);
+        if (fValidated)
+            viewValidated.Flush();
+        else
+            LogPrintf("%s: validated block %s does not apply to the UTXO set, checking it in full\n", __func__, block_hash.ToString());
+    }
+    if (fValidated) {
+        blockundo = std::move(validated.blockundo);
+        nFees = validated.nFees;
+        nSigOpsCost = validated.nSigOpsCost;
+        allNewIssuances = std::move(validated.newIssuances);
+        for (const auto& tx : block.vtx) nInputs += tx->vin.size();
+    }
+
+    for (unsigned int i = 0; !fValidated && i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
         CAmount txfee = 0;
@@ -689,13 +781,14 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         }
 
         //if there are colored coins in the output verify their colorids
-        if(!CheckColorIdentifierValidity(tx, state, view, pindex->nHeight))
+        CTxInputColors inputColors(tx, view);
+        if(!CheckColorIdentifierValidity(tx, state, inputColors, pindex->nHeight))
             return false;
 
         //verify token balances (coinbase has no real inputs so balance check does not apply)
         if (!tx.IsCoinBase()) {
             std::set<ColorIdentifier> newIssuances;
-            if (!VerifyTokenBalances(tx, state, view, txfee, !fJustCheck ? &newIssuances : nullptr, pindex->nHeight))
+            if (!VerifyTokenBalances(tx, state, inputColors, txfee, !fJustCheck || pvalidated ? &newIssuances : nullptr, pindex->nHeight))
                 // FormatStateMessage is evaluated before DoS() overwrites state, preserving
                 // the per-tx detail in the log while enforcing DoS 100 at the block level.
                 return state.DoS(100, error("ConnectBlock(): VerifyTokenBalances on %s failed with %s",
@@ -722,11 +815,29 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 
     if (!control.Wait())
         return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
+    if (fJustCheck && fScriptChecks && nScriptCheckThreads) {
+        // CheckInputs caches the scripts it runs inline only. Cache those run by the
+        // check queue now that they all passed, so that connecting the block after
+        // TestBlockValidity (testproposedblock, template precomputation) does not
+        // run them again.
+        for (const auto& tx : block.vtx) {
+            if (!tx->IsCoinBase()) CacheScriptExecution(*tx, GetBlockScriptFlags(pindex));
+        }
+    }
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
 
-    if (fJustCheck)
+    if (fJustCheck) {
+        if (pvalidated) {
+            pvalidated->hashForSign = block.GetHashForSign();
+            pvalidated->hashPrevBlock = hashPrevBlock;
+            pvalidated->blockundo = std::move(blockundo);
+            pvalidated->nFees = nFees;
+            pvalidated->nSigOpsCost = nSigOpsCost;
+            pvalidated->newIssuances = std::move(allNewIssuances);
+        }
         return true;
+    }
 
     if (!WriteUndoDataForBlock(blockundo, state, pindex))
         return false;
@@ -867,6 +978,10 @@ bool CChainState::ConnectTip(CValidationState& state, CBlockIndex* pindexNew, co
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    size_t nPrefetched = PrefetchInputs(blockConnecting);
+    int64_t nTime2a = GetTimeMicros(); nTimePrefetch += nTime2a - nTime2;
+    LogPrint(BCLog::BENCH, "  - Prefetch inputs: %.2fms (%u coins) [%.2fs]\n", (nTime2a - nTime2) * MILLI, nPrefetched, nTimePrefetch * MICRO);
+    nTime2 = nTime2a;
     {
         CCoinsViewCache view(pcoinsTip.get());
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view);
@@ -924,7 +1039,7 @@ bool CChainState::ConnectTip(CValidationState& state, CBlockIndex* pindexNew, co
 
     // Update chainActive & related variables.
     chainActive.SetTip(pindexNew);
-    UpdateTip(pindexNew);
+    UpdateTip(pindexNew, &blockConnecting);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime5) * MILLI, nTimePostConnect * MICRO, nTimePostConnect * MILLI / nBlocksTotal);
@@ -935,6 +1050,50 @@ bool CChainState::ConnectTip(CValidationState& state, CBlockIndex* pindexNew, co
 }
 
 
+size_t CChainState::PrefetchInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!coinfetchqueue)
+        return 0;
+
+    // Outputs created in the block are not in the chainstate yet.
+    std::set<uint256> txids;
+    for (const auto& tx : block.vtx)
+        txids.insert(tx->GetHashMalFix());
+
+    std::vector<COutPoint> outpoints;
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!txids.count(txin.prevout.hashMalFix) && !pcoinsTip->HaveCoinInCache(txin.prevout))
+                outpoints.push_back(txin.prevout);
+        }
+    }
+    if (outpoints.empty())
+        return 0;
+
+    // pcoinsTip is not modified while the coins are read, so coins found
+    // in its base are still unspent when they are added below.
+    const CCoinsView& base = *pcoinsTip->GetBackend();
+    std::vector<Coin> coins(outpoints.size());
+    std::vector<CCoinFetch> fetches;
+    fetches.reserve(outpoints.size());
+    for (size_t i = 0; i < outpoints.size(); i++)
+        fetches.emplace_back(base, outpoints[i], coins[i]);
+
+    CCheckQueueControl<CCoinFetch> control(coinfetchqueue.get());
+    control.Add(std::move(fetches));
+    control.Wait();
+
+    size_t nFetched = 0;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        if (!coins[i].IsSpent() && pcoinsTip->EmplaceCoinFromBase(outpoints[i], std::move(coins[i])))
+            nFetched++;
+    }
+    return nFetched;
+}
+
 /**
  * Return the tip of the chain with the most work in it, that isn't
  * known to be invalid (it's however far from certain to be valid).
@@ -1311,7 +1470,7 @@ CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    CBlockIndex* pindexNew = m_blockindex_arena.New(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -1380,6 +1539,33 @@ void CChainState::ReceivedBlockTransactions(const CBlock& block, CBlockIndex* pi
 }
 
 
+bool CChainState::CheckDeferredBlockProofs(CBlockIndex* pindexLast, bool fConfirmed, CValidationState& state, CXFieldHistoryMap* pxfieldHistory)
+{
+    AssertLockHeld(cs_main);
+    std::vector<CBlockIndex*> vDeferred;
+    for (CBlockIndex* pindex = pindexLast; pindex && (pindex->nStatus & BLOCK_PROOF_UNVERIFIED); pindex = pindex->pprev)
+        vDeferred.push_back(pindex);
+
+    // Lowest first, so that a failure marks the rest as its descendants
+    for (auto it = vDeferred.rbegin(); it != vDeferred.rend(); ++it) {
+        CBlockIndex* pindex = *it;
+        CValidationState proofState;
+        if (!fConfirmed && !CheckBlockHeader(pindex->GetBlockHeader(), proofState, pxfieldHistory, pindex->nHeight)) {
+            pindex->nStatus |= BLOCK_FAILED_VALID;
+            m_failed_blocks.insert(pindex);
+            setDirtyBlockIndex.insert(pindex);
+            for (++it; it != vDeferred.rend(); ++it) {
+                (*it)->nStatus |= BLOCK_FAILED_CHILD;
+                setDirtyBlockIndex.insert(*it);
+            }
+            return state.DoS(100, error("%s: header %s accepted without its proof: %s", __func__, pindex->GetBlockHash().ToString(), FormatStateMessage(proofState)), REJECT_INVALID, "bad-prevblk");
+        }
+        pindex->nStatus &= ~BLOCK_PROOF_UNVERIFIED;
+        setDirtyBlockIndex.insert(pindex);
+    }
+    return true;
+}
+
 bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, CXFieldHistoryMap* pxfieldHistory)
 {
     AssertLockHeld(cs_main);
@@ -1387,6 +1573,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
     uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = nullptr;
+    bool fProofDeferred = false;
     if (hash != FederationParams().GenesisBlock().GetHash()) {
         if (miSelf != mapBlockIndex.end()) {
             // Block header is already known.
@@ -1408,7 +1595,8 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
         }
         int nBlockHeight = pindexPrev ? pindexPrev->nHeight + 1 : -1;
 
-        if (!CheckBlockHeader(block, state, pxfieldHistory, nBlockHeight))
+        fProofDeferred = IsBlockProofDeferred(block, hash, nBlockHeight);
+        if (!CheckBlockHeader(block, state, pxfieldHistory, nBlockHeight, true, fProofDeferred || IsBlockProofAssumedValid(hash, nBlockHeight)))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         if (!pindexPrev)
@@ -1435,9 +1623,19 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
                 }
             }
         }
+
+        // The header at -assumevalidproofheight settles the proofs of the ancestors accepted without them
+        if (nBlockHeight == nAssumeValidProofHeight && (pindexPrev->nStatus & BLOCK_PROOF_UNVERIFIED)
+            && !CheckDeferredBlockProofs(pindexPrev, hash == hashAssumeValidProof, state, pxfieldHistory))
+            return false;
     }
-    if (pindex == nullptr)
+    if (pindex == nullptr) {
         pindex = AddToBlockIndex(block);
+        if (fProofDeferred && hash != hashAssumeValidProof) {
+            pindex->nStatus |= BLOCK_PROOF_UNVERIFIED;
+            setDirtyBlockIndex.insert(pindex);
+        }
+    }
 
     //if this header was valid and has any xfield change remember it until we finish processing the headers message
     if(pxfieldHistory
@@ -1546,7 +1744,7 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
+    CBlockIndex* pindexNew = m_blockindex_arena.New();
     mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -1555,17 +1753,31 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
 
 bool CChainState::LoadBlockIndex(CBlockTreeDB& blocktree)
 {
-    if (!blocktree.LoadBlockIndexGuts([this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    auto reserve = [this](size_t nEntries) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+        mapBlockIndex.reserve(mapBlockIndex.size() + nEntries);
+        m_blockindex_arena.Reserve(nEntries);
+    };
+    if (!blocktree.LoadBlockIndexGuts([this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }, reserve, nThreads))
         return false;
 
-    std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
+    // Order the entries by height with a counting sort, so that every block is
+    // visited after its predecessor.
+    int64_t nStart = GetTimeMicros();
+    int nMaxHeight = 0;
+    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+        nMaxHeight = std::max(nMaxHeight, item.second->nHeight);
+    std::vector<size_t> vHeightStart(nMaxHeight + 2, 0);
+    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+        vHeightStart[item.second->nHeight + 1]++;
+    for (int nHeight = 1; nHeight <= nMaxHeight + 1; nHeight++)
+        vHeightStart[nHeight] += vHeightStart[nHeight - 1];
+    std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight(mapBlockIndex.size());
     for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
     {
         CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+        vSortedByHeight[vHeightStart[pindex->nHeight]++] = std::make_pair(pindex->nHeight, pindex);
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
     for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
@@ -1597,6 +1809,7 @@ bool CChainState::LoadBlockIndex(CBlockTreeDB& blocktree)
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    LogPrintf("%s: linked %u block index entries up to height %d in %.2fms\n", __func__, vSortedByHeight.size(), nMaxHeight, 0.001 * (GetTimeMicros() - nStart));
 
     return true;
 }
@@ -1785,6 +1998,8 @@ void CChainState::UnloadBlockIndex()
     nBlockSequenceId = 1;
     m_failed_blocks.clear();
     setBlockIndexCandidates.clear();
+    m_validated_blocks.clear();
+    m_blockindex_arena.Clear();
 }
 
 
@@ -1830,6 +2045,57 @@ bool CChainState::LoadGenesisBlock()
 }
 
 
+bool CChainState::ActivateSnapshotBase(CBlockIndex* pindexBase)
+{
+    AssertLockHeld(cs_main);
+    assert(pindexBase->GetBlockHash() == pcoinsTip->GetBestBlock());
+
+    // The snapshot vouches for the scripts of all blocks up to the base. We
+    // have none of their transactions, so count one per block for nChainTx
+    // (LoadBlockIndex recomputes nChainTx from nTx in the same way).
+    for (int nHeight = 1; nHeight <= pindexBase->nHeight; ++nHeight) {
+        CBlockIndex* pindex = pindexBase->GetAncestor(nHeight);
+        if (pindex->nStatus & BLOCK_FAILED_MASK) {
+            return error("%s: block %s below the snapshot base is invalid", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (pindex->nTx == 0) {
+            pindex->nTx = 1;
+        }
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindex);
+    }
+
+    chainActive.SetTip(pindexBase);
+    UpdateTip(pindexBase);
+
+    // Blocks received before the snapshot was loaded whose parents lacked
+    // nChainTx can now be linked, and those above the base connected.
+    setBlockIndexCandidates.insert(pindexBase);
+    std::deque<CBlockIndex*> queue;
+    for (CBlockIndex* pindex = pindexBase; pindex; pindex = pindex->pprev) {
+        queue.push_front(pindex);
+    }
+    while (!queue.empty()) {
+        CBlockIndex *pindex = queue.front();
+        queue.pop_front();
+        auto range = mapBlocksUnlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
+            CBlockIndex* pindexChild = it->second;
+            pindexChild->nChainTx = pindex->nChainTx + pindexChild->nTx;
+            setBlockIndexCandidates.insert(pindexChild);
+            queue.push_back(pindexChild);
+            range.first++;
+            mapBlocksUnlinked.erase(it);
+        }
+    }
+    PruneBlockIndexCandidates();
+
+    CheckBlockIndex();
+    return true;
+}
+
 void CChainState::CheckBlockIndex()
 {
     if (!fCheckBlockIndex) {
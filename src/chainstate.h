@@ -9,12 +9,14 @@
 #include <cs_main.h>
 
 #include <checkqueue.h>
+#include <coinfetch.h>
 #include <coins.h>
 #include <sync.h>
 #include <chain.h>
 #include <xfieldhistory.h>
 #include <undo.h>
 #include <scriptcheck.h>
+#include <list>
 #include <map>
 #include <set>
 
@@ -55,6 +57,26 @@ struct BlockHasher
 
 typedef std::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 
+/**
+ * What connecting a block on top of its parent does to the UTXO set, as found
+ * by TestBlockValidity. The coins delta is the outputs of the block and the
+ * coins spent by it, which are its undo data.
+ */
+struct CValidatedBlock
+{
+    //! Hash of the block without its proof, which its transactions are committed to
+    uint256 hashForSign;
+    uint256 hashPrevBlock;
+    CBlockUndo blockundo;
+    CAmount nFees = 0;
+    int64_t nSigOpsCost = 0;
+    //! NON_REISSUABLE and NFT colors issued by the block
+    std::set<ColorIdentifier> newIssuances;
+};
+
+/** Number of validated blocks kept for ConnectBlock, each holding the undo data of a block */
+static const size_t MAX_VALIDATED_BLOCKS = 4;
+
 /**
  * CChainState stores and provides an API to update our local knowledge of the
  * current best chain and header tree.
@@ -116,13 +138,25 @@ private:
      */
     Mutex m_cs_chainstate;
 
+    /**
+     * Blocks checked by TestBlockValidity with their merkle root, most recent
+     * first. In a signing round the proposal is checked by testproposedblock
+     * before it is signed, and connecting the signed block, whose proof is not
+     * covered by hashForSign, applies its result instead of checking its
+     * transactions again.
+     */
+    std::list<CValidatedBlock> m_validated_blocks;
+
 public:
     CChain chainActive;
     BlockMap mapBlockIndex;
+    //! Owner of the entries of mapBlockIndex
+    CBlockIndexArena m_blockindex_arena;
     std::multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
     CBlockIndex *pindexBestInvalid = nullptr;
 
     std::unique_ptr< CCheckQueue<CScriptCheck> >scriptcheckqueue;
+    std::unique_ptr< CCheckQueue<CCoinFetch> >coinfetchqueue;
 
     bool LoadBlockIndex(CBlockTreeDB& blocktree) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -138,7 +172,11 @@ public:
     // Block (dis)connection on a given view:
     DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, bool fDryRun = false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                    CCoinsViewCache& view, bool fJustCheck = false);
+                    CCoinsViewCache& view, bool fJustCheck = false, CValidatedBlock* pvalidated = nullptr);
+
+    /** Keep the result of TestBlockValidity for connecting the same block on top of the same parent. */
+    void AddValidatedBlock(CValidatedBlock&& validated) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    bool HaveValidatedBlock(const uint256& hashForSign) const EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     // Block disconnection on our pcoinsTip:
     bool DisconnectTip(CValidationState& state, DisconnectedBlockTransactions *disconnectpool);
@@ -152,6 +190,13 @@ public:
     bool RewindBlockIndex();
     bool LoadGenesisBlock();
 
+    /**
+     * Make pindexBase, whose UTXO set was loaded into pcoinsTip from a
+     * snapshot, the tip of the active chain. Its ancestors are marked valid
+     * without their block data, as on a pruned node.
+     */
+    bool ActivateSnapshotBase(CBlockIndex* pindexBase) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
     void PruneBlockIndexCandidates();
 
     void UnloadBlockIndex();
@@ -159,6 +204,12 @@ public:
 private:
     bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace);
     bool ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool);
+    /**
+     * Read the coins spent by block that are neither created in it nor
+     * cached yet into pcoinsTip, in parallel on coinfetchqueue.
+     * @return the number of coins read
+     */
+    size_t PrefetchInputs(const CBlock& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /** Create a new block index entry for a given block hash */
@@ -176,6 +227,14 @@ private:
 
 
     bool RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& inputs) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    /**
+     * Clear BLOCK_PROOF_UNVERIFIED from pindexLast and its ancestors, verifying
+     * their proofs unless fConfirmed, when the -assumevalidproof block is their
+     * descendant. The first invalid one is marked failed along with the rest.
+     */
+    bool CheckDeferredBlockProofs(CBlockIndex* pindexLast, bool fConfirmed, CValidationState& state, CXFieldHistoryMap* pxfieldHistory) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    /** Remove the result of TestBlockValidity for block on top of hashPrevBlock, if any, into validated. */
+    bool TakeValidatedBlock(const CBlock& block, const uint256& hashPrevBlock, CValidatedBlock& validated) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 } ;
 
 extern CChainState g_chainstate;
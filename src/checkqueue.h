@@ -50,6 +50,9 @@ private:
     //! The temporary evaluation result.
     bool fAllOk;
 
+    //! The first verification that failed, if any, handed to the master in Wait().
+    std::vector<T> vFailed;
+
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
@@ -64,11 +67,12 @@ private:
     bool m_request_stop;
 
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(bool fMaster = false, T* pfailed = nullptr)
     {
         std::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
+        std::vector<T> vMyFailed;
         unsigned int nNow = 0;
         bool fOk = true;
         do {
@@ -77,6 +81,9 @@ private:
                 // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
                 if (nNow) {
                     fAllOk &= fOk;
+                    if (!vMyFailed.empty() && vFailed.empty())
+                        vFailed.push_back(std::move(vMyFailed.front()));
+                    vMyFailed.clear();
                     nTodo -= nNow;
                     if (nTodo == 0 && !fMaster)
                         // We processed the last element; inform the master it can exit and return the result
@@ -90,9 +97,13 @@ private:
                     if (fMaster && nTodo == 0) {
                         nTotal--;
                         bool fRet = fAllOk;
+                        if (!fRet && pfailed && !vFailed.empty())
+                            *pfailed = std::move(vFailed.front());
                         // reset the status for new work later
-                        if (fMaster)
+                        if (fMaster) {
                             fAllOk = true;
+                            vFailed.clear();
+                        }
                         // return the current status
                         return fRet;
                     }
@@ -126,9 +137,13 @@ private:
                 fOk = fAllOk;
             }
             // execute work
-            for (T& check : vChecks)
-                if (fOk)
+            for (T& check : vChecks) {
+                if (fOk) {
                     fOk = check();
+                    if (!fOk)
+                        vMyFailed.push_back(std::move(check));
+                }
+            }
             vChecks.clear();
         } while (true);
     }
@@ -143,8 +158,8 @@ public:
     //! Mutex to ensure only one concurrent CCheckQueueControl
     std::mutex ControlMutex;
 
-    //! Create a new check queue
-    explicit CCheckQueue(unsigned int batch_size, int worker_threads_num) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(batch_size), m_request_stop(false)
+    //! Create a new check queue, naming the worker threads thread_name.<n>
+    explicit CCheckQueue(unsigned int batch_size, int worker_threads_num, const char* thread_name = "scriptch") : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(batch_size), m_request_stop(false)
     {
         {
             WaitableLock loc(mutex);
@@ -154,8 +169,8 @@ public:
         }
         assert(m_worker_threads.empty());
         for (int n = 0; n < worker_threads_num; ++n) {
-            m_worker_threads.emplace_back([this, n]() {
-                RenameThread(strprintf("scriptch.%i", n));
+            m_worker_threads.emplace_back([this, n, thread_name]() {
+                RenameThread(strprintf("%s.%i", thread_name, n));
                 WorkerLoop();
         });
         }
@@ -168,10 +183,13 @@ public:
     CCheckQueue(CCheckQueue&&) = delete;
     CCheckQueue& operator=(CCheckQueue&&) = delete;
 
-    //! Wait until execution finishes, and return whether all evaluations were successful.
-    bool Wait()
+    /**
+     * Wait until execution finishes, and return whether all evaluations were successful.
+     * On failure, one of the verifications that failed is moved into *pfailed if given.
+     */
+    bool Wait(T* pfailed = nullptr)
     {
-        return Loop(true);
+        return Loop(true, pfailed);
     }
 
     //! Add a batch of checks to the queue
@@ -231,11 +249,11 @@ public:
         }
     }
 
-    bool Wait()
+    bool Wait(T* pfailed = nullptr)
     {
         if (pqueue == nullptr)
             return true;
-        bool fRet = pqueue->Wait();
+        bool fRet = pqueue->Wait(pfailed);
         fDone = true;
         return fRet;
     }
@@ -0,0 +1,47 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TAPYRUS_COINFETCH_H
+#define TAPYRUS_COINFETCH_H
+
+#include <coins.h>
+
+#include <stdexcept>
+
+/**
+ * Closure representing the read of one coin from a view, so that the inputs
+ * of a block can be read on the worker threads of a CCheckQueue before the
+ * block is connected. The view must support concurrent GetCoin calls.
+ *
+ * The coin is left spent if it was not found, or if the view threw while
+ * reading it; such a coin is simply read again when the block is connected.
+ * Note that the chainstate view (CCoinsViewErrorCatcher) does not throw on a
+ * database read error but aborts the node, from the worker thread when the
+ * failing read is a prefetch.
+ */
+class CCoinFetch
+{
+private:
+    const CCoinsView* view;
+    COutPoint outpoint;
+    Coin* coin;
+
+public:
+    CCoinFetch() : view(nullptr), coin(nullptr) {}
+    CCoinFetch(const CCoinsView& viewIn, const COutPoint& outpointIn, Coin& coinIn) :
+        view(&viewIn), outpoint(outpointIn), coin(&coinIn) {}
+
+    bool operator()()
+    {
+        try {
+            if (!view->GetCoin(outpoint, *coin))
+                coin->Clear();
+        } catch (const std::exception&) {
+            coin->Clear();
+        }
+        return true;
+    }
+};
+
+#endif // TAPYRUS_COINFETCH_H
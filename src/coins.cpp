@@ -9,10 +9,12 @@
 #include <random.h>
 #include <trace.h>
 
+#include <limits>
+
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) { return false; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return nullptr; }
 
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
@@ -27,13 +29,14 @@ bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) { return base->BatchWrite(mapCoins, hashBlock, erase); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn),
+    cacheCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &m_cache_coins_memory_resource), cachedCoinsUsage(0), nAccessEpoch(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -41,12 +44,15 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
 
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        it->second.epoch = nAccessEpoch;
         return it;
+    }
     Coin tmp;
     if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
+    ret->second.epoch = nAccessEpoch;
     if (ret->second.coin.IsSpent()) {
         // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
@@ -83,6 +89,7 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     }
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
+    it->second.epoch = nAccessEpoch;
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 
     TRACE6(utxocache, utxocache_add,
@@ -94,6 +101,16 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
         (bool)coin.IsCoinBase());
 }
 
+bool CCoinsViewCache::EmplaceCoinFromBase(const COutPoint& outpoint, Coin&& coin) {
+    assert(!coin.IsSpent());
+    auto [it, inserted] = cacheCoins.try_emplace(outpoint, std::move(coin));
+    if (!inserted)
+        return false;
+    it->second.epoch = nAccessEpoch;
+    cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    return true;
+}
+
 void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check) {
     bool fCoinbase = tx.IsCoinBase();
     const uint256& txid = tx.GetHashMalFix();
@@ -159,8 +176,8 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, bool erase) {
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = erase ? mapCoins.erase(it) : std::next(it)) {
         // Ignore non-dirty entries (optimization).
         if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
             continue;
@@ -173,7 +190,11 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 // Otherwise we will need to create it in the parent
                 // and move the data up and mark it as dirty
                 CCoinsCacheEntry& entry = cacheCoins[it->first];
-                entry.coin = std::move(it->second.coin);
+                if (erase)
+                    entry.coin = std::move(it->second.coin);
+                else
+                    entry.coin = it->second.coin;
+                entry.epoch = nAccessEpoch;
                 cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
                 entry.flags = CCoinsCacheEntry::DIRTY;
                 // We can mark it FRESH in the parent if it was FRESH in the child
@@ -202,9 +223,13 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
             } else {
                 // A normal modification.
                 cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
-                itUs->second.coin = std::move(it->second.coin);
+                if (erase)
+                    itUs->second.coin = std::move(it->second.coin);
+                else
+                    itUs->second.coin = it->second.coin;
                 cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
                 itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                itUs->second.epoch = nAccessEpoch;
                 // NOTE: It is possible the child has a FRESH flag here in
                 // the event the entry we found in the parent is pruned. But
                 // we must not copy that FRESH flag to the parent as that
@@ -214,16 +239,100 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
         }
     }
     hashBlock = hashBlockIn;
+    // Entries used from here on are more recent than those touched so far.
+    // When the epoch wraps around, all entries start over as equally recent.
+    if (++nAccessEpoch == 0) {
+        for (auto& entry : cacheCoins)
+            entry.second.epoch = 0;
+    }
     return true;
 }
 
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    ReallocateCache();
     cachedCoinsUsage = 0;
     return fOk;
 }
 
+bool CCoinsViewCache::Sync() {
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, false);
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ) {
+        if (it->second.coin.IsSpent()) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    return fOk;
+}
+
+std::shared_ptr<CCoinsDirtySet> CCoinsViewCache::TakeDirty() {
+    std::shared_ptr<CCoinsDirtySet> dirty = std::make_shared<CCoinsDirtySet>();
+    dirty->hashBlock = hashBlock;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            ++it;
+            continue;
+        }
+        if (!it->second.coin.IsSpent()) {
+            // Unspent coins stay cached as unmodified, the writer gets a copy.
+            dirty->coins.emplace(it->first, it->second);
+            it->second.flags = 0;
+            ++it;
+            continue;
+        }
+        // A spent FRESH coin never reached the base, so there is nothing to write.
+        if (!(it->second.flags & CCoinsCacheEntry::FRESH))
+            dirty->coins.emplace(it->first, std::move(it->second));
+        it = cacheCoins.erase(it);
+    }
+    return dirty;
+}
+
+size_t CCoinsViewCache::Evict(size_t target_usage) {
+    if (DynamicMemoryUsage() <= target_usage)
+        return 0;
+
+    // Estimate the bytes held by unmodified entries of each age, and find the
+    // youngest age that still has to go to bring the usage under the target.
+    const size_t nodeUsage = sizeof(CCoinsMap::value_type) + 2 * sizeof(void*);
+    std::vector<size_t> usageByAge(std::numeric_limits<uint16_t>::max() + 1, 0);
+    for (const auto& entry : cacheCoins) {
+        if (entry.second.flags == 0)
+            usageByAge[static_cast<uint16_t>(nAccessEpoch - entry.second.epoch)] += nodeUsage + entry.second.coin.DynamicMemoryUsage();
+    }
+    size_t excess = DynamicMemoryUsage() - target_usage;
+    size_t minAge = usageByAge.size();
+    size_t freed = 0;
+    while (minAge > 0 && freed < excess)
+        freed += usageByAge[--minAge];
+
+    size_t count = 0;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end() && DynamicMemoryUsage() > target_usage; ) {
+        if (it->second.flags == 0 && static_cast<uint16_t>(nAccessEpoch - it->second.epoch) >= minAge) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+            count++;
+        } else {
+            ++it;
+        }
+    }
+    return count;
+}
+
+void CCoinsViewCache::ReallocateCache()
+{
+    assert(cacheCoins.empty());
+    cacheCoins.~CCoinsMap();
+    m_cache_coins_memory_resource.~CCoinsMapMemoryResource();
+    ::new (&m_cache_coins_memory_resource) CCoinsMapMemoryResource{};
+    ::new (&cacheCoins) CCoinsMap{0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &m_cache_coins_memory_resource};
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
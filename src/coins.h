@@ -13,12 +13,14 @@
 #include <hash.h>
 #include <memusage.h>
 #include <serialize.h>
+#include <support/allocators/pool.h>
 #include <uint256.h>
 #include <coloridentifier.h>
 
 #include <assert.h>
 #include <stdint.h>
 
+#include <memory>
 #include <unordered_map>
 
 /**
@@ -104,8 +106,12 @@ public:
 
 struct CCoinsCacheEntry
 {
-    Coin coin; // The actual cached data.
+    // The actual cached data. Coin has tail padding after its bitfields;
+    // letting flags and epoch live in it keeps each cache node one word smaller.
+    [[no_unique_address]] Coin coin;
     unsigned char flags;
+    // Access epoch of the owning cache when this entry was last used, see CCoinsViewCache::Evict.
+    uint16_t epoch;
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -117,11 +123,32 @@ struct CCoinsCacheEntry
          */
     };
 
-    CCoinsCacheEntry() : flags(0) {}
-    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
+    CCoinsCacheEntry() : flags(0), epoch(0) {}
+    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0), epoch(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * The nodes of the map come from a PoolResource owned by the cache, so that a
+ * cached coin does not pay for a separate malloc'ed node. The exact node size
+ * of std::unordered_map is implementation defined, so the pool handles blocks
+ * of up to four pointers more than the stored value.
+ */
+using CCoinsMap = std::unordered_map<COutPoint,
+                                     CCoinsCacheEntry,
+                                     SaltedOutpointHasher,
+                                     std::equal_to<COutPoint>,
+                                     PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                                                   sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4>>;
+
+using CCoinsMapMemoryResource = CCoinsMap::allocator_type::ResourceType;
+
+/** Modified coins taken out of a CCoinsViewCache, to be written to its base separately. */
+struct CCoinsDirtySet
+{
+    CCoinsMapMemoryResource resource;
+    CCoinsMap coins{0, CCoinsMap::hasher{}, CCoinsMap::key_equal{}, &resource};
+    uint256 hashBlock;
+};
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -166,8 +193,9 @@ public:
     virtual std::vector<uint256> GetHeadBlocks() const;
 
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified. With erase set to false, the
+    //! entries of mapCoins are copied and left in place for the caller.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true);
 
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
@@ -193,7 +221,8 @@ public:
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    CCoinsView* GetBackend() const { return base; }
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -208,11 +237,15 @@ protected:
      * declared as "const".
      */
     mutable uint256 hashBlock;
+    mutable CCoinsMapMemoryResource m_cache_coins_memory_resource{};
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Stamped on entries as they are used; advanced with every BatchWrite into this cache. */
+    mutable uint16_t nAccessEpoch;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -226,7 +259,7 @@ public:
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
     CCoinsViewCursor* Cursor() const override {
         throw std::logic_error("CCoinsViewCache cursor iteration not supported.");
     }
@@ -256,6 +289,13 @@ public:
      */
     void AddCoin(const COutPoint& outpoint, Coin&& coin, bool potential_overwrite);
 
+    /**
+     * Add a coin that the caller read from the base, unless the outpoint is
+     * cached already. The entry is not modified, as the base has the coin.
+     * Returns whether the coin was added.
+     */
+    bool EmplaceCoinFromBase(const COutPoint& outpoint, Coin&& coin);
+
     /**
      * Spend a coin. Pass moveto in order to get the deleted data.
      * If no unspent output exists for the passed outpoint, this call
@@ -270,6 +310,30 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base, like Flush,
+     * but keep the unmodified coins cached. Spent coins are dropped and no
+     * entry is DIRTY or FRESH afterwards.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync();
+
+    /**
+     * Remove unmodified coins, least recently used first, until the cache
+     * uses no more than target_usage bytes. Recency is tracked per access
+     * epoch rather than per access.
+     * @return the number of coins removed
+     */
+    size_t Evict(size_t target_usage);
+
+    /**
+     * Copy the modified entries into a CCoinsDirtySet and then treat them as
+     * written: unspent coins stay cached as unmodified, spent ones are moved
+     * out. The caller becomes responsible for writing the set to the base,
+     * and the base must serve these coins until it has.
+     */
+    std::shared_ptr<CCoinsDirtySet> TakeDirty();
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -297,6 +361,12 @@ public:
 
 private:
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
+
+    /**
+     * Release the memory pool of the (empty) cache. Chunks of the pool are
+     * never returned to the system while the map exists.
+     */
+    void ReallocateCache();
 };
 
 //! Utility function to add all of a transaction's outputs to a cache.
@@ -0,0 +1,114 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinstats.h>
+
+#include <cs_main.h>
+#include <serialize.h>
+#include <util.h>
+#include <validation.h>
+
+#include <assert.h>
+#include <memory>
+
+void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    ss << hash;
+    ss << VARINT(outputs.begin()->second.nHeight * 2 + (outputs.begin()->second.fCoinBase ? 1u : 0u));
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
+        ss << VARINT(output.first + 1);
+        ss << output.second.out.scriptPubKey;
+        ss << VARINT_MODE(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
+        stats.nTransactionOutputs++;
+        stats.mTotalAmount[GetColorIdFromScript(output.second.out.scriptPubKey)] += output.second.out.nValue;
+        stats.nBogoSize += GetBogoSize(output.second.out.scriptPubKey);
+    }
+    ss << VARINT(0u);
+}
+
+/** Serialization of a coin as an element of the MuHash of a UTXO set. */
+static CDataStream TxOutSer(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << static_cast<uint32_t>(coin.nHeight * 2 + (coin.fCoinBase ? 1u : 0u));
+    ss << coin.out;
+    return ss;
+}
+
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    const CDataStream ss = TxOutSer(outpoint, coin);
+    muhash.Insert(reinterpret_cast<const unsigned char*>(ss.data()), ss.size());
+}
+
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    const CDataStream ss = TxOutSer(outpoint, coin);
+    muhash.Remove(reinterpret_cast<const unsigned char*>(ss.data()), ss.size());
+}
+
+bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats, CoinStatsHashType hash_type)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    assert(pcursor);
+
+    if (!GetUTXOStats(pcursor.get(), stats, nullptr, hash_type)) {
+        return false;
+    }
+    stats.nDiskSize = view->EstimateSize();
+    return true;
+}
+
+bool GetUTXOStats(CCoinsViewCursor *pcursor, CCoinsStats &stats, const std::atomic<bool>* should_abort,
+                  CoinStatsHashType hash_type)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    MuHash3072 muhash;
+    stats.hashBlock = pcursor->GetBestBlock();
+    {
+        LOCK(cs_main);
+        stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
+    }
+    ss << stats.hashBlock;
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    while (pcursor->Valid()) {
+        if (should_abort && *should_abort) {
+            return false;
+        }
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            if (!outputs.empty() && key.hashMalFix != prevkey) {
+                ApplyStats(stats, ss, prevkey, outputs);
+                outputs.clear();
+            }
+            prevkey = key.hashMalFix;
+            if (hash_type == CoinStatsHashType::MUHASH) {
+                ApplyCoinHash(muhash, key, coin);
+            }
+            outputs.emplace(key.n, coin);
+        } else {
+            return error("%s: unable to read value", __func__);
+        }
+        pcursor->Next();
+    }
+    if (!outputs.empty()) {
+        ApplyStats(stats, ss, prevkey, outputs);
+    }
+    switch (hash_type) {
+    case CoinStatsHashType::HASH_SERIALIZED:
+        stats.hashSerialized = ss.GetHash();
+        break;
+    case CoinStatsHashType::MUHASH:
+        muhash.Finalize(stats.hashSerialized);
+        break;
+    case CoinStatsHashType::NONE:
+        break;
+    }
+    return true;
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include <coins.h>
+#include <coloridentifier.h>
+#include <crypto/muhash.h>
+#include <hash.h>
+#include <uint256.h>
+
+#include <atomic>
+#include <map>
+#include <stdint.h>
+
+/** Hash committing to the coins of a UTXO set, as reported by gettxoutsetinfo. */
+enum class CoinStatsHashType {
+    //! hash_serialized_3: depends on the order of the coins, so needs a full scan
+    HASH_SERIALIZED,
+    //! MuHash3072 of the coins: can be updated per block, see CoinStatsIndex
+    MUHASH,
+    NONE,
+};
+
+struct CCoinsStats
+{
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    //! Hash of the requested CoinStatsHashType
+    uint256 hashSerialized;
+    uint64_t nDiskSize;
+    TxColoredCoinBalancesMap mTotalAmount;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0){ mTotalAmount[ColorIdentifier()] = 0; }
+};
+
+//! Contribution of an unspent output to CCoinsStats::nBogoSize
+static inline uint64_t GetBogoSize(const CScript& scriptPubKey)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + scriptPubKey.size() /* scriptPubKey */;
+}
+
+/**
+ * Add the unspent outputs of one transaction to stats and to the running
+ * hash_serialized writer. ss must have been seeded with the block hash the
+ * set is based on, and transactions must be applied in txid order.
+ */
+void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs);
+
+//! Add the coin at outpoint to, or remove it from, the MuHash of a UTXO set
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+
+//! Calculate statistics about the unspent transaction output set
+bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats, CoinStatsHashType hash_type = CoinStatsHashType::HASH_SERIALIZED);
+
+//! Calculate statistics over the coins of cursor, stopping early if should_abort is set; nDiskSize is not set
+bool GetUTXOStats(CCoinsViewCursor *pcursor, CCoinsStats &stats, const std::atomic<bool>* should_abort = nullptr,
+                  CoinStatsHashType hash_type = CoinStatsHashType::HASH_SERIALIZED);
+
+#endif // BITCOIN_COINSTATS_H
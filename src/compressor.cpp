@@ -5,6 +5,7 @@
 
 #include <compressor.h>
 
+#include <coloridentifier.h>
 #include <hash.h>
 #include <pubkey.h>
 #include <script/standard.h>
@@ -53,6 +54,34 @@ static bool IsToPubKey(const CScript& script, CPubKey &pubkey)
     return false;
 }
 
+/** Index of a token type among the colored special scripts, or -1 if it has none */
+static int GetColoredScriptIndex(unsigned char type)
+{
+    switch (UintToToken(type)) {
+    case TokenTypes::REISSUABLE: return 0;
+    case TokenTypes::NON_REISSUABLE: return 1;
+    case TokenTypes::NFT: return 2;
+    default: return -1;
+    }
+}
+
+static bool IsToColoredKeyID(const CScript& script)
+{
+    return script.size() == 60 && script[0] == COLOR_IDENTIFIER_SIZE
+                               && script[34] == OP_COLOR && script[35] == OP_DUP
+                               && script[36] == OP_HASH160 && script[37] == 20
+                               && script[58] == OP_EQUALVERIFY && script[59] == OP_CHECKSIG
+                               && GetColoredScriptIndex(script[1]) >= 0;
+}
+
+static bool IsToColoredScriptID(const CScript& script)
+{
+    return script.size() == 58 && script[0] == COLOR_IDENTIFIER_SIZE
+                               && script[34] == OP_COLOR && script[35] == OP_HASH160
+                               && script[36] == 20 && script[57] == OP_EQUAL
+                               && GetColoredScriptIndex(script[1]) >= 0;
+}
+
 bool CompressScript(const CScript& script,  CompressedScript& out)
 {
     CKeyID keyID;
@@ -84,17 +113,62 @@ bool CompressScript(const CScript& script,  CompressedScript& out)
     return false;
 }
 
+bool CompressColoredScript(const CScript& script, unsigned int &nSize, CompressedScript &out)
+{
+    if (IsToColoredKeyID(script)) {
+        nSize = COLORED_SCRIPT_CODE_FIRST + GetColoredScriptIndex(script[1]);
+        out.resize(52);
+        memcpy(&out[0], &script[2], 32);
+        memcpy(&out[32], &script[38], 20);
+        return true;
+    }
+    if (IsToColoredScriptID(script)) {
+        nSize = COLORED_SCRIPT_CODE_FIRST + 3 + GetColoredScriptIndex(script[1]);
+        out.resize(52);
+        memcpy(&out[0], &script[2], 32);
+        memcpy(&out[32], &script[37], 20);
+        return true;
+    }
+    return false;
+}
+
 unsigned int GetSpecialScriptSize(unsigned int nSize)
 {
     if (nSize == 0 || nSize == 1)
         return 20;
     if (nSize == 2 || nSize == 3 || nSize == 4 || nSize == 5)
         return 32;
+    if (nSize >= COLORED_SCRIPT_CODE_FIRST && nSize < COLORED_SCRIPT_CODE_FIRST + COLORED_SCRIPT_CODES)
+        return 52;
     return 0;
 }
 
 bool DecompressScript(CScript& script, unsigned int nSize, const CompressedScript &in)
 {
+    if (nSize >= COLORED_SCRIPT_CODE_FIRST && nSize < COLORED_SCRIPT_CODE_FIRST + COLORED_SCRIPT_CODES) {
+        static const TokenTypes types[] = {TokenTypes::REISSUABLE, TokenTypes::NON_REISSUABLE, TokenTypes::NFT};
+        const unsigned int nIndex = nSize - COLORED_SCRIPT_CODE_FIRST;
+        const bool fScriptHash = nIndex >= 3;
+        script.resize(fScriptHash ? 58 : 60);
+        script[0] = COLOR_IDENTIFIER_SIZE;
+        script[1] = TokenToUint(types[nIndex % 3]);
+        memcpy(&script[2], in.data(), 32);
+        script[34] = OP_COLOR;
+        if (fScriptHash) {
+            script[35] = OP_HASH160;
+            script[36] = 20;
+            memcpy(&script[37], in.data() + 32, 20);
+            script[57] = OP_EQUAL;
+        } else {
+            script[35] = OP_DUP;
+            script[36] = OP_HASH160;
+            script[37] = 20;
+            memcpy(&script[38], in.data() + 32, 20);
+            script[58] = OP_EQUALVERIFY;
+            script[59] = OP_CHECKSIG;
+        }
+        return true;
+    }
     switch(nSize) {
     case 0x00:
         script.resize(25);
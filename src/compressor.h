@@ -17,12 +17,24 @@
  * and deserializing compressed scripts.
  *
  * This prevector size is determined by the largest .resize() in the
- * CompressScript function. The largest compressed script format is a
- * compressed public key, which is 33 bytes.
+ * CompressScript and CompressColoredScript functions. The largest compressed
+ * script format is a colored P2PKH or P2SH script, which is 52 bytes (the
+ * color identifier payload and the hash).
  */
-using CompressedScript = prevector<33, unsigned char>;
+using CompressedScript = prevector<52, unsigned char>;
+
+/**
+ * Size codes of the colored special scripts: colored P2PKH with token type
+ * REISSUABLE, NON_REISSUABLE and NFT, then colored P2SH with the same types.
+ * They follow the codes of all scripts up to MAX_SCRIPT_SIZE, which no coin
+ * written before they were introduced can use, as longer scripts are never
+ * in the UTXO set.
+ */
+static const unsigned int COLORED_SCRIPT_CODE_FIRST = 6 + MAX_SCRIPT_SIZE + 1;
+static const unsigned int COLORED_SCRIPT_CODES = 6;
 
 bool CompressScript(const CScript& script, CompressedScript &out);
+bool CompressColoredScript(const CScript& script, unsigned int &nSize, CompressedScript &out);
 unsigned int GetSpecialScriptSize(unsigned int nSize);
 bool DecompressScript(CScript& script, unsigned int nSize, const CompressedScript &out);
 
@@ -32,13 +44,16 @@ uint64_t DecompressAmount(uint64_t nAmount);
 /** Compact serializer for scripts.
  *
  *  It detects common cases and encodes them much more efficiently.
- *  3 special cases are defined:
+ *  5 special cases are defined:
  *  * Pay to pubkey hash (encoded as 21 bytes)
  *  * Pay to script hash (encoded as 21 bytes)
  *  * Pay to pubkey starting with 0x02, 0x03 or 0x04 (encoded as 33 bytes)
+ *  * Colored pay to pubkey hash (encoded as 54 bytes instead of 61)
+ *  * Colored pay to script hash (encoded as 54 bytes instead of 59)
  *
  *  Other scripts up to 121 bytes require 1 byte + script length. Above
- *  that, scripts up to 16505 bytes require 2 bytes + script length.
+ *  that, scripts up to 10000 bytes (MAX_SCRIPT_SIZE) require 2 bytes +
+ *  script length. Longer scripts are unspendable and stored as OP_RETURN.
  */
 class CScriptCompressor
 {
@@ -55,6 +70,11 @@ private:
 public:
     explicit CScriptCompressor(CScript &scriptIn) : script(scriptIn) { }
 
+    static bool IsSpecialScript(unsigned int nSize) {
+        return nSize < nSpecialScripts ||
+            (nSize >= COLORED_SCRIPT_CODE_FIRST && nSize < COLORED_SCRIPT_CODE_FIRST + COLORED_SCRIPT_CODES);
+    }
+
     template<typename Stream>
     void Serialize(Stream &s) const {
         CompressedScript compr;
@@ -62,7 +82,21 @@ public:
             s << MakeSpan(compr);
             return;
         }
-        unsigned int nSize = script.size() + nSpecialScripts;
+        unsigned int nSize;
+        if (CompressColoredScript(script, nSize, compr)) {
+            s << VARINT(nSize);
+            s << MakeSpan(compr);
+            return;
+        }
+        if (script.size() > MAX_SCRIPT_SIZE) {
+            // Overly long scripts are read back as OP_RETURN anyway, and their
+            // size codes would overlap the colored special scripts.
+            nSize = 1 + nSpecialScripts;
+            s << VARINT(nSize);
+            s << (unsigned char)OP_RETURN;
+            return;
+        }
+        nSize = script.size() + nSpecialScripts;
         s << VARINT(nSize);
         s << MakeSpan(script);
     }
@@ -71,7 +105,7 @@ public:
     void Unserialize(Stream &s) {
         unsigned int nSize = 0;
         s >> VARINT(nSize);
-        if (nSize < nSpecialScripts) {
+        if (IsSpecialScript(nSize)) {
             CompressedScript vch(GetSpecialScriptSize(nSize), 0x00);
             s >> MakeSpan(vch);
             DecompressScript(script, nSize, vch);
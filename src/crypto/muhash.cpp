@@ -0,0 +1,224 @@
+// Copyright (c) 2017-2020 The Bitcoin Core developers
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/muhash.h>
+
+#include <crypto/chacha20.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+
+#include <limits>
+
+namespace {
+
+using limb_t = Num3072::limb_t;
+using double_limb_t = Num3072::double_limb_t;
+constexpr int LIMBS = Num3072::LIMBS;
+constexpr int LIMB_SIZE = Num3072::LIMB_SIZE;
+/** The modulus is 2^3072 - MAX_PRIME_DIFF, so 2^3072 is MAX_PRIME_DIFF modulo the prime. */
+constexpr limb_t MAX_PRIME_DIFF = 1103717;
+/** Width in bits of the exponent windows of GetInverse. */
+constexpr int WINDOW_BITS = 4;
+
+/** [c0,c1,c2] += a * b */
+inline void muladd3(limb_t& c0, limb_t& c1, limb_t& c2, limb_t a, limb_t b)
+{
+    double_limb_t t = (double_limb_t)a * b;
+    limb_t th = t >> LIMB_SIZE;
+    limb_t tl = t;
+
+    c0 += tl;
+    th += (c0 < tl) ? 1 : 0;
+    c1 += th;
+    c2 += (c1 < th) ? 1 : 0;
+}
+
+/** Add n to the number in limbs. Returns the carry out of the most significant limb. */
+inline bool addsmall(limb_t (&limbs)[LIMBS], double_limb_t n)
+{
+    for (int i = 0; i < LIMBS && n; ++i) {
+        n += limbs[i];
+        limbs[i] = n;
+        n >>= LIMB_SIZE;
+    }
+    return n != 0;
+}
+
+} // namespace
+
+Num3072::Num3072()
+{
+    SetToOne();
+}
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        if (sizeof(limb_t) == 8) {
+            limbs[i] = ReadLE64(data + 8 * i);
+        } else {
+            limbs[i] = ReadLE32(data + 4 * i);
+        }
+    }
+    // Any number below 2^3072 is less than twice the modulus
+    if (IsOverflow()) FullReduce();
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        if (sizeof(limb_t) == 8) {
+            WriteLE64(out + 8 * i, limbs[i]);
+        } else {
+            WriteLE32(out + 4 * i, limbs[i]);
+        }
+    }
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i) limbs[i] = 0;
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= std::numeric_limits<limb_t>::max() - MAX_PRIME_DIFF) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != std::numeric_limits<limb_t>::max()) return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtracting the modulus is adding MAX_PRIME_DIFF and dropping the carry
+    addsmall(limbs, MAX_PRIME_DIFF);
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook product, one column at a time
+    limb_t product[2 * LIMBS];
+    limb_t c0 = 0, c1 = 0, c2 = 0;
+    for (int k = 0; k < 2 * LIMBS - 1; ++k) {
+        const int begin = k < LIMBS ? 0 : k - LIMBS + 1;
+        const int end = k < LIMBS ? k : LIMBS - 1;
+        for (int i = begin; i <= end; ++i) {
+            muladd3(c0, c1, c2, limbs[i], a.limbs[k - i]);
+        }
+        product[k] = c0;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+    product[2 * LIMBS - 1] = c0;
+
+    // Fold the high half into the low one: low + high * 2^3072 = low + high * MAX_PRIME_DIFF
+    limb_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        double_limb_t t = (double_limb_t)product[LIMBS + i] * MAX_PRIME_DIFF + product[i] + carry;
+        limbs[i] = t;
+        carry = t >> LIMB_SIZE;
+    }
+    // The carry is at most MAX_PRIME_DIFF, so folding it in again leaves a small
+    // number whenever it wraps past 2^3072, and the last fold cannot wrap.
+    if (addsmall(limbs, (double_limb_t)carry * MAX_PRIME_DIFF)) {
+        addsmall(limbs, MAX_PRIME_DIFF);
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+void Num3072::Square()
+{
+    const Num3072 copy = *this;
+    Multiply(copy);
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // a^(p-2) = a^-1 by Fermat's little theorem, with fixed windows. All limbs of
+    // p-2 but the lowest one are all ones.
+    Num3072 table[1 << WINDOW_BITS];
+    table[1] = *this;
+    for (int i = 2; i < (1 << WINDOW_BITS); ++i) {
+        table[i] = table[i - 1];
+        table[i].Multiply(*this);
+    }
+
+    Num3072 out;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        const limb_t exponent = i == 0 ? std::numeric_limits<limb_t>::max() - MAX_PRIME_DIFF - 1 : std::numeric_limits<limb_t>::max();
+        for (int j = LIMB_SIZE - WINDOW_BITS; j >= 0; j -= WINDOW_BITS) {
+            for (int k = 0; k < WINDOW_BITS; ++k) out.Square();
+            const limb_t window = (exponent >> j) & ((1 << WINDOW_BITS) - 1);
+            if (window) out.Multiply(table[window]);
+        }
+    }
+    return out;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+bool operator==(const Num3072& a, const Num3072& b)
+{
+    for (int i = 0; i < Num3072::LIMBS; ++i) {
+        if (a.limbs[i] != b.limbs[i]) return false;
+    }
+    return true;
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char hashed[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(hashed);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    ChaCha20(hashed, sizeof(hashed)).Output(expanded, sizeof(expanded));
+    return Num3072(expanded);
+}
+
+MuHash3072::MuHash3072(const unsigned char* data, size_t len) noexcept
+{
+    m_numerator = ToNum3072(data, len);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len) noexcept
+{
+    m_numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len) noexcept
+{
+    m_denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul) noexcept
+{
+    m_numerator.Multiply(mul.m_numerator);
+    m_denominator.Multiply(mul.m_denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div) noexcept
+{
+    m_numerator.Multiply(div.m_denominator);
+    m_denominator.Multiply(div.m_numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(uint256& out) noexcept
+{
+    m_numerator.Divide(m_denominator);
+    m_denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    m_numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out.begin());
+}
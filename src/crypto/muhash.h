@@ -0,0 +1,121 @@
+// Copyright (c) 2017-2020 The Bitcoin Core developers
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <serialize.h>
+#include <uint256.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** An integer modulo 2^3072 - 1103717, the largest 3072-bit safe prime. */
+class Num3072
+{
+public:
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128 double_limb_t;
+    typedef uint64_t limb_t;
+    static constexpr int LIMBS = 48;
+    static constexpr int LIMB_SIZE = 64;
+#else
+    typedef uint64_t double_limb_t;
+    typedef uint32_t limb_t;
+    static constexpr int LIMBS = 96;
+    static constexpr int LIMB_SIZE = 32;
+#endif
+    static constexpr size_t BYTE_SIZE = 384;
+
+    //! Little endian, always fully reduced
+    limb_t limbs[LIMBS];
+
+    //! The number one
+    Num3072();
+    //! Read a number from BYTE_SIZE little endian bytes, reducing it
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Square();
+    //! Multiply by the inverse of a, which must not be zero
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+
+    friend bool operator==(const Num3072& a, const Num3072& b);
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        unsigned char data[BYTE_SIZE];
+        ToBytes(data);
+        s.write((const char*)data, BYTE_SIZE);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        unsigned char data[BYTE_SIZE];
+        s.read((char*)data, BYTE_SIZE);
+        *this = Num3072(data);
+    }
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/**
+ * A hash of a set of byte strings that can be updated in constant time when
+ * an element is added or removed, and whose value does not depend on the
+ * order of the updates (MuHash, see "A New Paradigm for Collision-free
+ * Hashing: Incrementality at Reduced Cost", Bellare and Micciancio).
+ *
+ * Every element is hashed with SHA256 and expanded with ChaCha20 to a
+ * Num3072. The set is represented by the product of its elements modulo the
+ * prime, kept as a fraction so that removing an element is a multiplication
+ * as well. Only Finalize computes the (expensive) modular inverse.
+ *
+ * The same element may be added more than once; removing an element that was
+ * never added gives a meaningless result.
+ */
+class MuHash3072
+{
+private:
+    Num3072 m_numerator;
+    Num3072 m_denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    //! The hash of the empty set
+    MuHash3072() noexcept {}
+
+    //! The hash of the set containing only data
+    MuHash3072(const unsigned char* data, size_t len) noexcept;
+
+    MuHash3072& Insert(const unsigned char* data, size_t len) noexcept;
+    MuHash3072& Remove(const unsigned char* data, size_t len) noexcept;
+
+    //! Union of two sets
+    MuHash3072& operator*=(const MuHash3072& mul) noexcept;
+    //! Difference of two sets; every element of div must be in this set
+    MuHash3072& operator/=(const MuHash3072& div) noexcept;
+
+    //! The 256-bit hash of the set
+    void Finalize(uint256& out) noexcept;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(m_numerator);
+        READWRITE(m_denominator);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -0,0 +1,84 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TAPYRUS_DBENGINE_H
+#define TAPYRUS_DBENGINE_H
+
+#include <leveldb/slice.h>
+#include <leveldb/write_batch.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/** Counters of background work of a storage engine. */
+struct DBCounters
+{
+    uint64_t compactions = 0;
+    uint64_t trivial_moves = 0;
+    uint64_t memtable_flushes = 0;
+    uint64_t write_stalls = 0;
+};
+
+/** Iterator over a consistent view of a CDBEngine, in bytewise key order. */
+class CDBEngineIterator
+{
+public:
+    virtual ~CDBEngineIterator() = default;
+
+    virtual bool Valid() const = 0;
+    virtual void SeekToFirst() = 0;
+    //! Position at the first key at or after key
+    virtual void Seek(const leveldb::Slice& key) = 0;
+    virtual void Next() = 0;
+    //! Key and value of the current entry, valid until the iterator is moved
+    virtual leveldb::Slice key() const = 0;
+    virtual leveldb::Slice value() const = 0;
+    virtual bool HasError() const = 0;
+};
+
+/** Read-only view of a CDBEngine as it was when the snapshot was taken. */
+class CDBEngineSnapshot
+{
+public:
+    virtual ~CDBEngineSnapshot() = default;
+
+    virtual bool Read(const leveldb::Slice& key, std::string& value) const = 0;
+    virtual std::unique_ptr<CDBEngineIterator> NewIterator() const = 0;
+};
+
+/**
+ * Sorted key-value store behind a CDBWrapper. Writes are applied atomically
+ * per batch; batches use the leveldb::WriteBatch format whatever the engine.
+ * Reads, iterators and snapshots may be used from other threads while the
+ * database is written. Iterators see the database as it was when they were
+ * created, and must be destroyed before the engine.
+ *
+ * Failures are reported by throwing dbwrapper_error.
+ */
+class CDBEngine
+{
+public:
+    virtual ~CDBEngine() = default;
+
+    //! Read the value of key; returns false if it does not exist
+    virtual bool Read(const leveldb::Slice& key, std::string& value) const = 0;
+    virtual void Write(leveldb::WriteBatch& batch, bool fSync) = 0;
+
+    virtual std::unique_ptr<CDBEngineIterator> NewIterator() const = 0;
+    virtual std::unique_ptr<CDBEngineSnapshot> NewSnapshot() const = 0;
+
+    //! Approximate number of bytes used by the keys in [begin, end)
+    virtual uint64_t EstimateSize(const leveldb::Slice& begin, const leveldb::Slice& end) const = 0;
+    //! Compact the keys in [begin, end]; nullptr for an open end
+    virtual void CompactRange(const leveldb::Slice* begin, const leveldb::Slice* end) = 0;
+
+    //! Engine specific statistics, such as "leveldb.stats"
+    virtual bool GetProperty(const std::string& property, std::string& value) const = 0;
+    virtual size_t DynamicMemoryUsage() const = 0;
+    virtual DBCounters GetCounters() const = 0;
+};
+
+#endif // TAPYRUS_DBENGINE_H
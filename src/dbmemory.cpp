@@ -0,0 +1,310 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <dbwrapper.h>
+
+#include <sync.h>
+#include <tinyformat.h>
+
+#include <cassert>
+#include <limits>
+#include <map>
+#include <set>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+/** Estimated allocation overhead of a key in the map, on top of the key itself. */
+static constexpr size_t MEMORY_DB_NODE_OVERHEAD = 96;
+
+/** One value of a key, or its deletion, as written by the batch with sequence number seq. */
+struct MemoryDBVersion
+{
+    uint64_t seq;
+    bool deleted;
+    std::string value;
+};
+
+/**
+ * CDBEngine keeping the data in a std::map, for nodes that do not need to
+ * keep their databases, such as test and observer nodes.
+ *
+ * Snapshots are sequence numbers: every key keeps the versions that a live
+ * snapshot may still read, and a snapshot reads the newest version written
+ * at or before it. Iterators read from a snapshot of their own and copy the
+ * current entry, so they are not affected by writes.
+ */
+class CMemoryDBEngine final : public CDBEngine
+{
+public:
+    using Versions = std::vector<MemoryDBVersion>;
+
+    mutable Mutex m_mutex;
+
+private:
+    //! versions of every key, oldest first
+    std::map<std::string, Versions, std::less<>> m_data GUARDED_BY(m_mutex);
+    //! sequence number of the last batch written
+    uint64_t m_seq GUARDED_BY(m_mutex) = 0;
+    //! sequence numbers of the live snapshots
+    mutable std::multiset<uint64_t> m_snapshots GUARDED_BY(m_mutex);
+    //! versions and deleted keys kept only for snapshots
+    size_t m_garbage GUARDED_BY(m_mutex) = 0;
+    size_t m_usage GUARDED_BY(m_mutex) = 0;
+
+    static size_t VersionUsage(const MemoryDBVersion& version)
+    {
+        return sizeof(MemoryDBVersion) + version.value.size();
+    }
+
+    /** Drop the versions of a key that no snapshot reads. Returns false if the key can be erased. */
+    bool CollectVersions(Versions& versions) EXCLUSIVE_LOCKS_REQUIRED(m_mutex)
+    {
+        const uint64_t oldest = m_snapshots.empty() ? m_seq : *m_snapshots.begin();
+        size_t keep_from = 0;
+        for (size_t i = 0; i < versions.size() && versions[i].seq <= oldest; i++) {
+            keep_from = i;
+        }
+        for (size_t i = 0; i < keep_from; i++) {
+            m_usage -= VersionUsage(versions[i]);
+        }
+        versions.erase(versions.begin(), versions.begin() + keep_from);
+        return !(versions.size() == 1 && versions[0].deleted && versions[0].seq <= oldest);
+    }
+
+    /** Drop the versions and deleted keys that no live snapshot reads. */
+    void Collect() EXCLUSIVE_LOCKS_REQUIRED(m_mutex)
+    {
+        for (auto it = m_data.begin(); it != m_data.end();) {
+            if (CollectVersions(it->second)) {
+                ++it;
+            } else {
+                m_usage -= it->first.size() + MEMORY_DB_NODE_OVERHEAD + VersionUsage(it->second[0]);
+                it = m_data.erase(it);
+            }
+        }
+        m_garbage = 0;
+    }
+
+    void Apply(const leveldb::Slice& key, bool deleted, const leveldb::Slice& value) EXCLUSIVE_LOCKS_REQUIRED(m_mutex)
+    {
+        auto it = m_data.find(std::string_view(key.data(), key.size()));
+        if (it == m_data.end()) {
+            if (deleted) return;
+            it = m_data.emplace(key.ToString(), Versions{}).first;
+            m_usage += key.size() + MEMORY_DB_NODE_OVERHEAD;
+        }
+        Versions& versions = it->second;
+        CollectVersions(versions);
+        if (m_snapshots.empty() || (!versions.empty() && versions.back().seq == m_seq)) {
+            // nobody reads the previous value anymore, or it was written by this same batch
+            if (!versions.empty()) {
+                m_usage -= VersionUsage(versions.back());
+                versions.pop_back();
+            }
+            if (deleted && versions.empty()) {
+                m_usage -= it->first.size() + MEMORY_DB_NODE_OVERHEAD;
+                m_data.erase(it);
+                return;
+            }
+        } else if (!versions.empty() || deleted) {
+            // the previous version, or the deletion, is only kept for the snapshots
+            m_garbage++;
+        }
+        versions.push_back(MemoryDBVersion{m_seq, deleted, deleted ? std::string() : value.ToString()});
+        m_usage += VersionUsage(versions.back());
+    }
+
+    class BatchHandler final : public leveldb::WriteBatch::Handler
+    {
+        CMemoryDBEngine& m_engine;
+
+    public:
+        explicit BatchHandler(CMemoryDBEngine& engine) : m_engine(engine) {}
+
+        void Put(const leveldb::Slice& key, const leveldb::Slice& value) override NO_THREAD_SAFETY_ANALYSIS
+        {
+            m_engine.Apply(key, false, value);
+        }
+        void Delete(const leveldb::Slice& key) override NO_THREAD_SAFETY_ANALYSIS
+        {
+            m_engine.Apply(key, true, leveldb::Slice());
+        }
+    };
+
+public:
+    /** Newest version of versions at or before seq, if any. */
+    static const MemoryDBVersion* Visible(const Versions& versions, uint64_t seq)
+    {
+        for (auto it = versions.rbegin(); it != versions.rend(); ++it) {
+            if (it->seq <= seq) return &*it;
+        }
+        return nullptr;
+    }
+
+    /** Read key as of the batch with sequence number seq. */
+    bool ReadAt(const leveldb::Slice& key, uint64_t seq, std::string& value) const
+    {
+        LOCK(m_mutex);
+        auto it = m_data.find(std::string_view(key.data(), key.size()));
+        if (it == m_data.end()) return false;
+        const MemoryDBVersion* version = Visible(it->second, seq);
+        if (!version || version->deleted) return false;
+        value = version->value;
+        return true;
+    }
+
+    /**
+     * Find the first key at or after target (after it, if skip_target) that
+     * exists as of seq, and copy it with its value.
+     */
+    bool FindAt(const std::string& target, bool skip_target, uint64_t seq, std::string& key, std::string& value) const
+    {
+        LOCK(m_mutex);
+        auto it = skip_target ? m_data.upper_bound(target) : m_data.lower_bound(target);
+        for (; it != m_data.end(); ++it) {
+            const MemoryDBVersion* version = Visible(it->second, seq);
+            if (version && !version->deleted) {
+                key = it->first;
+                value = version->value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Register a snapshot at the last written batch. It is released by the returned handle. */
+    std::shared_ptr<const uint64_t> AcquireSnapshot() const
+    {
+        LOCK(m_mutex);
+        m_snapshots.insert(m_seq);
+        return std::shared_ptr<const uint64_t>(new uint64_t(m_seq), [this](const uint64_t* seq) {
+            LOCK(m_mutex);
+            m_snapshots.erase(m_snapshots.find(*seq));
+            delete seq;
+            // Removing deleted keys requires a full pass, so only do it once enough of them piled up
+            if (m_snapshots.empty() && m_garbage > m_data.size() / 4) {
+                const_cast<CMemoryDBEngine*>(this)->Collect();
+            }
+        });
+    }
+
+    bool Read(const leveldb::Slice& key, std::string& value) const override
+    {
+        return ReadAt(key, std::numeric_limits<uint64_t>::max(), value);
+    }
+
+    void Write(leveldb::WriteBatch& batch, bool fSync) override
+    {
+        LOCK(m_mutex);
+        ++m_seq;
+        BatchHandler handler(*this);
+        leveldb::Status status = batch.Iterate(&handler);
+        dbwrapper_private::HandleError(status);
+    }
+
+    std::unique_ptr<CDBEngineIterator> NewIterator() const override;
+    std::unique_ptr<CDBEngineSnapshot> NewSnapshot() const override;
+
+    uint64_t EstimateSize(const leveldb::Slice& begin, const leveldb::Slice& end) const override
+    {
+        LOCK(m_mutex);
+        uint64_t size = 0;
+        auto it_end = m_data.lower_bound(std::string_view(end.data(), end.size()));
+        for (auto it = m_data.lower_bound(std::string_view(begin.data(), begin.size())); it != it_end; ++it) {
+            size += it->first.size() + it->second.back().value.size();
+        }
+        return size;
+    }
+
+    void CompactRange(const leveldb::Slice* begin, const leveldb::Slice* end) override
+    {
+        LOCK(m_mutex);
+        Collect();
+    }
+
+    bool GetProperty(const std::string& property, std::string& value) const override
+    {
+        LOCK(m_mutex);
+        if (property == "memory.stats") {
+            value = strprintf("keys=%u snapshots=%u garbage=%u usage=%u", m_data.size(), m_snapshots.size(), m_garbage, m_usage);
+            return true;
+        }
+        return false;
+    }
+
+    size_t DynamicMemoryUsage() const override
+    {
+        LOCK(m_mutex);
+        return m_usage;
+    }
+
+    DBCounters GetCounters() const override
+    {
+        return DBCounters();
+    }
+};
+
+class CMemoryDBIterator final : public CDBEngineIterator
+{
+    const CMemoryDBEngine& m_engine;
+    std::shared_ptr<const uint64_t> m_snapshot;
+    bool m_valid = false;
+    std::string m_key;
+    std::string m_value;
+
+public:
+    CMemoryDBIterator(const CMemoryDBEngine& engine, std::shared_ptr<const uint64_t> snapshot)
+        : m_engine(engine), m_snapshot(std::move(snapshot)) {}
+
+    bool Valid() const override { return m_valid; }
+    void SeekToFirst() override { m_valid = m_engine.FindAt(std::string(), false, *m_snapshot, m_key, m_value); }
+    void Seek(const leveldb::Slice& key) override { m_valid = m_engine.FindAt(key.ToString(), false, *m_snapshot, m_key, m_value); }
+    void Next() override
+    {
+        assert(m_valid);
+        const std::string current = m_key;
+        m_valid = m_engine.FindAt(current, true, *m_snapshot, m_key, m_value);
+    }
+    leveldb::Slice key() const override { assert(m_valid); return leveldb::Slice(m_key); }
+    leveldb::Slice value() const override { assert(m_valid); return leveldb::Slice(m_value); }
+    bool HasError() const override { return false; }
+};
+
+class CMemoryDBSnapshot final : public CDBEngineSnapshot
+{
+    const CMemoryDBEngine& m_engine;
+    std::shared_ptr<const uint64_t> m_snapshot;
+
+public:
+    explicit CMemoryDBSnapshot(const CMemoryDBEngine& engine) : m_engine(engine), m_snapshot(engine.AcquireSnapshot()) {}
+
+    bool Read(const leveldb::Slice& key, std::string& value) const override
+    {
+        return m_engine.ReadAt(key, *m_snapshot, value);
+    }
+
+    std::unique_ptr<CDBEngineIterator> NewIterator() const override
+    {
+        return std::make_unique<CMemoryDBIterator>(m_engine, m_snapshot);
+    }
+};
+
+std::unique_ptr<CDBEngineIterator> CMemoryDBEngine::NewIterator() const
+{
+    return std::make_unique<CMemoryDBIterator>(*this, AcquireSnapshot());
+}
+
+std::unique_ptr<CDBEngineSnapshot> CMemoryDBEngine::NewSnapshot() const
+{
+    return std::make_unique<CMemoryDBSnapshot>(*this);
+}
+
+} // namespace
+
+std::unique_ptr<CDBEngine> MakeMemoryDBEngine()
+{
+    return std::make_unique<CMemoryDBEngine>();
+}
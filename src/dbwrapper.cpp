@@ -6,20 +6,119 @@
 
 #include <memory>
 #include <random.h>
+#include <sync.h>
+#include <tinyformat.h>
 
 #include <leveldb/cache.h>
+#include <leveldb/db.h>
 #include <leveldb/env.h>
 #include <leveldb/filter_policy.h>
 #include <memenv.h>
 #include <stdint.h>
 #include <algorithm>
 #include <charconv>
+#include <set>
+#include <string.h>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+
+const std::vector<std::string> DB_PROFILE_NAMES{"chainstate", "index", "txindex", "coinstats"};
+const std::vector<std::string> DB_BACKENDS{"leveldb", "memory"};
+
+std::string DBProfile::ToString() const
+{
+    return strprintf("compression=%d,bloombits=%d,blocksize=%u,maxfilesize=%u,writebuffer=%u",
+                     compression, bloom_bits, block_size, max_file_size, write_buffer_size);
+}
+
+DBProfile DefaultDBProfile(const std::string& name)
+{
+    DBProfile profile;
+    if (name == "txindex") {
+        // Written in block order and only read by key: fewer, larger files
+        // and blocks keep the index and the number of open files small.
+        profile.block_size = 16 * 1024;
+        profile.max_file_size = 32 * 1024 * 1024;
+    }
+    return profile;
+}
+
+bool ParseDBProfileArg(const std::string& arg, std::string& name, DBProfile& profile, std::string& error)
+{
+    const size_t colon = arg.find(':');
+    if (colon == std::string::npos || colon == 0) {
+        error = strprintf("Invalid -dbprofile '%s': expected <db>:<setting>=<value>[,...]", arg);
+        return false;
+    }
+    name = arg.substr(0, colon);
+    if (std::find(DB_PROFILE_NAMES.begin(), DB_PROFILE_NAMES.end(), name) == DB_PROFILE_NAMES.end()) {
+        error = strprintf("Invalid -dbprofile '%s': unknown database '%s'", arg, name);
+        return false;
+    }
+
+    std::vector<std::string> settings;
+    const std::string settings_str = arg.substr(colon + 1);
+    boost::split(settings, settings_str, boost::is_any_of(","));
+    for (const std::string& setting : settings) {
+        const size_t eq = setting.find('=');
+        int64_t value;
+        if (eq == std::string::npos || !ParseInt64(setting.substr(eq + 1), &value) || value < 0) {
+            error = strprintf("Invalid -dbprofile '%s': expected <setting>=<non-negative number>, got '%s'", arg, setting);
+            return false;
+        }
+        const std::string key = setting.substr(0, eq);
+        if (key == "compression" && value <= 1) {
+            profile.compression = value;
+        } else if (key == "bloombits" && value <= 64) {
+            profile.bloom_bits = value;
+        } else if (key == "blocksize" && value >= 1 && value <= 1024) {
+            profile.block_size = value * 1024;
+        } else if (key == "maxfilesize" && value >= 1 && value <= 1024) {
+            profile.max_file_size = value * 1024 * 1024;
+        } else if (key == "writebuffer" && value <= 1024) {
+            profile.write_buffer_size = value * 1024 * 1024;
+        } else {
+            error = strprintf("Invalid -dbprofile '%s': unknown setting or value out of range '%s'", arg, setting);
+            return false;
+        }
+    }
+    return true;
+}
+
+DBProfile GetDBProfile(const std::string& name)
+{
+    DBProfile profile = DefaultDBProfile(name);
+    for (const std::string& arg : gArgs.GetArgs("-dbprofile")) {
+        if (arg.compare(0, name.size() + 1, name + ":") != 0)
+            continue;
+        // The settings were checked at startup; later ones override earlier ones.
+        std::string arg_name, error;
+        ParseDBProfileArg(arg, arg_name, profile, error);
+    }
+    return profile;
+}
 
 class CBitcoinLevelDBLogger : public leveldb::Logger {
 public:
+    std::atomic<uint64_t> m_compactions{0};
+    std::atomic<uint64_t> m_trivial_moves{0};
+    std::atomic<uint64_t> m_memtable_flushes{0};
+    std::atomic<uint64_t> m_write_stalls{0};
+
     // This code is adapted from posix_logger.h, which is why it is using vsprintf.
     // Please do not do this in normal code
     void Logv(const char * format, va_list ap) override {
+            // Count background work by the messages LevelDB logs for it
+            if (strncmp(format, "Compacted ", 10) == 0) {
+                ++m_compactions;
+            } else if (strncmp(format, "Moved #", 7) == 0) {
+                ++m_trivial_moves;
+            } else if (strncmp(format, "Level-0 table #%llu: started", 28) == 0) {
+                ++m_memtable_flushes;
+            } else if (strncmp(format, "Current memtable full; waiting", 30) == 0 || strncmp(format, "Too many L0 files; waiting", 26) == 0) {
+                ++m_write_stalls;
+            }
             if (!LogAcceptCategory(BCLog::LEVELDB)) {
                 return;
             }
@@ -98,14 +197,16 @@ static void SetMaxOpenFiles(leveldb::Options *options) {
              options->max_open_files, default_open_files);
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static leveldb::Options GetOptions(size_t nCacheSize, const DBProfile& profile, CBitcoinLevelDBLogger* logger)
 {
     leveldb::Options options;
     options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.info_log = new CBitcoinLevelDBLogger();
+    options.write_buffer_size = profile.write_buffer_size; // up to two write buffers may be held in memory simultaneously
+    options.filter_policy = profile.bloom_bits > 0 ? leveldb::NewBloomFilterPolicy(profile.bloom_bits) : nullptr;
+    options.compression = profile.compression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.block_size = profile.block_size;
+    options.max_file_size = profile.max_file_size;
+    options.info_log = logger;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -115,35 +216,237 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
+namespace {
+
+class CLevelDBIterator final : public CDBEngineIterator
+{
+    //! snapshot the iterator reads, if any; outlives m_iter
+    std::shared_ptr<const leveldb::Snapshot> m_snapshot;
+    std::unique_ptr<leveldb::Iterator> m_iter;
+
+public:
+    explicit CLevelDBIterator(leveldb::Iterator* iter, std::shared_ptr<const leveldb::Snapshot> snapshot = nullptr)
+        : m_snapshot(std::move(snapshot)), m_iter(iter) {}
+
+    bool Valid() const override { return m_iter->Valid(); }
+    void SeekToFirst() override { m_iter->SeekToFirst(); }
+    void Seek(const leveldb::Slice& key) override { m_iter->Seek(key); }
+    void Next() override { m_iter->Next(); }
+    leveldb::Slice key() const override { return m_iter->key(); }
+    leveldb::Slice value() const override { return m_iter->value(); }
+    bool HasError() const override { return !m_iter->status().ok(); }
+};
+
+bool LevelDBRead(leveldb::DB* db, const leveldb::ReadOptions& options, const leveldb::Slice& key, std::string& value)
+{
+    leveldb::Status status = db->Get(options, key, &value);
+    if (!status.ok()) {
+        if (status.IsNotFound())
+            return false;
+        LogPrintf("LevelDB read failure: %s\n", status.ToString());
+        dbwrapper_private::HandleError(status);
+    }
+    return true;
+}
+
+class CLevelDBSnapshot final : public CDBEngineSnapshot
+{
+    leveldb::DB* m_db;
+    std::shared_ptr<const leveldb::Snapshot> m_snapshot;
+    leveldb::ReadOptions m_readoptions;
+    leveldb::ReadOptions m_iteroptions;
+
+public:
+    CLevelDBSnapshot(leveldb::DB* db, const leveldb::ReadOptions& readoptions, const leveldb::ReadOptions& iteroptions)
+        : m_db(db), m_snapshot(db->GetSnapshot(), [db](const leveldb::Snapshot* snapshot) { db->ReleaseSnapshot(snapshot); }),
+          m_readoptions(readoptions), m_iteroptions(iteroptions)
+    {
+        m_readoptions.snapshot = m_snapshot.get();
+        m_iteroptions.snapshot = m_snapshot.get();
+    }
+
+    bool Read(const leveldb::Slice& key, std::string& value) const override
+    {
+        return LevelDBRead(m_db, m_readoptions, key, value);
+    }
+
+    std::unique_ptr<CDBEngineIterator> NewIterator() const override
+    {
+        return std::make_unique<CLevelDBIterator>(m_db->NewIterator(m_iteroptions), m_snapshot);
+    }
+};
+
+class CLevelDBEngine final : public CDBEngine
+{
+    //! custom environment this database is using (may be nullptr in case of default environment)
+    leveldb::Env* penv = nullptr;
+
+    //! database options used
+    leveldb::Options options;
+
+    //! options used when reading from the database
+    leveldb::ReadOptions readoptions;
+
+    //! options used when iterating over values of the database
+    leveldb::ReadOptions iteroptions;
+
+    //! options used when writing to the database
+    leveldb::WriteOptions writeoptions;
+
+    //! options used when sync writing to the database
+    leveldb::WriteOptions syncoptions;
+
+    //! the database itself
+    leveldb::DB* pdb = nullptr;
+
+    //! logger that counts LevelDB background work, owned by options
+    CBitcoinLevelDBLogger* m_logger;
+
+public:
+    CLevelDBEngine(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const DBProfile& profile)
+    {
+        readoptions.verify_checksums = true;
+        iteroptions.verify_checksums = true;
+        iteroptions.fill_cache = false;
+        syncoptions.sync = true;
+        m_logger = new CBitcoinLevelDBLogger();
+        options = GetOptions(nCacheSize, profile, m_logger);
+        options.create_if_missing = true;
+        if (fMemory) {
+            penv = leveldb::NewMemEnv(leveldb::Env::Default());
+            options.env = penv;
+        } else {
+            if (fWipe) {
+                LogPrintf("Wiping LevelDB in %s\n", path.string());
+                leveldb::Status result = leveldb::DestroyDB(path.string(), options);
+                dbwrapper_private::HandleError(result);
+            }
+            TryCreateDirectories(path);
+            LogPrintf("Opening LevelDB in %s\n", path.string());
+        }
+        leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
+        dbwrapper_private::HandleError(status);
+        LogPrintf("Opened LevelDB successfully\n");
+    }
+
+    ~CLevelDBEngine()
+    {
+        delete pdb;
+        pdb = nullptr;
+        delete options.filter_policy;
+        options.filter_policy = nullptr;
+        delete options.info_log;
+        options.info_log = nullptr;
+        delete options.block_cache;
+        options.block_cache = nullptr;
+        delete penv;
+        options.env = nullptr;
+    }
+
+    bool Read(const leveldb::Slice& key, std::string& value) const override
+    {
+        return LevelDBRead(pdb, readoptions, key, value);
+    }
+
+    void Write(leveldb::WriteBatch& batch, bool fSync) override
+    {
+        leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch);
+        dbwrapper_private::HandleError(status);
+    }
+
+    std::unique_ptr<CDBEngineIterator> NewIterator() const override
+    {
+        return std::make_unique<CLevelDBIterator>(pdb->NewIterator(iteroptions));
+    }
+
+    std::unique_ptr<CDBEngineSnapshot> NewSnapshot() const override
+    {
+        return std::make_unique<CLevelDBSnapshot>(pdb, readoptions, iteroptions);
+    }
+
+    uint64_t EstimateSize(const leveldb::Slice& begin, const leveldb::Slice& end) const override
+    {
+        uint64_t size = 0;
+        leveldb::Range range(begin, end);
+        pdb->GetApproximateSizes(&range, 1, &size);
+        return size;
+    }
+
+    void CompactRange(const leveldb::Slice* begin, const leveldb::Slice* end) override
+    {
+        pdb->CompactRange(begin, end);
+    }
+
+    bool GetProperty(const std::string& property, std::string& value) const override
+    {
+        return pdb->GetProperty(property, &value);
+    }
+
+    size_t DynamicMemoryUsage() const override
+    {
+        std::string memory;
+        if (!pdb->GetProperty("leveldb.approximate-memory-usage", &memory)) {
+            LogPrint(BCLog::LEVELDB, "Failed to get approximate-memory-usage property\n");
+            return 0;
+        }
+        // Use std::from_chars for locale-independent conversion
+        size_t result = 0;
+        auto ret = std::from_chars(memory.data(), memory.data() + memory.size(), result);
+        if (ret.ec == std::errc() && ret.ptr == memory.data() + memory.size())
+            return result;
+        else{
+            LogPrint(BCLog::LEVELDB, "Failed to parse memory usage value: %s, using default\n", memory);
+            return 4 * 1024 * 1024;  //nMinDbCache = 4;
+        }
+    }
+
+    DBCounters GetCounters() const override
+    {
+        DBCounters counters;
+        counters.compactions = m_logger->m_compactions;
+        counters.trivial_moves = m_logger->m_trivial_moves;
+        counters.memtable_flushes = m_logger->m_memtable_flushes;
+        counters.write_stalls = m_logger->m_write_stalls;
+        return counters;
+    }
+};
+
+} // namespace
+
+std::unique_ptr<CDBEngine> MakeLevelDBEngine(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const DBProfile& profile)
+{
+    return std::make_unique<CLevelDBEngine>(path, nCacheSize, fMemory, fWipe, profile);
+}
+
+static Mutex g_dbwrappers_mutex;
+static std::set<const CDBWrapper*> g_dbwrappers GUARDED_BY(g_dbwrappers_mutex);
+
+void ForEachDBWrapper(const std::function<void(const CDBWrapper&)>& f)
+{
+    LOCK(g_dbwrappers_mutex);
+    for (const CDBWrapper* db : g_dbwrappers) {
+        f(*db);
+    }
+}
+
 CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
-    : m_name(path.stem().string())
+    : m_backend(gArgs.GetArg("-dbbackend", DEFAULT_DB_BACKEND)), m_name(path.stem().string()), m_path(path)
 {
-    penv = nullptr;
-    readoptions.verify_checksums = true;
-    iteroptions.verify_checksums = true;
-    iteroptions.fill_cache = false;
-    syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
-    options.create_if_missing = true;
-    if (fMemory) {
-        penv = leveldb::NewMemEnv(leveldb::Env::Default());
-        options.env = penv;
+    const DBProfile configured = GetDBProfile(m_name);
+    m_profile = configured;
+    if (m_profile.write_buffer_size == 0) {
+        m_profile.write_buffer_size = nCacheSize / 4;
+    }
+    if (m_backend == "memory") {
+        LogPrintf("Opening in-memory database %s\n", m_name);
+        m_engine = MakeMemoryDBEngine();
     } else {
-        if (fWipe) {
-            LogPrintf("Wiping LevelDB in %s\n", path.string());
-            leveldb::Status result = leveldb::DestroyDB(path.string(), options);
-            dbwrapper_private::HandleError(result);
-        }
-        TryCreateDirectories(path);
-        LogPrintf("Opening LevelDB in %s\n", path.string());
+        m_engine = MakeLevelDBEngine(path, nCacheSize, fMemory, fWipe, m_profile);
     }
-    leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
-    dbwrapper_private::HandleError(status);
-    LogPrintf("Opened LevelDB successfully\n");
 
     if (gArgs.GetBoolArg("-forcecompactdb", false)) {
         LogPrintf("Starting database compaction of %s\n", path.string());
-        pdb->CompactRange(nullptr, nullptr);
+        m_engine->CompactRange(nullptr, nullptr);
         LogPrintf("Finished database compaction of %s\n", path.string());
     }
 
@@ -165,20 +468,43 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     }
 
     LogPrintf("Using obfuscation key for %s: %s\n", path.string(), HexStr(obfuscate_key));
+
+    if (m_backend != "memory") {
+        RecordProfile(configured);
+    }
+
+    LOCK(g_dbwrappers_mutex);
+    g_dbwrappers.insert(this);
+}
+
+void CDBWrapper::RecordProfile(const DBProfile& configured)
+{
+    // Settings only apply to the table files written from now on, so a
+    // change is logged, and the profile is kept in the database to show
+    // which settings it was last written with.
+    DBProfile recorded = DefaultDBProfile(m_name);
+    const bool has_record = Read(PROFILE_KEY, recorded);
+    if (!has_record) {
+        recorded.write_buffer_size = m_profile.write_buffer_size;
+    }
+    if (recorded != m_profile) {
+        LogPrintf("LevelDB profile of %s changed from %s to %s\n", m_name, recorded.ToString(), m_profile.ToString());
+    } else {
+        LogPrint(BCLog::LEVELDB, "LevelDB profile of %s: %s\n", m_name, m_profile.ToString());
+    }
+    if (configured == DefaultDBProfile(m_name)) {
+        if (has_record) Erase(PROFILE_KEY);
+    } else if (!has_record || recorded != m_profile) {
+        Write(PROFILE_KEY, m_profile);
+    }
 }
 
 CDBWrapper::~CDBWrapper()
 {
-    delete pdb;
-    pdb = nullptr;
-    delete options.filter_policy;
-    options.filter_policy = nullptr;
-    delete options.info_log;
-    options.info_log = nullptr;
-    delete options.block_cache;
-    options.block_cache = nullptr;
-    delete penv;
-    options.env = nullptr;
+    {
+        LOCK(g_dbwrappers_mutex);
+        g_dbwrappers.erase(this);
+    }
 }
 
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
@@ -188,8 +514,7 @@ bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
     if (log_memory) {
         mem_before = DynamicMemoryUsage() / 1024.0 / 1024;
     }
-    leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
-    dbwrapper_private::HandleError(status);
+    m_engine->Write(batch.batch, fSync);
     if (log_memory) {
         double mem_after = DynamicMemoryUsage() / 1024.0 / 1024;
         LogPrint(BCLog::LEVELDB, "WriteBatch memory usage: db=%s, before=%.1fMiB, after=%.1fMiB\n",
@@ -199,21 +524,24 @@ bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 }
 
 size_t CDBWrapper::DynamicMemoryUsage() const {
-    std::string memory;
-    if (!pdb->GetProperty("leveldb.approximate-memory-usage", &memory)) {
-        LogPrint(BCLog::LEVELDB, "Failed to get approximate-memory-usage property\n");
-        return 0;
-    }
-    // Use std::from_chars for locale-independent conversion
-    size_t result = 0;
-    auto ret = std::from_chars(memory.data(), memory.data() + memory.size(), result);
-    if (ret.ec == std::errc() && ret.ptr == memory.data() + memory.size())
-        return result;
-    else{
-        LogPrint(BCLog::LEVELDB, "Failed to parse memory usage value: %s, using default\n", memory);
-        return 4 * 1024 * 1024;  //nMinDbCache = 4;
-    }
-        
+    return m_engine->DynamicMemoryUsage();
+}
+
+bool CDBWrapper::GetProperty(const std::string& property, std::string& value) const
+{
+    return m_engine->GetProperty(property, value);
+}
+
+uint64_t CDBWrapper::EstimateTotalSize() const
+{
+    // Keys are serialized data; none sorts after a run of 0xff bytes.
+    const std::string last(DBWRAPPER_PREALLOC_KEY_SIZE, '\xff');
+    return m_engine->EstimateSize(leveldb::Slice(), leveldb::Slice(last));
+}
+
+DBCounters CDBWrapper::GetCounters() const
+{
+    return m_engine->GetCounters();
 }
 
 // Prefixed with null character to avoid collisions with other keys
@@ -224,6 +552,8 @@ const std::string CDBWrapper::OBFUSCATE_KEY_KEY("\000obfuscate_key", 14);
 
 const unsigned int CDBWrapper::OBFUSCATE_KEY_NUM_BYTES = 8;
 
+const std::string CDBWrapper::PROFILE_KEY("\000profile", 8);
+
 /**
  * Returns a string (consisting of 8 random bytes) suitable for use as an
  * obfuscating XOR key.
@@ -243,7 +573,7 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
-CDBIterator::~CDBIterator() { delete piter; }
+CDBIterator::~CDBIterator() = default;
 bool CDBIterator::Valid() const { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
 void CDBIterator::Next() { piter->Next(); }
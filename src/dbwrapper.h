@@ -6,6 +6,7 @@
 #define BITCOIN_DBWRAPPER_H
 
 #include <clientversion.h>
+#include <dbengine.h>
 #include <fs.h>
 #include <serialize.h>
 #include <streams.h>
@@ -13,9 +14,12 @@
 #include <utilstrencodings.h>
 #include <version.h>
 
-#include <leveldb/db.h>
+#include <leveldb/status.h>
 #include <leveldb/write_batch.h>
 
+#include <functional>
+#include <memory>
+
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
@@ -25,6 +29,73 @@ public:
     explicit dbwrapper_error(const std::string& msg) : std::runtime_error(msg) {}
 };
 
+/**
+ * LevelDB settings of one database. The defaults suit the random reads and
+ * writes of the chainstate; each database can be tuned with -dbprofile.
+ */
+struct DBProfile
+{
+    //! Compress blocks with Snappy. LevelDB stores them uncompressed if it was built without it.
+    bool compression = false;
+    //! Bits per key of the bloom filter, 0 for no filter
+    int32_t bloom_bits = 10;
+    //! Approximate size of the user data in a block
+    uint64_t block_size = 4 * 1024;
+    //! Size at which a table file is closed and a new one started
+    uint64_t max_file_size = 2 * 1024 * 1024;
+    //! Size of the memtable, 0 for a quarter of the cache size
+    uint64_t write_buffer_size = 0;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(compression);
+        READWRITE(bloom_bits);
+        READWRITE(block_size);
+        READWRITE(max_file_size);
+        READWRITE(write_buffer_size);
+    }
+
+    std::string ToString() const;
+
+    friend bool operator==(const DBProfile& a, const DBProfile& b)
+    {
+        return a.compression == b.compression && a.bloom_bits == b.bloom_bits && a.block_size == b.block_size &&
+               a.max_file_size == b.max_file_size && a.write_buffer_size == b.write_buffer_size;
+    }
+    friend bool operator!=(const DBProfile& a, const DBProfile& b) { return !(a == b); }
+};
+
+/** Names of the databases -dbprofile applies to: their directory names. */
+extern const std::vector<std::string> DB_PROFILE_NAMES;
+
+/** Built-in profile of the database called name. */
+DBProfile DefaultDBProfile(const std::string& name);
+
+/**
+ * Parse a -dbprofile value, "<db>:<setting>=<value>[,<setting>=<value>...]",
+ * into the database name, applying the settings to profile. Sizes are given
+ * in KiB for blocksize and in MiB for maxfilesize and writebuffer.
+ */
+bool ParseDBProfileArg(const std::string& arg, std::string& name, DBProfile& profile, std::string& error);
+
+/** Profile of the database called name: its built-in one changed by the -dbprofile settings for it. */
+DBProfile GetDBProfile(const std::string& name);
+
+/** Storage engines selectable with -dbbackend. */
+extern const std::vector<std::string> DB_BACKENDS;
+static const char* const DEFAULT_DB_BACKEND = "leveldb";
+
+/**
+ * Open the LevelDB database at path. With fMemory, it is kept in memory by
+ * LevelDB's memory environment. Background work is counted from its log.
+ */
+std::unique_ptr<CDBEngine> MakeLevelDBEngine(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const DBProfile& profile);
+
+/** Create an empty database that is kept in a sorted in-memory map and never stored. */
+std::unique_ptr<CDBEngine> MakeMemoryDBEngine();
+
 class CDBWrapper;
 
 /** These should be considered an implementation detail of the specific database.
@@ -118,16 +189,16 @@ class CDBIterator
 {
 private:
     const CDBWrapper &parent;
-    leveldb::Iterator *piter;
+    std::unique_ptr<CDBEngineIterator> piter;
 
 public:
 
     /**
      * @param[in] _parent          Parent CDBWrapper instance.
-     * @param[in] _piter           The original leveldb iterator.
+     * @param[in] _piter           The iterator of the storage engine.
      */
-    CDBIterator(const CDBWrapper &_parent, leveldb::Iterator *_piter) :
-        parent(_parent), piter(_piter) { };
+    CDBIterator(const CDBWrapper &_parent, std::unique_ptr<CDBEngineIterator> _piter) :
+        parent(_parent), piter(std::move(_piter)) { };
     ~CDBIterator();
 
     bool Valid() const;
@@ -172,39 +243,68 @@ public:
     }
 
     bool HasError() {
-        return !piter->status().ok();
+        return piter->HasError();
     }
 
 };
 
-class CDBWrapper
+/** Read-only view of a CDBWrapper as it was when the snapshot was taken. */
+class CDBSnapshot
 {
-    friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
 private:
-    //! custom environment this database is using (may be nullptr in case of default environment)
-    leveldb::Env* penv;
+    const CDBWrapper &parent;
+    std::unique_ptr<CDBEngineSnapshot> psnapshot;
 
-    //! database options used
-    leveldb::Options options;
+public:
+    CDBSnapshot(const CDBWrapper &_parent, std::unique_ptr<CDBEngineSnapshot> _psnapshot) :
+        parent(_parent), psnapshot(std::move(_psnapshot)) { };
 
-    //! options used when reading from the database
-    leveldb::ReadOptions readoptions;
+    template <typename K, typename V>
+    bool Read(const K& key, V& value) const
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey << key;
+        leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
-    //! options used when iterating over values of the database
-    leveldb::ReadOptions iteroptions;
+        std::string strValue;
+        if (!psnapshot->Read(slKey, strValue))
+            return false;
+        try {
+            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
+            ssValue >> value;
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
 
-    //! options used when writing to the database
-    leveldb::WriteOptions writeoptions;
+    CDBIterator *NewIterator() const
+    {
+        return new CDBIterator(parent, psnapshot->NewIterator());
+    }
+};
 
-    //! options used when sync writing to the database
-    leveldb::WriteOptions syncoptions;
+class CDBWrapper
+{
+    friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
+private:
+    //! the storage engine holding the data
+    std::unique_ptr<CDBEngine> m_engine;
 
-    //! the database itself
-    leveldb::DB* pdb;
+    //! the -dbbackend the database was opened with
+    std::string m_backend;
 
     //! the name of this database
     std::string m_name;
 
+    //! where this database is stored
+    fs::path m_path;
+
+    //! the settings the database was opened with, with the write buffer size resolved
+    DBProfile m_profile;
+
     //! a key used for optional XOR-obfuscation of the database
     std::vector<unsigned char> obfuscate_key;
 
@@ -214,13 +314,21 @@ private:
     //! the length of the obfuscate key in number of bytes
     static const unsigned int OBFUSCATE_KEY_NUM_BYTES;
 
+    //! the key under which a non-default profile is recorded
+    static const std::string PROFILE_KEY;
+
+    void RecordProfile(const DBProfile& configured);
+
     std::vector<unsigned char> CreateObfuscateKey() const;
 
 public:
     /**
+     * The storage engine is chosen with -dbbackend.
+     *
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
      * @param[in] nCacheSize  Configures various leveldb cache settings.
-     * @param[in] fMemory     If true, use leveldb's memory environment.
+     * @param[in] fMemory     If true, use leveldb's memory environment. Data of the memory
+     *                        backend is never stored.
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
@@ -240,13 +348,8 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
-        if (!status.ok()) {
-            if (status.IsNotFound())
-                return false;
-            LogPrintf("LevelDB read failure: %s\n", status.ToString());
-            dbwrapper_private::HandleError(status);
-        }
+        if (!m_engine->Read(slKey, strValue))
+            return false;
         try {
             CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
             ssValue.Xor(obfuscate_key);
@@ -274,14 +377,7 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
-        if (!status.ok()) {
-            if (status.IsNotFound())
-                return false;
-            LogPrintf("LevelDB read failure: %s\n", status.ToString());
-            dbwrapper_private::HandleError(status);
-        }
-        return true;
+        return m_engine->Read(slKey, strValue);
     }
 
     template <typename K>
@@ -294,9 +390,22 @@ public:
 
     bool WriteBatch(CDBBatch& batch, bool fSync = false);
 
-    // Get an estimate of LevelDB memory usage (in bytes).
+    // Get an estimate of the memory usage of the storage engine (in bytes).
     size_t DynamicMemoryUsage() const;
 
+    const std::string& GetName() const { return m_name; }
+    const std::string& GetBackend() const { return m_backend; }
+    const fs::path& GetPath() const { return m_path; }
+    const DBProfile& GetProfile() const { return m_profile; }
+
+    /** Read a property of the storage engine, such as "leveldb.stats". */
+    bool GetProperty(const std::string& property, std::string& value) const;
+
+    /** Approximate size of the whole database on disk, in bytes. */
+    uint64_t EstimateTotalSize() const;
+
+    DBCounters GetCounters() const;
+
     // not available for LevelDB; provide for compatibility with BDB
     bool Flush()
     {
@@ -311,7 +420,13 @@ public:
 
     CDBIterator *NewIterator()
     {
-        return new CDBIterator(*this, pdb->NewIterator(iteroptions));
+        return new CDBIterator(*this, m_engine->NewIterator());
+    }
+
+    /** Take a consistent read-only view of the database. It must be destroyed before the database. */
+    std::unique_ptr<CDBSnapshot> NewSnapshot() const
+    {
+        return std::make_unique<CDBSnapshot>(*this, m_engine->NewSnapshot());
     }
 
     /**
@@ -329,10 +444,7 @@ public:
         ssKey2 << key_end;
         leveldb::Slice slKey1(ssKey1.data(), ssKey1.size());
         leveldb::Slice slKey2(ssKey2.data(), ssKey2.size());
-        uint64_t size = 0;
-        leveldb::Range range(slKey1, slKey2);
-        pdb->GetApproximateSizes(&range, 1, &size);
-        return size;
+        return m_engine->EstimateSize(slKey1, slKey2);
     }
 
     /**
@@ -348,9 +460,12 @@ public:
         ssKey2 << key_end;
         leveldb::Slice slKey1(ssKey1.data(), ssKey1.size());
         leveldb::Slice slKey2(ssKey2.data(), ssKey2.size());
-        pdb->CompactRange(&slKey1, &slKey2);
+        m_engine->CompactRange(&slKey1, &slKey2);
     }
 
 };
 
+/** Call f for every open database. No database is opened or closed meanwhile. */
+void ForEachDBWrapper(const std::function<void(const CDBWrapper&)>& f);
+
 #endif // BITCOIN_DBWRAPPER_H
@@ -5,10 +5,18 @@
 #include <index/txindex.h>
 #include <shutdown.h>
 #include <trace.h>
+#include <txdb.h>
 #include <blockprune.h>
+#include <consensus/tx_verify.h>
 #include <validation.h>
 #include <file_io.h>
+#include <streams.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <deque>
+#include <thread>
 
 static const uint64_t MEMPOOL_DUMP_VERSION = 1;
 
@@ -195,24 +203,62 @@ static bool FindBlockPos(CDiskBlockPos &pos, unsigned int nAddSize, unsigned int
     return true;
 }
 
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp, CXFieldHistoryMap* pxfieldHistory)
+BlockImportPipeline::BlockImportPipeline(FILE* fileIn, const CDiskBlockPos* dbp, uint32_t bufferSize, uint32_t maxBlockSize, int nWorkers, CXFieldHistoryMap* pxfieldHistory)
+    : m_has_pos(dbp != nullptr), m_pos(dbp ? *dbp : CDiskBlockPos()), m_worker_count(nWorkers), m_xfield_history(pxfieldHistory)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    m_reader = std::thread([this, fileIn, bufferSize, maxBlockSize] {
+        RenameThread("tapyrus-blkread");
+        ReadLoop(fileIn, bufferSize, maxBlockSize);
+    });
+    for (int i = 0; i < nWorkers; i++) {
+        m_workers.emplace_back([this] {
+            RenameThread("tapyrus-blkcheck");
+            DecodeLoop();
+        });
+    }
+}
 
-    uint32_t maxBlockSize = GetCurrentMaxBlockSize();
-    uint32_t bufferSize;
+BlockImportPipeline::~BlockImportPipeline()
+{
+    Stop();
+}
 
-    if (dbp != nullptr) {
-        // Reindexing - use large 32MB buffer to handle any block size
-        bufferSize = REINDEX_BUFFER_SIZE;
-    } else {
-        // Normal operation - use buffer based on current max block size
-        bufferSize = maxBlockSize;
+std::shared_ptr<BlockImportFrame> BlockImportPipeline::Next()
+{
+    int64_t nTimeStart = GetTimeMicros();
+    WaitableLock lock(m_mutex);
+    m_cond_consumer.wait(lock, [this] {
+        return m_ordered.empty() ? m_read_done : m_ordered.front()->fDone;
+    });
+    nWaitMicros += GetTimeMicros() - nTimeStart;
+    if (m_ordered.empty())
+        return nullptr;
+    std::shared_ptr<BlockImportFrame> frame = std::move(m_ordered.front());
+    m_ordered.pop_front();
+    m_bytes_in_flight -= frame->nSize;
+    m_cond_reader.notify_one();
+    return frame;
+}
+
+void BlockImportPipeline::Stop()
+{
+    {
+        WaitableLock lock(m_mutex);
+        m_stop = true;
     }
+    m_cond_reader.notify_all();
+    m_cond_worker.notify_all();
+    if (m_reader.joinable())
+        m_reader.join();
+    for (std::thread& worker : m_workers)
+        worker.join();
+    m_workers.clear();
+}
 
-    int nLoaded = 0;
+void BlockImportPipeline::ReadLoop(FILE* fileIn, uint32_t bufferSize, uint32_t maxBlockSize)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    int64_t nTimeBlocked = 0;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*bufferSize, bufferSize+8, SER_DISK, CLIENT_VERSION);
@@ -237,8 +283,8 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp, CXFieldHistoryMap*
                     continue;
                 }
                 // During normal operation, validate against maxBlockSize
-                // During reindex (dbp != nullptr), skip size validation as it happens in CheckBlock
-                if (dbp == nullptr) {
+                // During reindex (m_has_pos), skip size validation as it happens in CheckBlock
+                if (!m_has_pos) {
                     // Normal operation - validate against current maxBlockSize
                     if (nSize > maxBlockSize) {
                         continue;
@@ -256,81 +302,204 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp, CXFieldHistoryMap*
                 break;
             }
             try {
-                // read block
+                // read the raw block; it is deserialized by a worker
                 uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
                 blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
+                std::shared_ptr<BlockImportFrame> frame = std::make_shared<BlockImportFrame>();
+                frame->pos = m_pos;
+                frame->pos.nPos = nBlockPos;
+                frame->nSize = nSize;
+                frame->raw.resize(nSize);
+                // read in pieces, the rewind margin keeps a single read below the buffer size
+                for (unsigned int nRead = 0; nRead < nSize; ) {
+                    unsigned int nChunk = std::min<unsigned int>(nSize - nRead, bufferSize / 2);
+                    blkdat.read(frame->raw.data() + nRead, nChunk);
+                    nRead += nChunk;
+                }
                 nRewind = blkdat.GetPos();
 
-                uint256 hash = block.GetHash();
-                {
-                    LOCK(cs_main);
-                    // detect out of order blocks, and store them for later
-                    if (hash != FederationParams().GenesisBlock().GetHash() && !LookupBlockIndex(block.hashPrevBlock)) {
-                        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                                block.hashPrevBlock.ToString());
-                        if (dbp)
-                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                        continue;
-                    }
+                int64_t nTimeWait = GetTimeMicros();
+                WaitableLock lock(m_mutex);
+                m_cond_reader.wait(lock, [this] {
+                    return m_stop || m_ordered.empty() || m_bytes_in_flight < BLOCK_IMPORT_PIPELINE_BYTES;
+                });
+                nTimeBlocked += GetTimeMicros() - nTimeWait;
+                if (m_stop)
+                    break;
+                m_bytes_in_flight += nSize;
+                nFrames++;
+                nBytes += nSize;
+                m_ordered.push_back(frame);
+                m_to_decode.push_back(std::move(frame));
+                m_cond_worker.notify_one();
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    } catch (const std::exception& e) {
+        strAbortReason = e.what();
+    }
+    nReadMicros = GetTimeMicros() - nTimeStart - nTimeBlocked;
+    {
+        WaitableLock lock(m_mutex);
+        m_read_done = true;
+    }
+    m_cond_worker.notify_all();
+    m_cond_consumer.notify_all();
+}
 
-                    // process in case the block isn't known yet
-                    CBlockIndex* pindex = LookupBlockIndex(hash);
-                    if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
-                        CValidationState state;
-                        if (g_chainstate.AcceptBlock(pblock, state, nullptr, true, dbp, nullptr, pxfieldHistory)) {
-                            nLoaded++;
-                        }
-                        if (state.IsError()) {
-                          break;
-                      }
-                    } else if (hash != FederationParams().GenesisBlock().GetHash() && pindex->nHeight % 1000 == 0) {
-                      LogPrint(BCLog::REINDEX, "%s Block Import: already had block %s at height %d\n", __func__, hash.ToString(), pindex->nHeight);
-                    }
-                }
+void BlockImportPipeline::DecodeLoop()
+{
+    while (true) {
+        std::shared_ptr<BlockImportFrame> frame;
+        {
+            WaitableLock lock(m_mutex);
+            m_cond_worker.wait(lock, [this] { return m_stop || m_read_done || !m_to_decode.empty(); });
+            if (m_stop || m_to_decode.empty())
+                return;
+            frame = std::move(m_to_decode.front());
+            m_to_decode.pop_front();
+        }
 
-                // Activate the genesis block so normal node progress can continue
-                if (hash == FederationParams().GenesisBlock().GetHash()) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state)) {
-                        break;
-                    }
+        int64_t nTimeStart = GetTimeMicros();
+        try {
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            frame->raw >> *pblock;
+            // Only passing checks are remembered; CheckBlock reports any failure in order.
+            CValidationState state;
+            pblock->fCheckedMerkleRoot = CheckBlockMerkleRoot(*pblock, state);
+            pblock->fCheckedTransactions = std::all_of(pblock->vtx.begin(), pblock->vtx.end(), [&state](const CTransactionRef& tx) {
+                return CheckTransaction(*tx, state, true);
+            });
+
+            // Blocks are accepted in file order, so the aggregate pubkey of a
+            // block is usually the latest one. A wrong prediction only costs
+            // the work, as cache entries commit to the pubkey.
+            XFieldAggPubKey aggPubKey;
+            if (m_xfield_history)
+                m_xfield_history->GetLatest(TAPYRUS_XFIELDTYPES::AGGPUBKEY, aggPubKey);
+            else
+                CXFieldHistory().GetLatest(TAPYRUS_XFIELDTYPES::AGGPUBKEY, aggPubKey);
+            PreVerifyBlockProof(*pblock, aggPubKey.getPubKey());
+            frame->pblock = std::move(pblock);
+        } catch (const std::exception& e) {
+            frame->strError = e.what();
+        }
+        frame->raw = CDataStream(SER_DISK, CLIENT_VERSION);
+        nDecodeMicros += GetTimeMicros() - nTimeStart;
+
+        {
+            WaitableLock lock(m_mutex);
+            frame->fDone = true;
+        }
+        m_cond_consumer.notify_one();
+    }
+}
+
+bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp, CXFieldHistoryMap* pxfieldHistory)
+{
+    // Map of disk positions for blocks with unknown parent (only used for reindex)
+    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    int64_t nStart = GetTimeMillis();
+
+    uint32_t maxBlockSize = GetCurrentMaxBlockSize();
+    uint32_t bufferSize;
+
+    if (dbp != nullptr) {
+        // Reindexing - use large 32MB buffer to handle any block size
+        bufferSize = REINDEX_BUFFER_SIZE;
+    } else {
+        // Normal operation - use buffer based on current max block size
+        bufferSize = maxBlockSize;
+    }
+
+    int nLoaded = 0;
+
+    const char* const func = __func__;
+
+    // Accept one block read from the file. Returns false when loading must stop.
+    auto processBlock = [&](const std::shared_ptr<CBlock>& pblock, CDiskBlockPos* pos) -> bool {
+        const CBlock& block = *pblock;
+        uint256 hash = block.GetHash();
+        {
+            LOCK(cs_main);
+            // detect out of order blocks, and store them for later
+            if (hash != FederationParams().GenesisBlock().GetHash() && !LookupBlockIndex(block.hashPrevBlock)) {
+                LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", func, hash.ToString(),
+                        block.hashPrevBlock.ToString());
+                if (pos)
+                    mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *pos));
+                return true;
+            }
+
+            // process in case the block isn't known yet
+            CBlockIndex* pindex = LookupBlockIndex(hash);
+            if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
+                CValidationState state;
+                if (g_chainstate.AcceptBlock(pblock, state, nullptr, true, pos, nullptr, pxfieldHistory)) {
+                    nLoaded++;
                 }
+                if (state.IsError()) {
+                  return false;
+              }
+            } else if (hash != FederationParams().GenesisBlock().GetHash() && pindex->nHeight % 1000 == 0) {
+              LogPrint(BCLog::REINDEX, "%s Block Import: already had block %s at height %d\n", func, hash.ToString(), pindex->nHeight);
+            }
+        }
 
-                NotifyHeaderTip();
+        // Activate the genesis block so normal node progress can continue
+        if (hash == FederationParams().GenesisBlock().GetHash()) {
+            CValidationState state;
+            if (!ActivateBestChain(state)) {
+                return false;
+            }
+        }
 
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, pxfieldHistory))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (g_chainstate.AcceptBlock(pblockrecursive, dummy, nullptr, true, &it->second, nullptr, pxfieldHistory))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
+        NotifyHeaderTip();
+
+        // Recursively process earlier encountered successors of this block
+        std::deque<uint256> queue;
+        queue.push_back(hash);
+        while (!queue.empty()) {
+            uint256 head = queue.front();
+            queue.pop_front();
+            std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+            while (range.first != range.second) {
+                std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
+                if (ReadBlockFromDisk(*pblockrecursive, it->second, pxfieldHistory))
+                {
+                    LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", func, pblockrecursive->GetHash().ToString(),
+                            head.ToString());
+                    LOCK(cs_main);
+                    CValidationState dummy;
+                    if (g_chainstate.AcceptBlock(pblockrecursive, dummy, nullptr, true, &it->second, nullptr, pxfieldHistory))
+                    {
+                        nLoaded++;
+                        queue.push_back(pblockrecursive->GetHash());
                     }
                 }
+                range.first++;
+                mapBlocksUnknownParent.erase(it);
+                NotifyHeaderTip();
+            }
+        }
+        return true;
+    };
+
+    int nWorkers = std::max(1, std::min(GetNumCores() - 1, MAX_BLOCK_IMPORT_WORKERS));
+    BlockImportPipeline pipeline(fileIn, dbp, bufferSize, maxBlockSize, nWorkers, pxfieldHistory);
+    try {
+        while (std::shared_ptr<BlockImportFrame> frame = pipeline.Next()) {
+            if (!frame->pblock) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, frame->strError);
+                continue;
+            }
+            if (dbp)
+                dbp->nPos = frame->pos.nPos;
+            try {
+                if (!processBlock(frame->pblock, dbp))
+                    break;
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
@@ -338,6 +507,15 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp, CXFieldHistoryMap*
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
+    pipeline.Stop();
+    if (!pipeline.strAbortReason.empty())
+        AbortNode(std::string("System error: ") + pipeline.strAbortReason);
+
+    int64_t nElapsedMicros = (GetTimeMillis() - nStart) * 1000;
+    LogPrint(BCLog::BENCH, "%s: %u blocks (%.2fMB): read %.2fms, deserialize, check and pre-verify %.2fms on %d workers, accept %.2fms, waited %.2fms for workers\n",
+        __func__, pipeline.nFrames, pipeline.nBytes * 0.000001, pipeline.nReadMicros * MILLI,
+        pipeline.nDecodeMicros.load() * MILLI, pipeline.WorkerCount(),
+        std::max<int64_t>(nElapsedMicros - pipeline.nWaitMicros, 0) * MILLI, pipeline.nWaitMicros * MILLI);
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
@@ -400,6 +578,10 @@ bool FlushStateToDisk(CValidationState &state, FlushStateMode mode, int nManualP
 
     try {
     {
+        // A background write of the coins failed since the last call.
+        if (pcoinsflush && pcoinsflush->Failed())
+            return AbortNode(state, "Failed to write to coin database");
+
         [[maybe_unused]]const size_t coins_count = pcoinsTip->GetCacheSize();
         [[maybe_unused]]const size_t coins_mem_usage = pcoinsTip->DynamicMemoryUsage();
 
@@ -457,15 +639,15 @@ bool FlushStateToDisk(CValidationState &state, FlushStateMode mode, int nManualP
                     vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
                     setDirtyFileInfo.erase(it++);
                 }
-                std::vector<const CBlockIndex*> vBlocks;
-                vBlocks.reserve(setDirtyBlockIndex.size());
-                for (std::set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-                    vBlocks.push_back(*it);
-                    setDirtyBlockIndex.erase(it++);
-                }
+                std::vector<CBlockIndex*> vDirty(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
+                setDirtyBlockIndex.clear();
+                std::vector<const CBlockIndex*> vBlocks(vDirty.begin(), vDirty.end());
                 if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                     return AbortNode(state, "Failed to write to block index database");
                 }
+                // The headers can now be read back from the database when needed
+                for (CBlockIndex* pindex : vDirty)
+                    pindex->ReleaseHeaderExtra();
             }
             // Finally remove any pruned files
             if (fFlushForPrune)
@@ -482,8 +664,26 @@ bool FlushStateToDisk(CValidationState &state, FlushStateMode mode, int nManualP
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // The modified coins are written on a background thread while
+            // validation continues; pcoinsflush serves them until then.
+            // Unspent coins stay cached, so the node does not run cold after
+            // a flush: the writer gets copies of them, and the spent ones.
+            // Without a background writer they are written in place.
+            if (pcoinsflush) {
+                int64_t nStallStart = GetTimeMicros();
+                if (!pcoinsflush->Start(pcoinsTip->TakeDirty(), nStallStart))
+                    return AbortNode(state, "Failed to write to coin database");
+                // Callers asking for a full flush expect the database to be complete on return.
+                if (mode == FlushStateMode::ALWAYS && !pcoinsflush->Wait())
+                    return AbortNode(state, "Failed to write to coin database");
+            } else if (!pcoinsTip->Sync()) {
                 return AbortNode(state, "Failed to write to coin database");
+            }
+            // Make room when the cache outgrew its limit, keeping the most recently used coins.
+            if (fCacheLarge || fCacheCritical) {
+                size_t nEvicted = pcoinsTip->Evict(nTotalSpace * COINS_CACHE_EVICT_TARGET_PERCENT / 100);
+                LogPrint(BCLog::COINDB, "Evicted %u coins from the cache (%.2f MiB remaining)\n", nEvicted, pcoinsTip->DynamicMemoryUsage() * (1.0 / 1048576.0));
+            }
             nLastFlush = nNow;
             full_flush_completed = true;
             TRACE5(utxocache, utxocache_flush,
@@ -568,7 +768,7 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos,
 }
 
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, CXFieldHistoryMap* pxfieldHistory, int nHeight)
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, CXFieldHistoryMap* pxfieldHistory, int nHeight, bool fProofAssumedValid)
 {
     block.SetNull();
 
@@ -590,7 +790,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, CXFieldHistoryMa
     // Get() returns the latest aggregate key — the safe conservative choice.
     // Never use block.GetHeight() (coinbase prevout.n): that field is attacker-controlled.
     CValidationState state;
-    if(!CheckBlockHeader(block.GetBlockHeader(), state, pxfieldHistory, nHeight, true))
+    if(!CheckBlockHeader(block.GetBlockHeader(), state, pxfieldHistory, nHeight, true, fProofAssumedValid))
         return error("%s: ReadBlockFromDisk: %s", __func__, FormatStateMessage(state));
 
     return true;
@@ -599,15 +799,17 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, CXFieldHistoryMa
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
     CDiskBlockPos blockPos;
+    bool fProofAssumedValid;
     {
         LOCK(cs_main);
         blockPos = pindex->GetBlockPos();
+        fProofAssumedValid = IsBlockProofAssumedValid(pindex->GetBlockHash(), pindex->nHeight);
     }
 
     // Pass pindex->nHeight so CheckBlockHeader uses the correct aggregate key for
     // this block's height, not the latest one.  pindex->nHeight is from our trusted
     // block index and is not attacker-controlled.
-    if (!ReadBlockFromDisk(block, blockPos, nullptr, pindex->nHeight))
+    if (!ReadBlockFromDisk(block, blockPos, nullptr, pindex->nHeight, fProofAssumedValid))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
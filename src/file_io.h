@@ -5,7 +5,24 @@
 #ifndef BITCOIN_FILE_IO_H
 #define BITCOIN_FILE_IO_H
 
+#include <chain.h>
+#include <clientversion.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <sync.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
 constexpr size_t REINDEX_BUFFER_SIZE = 32 * 1000000;  //  use large 32MB buffer to handle any block size
+constexpr size_t BLOCK_IMPORT_PIPELINE_BYTES = 2 * REINDEX_BUFFER_SIZE;  //  blocks read ahead of the importing thread
+constexpr int MAX_BLOCK_IMPORT_WORKERS = 8;  //  threads deserializing and checking blocks during import
+constexpr int64_t COINS_CACHE_EVICT_TARGET_PERCENT = 75;  //  share of the coins cache limit kept after evicting an oversized cache
 enum class FlushStateMode {
     NONE,
     IF_NEEDED,
@@ -19,6 +36,78 @@ bool LoadMempool();
 /** Dump the mempool to disk. */
 bool DumpMempool();
 
+/** One block located in an external block file by the reader stage. */
+struct BlockImportFrame
+{
+    CDiskBlockPos pos;
+    unsigned int nSize;
+    CDataStream raw{SER_DISK, CLIENT_VERSION};
+    std::shared_ptr<CBlock> pblock;  //!< set by a worker, stays null when the block did not deserialize
+    std::string strError;
+    bool fDone = false;
+};
+
+/**
+ * Reads the blocks of one external file on a dedicated thread and
+ * deserializes them on a pool of workers, handing them back to the importing
+ * thread in file order. The workers also check the merkle roots and the
+ * transactions, and verify the proofs against the latest aggregate pubkey of
+ * the xfield history into the block proof cache, so that little of CheckBlock
+ * is left for the importing thread. The number of bytes in flight is bounded
+ * by BLOCK_IMPORT_PIPELINE_BYTES.
+ *
+ * With dbp, the frames carry its file number and the position of the block in
+ * the file. dbp is copied when the pipeline is constructed, so the caller may
+ * update it while the file is read.
+ */
+class BlockImportPipeline
+{
+public:
+    BlockImportPipeline(FILE* fileIn, const CDiskBlockPos* dbp, uint32_t bufferSize, uint32_t maxBlockSize, int nWorkers, CXFieldHistoryMap* pxfieldHistory = nullptr);
+    ~BlockImportPipeline();
+
+    /** Return the next block frame in file order, or nullptr once the file is exhausted. */
+    std::shared_ptr<BlockImportFrame> Next();
+
+    /** Stop all stages and wait for their threads. */
+    void Stop();
+
+    int WorkerCount() const { return m_worker_count; }
+
+    //! Set by the reader on a fatal I/O error; only valid after Stop().
+    std::string strAbortReason;
+    //! Stage timings; only valid after Stop().
+    int64_t nReadMicros = 0;
+    std::atomic<int64_t> nDecodeMicros{0};
+    int64_t nWaitMicros = 0;
+    uint64_t nFrames = 0;
+    uint64_t nBytes = 0;
+
+private:
+    void ReadLoop(FILE* fileIn, uint32_t bufferSize, uint32_t maxBlockSize);
+    void DecodeLoop();
+
+    Mutex m_mutex;
+    std::condition_variable m_cond_reader;
+    std::condition_variable m_cond_worker;
+    std::condition_variable m_cond_consumer;
+    //! Frames in file order, waiting to be handed out by Next()
+    std::deque<std::shared_ptr<BlockImportFrame>> m_ordered;
+    //! Frames not yet picked up by a worker
+    std::deque<std::shared_ptr<BlockImportFrame>> m_to_decode;
+    size_t m_bytes_in_flight = 0;
+    bool m_read_done = false;
+    bool m_stop = false;
+    //! Copy of the caller's dbp, only read by the reader thread
+    const bool m_has_pos;
+    const CDiskBlockPos m_pos;
+    const int m_worker_count;
+    //! History the proofs are predicted from, the global one if null
+    CXFieldHistoryMap* const m_xfield_history;
+    std::thread m_reader;
+    std::vector<std::thread> m_workers;
+};
+
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = nullptr, CXFieldHistoryMap* pxfieldHistory = nullptr);
 
@@ -36,7 +125,7 @@ bool FlushStateToDisk(CValidationState &state, FlushStateMode mode, int nManualP
 void  FlushBlockFile(bool fFinalize = false);
 
 /** Functions for disk access for blocks */
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, CXFieldHistoryMap* pxfieldHistory = nullptr, int nHeight = -1);
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, CXFieldHistoryMap* pxfieldHistory = nullptr, int nHeight = -1, bool fProofAssumedValid = false);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
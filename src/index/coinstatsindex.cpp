@@ -0,0 +1,383 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/coinstatsindex.h>
+
+#include <chainstate.h>
+#include <crypto/common.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+constexpr char DB_BLOCK_STATS = 's';
+constexpr char DB_BLOCK_HEIGHT = 'h';
+constexpr char DB_COLOR_SUPPLY = 'u';
+
+std::unique_ptr<CoinStatsIndex> g_coinstatsindex;
+
+/** Statistics of the UTXO set after a block, as stored in the index. */
+struct CoinStatsEntry
+{
+    MuHash3072 muhash;
+    uint64_t transaction_output_count = 0;
+    uint64_t bogo_size = 0;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(muhash);
+        READWRITE(VARINT(transaction_output_count));
+        READWRITE(VARINT(bogo_size));
+    }
+};
+
+/** The indexed block at a height, and the colors whose supply it changed. */
+struct BlockHeightEntry
+{
+    uint256 block_hash;
+    std::vector<ColorIdentifier> colors;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(block_hash);
+        READWRITE(colors);
+    }
+};
+
+/** Key of a BlockHeightEntry. Big-endian, so that the entries are ordered by height. */
+struct BlockHeightKey
+{
+    int height;
+
+    explicit BlockHeightKey(int height_in = 0) : height(height_in) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, DB_BLOCK_HEIGHT);
+        unsigned char buf[4];
+        WriteBE32(buf, height);
+        s.write((const char*)buf, sizeof(buf));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        if (ser_readdata8(s) != DB_BLOCK_HEIGHT) {
+            throw std::ios_base::failure("Invalid format for coinstatsindex block height key");
+        }
+        unsigned char buf[4];
+        s.read((char*)buf, sizeof(buf));
+        height = ReadBE32(buf);
+    }
+};
+
+/**
+ * Key of the supply of a color after a block that changed it. The height is
+ * stored inverted and big-endian, so that the records of a color are ordered
+ * from the latest and a seek to a height finds the last change at or below it.
+ */
+struct ColorSupplyKey
+{
+    ColorIdentifier colorId;
+    int height;
+
+    ColorSupplyKey() : height(0) {}
+    ColorSupplyKey(const ColorIdentifier& colorId_in, int height_in) : colorId(colorId_in), height(height_in) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, DB_COLOR_SUPPLY);
+        s << colorId;
+        unsigned char buf[4];
+        WriteBE32(buf, ~(uint32_t)height);
+        s.write((const char*)buf, sizeof(buf));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        if (ser_readdata8(s) != DB_COLOR_SUPPLY) {
+            throw std::ios_base::failure("Invalid format for coinstatsindex color supply key");
+        }
+        s >> colorId;
+        unsigned char buf[4];
+        s.read((char*)buf, sizeof(buf));
+        height = ~ReadBE32(buf);
+    }
+};
+
+/**
+ * Access to the coinstats index database (indexes/coinstats/)
+ *
+ * Besides the locator of BaseIndex, the database stores a CoinStatsEntry per
+ * indexed block, keyed by block hash. For the blocks of the indexed chain,
+ * it stores a BlockHeightEntry per height, and the supply of a color after
+ * each block that changed it, keyed by color and height. Blocks above the
+ * fork point are erased from the height and supply records when the index
+ * continues from another block.
+ */
+class CoinStatsIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    bool ReadStats(const uint256& block_hash, CoinStatsEntry& entry) const;
+    /** Write the entry of the block pindex and the supply of the colors it changed,
+      * after erasing the records of the blocks at its height and above if rewind is set */
+    bool WriteStats(const CBlockIndex* pindex, const CoinStatsEntry& entry, const ColorSupplyMap& changed_supply, bool rewind);
+
+    /** Whether pindex is the indexed block at its height */
+    bool IsIndexedChain(const CBlockIndex* pindex) const;
+    /** Read the supply of a color after the last change at or below height. If prev_supply
+      * is given, it is set to the supply before the block at height. */
+    bool ReadColorSupply(const ColorIdentifier& colorId, int height, CColorSupply& supply, CColorSupply* prev_supply = nullptr);
+    /** Read the supply of every color left in the UTXO set after height */
+    bool ReadAllColorSupply(int height, ColorSupplyMap& supply);
+};
+
+CoinStatsIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "coinstats", n_cache_size, f_memory, f_wipe)
+{}
+
+bool CoinStatsIndex::DB::ReadStats(const uint256& block_hash, CoinStatsEntry& entry) const
+{
+    return Read(std::make_pair(DB_BLOCK_STATS, block_hash), entry);
+}
+
+bool CoinStatsIndex::DB::WriteStats(const CBlockIndex* pindex, const CoinStatsEntry& entry, const ColorSupplyMap& changed_supply, bool rewind)
+{
+    CDBBatch batch(*this);
+    if (rewind) {
+        std::unique_ptr<CDBIterator> cursor(NewIterator());
+        BlockHeightKey key;
+        for (cursor->Seek(BlockHeightKey(pindex->nHeight)); cursor->Valid() && cursor->GetKey(key); cursor->Next()) {
+            BlockHeightEntry height_entry;
+            if (!cursor->GetValue(height_entry)) {
+                return error("%s: Failed to read the indexed block at height %d", __func__, key.height);
+            }
+            for (const ColorIdentifier& colorId : height_entry.colors) {
+                batch.Erase(ColorSupplyKey(colorId, key.height));
+            }
+            batch.Erase(key);
+        }
+    }
+
+    BlockHeightEntry height_entry;
+    height_entry.block_hash = pindex->GetBlockHash();
+    for (const auto& supply : changed_supply) {
+        batch.Write(ColorSupplyKey(supply.first, pindex->nHeight), supply.second);
+        height_entry.colors.push_back(supply.first);
+    }
+    batch.Write(BlockHeightKey(pindex->nHeight), height_entry);
+    batch.Write(std::make_pair(DB_BLOCK_STATS, pindex->GetBlockHash()), entry);
+    return WriteBatch(batch);
+}
+
+bool CoinStatsIndex::DB::IsIndexedChain(const CBlockIndex* pindex) const
+{
+    BlockHeightEntry height_entry;
+    return Read(BlockHeightKey(pindex->nHeight), height_entry) && height_entry.block_hash == pindex->GetBlockHash();
+}
+
+bool CoinStatsIndex::DB::ReadColorSupply(const ColorIdentifier& colorId, int height, CColorSupply& supply, CColorSupply* prev_supply)
+{
+    supply = CColorSupply();
+    std::unique_ptr<CDBIterator> cursor(NewIterator());
+    ColorSupplyKey key;
+    cursor->Seek(ColorSupplyKey(colorId, height));
+    if (!cursor->Valid() || !cursor->GetKey(key) || key.colorId != colorId) {
+        // Never changed at or below height
+        if (prev_supply) *prev_supply = supply;
+        return true;
+    }
+    if (!cursor->GetValue(supply)) {
+        return error("%s: Failed to read the supply of %s at height %d", __func__, colorId.toHexString(), key.height);
+    }
+    if (!prev_supply) return true;
+
+    *prev_supply = supply;
+    if (key.height != height) return true;
+    *prev_supply = CColorSupply();
+    cursor->Next();
+    if (cursor->Valid() && cursor->GetKey(key) && key.colorId == colorId && !cursor->GetValue(*prev_supply)) {
+        return error("%s: Failed to read the supply of %s at height %d", __func__, colorId.toHexString(), key.height);
+    }
+    return true;
+}
+
+bool CoinStatsIndex::DB::ReadAllColorSupply(int height, ColorSupplyMap& supply)
+{
+    supply.clear();
+    // The native token is always listed
+    supply[ColorIdentifier()];
+    std::unique_ptr<CDBIterator> cursor(NewIterator());
+    ColorSupplyKey key;
+    cursor->Seek(DB_COLOR_SUPPLY);
+    while (cursor->Valid() && cursor->GetKey(key)) {
+        // Seek to the last change of this color at or below height, then past its first change
+        const ColorIdentifier colorId = key.colorId;
+        cursor->Seek(ColorSupplyKey(colorId, height));
+        if (cursor->Valid() && cursor->GetKey(key) && key.colorId == colorId) {
+            CColorSupply color_supply;
+            if (!cursor->GetValue(color_supply)) {
+                return error("%s: Failed to read the supply of %s at height %d", __func__, colorId.toHexString(), key.height);
+            }
+            // Like a scan of the UTXO set, only list the tokens that are left
+            if (color_supply.utxos > 0 || colorId.type == TokenTypes::NONE) {
+                supply[colorId] = color_supply;
+            }
+        }
+        cursor->Seek(ColorSupplyKey(colorId, 0));
+        if (cursor->Valid() && cursor->GetKey(key) && key.colorId == colorId) {
+            cursor->Next();
+        }
+    }
+    return true;
+}
+
+CoinStatsIndex::CoinStatsIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<CoinStatsIndex::DB>(n_cache_size, f_memory, f_wipe))
+{}
+
+CoinStatsIndex::~CoinStatsIndex() {}
+
+void CoinStatsIndex::AddCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    ApplyCoinHash(m_muhash, outpoint, coin);
+    m_transaction_output_count++;
+    m_bogo_size += GetBogoSize(coin.out.scriptPubKey);
+    CColorSupplyChange& change = m_block_changes[GetColorIdFromScript(coin.out.scriptPubKey)];
+    change.amount += coin.out.nValue;
+    change.utxos++;
+}
+
+void CoinStatsIndex::SpendCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    RemoveCoinHash(m_muhash, outpoint, coin);
+    m_transaction_output_count--;
+    m_bogo_size -= GetBogoSize(coin.out.scriptPubKey);
+    CColorSupplyChange& change = m_block_changes[GetColorIdFromScript(coin.out.scriptPubKey)];
+    change.amount -= coin.out.nValue;
+    change.utxos--;
+}
+
+bool CoinStatsIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    // Continue from the statistics after the parent block, which are only
+    // read back on the first block after a restart or a reorg. The blocks
+    // indexed above the parent, if any, are then left out of the supply.
+    // The UTXO set is empty after the genesis block, which a new index starts
+    // syncing after, so its statistics are never read back.
+    bool rewind = false;
+    if (!pindex->pprev || !pindex->pprev->pprev) {
+        m_muhash = MuHash3072();
+        m_transaction_output_count = 0;
+        m_bogo_size = 0;
+        rewind = true;
+    } else if (m_current_block != pindex->pprev->GetBlockHash()) {
+        CoinStatsEntry prev_entry;
+        if (!m_db->ReadStats(pindex->pprev->GetBlockHash(), prev_entry)) {
+            return error("%s: Failed to read the statistics of block %s", __func__, pindex->pprev->GetBlockHash().ToString());
+        }
+        m_muhash = prev_entry.muhash;
+        m_transaction_output_count = prev_entry.transaction_output_count;
+        m_bogo_size = prev_entry.bogo_size;
+        rewind = true;
+    }
+    m_block_changes.clear();
+    // Until this block is written, the statistics are those of no block
+    m_current_block.SetNull();
+
+    // The outputs of the genesis block are not added to the UTXO set
+    if (pindex->pprev) {
+        CBlockUndo block_undo;
+        if (!UndoReadFromDisk(block_undo, pindex)) {
+            return error("%s: Failed to read the undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (block_undo.vtxundo.size() + 1 != block.vtx.size()) {
+            return error("%s: Undo data of block %s does not match the block", __func__, pindex->GetBlockHash().ToString());
+        }
+
+        for (size_t i = 0; i < block.vtx.size(); ++i) {
+            const CTransaction& tx = *block.vtx[i];
+            for (uint32_t n = 0; n < tx.vout.size(); ++n) {
+                if (tx.vout[n].scriptPubKey.IsUnspendable()) continue;
+                AddCoin(COutPoint(tx.GetHashMalFix(), n), Coin(tx.vout[n], pindex->nHeight, tx.IsCoinBase()));
+            }
+            if (tx.IsCoinBase()) continue;
+
+            const CTxUndo& tx_undo = block_undo.vtxundo[i - 1];
+            if (tx_undo.vprevout.size() != tx.vin.size()) {
+                return error("%s: Undo data of block %s does not match the block", __func__, pindex->GetBlockHash().ToString());
+            }
+            for (size_t n = 0; n < tx.vin.size(); ++n) {
+                SpendCoin(tx.vin[n].prevout, tx_undo.vprevout[n]);
+            }
+        }
+    }
+
+    CoinStatsEntry entry;
+    entry.muhash = m_muhash;
+    entry.transaction_output_count = m_transaction_output_count;
+    entry.bogo_size = m_bogo_size;
+
+    // The supply of the colors changed by the block, from their last change.
+    // Transfers leave the supply unchanged.
+    ColorSupplyMap changed_supply;
+    for (const auto& change : m_block_changes) {
+        if (change.second.amount == 0 && change.second.utxos == 0) continue;
+        CColorSupply& supply = changed_supply[change.first];
+        if (pindex->pprev && !m_db->ReadColorSupply(change.first, pindex->nHeight - 1, supply)) {
+            return false;
+        }
+        assert((int64_t)supply.utxos + change.second.utxos >= 0);
+        supply.amount += change.second.amount;
+        supply.utxos += change.second.utxos;
+    }
+    if (!m_db->WriteStats(pindex, entry, changed_supply, rewind)) {
+        return false;
+    }
+    m_current_block = pindex->GetBlockHash();
+    return true;
+}
+
+BaseIndex::DB& CoinStatsIndex::GetDB() const { return *m_db; }
+
+bool CoinStatsIndex::LookUpStats(const CBlockIndex* pindex, CCoinsStats& stats) const
+{
+    CoinStatsEntry entry;
+    ColorSupplyMap supply;
+    if (!m_db->ReadStats(pindex->GetBlockHash(), entry) || !m_db->IsIndexedChain(pindex) ||
+        !m_db->ReadAllColorSupply(pindex->nHeight, supply)) {
+        return false;
+    }
+
+    stats.nHeight = pindex->nHeight;
+    stats.hashBlock = pindex->GetBlockHash();
+    stats.nTransactionOutputs = entry.transaction_output_count;
+    stats.nBogoSize = entry.bogo_size;
+    stats.mTotalAmount.clear();
+    for (const auto& color_supply : supply) {
+        stats.mTotalAmount[color_supply.first] = color_supply.second.amount;
+    }
+    entry.muhash.Finalize(stats.hashSerialized);
+    return true;
+}
+
+bool CoinStatsIndex::LookUpColorSupply(const CBlockIndex* pindex, const ColorIdentifier& colorId,
+                                       CColorSupply& supply, CColorSupplyChange& block_change) const
+{
+    CColorSupply prev_supply;
+    if (!m_db->IsIndexedChain(pindex) || !m_db->ReadColorSupply(colorId, pindex->nHeight, supply, &prev_supply)) {
+        return false;
+    }
+    block_change.amount = supply.amount - prev_supply.amount;
+    block_change.utxos = (int64_t)supply.utxos - (int64_t)prev_supply.utxos;
+    return true;
+}
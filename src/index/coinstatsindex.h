@@ -0,0 +1,117 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_COINSTATSINDEX_H
+#define BITCOIN_INDEX_COINSTATSINDEX_H
+
+#include <chain.h>
+#include <coinstats.h>
+#include <crypto/muhash.h>
+#include <index/base.h>
+
+/** Supply of one color in the UTXO set after a block. */
+struct CColorSupply
+{
+    CAmount amount = 0;
+    uint64_t utxos = 0;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(amount);
+        READWRITE(VARINT(utxos));
+    }
+};
+
+/** Net change of the supply of one color by a block: positive if issued, negative if burned. */
+struct CColorSupplyChange
+{
+    CAmount amount = 0;
+    int64_t utxos = 0;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(amount);
+        READWRITE(utxos);
+    }
+};
+
+typedef std::map<ColorIdentifier, CColorSupply, ColorIdentifierCompare> ColorSupplyMap;
+typedef std::map<ColorIdentifier, CColorSupplyChange, ColorIdentifierCompare> ColorSupplyChangeMap;
+
+/**
+ * CoinStatsIndex records the statistics of the UTXO set after every block of
+ * the chain, so that gettxoutsetinfo can answer for any block without
+ * scanning the chainstate. The set is committed to by its MuHash3072, which
+ * is updated with the outputs created and the coins spent (read from the
+ * undo data) by each block. The supply of every color (the native token
+ * and each ColorIdentifier) and its net change by the block are recorded
+ * as well, for gettokensupply.
+ *
+ * Entries are keyed by block hash and hold the MuHash before its final
+ * division, so that indexing a block is a few multiplications per coin and
+ * continuing from any indexed block, after a restart or a reorg, is a single
+ * read. Entries of stale blocks are kept. The supply of a color is only
+ * written after the blocks that change it, keyed by color and height, so a
+ * supply lookup is a single seek. Supply lookups are only answered for the
+ * blocks of the indexed chain.
+ */
+class CoinStatsIndex final : public BaseIndex
+{
+protected:
+    class DB;
+
+private:
+    const std::unique_ptr<DB> m_db;
+
+    //! Statistics of the UTXO set after m_current_block, only used by WriteBlock
+    uint256 m_current_block;
+    MuHash3072 m_muhash;
+    uint64_t m_transaction_output_count{0};
+    uint64_t m_bogo_size{0};
+    //! Changes of the supply by the block being indexed
+    ColorSupplyChangeMap m_block_changes;
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin);
+    void SpendCoin(const COutPoint& outpoint, const Coin& coin);
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "coinstatsindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit CoinStatsIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~CoinStatsIndex() override;
+
+    /// Look up the statistics of the UTXO set after the block pindex.
+    ///
+    /// @param[in]   pindex  The block, which must be on the indexed chain.
+    /// @param[out]  stats   All but nTransactions and nDiskSize; hashSerialized is the MuHash.
+    /// @return  true if the block is found in the index, false otherwise
+    bool LookUpStats(const CBlockIndex* pindex, CCoinsStats& stats) const;
+
+    /// Look up the supply of a color after the block pindex, and its change by that block.
+    ///
+    /// @param[in]   pindex  The block, which must be on the indexed chain.
+    /// @param[in]   colorId  The color, ColorIdentifier() for the native token.
+    /// @param[out]  supply  Zero if the color has no unspent output after the block.
+    /// @param[out]  block_change  Zero if the block did not change the supply of the color.
+    /// @return  true if the block is found in the index, false otherwise
+    bool LookUpColorSupply(const CBlockIndex* pindex, const ColorIdentifier& colorId,
+                           CColorSupply& supply, CColorSupplyChange& block_change) const;
+};
+
+/// The global UTXO set statistics index. May be null.
+extern std::unique_ptr<CoinStatsIndex> g_coinstatsindex;
+
+#endif // BITCOIN_INDEX_COINSTATSINDEX_H
@@ -17,6 +17,7 @@
 #include <fs.h>
 #include <httpserver.h>
 #include <httprpc.h>
+#include <index/coinstatsindex.h>
 #include <index/txindex.h>
 #include <key.h>
 #include <validation.h>
@@ -41,6 +42,7 @@
 #include <ui_interface.h>
 #include <util.h>
 #include <utilmoneystr.h>
+#include <utxo_snapshot.h>
 #include <validationinterface.h>
 #include <warnings.h>
 #include <walletinitinterface.h>
@@ -183,6 +185,9 @@ void Interrupt()
     if (g_txindex) {
         g_txindex->Interrupt();
     }
+    if (g_coinstatsindex) {
+        g_coinstatsindex->Interrupt();
+    }
 }
 
 void Shutdown()
@@ -203,6 +208,7 @@ void Shutdown()
     StopHTTPRPC();
     StopREST();
     StopRPC();
+    StopTxOutSetDump();
     StopHTTPServer();
     g_wallet_init_interface.Flush();
     StopMapPort();
@@ -210,8 +216,10 @@ void Shutdown()
     // Because these depend on each-other, we make sure that neither can be
     // using the other before destroying them.
     if (peerLogic) UnregisterValidationInterface(peerLogic.get());
+    if (g_template_builder) UnregisterValidationInterface(g_template_builder.get());
     if (g_connman) g_connman->Stop();
     if (g_txindex) g_txindex->Stop();
+    if (g_coinstatsindex) g_coinstatsindex->Stop();
 
     StopTorControl();
 
@@ -224,6 +232,8 @@ void Shutdown()
     peerLogic.reset();
     g_connman.reset();
     g_txindex.reset();
+    g_coinstatsindex.reset();
+    g_template_builder.reset();
 
     if (g_is_mempool_loaded && gArgs.GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         DumpMempool();
@@ -263,6 +273,7 @@ void Shutdown()
         }
         pcoinsTip.reset();
         pcoinscatcher.reset();
+        pcoinsflush.reset();
         pcoinsdbview.reset();
         g_colorid_state.reset();
         pblocktree.reset();
@@ -357,19 +368,27 @@ void SetupServerArgs()
     gArgs.AddArg("-version", "Print version and exit", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-networkid=<id>", "Network Identifier, an unsigned number representing this tapyrus network. The range is from 1 to 4294967295.", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-alertnotify=<cmd>", "Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)", false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-assumeutxo=<blockhash>:<hash>", "Trust a UTXO set snapshot of block <blockhash> with the txoutset hash <hash> (hash_serialized_3 in gettxoutsetinfo) for loadtxoutset and -loadsnapshot. Can be specified multiple times", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-assumevalid=<hex>", "If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: 0)", false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-assumevalidproof=<hex>", "If this block is in the chain assume that the block proofs of its ancestors are valid and potentially skip their verification. Aggregate pubkey changes are still checked (0 to verify all, default: 0)", false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-assumevalidproofheight=<n>", "Height of the -assumevalidproof block. Headers at or below it that are older than two weeks are synced before their proofs are verified, which happens when a header at that height other than the assumed block is received (default: unknown)", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocksdir=<dir>", "Specify blocks directory (default: <datadir>/blocks)", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocknotify=<cmd>", "Execute command when the best block changes (%s in cmd is replaced by block hash)", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blockreconstructionextratxn=<n>", strprintf("Extra transactions to keep in memory for compact block reconstructions (default: %u)", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocksonly", strprintf("Whether to operate in a blocks only mode (default: %u)", DEFAULT_BLOCKSONLY), true, OptionsCategory::OPTIONS);
     gArgs.AddArg("-conf=<file>", strprintf("Specify configuration file. Relative paths will be prefixed by datadir location. (default: %s)", BITCOIN_CONF_FILENAME), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-datadir=<dir>", "Specify data directory", false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-dbbackend=<backend>", strprintf("Storage engine of the databases: leveldb, or memory to keep them in memory only, starting from scratch on every start with an empty blocks directory (default: %s)", DEFAULT_DB_BACKEND), true, OptionsCategory::OPTIONS);
     gArgs.AddArg("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize), true, OptionsCategory::OPTIONS);
     gArgs.AddArg("-dbcache=<n>", strprintf("Set database cache size in megabytes (%d to %d, default: %d)", nMinDbCache, nMaxDbCache, nDefaultDbCache), false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-dbprofile=<db>:<setting>=<n>[,...]", "Tune the LevelDB database <db> (chainstate, index, txindex or coinstats). Settings: compression (0 or 1, needs LevelDB built with Snappy), "
+        "bloombits (bits per key of the bloom filter, 0 for none), blocksize (KiB), maxfilesize (MiB), writebuffer (MiB, 0 for a quarter of the database cache). "
+        "Changes apply to the files written from then on. This option can be specified multiple times", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-debuglogfile=<file>", strprintf("Specify location of debug log file. Relative paths will be prefixed by a net-specific datadir location. (-nodebuglogfile to disable; default: %s)", DEFAULT_DEBUGLOGFILE), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER), true, OptionsCategory::OPTIONS);
     gArgs.AddArg("-includeconf=<file>", "Specify additional configuration file, relative to the -datadir path (only useable from configuration file, not command line)", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-loadblock=<file>", "Imports blocks from external blk000??.dat file on startup", false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-loadsnapshot=<file>", "Load a UTXO set snapshot written by dumptxoutset on first startup and sync only the blocks above its base block (see -assumeutxo). Relative paths will be prefixed by datadir location", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-maxmempool=<n>", strprintf("Keep the transaction memory pool below <n> megabytes (default: %u)", DEFAULT_MAX_MEMPOOL_SIZE), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-maxorphantx=<n>", strprintf("Keep at most <n> unconnectable transactions in memory (default: %u)", DEFAULT_MAX_ORPHAN_TRANSACTIONS), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-mempoolexpiry=<n>", strprintf("Do not keep transactions in the mempool longer than <n> hours (default: %u)", DEFAULT_MEMPOOL_EXPIRY), false, OptionsCategory::OPTIONS);
@@ -381,6 +400,8 @@ void SetupServerArgs()
 #else
     hidden_args.emplace_back("-pid");
 #endif
+    gArgs.AddArg("-prefetchthreads=<n>", strprintf("Set the number of threads reading the inputs of a block from the chainstate before it is connected (0 to %d, 0 = disabled, default: %d)",
+        MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-prune=<n>", strprintf("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >=%u = automatically prune block files to stay under the specified target size in MiB)", MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024), false, OptionsCategory::OPTIONS);
@@ -392,6 +413,7 @@ void SetupServerArgs()
 #else
     hidden_args.emplace_back("-sysperms");
 #endif
+    gArgs.AddArg("-coinstatsindex", strprintf("Maintain the statistics of the UTXO set at every block, used by the gettxoutsetinfo rpc call for the muhash hash type and for past blocks (default: %u)", DEFAULT_COINSTATSINDEX), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-txindex", strprintf("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)", DEFAULT_TXINDEX), false, OptionsCategory::OPTIONS);
 
     gArgs.AddArg("-addnode=<ip>", "Add a node to connect to and attempt to keep the connection open (see the `addnode` RPC command help for more info). This option can be specified multiple times to add multiple nodes.", false, OptionsCategory::CONNECTION);
@@ -497,6 +519,8 @@ void SetupServerArgs()
     gArgs.AddArg("-blockmintxfee=<amt>", strprintf("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)", CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)), false, OptionsCategory::BLOCK_CREATION);
     gArgs.AddArg("-blockfeatures=<n>", "Override block features to test forking scenarios", true, OptionsCategory::BLOCK_CREATION);
     gArgs.AddArg("-blockmaxsize=<n>", strprintf("Set maximum block size in bytes (default: %d)", DEFAULT_BLOCK_MAX_SIZE), false, OptionsCategory::BLOCK_CREATION);
+    gArgs.AddArg("-incrementaltemplate", strprintf("Keep the transactions of the next block selected as the mempool changes, instead of selecting them from the whole mempool for every block template (default: %u)", DEFAULT_INCREMENTAL_TEMPLATE), false, OptionsCategory::BLOCK_CREATION);
+    gArgs.AddArg("-precomputetemplate", strprintf("Assemble and validate the candidate of the next block as soon as the tip changes. Requires -incrementaltemplate (default: %u)", DEFAULT_PRECOMPUTE_TEMPLATE), false, OptionsCategory::BLOCK_CREATION);
 
     gArgs.AddArg("-rest", strprintf("Accept public REST requests (default: %u)", DEFAULT_REST_ENABLE), false, OptionsCategory::RPC);
     gArgs.AddArg("-rpcallowip=<ip>", "Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times", false, OptionsCategory::RPC);
@@ -647,7 +671,55 @@ static void CleanupBlockRevFiles()
     }
 }
 
-static void ThreadImport(std::vector<fs::path> vImportFiles, bool fReloadxfield)
+/**
+ * Load the -loadsnapshot UTXO set once the header of its base block is known.
+ * Block download is held back by fSnapshotPending until this returns.
+ */
+static void ImportSnapshot(const fs::path& pathSnapshot)
+{
+    SnapshotMetadata metadata;
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() != 0) {
+            LogPrintf("Ignoring -loadsnapshot, the active chain is already beyond the genesis block\n");
+            return;
+        }
+    }
+    try {
+        CAutoFile afile(fsbridge::fopen(pathSnapshot, "rb"), SER_DISK, CLIENT_VERSION);
+        afile >> metadata;
+    } catch (const std::exception& e) {
+        InitError(strprintf(_("Unable to read UTXO snapshot %s: %s"), pathSnapshot.string(), e.what()));
+        StartShutdown();
+        return;
+    }
+
+    LogPrintf("Waiting for the header of UTXO snapshot base block %s...\n", metadata.base_blockhash.ToString());
+    while (!ShutdownRequested()) {
+        {
+            LOCK(cs_main);
+            if (LookupBlockIndex(metadata.base_blockhash)) break;
+        }
+        MilliSleep(500);
+    }
+    if (ShutdownRequested()) return;
+
+    std::string strError;
+    if (!ActivateSnapshot(pathSnapshot, metadata, strError)) {
+        InitError(strprintf(_("Unable to load UTXO snapshot %s: %s"), pathSnapshot.string(), strError));
+        StartShutdown();
+        return;
+    }
+
+    // connect any blocks above the base that arrived before the snapshot was loaded
+    CValidationState state;
+    if (!ActivateBestChain(state)) {
+        LogPrintf("Failed to connect best block (%s)\n", FormatStateMessage(state));
+        StartShutdown();
+    }
+}
+
+static void ThreadImport(std::vector<fs::path> vImportFiles, bool fReloadxfield, fs::path pathSnapshot)
 {
     RenameThread("bitcoin-loadblk");
     ScheduleBatchPriority();
@@ -730,6 +802,13 @@ static void ThreadImport(std::vector<fs::path> vImportFiles, bool fReloadxfield)
         return;
     }
     } // End scope of CImportingNow
+
+    // -loadsnapshot=
+    if (!pathSnapshot.empty()) {
+        ImportSnapshot(pathSnapshot);
+        fSnapshotPending = false;
+    }
+
     if (gArgs.GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         LoadMempool();
     }
@@ -962,6 +1041,18 @@ bool AppInitParameterInteraction()
     if (gArgs.GetArg("-prune", 0)) {
         if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX))
+            return InitError(_("Prune mode is incompatible with -coinstatsindex."));
+    }
+
+    // a snapshot chainstate has no blocks below its base to index or reindex from
+    if (gArgs.IsArgSet("-loadsnapshot")) {
+        if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX))
+            return InitError(_("-loadsnapshot is incompatible with -txindex."));
+        if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX))
+            return InitError(_("-loadsnapshot is incompatible with -coinstatsindex."));
+        if (gArgs.GetBoolArg("-reindex", false) || gArgs.GetBoolArg("-reindex-chainstate", false))
+            return InitError(_("-loadsnapshot is incompatible with -reindex and -reindex-chainstate."));
     }
 
     // -bind and -whitebind can't be set when not listening
@@ -1035,12 +1126,27 @@ bool AppInitParameterInteraction()
     fCheckBlockIndex = gArgs.GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = gArgs.GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
+    for (const std::string& strAssumeutxo : gArgs.GetArgs("-assumeutxo")) {
+        const size_t nSep = strAssumeutxo.find(':');
+        const std::string strBlockHash = strAssumeutxo.substr(0, nSep);
+        const std::string strHash = nSep == std::string::npos ? "" : strAssumeutxo.substr(nSep + 1);
+        if (strBlockHash.size() != 64 || !IsHex(strBlockHash) || strHash.size() != 64 || !IsHex(strHash))
+            return InitError(strprintf(_("Invalid -assumeutxo value: '%s'. Expected <blockhash>:<hash>"), strAssumeutxo));
+        UpdateAssumeutxoData(uint256S(strBlockHash), AssumeutxoData{uint256S(strHash)});
+        LogPrintf("Trusting UTXO snapshot of block %s with txoutset hash %s.\n", strBlockHash, strHash);
+    }
+
     hashAssumeValid = uint256S(gArgs.GetArg("-assumevalid", ""));
     if (!hashAssumeValid.IsNull())
         LogPrintf("Assuming ancestors of block %s have valid signatures.\n", hashAssumeValid.GetHex());
     else
         LogPrintf("Validating signatures for all blocks.\n");
 
+    hashAssumeValidProof = uint256S(gArgs.GetArg("-assumevalidproof", ""));
+    if (!hashAssumeValidProof.IsNull())
+        LogPrintf("Assuming ancestors of block %s have valid block proofs.\n", hashAssumeValidProof.GetHex());
+    nAssumeValidProofHeight = gArgs.GetArg("-assumevalidproofheight", -1);
+
     // mempool limits
     int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     int64_t nMempoolSizeMin = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
@@ -1065,6 +1171,30 @@ bool AppInitParameterInteraction()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    const std::string strBackend = gArgs.GetArg("-dbbackend", DEFAULT_DB_BACKEND);
+    if (std::find(DB_BACKENDS.begin(), DB_BACKENDS.end(), strBackend) == DB_BACKENDS.end()) {
+        return InitError(strprintf(_("Unknown database backend -dbbackend=%s (available: leveldb, memory)"), strBackend));
+    }
+    if (strBackend != DEFAULT_DB_BACKEND) {
+        // The block index starts empty, so block files left in the blocks
+        // directory would be overwritten from the first one on.
+        for (fs::directory_iterator it(GetBlocksDir()); it != fs::directory_iterator(); it++) {
+            const std::string filename = it->path().filename().string();
+            if (fs::is_regular_file(*it) && (filename.substr(0, 3) == "blk" || filename.substr(0, 3) == "rev")) {
+                return InitError(strprintf(_("The blocks directory %s is not empty. -dbbackend=%s needs an empty one (see -blocksdir)"), GetBlocksDir().string(), strBackend));
+            }
+        }
+        InitWarning(strprintf(_("The databases are kept in memory (-dbbackend=%s) and will be lost on shutdown"), strBackend));
+    }
+
+    for (const std::string& strProfile : gArgs.GetArgs("-dbprofile")) {
+        std::string name, error;
+        DBProfile profile;
+        if (!ParseDBProfileArg(strProfile, name, profile, error)) {
+            return InitError(error);
+        }
+    }
+
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = gArgs.GetArg("-prune", 0);
     if (nPruneArg < 0) {
@@ -1282,6 +1412,12 @@ bool AppInitMain()
         StartScriptCheckWorkerThreads(nScriptCheckThreads);
     }
 
+    const int nPrefetchThreads = std::clamp<int>(gArgs.GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS), 0, MAX_PREFETCH_THREADS);
+    LogPrintf("Using %u threads for reading block inputs\n", nPrefetchThreads);
+    if (nPrefetchThreads) {
+        StartCoinFetchWorkerThreads(nPrefetchThreads);
+    }
+
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = std::bind(&CScheduler::serviceQueue, &scheduler);
     scheduler.m_service_thread = std::thread(&TraceThread, "scheduler", serviceLoop);
@@ -1445,6 +1581,8 @@ bool AppInitMain()
     nTotalCache -= nBlockTreeDBCache;
     int64_t nTxIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxTxIndexCache << 20 : 0);
     nTotalCache -= nTxIndexCache;
+    int64_t nCoinStatsIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX) ? nMaxCoinStatsIndexCache << 20 : 0);
+    nTotalCache -= nCoinStatsIndexCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
@@ -1455,6 +1593,9 @@ bool AppInitMain()
     if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
         LogPrintf("* Using %.1fMiB for transaction index database\n", nTxIndexCache * (1.0 / 1024 / 1024));
     }
+    if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX)) {
+        LogPrintf("* Using %.1fMiB for coinstats index database\n", nCoinStatsIndexCache * (1.0 / 1024 / 1024));
+    }
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
 
@@ -1472,6 +1613,7 @@ bool AppInitMain()
             try {
                 UnloadBlockIndex();
                 pcoinsTip.reset();
+                pcoinsflush.reset();
                 pcoinsdbview.reset();
                 pcoinscatcher.reset();
                 // new CBlockTreeDB tries to delete the existing file, which
@@ -1505,7 +1647,24 @@ bool AppInitMain()
 
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
-                if (fHavePruned && !fPruneMode) {
+                // A snapshot load that did not complete leaves a partially written chainstate.
+                bool fSnapshotLoading = false;
+                pblocktree->ReadFlag(SNAPSHOT_LOADING_FLAG, fSnapshotLoading);
+                if (fSnapshotLoading) {
+                    strLoadError = _("Loading of a UTXO snapshot was interrupted. You need to rebuild the database using -reindex");
+                    break;
+                }
+                if (fSnapshotChainstate && gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+                    strLoadError = _("-txindex is not supported on a chainstate loaded from a UTXO snapshot. You need to rebuild the database using -reindex");
+                    break;
+                }
+                if (fSnapshotChainstate && gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX)) {
+                    strLoadError = _("-coinstatsindex is not supported on a chainstate loaded from a UTXO snapshot. You need to rebuild the database using -reindex");
+                    break;
+                }
+
+                // Blocks below the base of a snapshot chainstate are missing as if pruned.
+                if (fHavePruned && !fPruneMode && !fSnapshotChainstate) {
                     strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode.  This will redownload the entire blockchain");
                     break;
                 }
@@ -1527,7 +1686,8 @@ bool AppInitMain()
                 // block tree into mapBlockIndex!
 
                 pcoinsdbview.reset(new CCoinsViewDB(nCoinDBCache, false, fReset || fReindexChainState));
-                pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsdbview.get()));
+                pcoinsflush.reset(new CCoinsViewBackgroundFlush(pcoinsdbview.get()));
+                pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsflush.get()));
 
                 // Create the colorId state before ReplayBlocks so that DisconnectBlock
                 // inside the replay can stage erases that CommitToBatch writes atomically
@@ -1587,13 +1747,10 @@ bool AppInitMain()
                 // wiped by -reindex or -reindex-chainstate (both construct CCoinsViewDB with
                 // fWipe=true).  ConnectBlock then rebuilds both stores as blocks are reconnected.
                 // cs_main is already held by the outer LOCK.
-                {
-                    std::set<ColorIdentifier> colorIds;
-                    if (!pcoinsdbview->LoadIssuedColorIds(colorIds)) {
-                        strLoadError = _("Failed to load issued colorId set from chainstate database");
-                        break;
-                    }
-                    g_colorid_state->SetConfirmed(std::move(colorIds));
+                // Only a filter over the set is kept in memory; IsIssued looks up the database.
+                if (!pcoinsdbview->LoadIssuedColorIds(*g_colorid_state)) {
+                    strLoadError = _("Failed to load issued colorId set from chainstate database");
+                    break;
                 }
 
                 if (!is_coinsview_empty) {
@@ -1669,6 +1826,11 @@ bool AppInitMain()
         g_txindex->Start();
     }
 
+    if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX)) {
+        g_coinstatsindex = MakeUnique<CoinStatsIndex>(nCoinStatsIndexCache, false, fReindex);
+        g_coinstatsindex->Start();
+    }
+
     // ********************************************************* Step 9: load wallet
     if (!g_wallet_init_interface.Open()) return false;
 
@@ -1685,6 +1847,12 @@ bool AppInitMain()
         }
     }
 
+    // blocks below the base of a UTXO snapshot are never downloaded, so they cannot be served either
+    if (!fPruneMode && (fSnapshotChainstate || gArgs.IsArgSet("-loadsnapshot"))) {
+        LogPrintf("Unsetting NODE_NETWORK on UTXO snapshot chainstate\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    }
+
     // ********************************************************* Step 11: import blocks
 
     if (!CheckDiskSpace() && !CheckDiskSpace(0, true))
@@ -1706,7 +1874,13 @@ bool AppInitMain()
         vImportFiles.push_back(strFile);
     }
 
-    scheduler.m_load_block = std::thread(std::bind(&ThreadImport, vImportFiles, fReloadxfield));
+    fs::path pathSnapshot;
+    if (gArgs.IsArgSet("-loadsnapshot")) {
+        pathSnapshot = GetDataDir() / gArgs.GetArg("-loadsnapshot", "");
+        fSnapshotPending = true;
+    }
+
+    scheduler.m_load_block = std::thread(std::bind(&ThreadImport, vImportFiles, fReloadxfield, pathSnapshot));
 
     // Wait for genesis block to be processed
     {
@@ -1724,6 +1898,15 @@ bool AppInitMain()
         return false;
     }
 
+    if (gArgs.GetBoolArg("-incrementaltemplate", DEFAULT_INCREMENTAL_TEMPLATE)) {
+        g_template_builder = MakeUnique<BlockTemplateBuilder>(scheduler);
+        if (gArgs.GetBoolArg("-precomputetemplate", DEFAULT_PRECOMPUTE_TEMPLATE)) {
+            RegisterValidationInterface(g_template_builder.get());
+        }
+    } else if (gArgs.GetBoolArg("-precomputetemplate", DEFAULT_PRECOMPUTE_TEMPLATE)) {
+        return InitError(_("-precomputetemplate requires -incrementaltemplate."));
+    }
+
     // ********************************************************* Step 12: start node
 
     int chain_active_height;
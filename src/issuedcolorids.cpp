@@ -4,22 +4,88 @@
 
 #include <issuedcolorids.h>
 
+#include <crypto/common.h>
+#include <memusage.h>
+
 static const char DB_ISSUED_COLORID = 'I';
 
-void CIssuedColorIds::SetConfirmed(std::set<ColorIdentifier> ids)
+void CColorIdFilter::Insert(const ColorIdentifier& id)
+{
+    if (m_segments.empty() || m_segments.back().nInserted >= m_segments.back().nCapacity) {
+        Segment segment;
+        segment.nCapacity = m_segments.empty() ? INITIAL_CAPACITY : 2 * m_segments.back().nCapacity;
+        segment.nInserted = 0;
+        segment.bits.assign(segment.nCapacity * BITS_PER_ELEMENT / 64, 0);
+        m_segments.push_back(std::move(segment));
+    }
+    Segment& segment = m_segments.back();
+    const uint64_t nMask = segment.bits.size() * 64 - 1;
+    const uint64_t h1 = ReadLE64(id.payload) ^ TokenToUint(id.type);
+    const uint64_t h2 = ReadLE64(id.payload + 8) | 1;
+    for (unsigned int i = 0; i < HASH_FUNCS; i++) {
+        const uint64_t nBit = (h1 + i * h2) & nMask;
+        segment.bits[nBit >> 6] |= uint64_t{1} << (nBit & 63);
+    }
+    segment.nInserted++;
+}
+
+bool CColorIdFilter::MaybeContains(const ColorIdentifier& id) const
+{
+    const uint64_t h1 = ReadLE64(id.payload) ^ TokenToUint(id.type);
+    const uint64_t h2 = ReadLE64(id.payload + 8) | 1;
+    for (const Segment& segment : m_segments) {
+        const uint64_t nMask = segment.bits.size() * 64 - 1;
+        bool fFound = true;
+        for (unsigned int i = 0; i < HASH_FUNCS && fFound; i++) {
+            const uint64_t nBit = (h1 + i * h2) & nMask;
+            fFound = (segment.bits[nBit >> 6] >> (nBit & 63)) & 1;
+        }
+        if (fFound)
+            return true;
+    }
+    return false;
+}
+
+size_t CColorIdFilter::size() const
+{
+    size_t nSize = 0;
+    for (const Segment& segment : m_segments)
+        nSize += segment.nInserted;
+    return nSize;
+}
+
+size_t CColorIdFilter::DynamicMemoryUsage() const
+{
+    size_t nUsage = memusage::DynamicUsage(m_segments);
+    for (const Segment& segment : m_segments)
+        nUsage += memusage::DynamicUsage(segment.bits);
+    return nUsage;
+}
+
+void CIssuedColorIds::AddConfirmed(const ColorIdentifier& id)
 {
-    m_confirmed = std::move(ids);
+    m_filter.Insert(id);
 }
 
 bool CIssuedColorIds::IsIssued(const ColorIdentifier& id) const
 {
-    return m_confirmed.count(id) > 0;
+    if (m_pending.inserts.count(id))
+        return true;
+    if (m_pending.erases.count(id))
+        return false;
+    if (m_staged.inserts.count(id))
+        return true;
+    if (m_staged.erases.count(id))
+        return false;
+    if (!m_db || !m_filter.MaybeContains(id))
+        return false;
+    return m_db->Exists(std::make_pair(DB_ISSUED_COLORID, id.toVector()));
 }
 
 void CIssuedColorIds::Insert(const std::set<ColorIdentifier>& ids)
 {
     for (const auto& id : ids) {
-        m_confirmed.insert(id);
+        m_filter.Insert(id);
         m_pending.erases.erase(id);
         m_pending.inserts.insert(id);
     }
@@ -27,7 +93,6 @@ void CIssuedColorIds::Insert(const std::set<ColorIdentifier>& ids)
 
 void CIssuedColorIds::Erase(const ColorIdentifier& id)
 {
-    m_confirmed.erase(id);
     m_pending.inserts.erase(id);
     m_pending.erases.insert(id);
 }
@@ -35,15 +100,43 @@ void CIssuedColorIds::Erase(const ColorIdentifier& id)
 std::unique_ptr<CIssuedColorIds> CIssuedColorIds::Clone() const
 {
     auto clone = std::make_unique<CIssuedColorIds>();
-    clone->m_confirmed = m_confirmed;
+    clone->m_db = m_db;
+    clone->m_filter = m_filter;
+    clone->m_pending = m_pending;
+    clone->m_staged = m_staged;
     return clone;
 }
 
-void CIssuedColorIds::CommitToBatch(CDBBatch& batch)
+static void WriteChangeset(const std::set<ColorIdentifier>& inserts, const std::set<ColorIdentifier>& erases, CDBBatch& batch)
 {
-    for (const auto& id : m_pending.inserts)
+    for (const auto& id : inserts)
         batch.Write(std::make_pair(DB_ISSUED_COLORID, id.toVector()), true);
-    for (const auto& id : m_pending.erases)
+    for (const auto& id : erases)
         batch.Erase(std::make_pair(DB_ISSUED_COLORID, id.toVector()));
+}
+
+void CIssuedColorIds::CommitToBatch(CDBBatch& batch)
+{
+    // Any staged changes were written already, and pending ones take precedence.
+    WriteChangeset(m_pending.inserts, m_pending.erases, batch);
     m_pending.clear();
+    m_staged.clear();
+}
+
+void CIssuedColorIds::StageCommit()
+{
+    m_staged = std::move(m_pending);
+    m_pending.clear();
+}
+
+void CIssuedColorIds::CommitStagedToBatch(CDBBatch& batch) const
+{
+    WriteChangeset(m_staged.inserts, m_staged.erases, batch);
+}
+
+size_t CIssuedColorIds::DynamicMemoryUsage() const
+{
+    return m_filter.DynamicMemoryUsage() +
+        memusage::DynamicUsage(m_pending.inserts) + memusage::DynamicUsage(m_pending.erases) +
+        memusage::DynamicUsage(m_staged.inserts) + memusage::DynamicUsage(m_staged.erases);
 }
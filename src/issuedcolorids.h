@@ -9,12 +9,50 @@
 #include <cs_main.h>
 #include <dbwrapper.h>
 
+#include <memory>
 #include <set>
+#include <vector>
+
+/**
+ * Bloom filter over colorIds, used to answer most IsIssued queries for
+ * colorIds that were never issued without a database lookup.
+ *
+ * Filters cannot be resized, so when the current segment reaches its
+ * capacity a segment twice as large is added and queries check all of them.
+ * The payload of a NON_REISSUABLE or NFT colorId is a SHA256 output, so the
+ * bit positions are taken from it directly instead of hashing it again.
+ */
+class CColorIdFilter
+{
+public:
+    void Insert(const ColorIdentifier& id);
+    /** False if id was never inserted; true if it was, or rarely if it was not. */
+    bool MaybeContains(const ColorIdentifier& id) const;
+    size_t size() const;
+    size_t DynamicMemoryUsage() const;
+
+private:
+    //! Filter bits per element at full capacity; with 11 bit positions per
+    //! element this gives a false positive rate below 0.05% per segment.
+    static const unsigned int BITS_PER_ELEMENT = 16;
+    static const unsigned int HASH_FUNCS = 11;
+    static const size_t INITIAL_CAPACITY = 1 << 16;
+
+    struct Segment {
+        std::vector<uint64_t> bits;
+        size_t nCapacity;
+        size_t nInserted;
+    };
+    std::vector<Segment> m_segments;
+};
 
 /**
  * Single source of truth for NON_REISSUABLE and NFT colorIds issued on-chain.
  *
- * Holds both the confirmed in-memory set and a Changeset that is written
+ * The confirmed colorIds live in the chainstate database ('I' records), which
+ * can hold millions of NFTs, so they are not kept in memory: a CColorIdFilter
+ * over all of them sits in front of a database lookup. Staged changes are
+ * kept in a Changeset that overrides the database until it is written
  * atomically with DB_BEST_BLOCK in CCoinsViewDB::BatchWrite.  This prevents
  * a crash between the colorId write and the UTXO flush from leaving the
  * chainstate database in a state where a block cannot be reconnected
@@ -24,28 +62,34 @@
  *   1. Constructed empty and connected to pcoinsdbview before ReplayBlocks,
  *      so DisconnectBlock inside ReplayBlocks can stage erases that
  *      CommitToBatch writes atomically with the replay's UTXO flush.
- *   2. SetConfirmed() is called after ReplayBlocks to populate the confirmed set.
+ *   2. CCoinsViewDB::LoadIssuedColorIds is called after ReplayBlocks to
+ *      populate the filter.
  *   3. Destroyed on shutdown after pcoinsdbview.
+ *
+ * Without a database (unit tests), all colorIds stay in the Changeset.
  */
 class CIssuedColorIds
 {
 public:
     CIssuedColorIds() = default;
 
-    /** Populate the confirmed set from ids loaded by the caller.  Call after ReplayBlocks. */
-    void SetConfirmed(std::set<ColorIdentifier> ids) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    /** Look up confirmed colorIds in db, which must outlive this object. */
+    void SetDB(const CDBWrapper* db) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { m_db = db; }
+
+    /** Add a colorId loaded from the database to the filter.  Call after ReplayBlocks. */
+    void AddConfirmed(const ColorIdentifier& id) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     /** True if colorId is confirmed on-chain.  All callers hold cs_main. */
     bool IsIssued(const ColorIdentifier& id) const EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     /**
-     * Stage inserts: update confirmed set immediately and queue DB writes.
+     * Stage inserts: visible to IsIssued immediately and queued as DB writes.
      * Called from ConnectBlock under cs_main.
      */
     void Insert(const std::set<ColorIdentifier>& ids) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     /**
-     * Stage an erase: update confirmed set immediately and queue DB erase.
+     * Stage an erase: visible to IsIssued immediately and queued as a DB erase.
      * Called from DisconnectBlock under cs_main.
      */
     void Erase(const ColorIdentifier& id) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
@@ -57,11 +101,35 @@ public:
      */
     void CommitToBatch(CDBBatch& batch) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
-    /** Return a copy with the same confirmed set but empty pending changes. */
+    /**
+     * Move the staged changes aside for a background write of the chainstate.
+     * They keep overriding the database for IsIssued until they are replaced
+     * by the next StageCommit or dropped by CommitToBatch.
+     */
+    void StageCommit() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /**
+     * Write the changes set aside by StageCommit to batch.  Runs on the flush
+     * thread without cs_main: the caller must not call StageCommit or
+     * CommitToBatch until the write has finished.
+     */
+    void CommitStagedToBatch(CDBBatch& batch) const;
+
+    /**
+     * Return a copy answering IsIssued the same way.  Staged changes are
+     * copied as well, as the database does not have them yet.
+     */
     std::unique_ptr<CIssuedColorIds> Clone() const EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+    /** Number of colorIds in the filter, including erased ones */
+    size_t FilterSize() const EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return m_filter.size(); }
+    size_t PendingInserts() const EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return m_pending.inserts.size(); }
+    size_t PendingErases() const EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return m_pending.erases.size(); }
+    size_t DynamicMemoryUsage() const EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 private:
-    std::set<ColorIdentifier> m_confirmed GUARDED_BY(cs_main);
+    const CDBWrapper* m_db GUARDED_BY(cs_main) = nullptr;
+    CColorIdFilter m_filter GUARDED_BY(cs_main);
 
     /**
      * Pending inserts and erases managed together: staging an insert
@@ -74,6 +142,9 @@ private:
         bool empty() const { return inserts.empty() && erases.empty(); }
         void clear()        { inserts.clear(); erases.clear(); }
     } m_pending GUARDED_BY(cs_main);
+
+    //! Changes being written by a background flush, see StageCommit.
+    Changeset m_staged;
 };
 
 #endif // BITCOIN_ISSUEDCOLORIDS_H
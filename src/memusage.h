@@ -6,6 +6,7 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include <indirectmap.h>
+#include <support/allocators/pool.h>
 
 #include <stdlib.h>
 
@@ -165,6 +166,19 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, typename E, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z, E, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>>& m)
+{
+    // Nodes live in the chunks of the pool. Blocks that were freed, or not
+    // handed out yet, are not charged: the map grows back into them before
+    // the pool takes more memory from the system. Each chunk is also tracked
+    // by a std::list node of three pointers. The bucket array is allocated
+    // separately.
+    const auto* pool_resource = m.get_allocator().resource();
+    size_t usage_chunks = (MallocUsage(pool_resource->ChunkSizeBytes()) + MallocUsage(sizeof(void*) * 3)) * pool_resource->NumAllocatedChunks() - pool_resource->UnusedBytes();
+    return usage_chunks + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -19,13 +19,16 @@
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <primitives/transaction.h>
+#include <scheduler.h>
 #include <script/standard.h>
 #include <util.h>
 #include <utilmoneystr.h>
 #include <validationinterface.h>
 
 #include <algorithm>
+#include <functional>
 #include <queue>
+#include <set>
 #include <utility>
 
 // Unconfirmed transactions in the memory pool often depend on other
@@ -36,6 +39,11 @@
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
+std::unique_ptr<BlockTemplateBuilder> g_template_builder;
+
+/** Transactions the builder keeps track of between two templates, beyond which it selects again */
+static const size_t MAX_TEMPLATE_PENDING_TXS = 10000;
+
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     int64_t nOldTime = pblock->nTime;
@@ -47,6 +55,17 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     return nNewTime - nOldTime;
 }
 
+/** Whether a coinbase paying to script is valid in any block that is valid with another coinbase:
+  * an uncolored standard script of one signature operation at most */
+static bool IsPlainCoinbaseScript(const CScript& script)
+{
+    std::vector<std::vector<unsigned char>> vSolutions;
+    txnouttype whichType;
+    if (!Solver(script, whichType, vSolutions))
+        return false;
+    return whichType == TX_PUBKEY || whichType == TX_PUBKEYHASH || whichType == TX_SCRIPTHASH;
+}
+
 BlockAssembler::Options::Options() {
     blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     nBlockMaxSize = DEFAULT_BLOCK_MAX_SIZE;
@@ -79,6 +98,11 @@ static BlockAssembler::Options DefaultOptions()
 
 BlockAssembler::BlockAssembler(const CChainParams& params) : BlockAssembler(params, DefaultOptions()) {}
 
+BlockAssembler::BlockAssembler(const CChainParams& params, BlockTemplateBuilder& builder) : BlockAssembler(params, DefaultOptions())
+{
+    m_builder = &builder;
+}
+
 void BlockAssembler::resetBlock()
 {
     inBlock.clear();
@@ -133,7 +157,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated, required_age_in_secs);
+    if (m_builder) {
+        addTemplateTxs(pindexPrev, required_age_in_secs);
+    } else {
+        addPackageTxs(nPackagesSelected, nDescendantsUpdated, required_age_in_secs);
+    }
 
     int64_t nTime1 = GetTimeMicros();
 
@@ -160,9 +188,16 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblock->proof.clear();
     pblocktemplate->vTxSigOpsCost[0] = GetLegacySigOpCount(*pblock->vtx[0]);
 
-    CValidationState state;
-    if (!TestBlockValidity(state, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    // Only the coinbase and the time differ from a template of the same transactions
+    // validated before, and a standard uncolored coinbase cannot make the block invalid
+    const bool fValidated = m_builder && m_builder->IsValidated(pindexPrev, *pblock) &&
+                            pblock->xfield.xfieldType == TAPYRUS_XFIELDTYPES::NONE && IsPlainCoinbaseScript(scriptPubKeyIn);
+    if (!fValidated) {
+        CValidationState state;
+        if (!TestBlockValidity(state, *pblock, pindexPrev, false, false)) {
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+        }
+        if (m_builder) m_builder->SetValidated(pindexPrev, *pblock);
     }
     int64_t nTime2 = GetTimeMicros();
 
@@ -427,6 +462,274 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
+void BlockAssembler::addTemplateTxs(const CBlockIndex* pindexPrev, int required_age_in_secs)
+{
+    for (CTxMemPool::txiter it : m_builder->GetTransactions(*this, pindexPrev, required_age_in_secs)) {
+        AddToBlock(it);
+    }
+}
+
+std::vector<CTxMemPool::txiter> BlockAssembler::SelectPackages(const CBlockIndex* pindexPrev)
+{
+    resetBlock();
+    pblocktemplate.reset(new CBlockTemplate());
+    pblock = &pblocktemplate->block;
+    nHeight = pindexPrev->nHeight + 1;
+    nLockTimeCutoff = pindexPrev->GetMedianTimePast();
+
+    int nPackagesSelected = 0;
+    int nDescendantsUpdated = 0;
+    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+
+    std::vector<CTxMemPool::txiter> selected;
+    selected.reserve(pblock->vtx.size());
+    for (const CTransactionRef& tx : pblock->vtx) {
+        selected.push_back(mempool.mapTx.find(tx->GetHashMalFix()));
+    }
+    return selected;
+}
+
+BlockTemplateBuilder::BlockTemplateBuilder(CScheduler& scheduler) : m_scheduler(scheduler)
+{
+    m_conn_added = mempool.NotifyEntryAdded.connect(std::bind(&BlockTemplateBuilder::MempoolEntryAdded, this, std::placeholders::_1));
+    m_conn_removed = mempool.NotifyEntryRemoved.connect(std::bind(&BlockTemplateBuilder::MempoolEntryRemoved, this, std::placeholders::_1, std::placeholders::_2));
+}
+
+BlockTemplateBuilder::~BlockTemplateBuilder()
+{
+    // Wait for a notification in progress
+    LOCK(mempool.cs);
+    m_conn_added.disconnect();
+    m_conn_removed.disconnect();
+}
+
+void BlockTemplateBuilder::UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload)
+{
+    if (fInitialDownload) return;
+
+    // Assembling the candidate holds cs_main for a whole TestBlockValidity.
+    // Skip tips that were already replaced, and run at most once per
+    // PRECOMPUTE_TEMPLATE_INTERVAL so that a burst of blocks does not keep
+    // the lock busy. A tip within the interval is left to a deferred run,
+    // which assembles on top of whatever the tip is by then.
+    {
+        LOCK(cs_main);
+        if (pindexNew != chainActive.Tip()) return;
+    }
+    if (m_precompute_scheduled) return;
+    const int64_t nWait = m_last_precompute + PRECOMPUTE_TEMPLATE_INTERVAL - GetTime();
+    if (nWait > 0) {
+        m_precompute_scheduled = true;
+        m_scheduler.scheduleFromNow([this] {
+            m_precompute_scheduled = false;
+            Precompute();
+        }, nWait * 1000);
+        return;
+    }
+    Precompute();
+}
+
+void BlockTemplateBuilder::Precompute()
+{
+    m_last_precompute = GetTime();
+
+    // Assembling the candidate validates its transactions on top of the tip
+    try {
+        int64_t nTimeStart = GetTimeMicros();
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params(), *this).CreateNewBlock(CScript() << OP_TRUE);
+        LogPrint(BCLog::BENCH, "BlockTemplateBuilder: precomputed a candidate of %u txs on top of %s: %.2fms\n",
+                 pblocktemplate->block.vtx.size() - 1, pblocktemplate->block.hashPrevBlock.ToString(), 0.001 * (GetTimeMicros() - nTimeStart));
+    } catch (const std::runtime_error& e) {
+        LogPrintf("%s: Failed to precompute the next block: %s\n", __func__, e.what());
+    }
+}
+
+bool BlockTemplateBuilder::IsValidated(const CBlockIndex* pindexPrev, const CBlock& block) const
+{
+    AssertLockHeld(mempool.cs);
+    if (pindexPrev != m_validated_prev || block.vtx.size() != m_validated_hashes.size() + 1) {
+        return false;
+    }
+    for (size_t i = 1; i < block.vtx.size(); ++i) {
+        if (block.vtx[i]->GetHash() != m_validated_hashes[i - 1]) return false;
+    }
+    return true;
+}
+
+void BlockTemplateBuilder::SetValidated(const CBlockIndex* pindexPrev, const CBlock& block)
+{
+    AssertLockHeld(mempool.cs);
+    m_validated_prev = pindexPrev;
+    m_validated_hashes.clear();
+    for (size_t i = 1; i < block.vtx.size(); ++i) {
+        m_validated_hashes.push_back(block.vtx[i]->GetHash());
+    }
+}
+
+void BlockTemplateBuilder::MempoolEntryAdded(CTransactionRef tx)
+{
+    AssertLockHeld(mempool.cs);
+    // The entry is not in mapTx yet, it is looked at when the next template is requested
+    if (m_stale) return;
+    if (m_added.size() >= MAX_TEMPLATE_PENDING_TXS) {
+        m_stale = true;
+        m_added.clear();
+        return;
+    }
+    m_added.push_back(tx->GetHashMalFix());
+}
+
+void BlockTemplateBuilder::MempoolEntryRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    AssertLockHeld(mempool.cs);
+    auto pos = m_positions.find(tx->GetHashMalFix());
+    if (pos != m_positions.end()) {
+        Entry& entry = m_entries[pos->second];
+        entry.fRemoved = true;
+        m_block_size -= entry.nSize;
+        m_block_sigops -= entry.nSigOpsCost;
+        m_positions.erase(pos);
+    }
+    // The room left may take transactions that were left out
+    if (!m_all_selected) {
+        m_stale = true;
+        m_added.clear();
+    }
+}
+
+void BlockTemplateBuilder::Rebuild(const BlockAssembler& assembler, const CBlockIndex* pindexPrev)
+{
+    BlockAssembler selector(assembler.chainparams);
+    selector.nBlockMaxSize = assembler.nBlockMaxSize;
+    selector.blockMinFeeRate = assembler.blockMinFeeRate;
+    const std::vector<CTxMemPool::txiter> selected = selector.SelectPackages(pindexPrev);
+
+    m_entries.clear();
+    m_positions.clear();
+    m_entries.reserve(selected.size());
+    for (CTxMemPool::txiter it : selected) {
+        const uint256& txid = it->GetTx().GetHashMalFix();
+        m_positions.emplace(txid, m_entries.size());
+        m_entries.push_back(Entry{txid, (uint64_t)it->GetTxSize(), it->GetSigOpCost(), false});
+    }
+    m_block_size = selector.nBlockSize;
+    m_block_sigops = selector.nBlockSigOpsCost;
+    m_added.clear();
+
+    m_prev = pindexPrev;
+    m_block_max_size = assembler.nBlockMaxSize;
+    m_min_fee_rate = assembler.blockMinFeeRate;
+    m_all_selected = m_entries.size() == mempool.mapTx.size();
+    m_stale = false;
+
+    LogPrint(BCLog::BENCH, "BlockTemplateBuilder: selected %u of %u mempool transactions on top of %s\n",
+             m_entries.size(), mempool.mapTx.size(), pindexPrev->GetBlockHash().ToString());
+}
+
+bool BlockTemplateBuilder::Append(const BlockAssembler& assembler, CTxMemPool::txiter it)
+{
+    for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it)) {
+        if (!m_positions.count(parent->GetTx().GetHashMalFix())) {
+            // Its fee may pay for ancestors that were left out
+            m_stale = true;
+            return false;
+        }
+    }
+
+    // With all its parents selected the transaction is a package of its own,
+    // and a full selection leaves it out for the same reasons
+    if (it->GetModifiedFee() < m_min_fee_rate.GetFee(it->GetTxSize()) ||
+        !IsFinalTx(it->GetTx(), assembler.nHeight, assembler.nLockTimeCutoff) ||
+        it->GetTx().HasWitness()) {
+        m_all_selected = false;
+        return true;
+    }
+
+    if (m_block_size + it->GetTxSize() >= m_block_max_size ||
+        m_block_sigops + it->GetSigOpCost() >= GetMaxBlockSigops()) {
+        // It may take the place of selected transactions of a lower feerate
+        m_stale = true;
+        return false;
+    }
+
+    const uint256& txid = it->GetTx().GetHashMalFix();
+    m_positions.emplace(txid, m_entries.size());
+    m_entries.push_back(Entry{txid, (uint64_t)it->GetTxSize(), it->GetSigOpCost(), false});
+    m_block_size += it->GetTxSize();
+    m_block_sigops += it->GetSigOpCost();
+    return true;
+}
+
+bool BlockTemplateBuilder::Collect(int required_age_in_secs, std::vector<CTxMemPool::txiter>& txs) const
+{
+    const int64_t current_time = GetTime();
+    std::set<uint256> setTooRecent;
+
+    txs.clear();
+    txs.reserve(m_positions.size());
+    for (const Entry& entry : m_entries) {
+        if (entry.fRemoved) continue;
+        CTxMemPool::txiter it = mempool.mapTx.find(entry.txid);
+        if (it == mempool.mapTx.end()) {
+            // Only when the mempool was cleared without notifying
+            return false;
+        }
+
+        // Skip transactions that are under X seconds in mempool, and their descendants
+        bool fTooRecent = required_age_in_secs && it->GetTime() > current_time - required_age_in_secs;
+        if (!fTooRecent && !setTooRecent.empty()) {
+            for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it)) {
+                if (setTooRecent.count(parent->GetTx().GetHashMalFix())) {
+                    fTooRecent = true;
+                    break;
+                }
+            }
+        }
+        if (fTooRecent) {
+            setTooRecent.insert(entry.txid);
+            continue;
+        }
+        txs.push_back(it);
+    }
+    return true;
+}
+
+std::vector<CTxMemPool::txiter> BlockTemplateBuilder::GetTransactions(const BlockAssembler& assembler, const CBlockIndex* pindexPrev, int required_age_in_secs)
+{
+    AssertLockHeld(mempool.cs);
+
+    // A reorg returns transactions to the mempool which selected ones may spend
+    if (m_stale || !m_prev || pindexPrev->GetAncestor(m_prev->nHeight) != m_prev ||
+        m_block_max_size != assembler.nBlockMaxSize || m_min_fee_rate != assembler.blockMinFeeRate) {
+        Rebuild(assembler, pindexPrev);
+    } else {
+        // Transactions confirmed by the blocks since m_prev have been removed already
+        m_prev = pindexPrev;
+        for (const uint256& txid : m_added) {
+            CTxMemPool::txiter it = mempool.mapTx.find(txid);
+            if (it == mempool.mapTx.end() || m_positions.count(txid)) continue;
+            if (!Append(assembler, it)) break;
+        }
+        m_added.clear();
+        if (m_stale) {
+            Rebuild(assembler, pindexPrev);
+        } else if (m_entries.size() > 2 * m_positions.size()) {
+            // Drop the entries of removed transactions
+            m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(), [](const Entry& entry) { return entry.fRemoved; }), m_entries.end());
+            for (size_t i = 0; i < m_entries.size(); ++i) {
+                m_positions[m_entries[i].txid] = i;
+            }
+        }
+    }
+
+    std::vector<CTxMemPool::txiter> txs;
+    if (!Collect(required_age_in_secs, txs)) {
+        Rebuild(assembler, pindexPrev);
+        Collect(required_age_in_secs, txs);
+    }
+    return txs;
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -10,19 +10,31 @@
 #include <primitives/block.h>
 #include <txmempool.h>
 #include <validation.h>
+#include <validationinterface.h>
 
 #include <stdint.h>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#include <boost/signals2/connection.hpp>
 
+class BlockTemplateBuilder;
 class CBlockIndex;
 class CChainParams;
+class CScheduler;
 class CScript;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -incrementaltemplate */
+static const bool DEFAULT_INCREMENTAL_TEMPLATE = true;
+/** Default for -precomputetemplate */
+static const bool DEFAULT_PRECOMPUTE_TEMPLATE = false;
+/** Minimum number of seconds between two precomputed candidates of the next block */
+static const int64_t PRECOMPUTE_TEMPLATE_INTERVAL = 5;
 
 struct CBlockTemplate
 {
@@ -147,6 +159,9 @@ private:
     int64_t nLockTimeCutoff;
     const CChainParams& chainparams;
 
+    // The builder keeping the transaction selection, if any
+    BlockTemplateBuilder* m_builder{nullptr};
+
 public:
     struct Options {
         Options();
@@ -156,11 +171,15 @@ public:
 
     explicit BlockAssembler(const CChainParams& params);
     BlockAssembler(const CChainParams& params, const Options& options);
+    /** Take the transactions from the selection kept by builder instead of the mempool */
+    BlockAssembler(const CChainParams& params, BlockTemplateBuilder& builder);
 
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, int required_age_in_secs=0, CXField* pXField = nullptr);
 
 private:
+    friend class BlockTemplateBuilder;
+
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
@@ -192,8 +211,116 @@ private:
       * state updated assuming given transactions are inBlock. Returns number
       * of updated descendants. */
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+
+    /** Add the transactions selected by m_builder, but those under required_age_in_secs in the mempool */
+    void addTemplateTxs(const CBlockIndex* pindexPrev, int required_age_in_secs) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    /** Select the transactions of a block on top of pindexPrev with addPackageTxs,
+      * and return them in block order */
+    std::vector<CTxMemPool::txiter> SelectPackages(const CBlockIndex* pindexPrev) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
 };
 
+/**
+ * Keeps the transactions of the next block selected while the mempool and
+ * the chain tip change, so that a block template does not have to walk the
+ * whole mempool by ancestor feerate every time it is requested.
+ *
+ * Transactions confirmed, conflicted or evicted are dropped from the
+ * selection as the mempool removes them. Transactions added to the mempool
+ * are appended when their in-mempool parents are all selected, they pay the
+ * block min fee rate and they fit. The selection is made again from the
+ * whole mempool only when a full selection could choose differently: after
+ * a reorg, when a new transaction does not fit or would pull in unselected
+ * ancestors, or when transactions leave the mempool while others are left
+ * out. Fee deltas of prioritisetransaction apply from the next full
+ * selection.
+ *
+ * The builder also remembers the last selection that passed
+ * TestBlockValidity, so that templates of the same transactions on top of
+ * the same block skip it. Registered as a validation interface
+ * (-precomputetemplate), it assembles and validates the candidate of the
+ * next block as soon as the tip changes, on the scheduler thread. Tips
+ * that arrive within PRECOMPUTE_TEMPLATE_INTERVAL seconds of the last
+ * candidate are coalesced: the candidate of the newest tip is computed
+ * once the interval expires. The signers' templates are then served
+ * without validation, and their proposals find the scripts in the script
+ * execution cache.
+ *
+ * The state is guarded by mempool.cs, which the mempool holds when it
+ * notifies the builder.
+ */
+class BlockTemplateBuilder final : public CValidationInterface
+{
+private:
+    struct Entry {
+        uint256 txid;
+        uint64_t nSize;
+        int32_t nSigOpsCost;
+        bool fRemoved;
+    };
+
+    boost::signals2::scoped_connection m_conn_added;
+    boost::signals2::scoped_connection m_conn_removed;
+
+    //! The block the selection is on top of
+    const CBlockIndex* m_prev GUARDED_BY(mempool.cs){nullptr};
+    //! The limits the selection was made with
+    unsigned int m_block_max_size GUARDED_BY(mempool.cs){0};
+    CFeeRate m_min_fee_rate GUARDED_BY(mempool.cs);
+    //! Selected transactions in block order, and the positions of those still selected
+    std::vector<Entry> m_entries GUARDED_BY(mempool.cs);
+    std::unordered_map<uint256, size_t, SaltedTxidHasher> m_positions GUARDED_BY(mempool.cs);
+    uint64_t m_block_size GUARDED_BY(mempool.cs){0};
+    int64_t m_block_sigops GUARDED_BY(mempool.cs){0};
+    //! Transactions added to the mempool since the selection was brought up to date
+    std::vector<uint256> m_added GUARDED_BY(mempool.cs);
+    //! Whether every transaction of the mempool is selected
+    bool m_all_selected GUARDED_BY(mempool.cs){false};
+    //! Whether the selection has to be made again from the whole mempool
+    bool m_stale GUARDED_BY(mempool.cs){true};
+    //! The last transactions that passed TestBlockValidity, and the block they were on top of.
+    //! Full hashes, as txids do not commit to the scriptSig.
+    const CBlockIndex* m_validated_prev GUARDED_BY(mempool.cs){nullptr};
+    std::vector<uint256> m_validated_hashes GUARDED_BY(mempool.cs);
+    //! Runs the deferred candidates
+    CScheduler& m_scheduler;
+    //! When the last candidate was precomputed, and whether one is scheduled.
+    //! Only used on the scheduler thread, which also delivers the notifications.
+    int64_t m_last_precompute{0};
+    bool m_precompute_scheduled{false};
+
+    void MempoolEntryAdded(CTransactionRef tx);
+    void MempoolEntryRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
+
+    /** Select the transactions from the whole mempool with the limits of assembler */
+    void Rebuild(const BlockAssembler& assembler, const CBlockIndex* pindexPrev) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    /** Append a transaction added to the mempool. Returns false if the selection became stale. */
+    bool Append(const BlockAssembler& assembler, CTxMemPool::txiter it) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    /** Collect the selected transactions. Returns false if one is missing from the mempool. */
+    bool Collect(int required_age_in_secs, std::vector<CTxMemPool::txiter>& txs) const EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    /** Assemble and validate the candidate of the next block on top of the tip */
+    void Precompute() LOCKS_EXCLUDED(cs_main);
+
+public:
+    explicit BlockTemplateBuilder(CScheduler& scheduler);
+    ~BlockTemplateBuilder();
+
+    /** Precompute the candidate of the next block */
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override;
+
+    /** Whether the transactions of block passed TestBlockValidity on top of pindexPrev */
+    bool IsValidated(const CBlockIndex* pindexPrev, const CBlock& block) const EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    /** Remember that the transactions of block passed TestBlockValidity on top of pindexPrev */
+    void SetValidated(const CBlockIndex* pindexPrev, const CBlock& block) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+
+    /** Bring the selection up to date with the mempool and the block pindexPrev, and
+      * return it in block order, without the transactions under required_age_in_secs
+      * in the mempool and their descendants */
+    std::vector<CTxMemPool::txiter> GetTransactions(const BlockAssembler& assembler, const CBlockIndex* pindexPrev, int required_age_in_secs) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+};
+
+/** The builder block templates are assembled from. May be null. */
+extern std::unique_ptr<BlockTemplateBuilder> g_template_builder;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
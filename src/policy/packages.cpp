@@ -12,6 +12,9 @@
 #include <uint256.h>
 #include <numeric>
 #include <net_processing.h>
+#include <util.h>
+
+#include <limits>
 
 
 bool CheckPackage(const Package& txns, CValidationState& state)
@@ -154,3 +157,212 @@ bool SubmitPackageToMempool(const Package& package,
 
     return success;
 }
+
+typedef std::vector<std::unique_ptr<CMempoolPendingTx>> PendingPackage;
+
+/**
+ * Validate the transactions of package in order against one view of the mempool and of the
+ * outputs of the transactions before them, up to the first one rejected, whose result is
+ * recorded. With pending, the transactions are kept in it without running their script checks.
+ */
+static bool ValidatePackageTxs(const Package& package, PackageValidationState& results,
+                               CTxMempoolAcceptanceOptions& opt, PendingPackage* pending) EXCLUSIVE_LOCKS_REQUIRED(cs_main, mempool.cs)
+{
+    CCoinsViewVirtualMemPool* virtualView = new CCoinsViewVirtualMemPool(pcoinsTip.get(), mempool);
+    delete opt.mempool_view;
+    opt.mempool_view = virtualView;
+
+    for (const auto& tx : package) {
+        std::unique_ptr<CMempoolPendingTx> pending_tx;
+        if (pending) pending_tx = MakeUnique<CMempoolPendingTx>();
+        opt.state = CValidationState();
+        opt.pending = pending_tx.get();
+        const bool accepted = AcceptToMemoryPool(tx, opt);
+        opt.pending = nullptr;
+        if (!accepted) {
+            opt.state.missingInputs = opt.missingInputs.size() > 0;
+            results.erase(tx->GetHashMalFix());
+            results.emplace(tx->GetHashMalFix(), opt.state);
+            return false;
+        }
+        virtualView->AddVirtualTx(*tx);
+        if (pending) pending->push_back(std::move(pending_tx));
+    }
+    return true;
+}
+
+/**
+ * Check the mempool limits for the package counted as one transaction, whose in-mempool
+ * ancestors are those of all its transactions. This overestimates the descendants of an
+ * ancestor of only some of the transactions.
+ */
+static bool CheckPackageLimits(const PendingPackage& pending, std::string& errString) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs)
+{
+    const uint64_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    const uint64_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+    const uint64_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    const uint64_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+
+    CTxMemPool::setEntries setAncestors;
+    uint64_t nPackageSize = 0;
+    for (const auto& pending_tx : pending) {
+        setAncestors.insert(pending_tx->setAncestors.begin(), pending_tx->setAncestors.end());
+        nPackageSize += pending_tx->entry->GetTxSize();
+    }
+
+    if (setAncestors.size() + pending.size() > nLimitAncestors) {
+        errString = strprintf("too many unconfirmed ancestors of package [limit: %u]", nLimitAncestors);
+        return false;
+    }
+    uint64_t nSizeWithAncestors = nPackageSize;
+    for (CTxMemPool::txiter it : setAncestors) {
+        nSizeWithAncestors += it->GetTxSize();
+        if (it->GetCountWithDescendants() + pending.size() > nLimitDescendants) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", it->GetTx().GetHashMalFix().ToString(), nLimitDescendants);
+            return false;
+        }
+        if (it->GetSizeWithDescendants() + nPackageSize > nLimitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", it->GetTx().GetHashMalFix().ToString(), nLimitDescendantSize);
+            return false;
+        }
+    }
+    if (nSizeWithAncestors > nLimitAncestorSize) {
+        errString = strprintf("exceeds ancestor size limit of package [limit: %u]", nLimitAncestorSize);
+        return false;
+    }
+    return true;
+}
+
+/** Reject the transactions of package that have no result of their own as a part of a rejected package. */
+static void RejectPackageTxs(const Package& package, PackageValidationState& results)
+{
+    for (const auto& tx : package) {
+        if (results.count(tx->GetHashMalFix())) continue;
+        CValidationState tx_state;
+        tx_state.Invalid(false, REJECT_PACKAGE_TX, "package-not-accepted");
+        results.emplace(tx->GetHashMalFix(), tx_state);
+    }
+}
+
+/** Run the script checks of all the pending transactions, in parallel if there are script check threads. */
+static bool RunPackageScriptChecks(PendingPackage& pending) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (!nScriptCheckThreads) {
+        for (const auto& pending_tx : pending) {
+            for (CScriptCheck& check : pending_tx->vChecks) {
+                if (!check()) return false;
+            }
+        }
+        return true;
+    }
+    CCheckQueueControl<CScriptCheck> control(g_chainstate.scriptcheckqueue.get());
+    for (const auto& pending_tx : pending) {
+        control.Add(std::move(pending_tx->vChecks));
+    }
+    return control.Wait();
+}
+
+bool SubmitPackageToMempoolAtomic(const Package& package,
+                                  CValidationState& state,
+                                  PackageValidationState& results,
+                                  CTxMempoolAcceptanceOptions& opt)
+{
+    assert(opt.flags != MempoolAcceptanceFlags::TEST_ONLY);
+    if(!CheckPackage(package, state))
+        return false;
+
+    {
+        LOCK2(::cs_main, mempool.cs);
+
+        PendingPackage pending;
+        bool valid = ValidatePackageTxs(package, results, opt, &pending);
+
+        CTxMemPool::setEntries allConflicting;
+        if (valid) {
+            std::string errString;
+            if (opt.flags != MempoolAcceptanceFlags::BYPASSS_LIMITS && !CheckPackageLimits(pending, errString)) {
+                RejectPackageTxs(package, results);
+                return state.DoS(0, false, REJECT_NONSTANDARD, "package-too-long-mempool-chain", false, errString);
+            }
+
+            // A transaction must not spend an output that another one in the package replaces
+            for (const auto& pending_tx : pending) {
+                allConflicting.insert(pending_tx->allConflicting.begin(), pending_tx->allConflicting.end());
+            }
+            for (const auto& pending_tx : pending) {
+                for (CTxMemPool::txiter it : pending_tx->setAncestors) {
+                    if (allConflicting.count(it)) {
+                        RejectPackageTxs(package, results);
+                        return state.DoS(10, false, REJECT_INVALID, "package-spends-conflicting-tx", false,
+                                         strprintf("%s spends conflicting transaction %s",
+                                                   pending_tx->entry->GetTx().GetHashMalFix().ToString(), it->GetTx().GetHashMalFix().ToString()));
+                    }
+                }
+            }
+        }
+
+        if (valid && !RunPackageScriptChecks(pending)) {
+            // Find the rejected transaction and its reason with the checks run one transaction at a time
+            const MempoolAcceptanceFlags flags = opt.flags;
+            opt.flags = MempoolAcceptanceFlags::TEST_ONLY;
+            if (ValidatePackageTxs(package, results, opt, nullptr)) {
+                LogPrintf("%s: script checks of the package failed only in parallel\n", __func__);
+            }
+            opt.flags = flags;
+            valid = false;
+        }
+
+        if (!valid) {
+            RejectPackageTxs(package, results);
+            return false;
+        }
+
+        for (size_t i = 0; i < package.size(); ++i) {
+            CacheScriptExecution(*package[i], pending[i]->tipScriptFlags);
+        }
+
+        for (CTxMemPool::txiter it : allConflicting) {
+            LogPrint(BCLog::MEMPOOL, "replacing tx %s in package submission\n", it->GetTx().GetHashMalFix().ToString());
+            opt.txnReplaced.push_back(it->GetSharedTx());
+        }
+        mempool.RemoveStaged(allConflicting, false, MemPoolRemovalReason::REPLACED);
+
+        // The package limits were checked as a whole, so the ancestors of each
+        // transaction, now including the package transactions before it, are not limited.
+        const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        for (size_t i = 0; i < package.size(); ++i) {
+            const CTxMemPoolEntry& entry = *pending[i]->entry;
+            CTxMemPool::setEntries setAncestors;
+            std::string dummy;
+            mempool.CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+            const bool validForFeeEstimation = pending[i]->validForFeeEstimation && mempool.HasNoInputsOf(*package[i]);
+            mempool.addUnchecked(package[i]->GetHashMalFix(), entry, setAncestors, validForFeeEstimation);
+        }
+
+        // Trimming the mempool must not leave a part of the package in it
+        if (opt.flags != MempoolAcceptanceFlags::BYPASSS_LIMITS) {
+            LimitMempoolSize(mempool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+            const bool trimmed = std::any_of(package.cbegin(), package.cend(),
+                                             [](const CTransactionRef& tx) { return !mempool.exists(tx->GetHashMalFix()); });
+            if (trimmed) {
+                for (const auto& tx : package) {
+                    if (mempool.exists(tx->GetHashMalFix())) mempool.removeRecursive(*tx, MemPoolRemovalReason::SIZELIMIT);
+                }
+                RejectPackageTxs(package, results);
+                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+            }
+        }
+
+        for (const auto& tx : package) {
+            GetMainSignals().TransactionAddedToMempool(tx);
+            results.emplace(tx->GetHashMalFix(), CValidationState());
+        }
+    }
+
+    if (g_connman) {
+        for (const auto& tx : package) {
+            RelayTransaction(*tx, g_connman.get());
+        }
+    }
+    return true;
+}
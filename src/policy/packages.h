@@ -57,6 +57,7 @@ void FilterMempoolDuplicates(const std::vector<CTransaction>& txns, Package& pac
  * earlier transactions in the package may already have been admitted. This is intentional:
  * packages are a submission convenience, not an all-or-nothing commit. Callers must
  * inspect per-transaction results to determine which transactions were admitted.
+ * SubmitPackageToMempoolAtomic admits all the transactions or none.
  *
  * @param package The package of transactions to be submitted.
  * @param state A reference to the validation state that tracks the package validation results.
@@ -69,6 +70,31 @@ bool SubmitPackageToMempool(const Package& package,
                                   PackageValidationState& results,
                                   CTxMempoolAcceptanceOptions& opt);
 
+/**
+ * SubmitPackageToMempoolAtomic submits the package to mempool as a whole: either all of its
+ * transactions are added or none is.
+ *
+ * The transactions are validated in package order against one view of the mempool and of
+ * the outputs of the package transactions before them. The ancestor and descendant limits
+ * are checked for the package as a unit, with the in-mempool ancestors of all its
+ * transactions. The script checks of all the transactions run in parallel on the script
+ * check queue, and the package is added to the mempool in a single critical section.
+ *
+ * Validation stops at the first transaction rejected, which gets its own result; the other
+ * transactions are rejected with "package-not-accepted". Rejections of the package as a
+ * whole are recorded in state.
+ *
+ * @param package The package of transactions to be submitted.
+ * @param state A reference to the validation state that tracks the package validation results.
+ * @param results A reference to the package validation state that records the validation outcome of each transaction.
+ * @param opt Options that control how the mempool accepts transactions. TEST_ONLY is not supported.
+ * @return True if the package was added to the mempool, false otherwise.
+ */
+bool SubmitPackageToMempoolAtomic(const Package& package,
+                                  CValidationState& state,
+                                  PackageValidationState& results,
+                                  CTxMempoolAcceptanceOptions& opt);
+
 /**
  * ArePackageTransactionsAccepted checks the result of a package submit attempt and
  * tells whether all the transactions in the package were accepted.
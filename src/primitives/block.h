@@ -114,6 +114,8 @@ public:
 
     // memory only
     mutable bool fChecked;
+    mutable bool fCheckedMerkleRoot;
+    mutable bool fCheckedTransactions;
 
     CBlock()
     {
@@ -139,6 +141,8 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         fChecked = false;
+        fCheckedMerkleRoot = false;
+        fCheckedTransactions = false;
     }
 
     CBlockHeader GetBlockHeader() const
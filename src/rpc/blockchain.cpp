@@ -13,10 +13,12 @@
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <coins.h>
+#include <coinstats.h>
 #include <consensus/validation.h>
 #include <validation.h>
 #include <blockprune.h>
 #include <core_io.h>
+#include <index/coinstatsindex.h>
 #include <index/txindex.h>
 #include <key_io.h>
 #include <policy/feerate.h>
@@ -81,8 +83,9 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.pushKV("time", (int64_t)blockindex->nTime);
     result.pushKV("mediantime", (int64_t)blockindex->GetMedianTimePast());
     result.pushKV("nTx", (uint64_t)blockindex->nTx);
-    result.pushKV("xfield", blockindex->xfield.ToString());
-    result.pushKV("proof", HexStr(blockindex->proof));
+    std::shared_ptr<const CBlockHeaderExtra> extra = blockindex->GetHeaderExtra();
+    result.pushKV("xfield", extra->xfield.ToString());
+    result.pushKV("proof", HexStr(extra->proof));
 
     if (blockindex->pprev)
         result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
@@ -123,8 +126,8 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.pushKV("tx", txs);
     result.pushKV("time", block.GetBlockTime());
     result.pushKV("mediantime", (int64_t)blockindex->GetMedianTimePast());
-    result.pushKV("xfield", blockindex->xfield.ToString());
-    result.pushKV("proof", HexStr(block.GetBlockHeader().proof));
+    result.pushKV("xfield", block.xfield.ToString());
+    result.pushKV("proof", HexStr(block.proof));
     result.pushKV("nTx", (uint64_t)blockindex->nTx);
 
     if (blockindex->pprev)
@@ -812,76 +815,6 @@ static UniValue getblock(const JSONRPCRequest& request)
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    TxColoredCoinBalancesMap mTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0){ mTotalAmount[ColorIdentifier()] = 0; }
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
-{
-    assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + (outputs.begin()->second.fCoinBase ? 1u : 0u));
-    stats.nTransactions++;
-    for (const auto& output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.out.scriptPubKey;
-        ss << VARINT_MODE(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
-        stats.nTransactionOutputs++;
-        stats.mTotalAmount[GetColorIdFromScript(output.second.out.scriptPubKey)] += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
-    }
-    ss << VARINT(0u);
-}
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
-{
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hashMalFix != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hashMalFix;
-            outputs.emplace(key.n, coin);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
-    return true;
-}
-
 static UniValue pruneblockchain(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -931,49 +864,207 @@ static UniValue pruneblockchain(const JSONRPCRequest& request)
     return UniValue(height);
 }
 
+/** Block of the active chain given by a hash_or_height argument. */
+static CBlockIndex* ParseHashOrHeight(const UniValue& param) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    CBlockIndex* pindex;
+    if (param.isNum()) {
+        const int height = param.get_int();
+        const int current_tip = chainActive.Height();
+        if (height < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d is negative", height));
+        }
+        if (height > current_tip) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d after current tip %d", height, current_tip));
+        }
+
+        pindex = chainActive[height];
+    } else {
+        const std::string strHash = param.get_str();
+        const uint256 hash(uint256S(strHash));
+        pindex = LookupBlockIndex(hash);
+        if (!pindex) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        }
+        if (!chainActive.Contains(pindex)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block is not in chain %s", FederationParams().NetworkIDString()));
+        }
+    }
+
+    assert(pindex != nullptr);
+    return pindex;
+}
+
+static CoinStatsHashType ParseHashType(const std::string& hash_type_input)
+{
+    if (hash_type_input == "hash_serialized_3") {
+        return CoinStatsHashType::HASH_SERIALIZED;
+    } else if (hash_type_input == "muhash") {
+        return CoinStatsHashType::MUHASH;
+    } else if (hash_type_input == "none") {
+        return CoinStatsHashType::NONE;
+    }
+    throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("%s is not a valid hash_type", hash_type_input));
+}
+
 static UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" hash_or_height )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time without -coinstatsindex.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"          (string, optional, default=hash_serialized_3) Which UTXO set hash should be calculated. Options: 'hash_serialized_3' (the legacy algorithm), 'muhash', 'none'.\n"
+            "2. hash_or_height       (string or numeric, optional) The block hash or height of the target block (only available with -coinstatsindex, not for hash_serialized_3)\n"
             "\nResult:\n"
             "{\n"
-            "  \"height\":n,     (numeric) The current block height (index)\n"
-            "  \"bestblock\": \"hex\",   (string) The hash of the block at the tip of the chain\n"
-            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs\n"
+            "  \"height\":n,     (numeric) The block height (index) of the returned statistics\n"
+            "  \"bestblock\": \"hex\",   (string) The hash of the block at which these statistics are calculated\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs (not available when coinstatsindex is used)\n"
             "  \"txouts\": n,            (numeric) The number of unspent transaction outputs\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_3\": \"hash\", (string) The serialized hash\n"
-            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
+            "  \"hash_serialized_3\": \"hash\", (string) The serialized hash (only present if 'hash_serialized_3' hash_type is chosen)\n"
+            "  \"muhash\": \"hash\",       (string) The MuHash3072 of the UTXO set (only present if 'muhash' hash_type is chosen)\n"
+            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk (not available when coinstatsindex is used)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"none\"")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\" 1000")
+            + HelpExampleCli("gettxoutsetinfo", "\"none\" '\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"'")
             + HelpExampleRpc("gettxoutsetinfo", "")
+            + HelpExampleRpc("gettxoutsetinfo", "\"muhash\", 1000")
         );
 
     UniValue ret(UniValue::VOBJ);
 
+    const CoinStatsHashType hash_type = request.params[0].isNull() ? CoinStatsHashType::HASH_SERIALIZED : ParseHashType(request.params[0].get_str());
+
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
-        ret.pushKV("height", (int64_t)stats.nHeight);
-        ret.pushKV("bestblock", stats.hashBlock.GetHex());
+    bool index_used = false;
+    if (!request.params[1].isNull()) {
+        if (!g_coinstatsindex) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Querying specific block heights requires -coinstatsindex");
+        }
+        if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "hash_serialized_3 hash type cannot be queried for a specific block");
+        }
+        const CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = ParseHashOrHeight(request.params[1]);
+        }
+        g_coinstatsindex->BlockUntilSyncedToCurrentChain();
+        if (!g_coinstatsindex->LookUpStats(pindex, stats)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set statistics of the block, coinstatsindex may still be syncing");
+        }
+        index_used = true;
+    } else if (g_coinstatsindex && hash_type != CoinStatsHashType::HASH_SERIALIZED && g_coinstatsindex->BlockUntilSyncedToCurrentChain()) {
+        // The index can lag behind a block connected meanwhile; scan the set then.
+        const CBlockIndex* tip;
+        {
+            LOCK(cs_main);
+            tip = chainActive.Tip();
+        }
+        index_used = g_coinstatsindex->LookUpStats(tip, stats);
+    }
+
+    if (!index_used) {
+        FlushStateToDisk();
+        if (!GetUTXOStats(pcoinsdbview.get(), stats, hash_type)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        }
+    }
+
+    ret.pushKV("height", (int64_t)stats.nHeight);
+    ret.pushKV("bestblock", stats.hashBlock.GetHex());
+    if (!index_used) {
         ret.pushKV("transactions", (int64_t)stats.nTransactions);
-        ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
-        ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
+    }
+    ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
+    ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
+    if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
         ret.pushKV("hash_serialized_3", stats.hashSerialized.GetHex());
+    } else if (hash_type == CoinStatsHashType::MUHASH) {
+        ret.pushKV("muhash", stats.hashSerialized.GetHex());
+    }
+    if (!index_used) {
         ret.pushKV("disk_size", stats.nDiskSize);
+    }
 
-        UniValue amount(UniValue::VOBJ);
-        for(auto amountPair:stats.mTotalAmount)
-            amount.pushKV(amountPair.first.toHexString(), amountPair.first.type == TokenTypes::NONE ? ValueFromAmount(amountPair.second) : amountPair.second );
-        ret.pushKV("total_amount", amount);
-    } else {
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+    UniValue amount(UniValue::VOBJ);
+    for(auto amountPair:stats.mTotalAmount)
+        amount.pushKV(amountPair.first.toHexString(), amountPair.first.type == TokenTypes::NONE ? ValueFromAmount(amountPair.second) : amountPair.second );
+    ret.pushKV("total_amount", amount);
+    return ret;
+}
+
+static UniValue gettokensupply(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "gettokensupply \"color\" ( hash_or_height )\n"
+            "\nReturns the supply of a token in the unspent transaction output set. Requires -coinstatsindex.\n"
+            "\nArguments:\n"
+            "1. \"color\"              (string, required) The colorid of the token, or \"" + CURRENCY_UNIT + "\" for the native token\n"
+            "2. hash_or_height       (string or numeric, optional) The block hash or height of the target block (default: the chain tip)\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"color\": \"hex\",          (string) The colorid of the token, or " + CURRENCY_UNIT + "\n"
+            "  \"height\": n,             (numeric) The height of the block\n"
+            "  \"bestblock\": \"hex\",      (string) The hash of the block\n"
+            "  \"supply\": x,             (numeric) The amount of the token in unspent outputs after the block\n"
+            "  \"utxos\": n,              (numeric) The number of unspent outputs of the token after the block\n"
+            "  \"block_change\": x,       (numeric) The net amount issued (positive) or burned (negative) by the block\n"
+            "  \"block_utxo_change\": n   (numeric) The net change of the number of unspent outputs of the token by the block\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gettokensupply", "\"c11863143c14ca3e2c6a8bdd03b4f7d48ee41da7e3aed5c4baa3a3537a69a6ba7a\"")
+            + HelpExampleCli("gettokensupply", "\"" + CURRENCY_UNIT + "\" 1000")
+            + HelpExampleRpc("gettokensupply", "\"c11863143c14ca3e2c6a8bdd03b4f7d48ee41da7e3aed5c4baa3a3537a69a6ba7a\", 1000")
+        );
+
+    if (!g_coinstatsindex) {
+        throw JSONRPCError(RPC_MISC_ERROR, "gettokensupply requires -coinstatsindex");
     }
+
+    ColorIdentifier colorId;
+    const std::string strColor = request.params[0].get_str();
+    if (strColor != CURRENCY_UNIT) {
+        const std::vector<unsigned char> vColorId(ParseHex(strColor));
+        if (!IsHex(strColor) || vColorId.size() != 33) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid color parameter.");
+        }
+        colorId = ColorIdentifier(vColorId);
+        if (colorId.type == TokenTypes::NONE) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid color parameter.");
+        }
+    }
+
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = request.params[1].isNull() ? chainActive.Tip() : ParseHashOrHeight(request.params[1]);
+    }
+    g_coinstatsindex->BlockUntilSyncedToCurrentChain();
+
+    CColorSupply supply;
+    CColorSupplyChange block_change;
+    if (!g_coinstatsindex->LookUpColorSupply(pindex, colorId, supply, block_change)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read the token supply of the block, coinstatsindex may still be syncing");
+    }
+
+    const bool fNative = colorId.type == TokenTypes::NONE;
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("color", colorId.toHexString());
+    ret.pushKV("height", pindex->nHeight);
+    ret.pushKV("bestblock", pindex->GetBlockHash().GetHex());
+    ret.pushKV("supply", fNative ? ValueFromAmount(supply.amount) : supply.amount);
+    ret.pushKV("utxos", supply.utxos);
+    ret.pushKV("block_change", fNative ? ValueFromAmount(block_change.amount) : block_change.amount);
+    ret.pushKV("block_utxo_change", block_change.utxos);
     return ret;
 }
 
@@ -1124,6 +1215,12 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "  \"prune_target_size\": xxxxxx,  (numeric) the target size used by pruning (only present if automatic pruning is enabled)\n"
             "  \"aggregatePubkeys\": {        (object) pairs of aggregate pubkey of the federation and block height where it is used to verify block proof\n"
             "  },\n"
+            "  \"coinsflush\": {              (object) background writes of the coins cache to the chainstate database\n"
+            "     \"in_progress\": xx,          (boolean) whether a write is in progress\n"
+            "     \"last_duration\": xxxxx,     (numeric) time the last finished write took, in milliseconds\n"
+            "     \"last_stall\": xxxxx,        (numeric) time block validation was blocked to start the last write, in milliseconds\n"
+            "     \"last_coins\": xxxxx,        (numeric) number of modified coins in the last write\n"
+            "  },\n"
             "  \"warnings\" : \"...\",           (string) any network and blockchain warnings.\n"
             "}\n"
             "\nExamples:\n"
@@ -1169,6 +1266,16 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
         obj.pushKV(GetXFieldNameForRpc(x), xfieldChanges);
     }
 
+    if (pcoinsflush) {
+        CCoinsViewBackgroundFlush::Stats stats = pcoinsflush->GetStats();
+        UniValue coinsflush(UniValue::VOBJ);
+        coinsflush.pushKV("in_progress",    stats.in_progress);
+        coinsflush.pushKV("last_duration",  stats.last_duration / 1000.0);
+        coinsflush.pushKV("last_stall",     stats.last_stall / 1000.0);
+        coinsflush.pushKV("last_coins",     stats.last_coins);
+        obj.pushKV("coinsflush", coinsflush);
+    }
+
     obj.pushKV("warnings", GetWarnings("statusbar"));
     return obj;
 }
@@ -1639,31 +1746,7 @@ static UniValue getblockstats(const JSONRPCRequest& request)
 
     LOCK(cs_main);
 
-    CBlockIndex* pindex;
-    if (request.params[0].isNum()) {
-        const int height = request.params[0].get_int();
-        const int current_tip = chainActive.Height();
-        if (height < 0) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d is negative", height));
-        }
-        if (height > current_tip) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d after current tip %d", height, current_tip));
-        }
-
-        pindex = chainActive[height];
-    } else {
-        const std::string strHash = request.params[0].get_str();
-        const uint256 hash(uint256S(strHash));
-        pindex = LookupBlockIndex(hash);
-        if (!pindex) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-        }
-        if (!chainActive.Contains(pindex)) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block is not in chain %s", FederationParams().NetworkIDString()));
-        }
-    }
-
-    assert(pindex != nullptr);
+    CBlockIndex* pindex = ParseHashOrHeight(request.params[0]);
 
     std::set<std::string> stats;
     if (!request.params[1].isNull()) {
@@ -2160,6 +2243,14 @@ static void CreateUTXOSnapshot(
     std::unique_ptr<CCoinsViewCursor> pcursor;
     const CBlockIndex* tip;
     CCoinsStats maybe_stats;
+    // When the coinstats index has the tip, the number of coins for the
+    // metadata is known up front and the txoutset hash is computed while the
+    // coins are written, in a single pass over the UTXO set.
+    bool fHashWhileWriting = false;
+
+    if (g_coinstatsindex) {
+        g_coinstatsindex->BlockUntilSyncedToCurrentChain();
+    }
 
     {
         // We need to lock cs_main to ensure that the coinsdb isn't written to
@@ -2178,13 +2269,17 @@ static void CreateUTXOSnapshot(
 
         FlushStateToDisk();
 
-        auto success = GetUTXOStats(pcoinsdbview.get(), maybe_stats);
-        if (!success) {
-            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
-        }
-
         pcursor = std::unique_ptr<CCoinsViewCursor>(pcoinsdbview.get()->Cursor());
-        tip = LookupBlockIndex(maybe_stats.hashBlock);
+        tip = LookupBlockIndex(pcursor->GetBestBlock());
+
+        fHashWhileWriting = g_coinstatsindex && g_coinstatsindex->LookUpStats(tip, maybe_stats);
+        if (!fHashWhileWriting) {
+            maybe_stats = CCoinsStats();
+            auto success = GetUTXOStats(pcoinsdbview.get(), maybe_stats);
+            if (!success) {
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+            }
+        }
     }
 
     LogPrint(BCLog::RPC, "writing UTXO snapshot at height %d (%s) to file %s (via %s)\n",
@@ -2200,7 +2295,10 @@ static void CreateUTXOSnapshot(
     unsigned int iter{0};
     uint256 last_hash;
     size_t written_coins_count{0};
-    std::vector<std::pair<uint32_t, Coin>> coins;
+    std::map<uint32_t, Coin> coins;
+    CCoinsStats hash_stats;
+    CHashWriter hash_writer(SER_GETHASH, PROTOCOL_VERSION);
+    hash_writer << tip->GetBlockHash();
 
     // To reduce space the serialization format of the snapshot avoids
     // duplication of tx hashes. The code takes advantage of the guarantee by
@@ -2209,7 +2307,10 @@ static void CreateUTXOSnapshot(
     // (key.hash) and when we have them all (key.hash != last_hash) we write
     // them to file using the below lambda function.
     // See also https://github.com/bitcoin/bitcoin/issues/25675
-    auto write_coins_to_file = [&](CAutoFile& afile, const uint256& last_hash, const std::vector<std::pair<uint32_t, Coin>>& coins, size_t& written_coins_count) {
+    auto write_coins_to_file = [&](CAutoFile& afile, const uint256& last_hash, const std::map<uint32_t, Coin>& coins, size_t& written_coins_count) {
+        if (fHashWhileWriting && !coins.empty()) {
+            ApplyStats(hash_stats, hash_writer, last_hash, coins);
+        }
         afile << last_hash;
         WriteCompactSize(afile, coins.size());
         for (const auto& [n, coin] : coins) {
@@ -2227,7 +2328,7 @@ static void CreateUTXOSnapshot(
                 last_hash = key.hashMalFix;
                 coins.clear();
             }
-            coins.emplace_back(key.n, coin);
+            coins.emplace(key.n, coin);
         }
         pcursor->Next();
     }
@@ -2236,6 +2337,13 @@ static void CreateUTXOSnapshot(
         write_coins_to_file(afile, last_hash, coins, written_coins_count);
     }
 
+    if (fHashWhileWriting) {
+        if (written_coins_count != maybe_stats.nTransactionOutputs) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Number of coins written does not match the coinstats index");
+        }
+        maybe_stats.hashSerialized = hash_writer.GetHash();
+    }
+
     result.pushKV("base_hash", tip->GetBlockHash().ToString());
     result.pushKV("base_height", tip->nHeight);
     result.pushKV("nchaintx", tip->nChainTx);
@@ -2245,28 +2353,11 @@ static void CreateUTXOSnapshot(
 }
 
 /**
- * Serialize the UTXO set to a file for loading elsewhere.
- *
- * @see SnapshotMetadata
+ * Resolve the dumptxoutset path argument inside datadir.
+ * Reject absolute paths and anything that would end up outside datadir.
  */
-static UniValue dumptxoutset(const JSONRPCRequest& request)
+static fs::path GetSnapshotPath(const std::string& path_name)
 {
-    if (request.fHelp || request.params.size() != 1)
-        throw std::runtime_error(
-        "dumptxoutset \"path\""
-        "Write the serialized UTXO set to disk."
-        "\nArguments:\n"
-            "1. path     -   Path to the output file. If relative, will be prefixed by datadir.\n"
-         "\nResult:\n"
-                "coins_written  - the number of coins written in the snapshot\n"
-                "base_hash  -  the hash of the base of the snapshot\n"
-                "base_height  - the height of the base of the snapshot\n"
-                "path  - the absolute path that the snapshot was written to\n"
-                "txoutset_hash  - the hash of the UTXO set contents\n"
-                "nchaintx  - the number of transactions in the chain up to and including the base block\n");
-
-    const std::string path_name = request.params[0].get_str();
-    // Reject absolute paths and any component that would traverse above datadir.
     {
         const fs::path rel(path_name);
         if (rel.is_absolute()) {
@@ -2296,14 +2387,323 @@ static UniValue dumptxoutset(const JSONRPCRequest& request)
             }
         }
     }
+    return path;
+}
+
+/** Upper bound on the chunks of a parallel dumptxoutset; chunks split the txid space by its first byte. */
+static constexpr int MAX_TXOUTSET_DUMP_CHUNKS = 256;
+
+/** Path of chunk file i of the chunked snapshot with manifest path. */
+static fs::path TxOutSetDumpChunkPath(const fs::path& path, int i)
+{
+    return fs::path(strprintf("%s.%03d", path.string(), i));
+}
+
+/** First txid byte of chunk i of nChunks. */
+static unsigned int TxOutSetDumpChunkStart(int i, int nChunks)
+{
+    return (unsigned int)i * 256 / nChunks;
+}
+
+/** State of a background chunked dumptxoutset, reported by getdumptxoutsetinfo. */
+struct TxOutSetDump
+{
+    fs::path path;
+    int chunks{0};
+    int64_t nStartTime{0};
+    std::atomic<int64_t> nEndTime{0};
+    std::atomic<bool> in_progress{true};
+    std::atomic<bool> should_abort{false};
+    //! Per chunk, how much of its txid range has been written, in 1/65536 of the txid space
+    std::unique_ptr<std::atomic<uint32_t>[]> progress;
+    Mutex cs;
+    std::string error GUARDED_BY(cs);
+    UniValue result GUARDED_BY(cs);
+    std::thread thread;
+};
+
+static Mutex g_txoutset_dump_mutex;
+static std::unique_ptr<TxOutSetDump> g_txoutset_dump GUARDED_BY(g_txoutset_dump_mutex);
+
+/**
+ * Write the chunk files and the manifest of a chunked snapshot. Chunks are
+ * written by up to one thread per core; the txoutset hash, being a single
+ * sequential stream, is computed by this thread meanwhile.
+ */
+static void DumpTxOutSetChunks(TxOutSetDump* dump, std::vector<std::unique_ptr<CCoinsViewCursor>> cursors,
+                               std::unique_ptr<CCoinsViewCursor> stats_cursor, const CBlockIndex* tip)
+{
+    RenameThread("bitcoin-dumptxout");
+    const int nChunks = dump->chunks;
+    const fs::path dir = dump->path.parent_path();
+    std::vector<SnapshotChunk> chunks(nChunks);
+    std::vector<std::string> errors(nChunks);
+    std::atomic<int> next_chunk{0};
+
+    auto write_chunks = [&]() {
+        int i;
+        while ((i = next_chunk++) < nChunks && !dump->should_abort) {
+            const unsigned int nStart = TxOutSetDumpChunkStart(i, nChunks);
+            const unsigned int nEnd = TxOutSetDumpChunkStart(i + 1, nChunks);
+            chunks[i].filename = TxOutSetDumpChunkPath(dump->path, i).filename().string();
+            bool fWritten = WriteSnapshotChunk(*cursors[i], nEnd, dir / chunks[i].filename, chunks[i],
+                [&](const uint256& txid) {
+                    dump->progress[i] = 0x100 * (*txid.begin() - nStart) + *(txid.begin() + 1);
+                    return !dump->should_abort;
+                }, errors[i]);
+            cursors[i].reset();
+            if (!fWritten) {
+                dump->should_abort = true;
+                return;
+            }
+            dump->progress[i] = 0x100 * (nEnd - nStart);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    const int nThreads = std::min(nChunks, std::max(1, GetNumCores()));
+    for (int i = 0; i < nThreads; ++i) {
+        threads.emplace_back(write_chunks);
+    }
+    CCoinsStats stats;
+    const bool fStats = GetUTXOStats(stats_cursor.get(), stats, &dump->should_abort);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    std::string strError;
+    for (const std::string& error : errors) {
+        if (!error.empty()) {
+            strError = error;
+            break;
+        }
+    }
+    if (strError.empty() && !fStats) {
+        strError = dump->should_abort ? "Aborted" : "Unable to read UTXO set";
+    }
+    uint64_t coins_written = 0;
+    for (const SnapshotChunk& chunk : chunks) {
+        coins_written += chunk.coins_count;
+    }
+    if (strError.empty() && coins_written != stats.nTransactionOutputs) {
+        strError = "Number of coins written does not match the UTXO set";
+    }
+
+    const fs::path temppath = fs::path(dump->path.string() + ".incomplete");
+    if (strError.empty()) {
+        SnapshotMetadata metadata{tip->GetBlockHash(), coins_written, SnapshotMetadata::CHUNKED_VERSION};
+        CAutoFile afile{fsbridge::fopen(temppath, "wb"), SER_DISK, CLIENT_VERSION};
+        try {
+            if (afile.IsNull()) {
+                throw std::ios_base::failure("Couldn't open file temp file for writing.");
+            }
+            afile << metadata;
+            afile << chunks;
+            afile.fclose();
+            fs::rename(temppath, dump->path);
+        } catch (const std::exception& e) {
+            strError = strprintf("Failed to write manifest: %s", e.what());
+        }
+    }
+
+    UniValue result(UniValue::VOBJ);
+    if (strError.empty()) {
+        LogPrint(BCLog::RPC, "wrote UTXO snapshot at height %d (%s) to %d chunks with manifest %s\n",
+            tip->nHeight, tip->GetBlockHash().ToString(), nChunks, dump->path.string());
+        UniValue chunk_list(UniValue::VARR);
+        for (const SnapshotChunk& chunk : chunks) {
+            UniValue entry(UniValue::VOBJ);
+            entry.pushKV("file", chunk.filename);
+            entry.pushKV("coins", chunk.coins_count);
+            entry.pushKV("sha256", chunk.checksum.GetHex());
+            chunk_list.push_back(entry);
+        }
+        result.pushKV("path", dump->path.string());
+        result.pushKV("base_hash", tip->GetBlockHash().ToString());
+        result.pushKV("base_height", tip->nHeight);
+        result.pushKV("nchaintx", tip->nChainTx);
+        result.pushKV("coins_written", coins_written);
+        result.pushKV("txoutset_hash", stats.hashSerialized.ToString());
+        result.pushKV("chunks", chunk_list);
+    } else {
+        LogPrintf("dumptxoutset to %s failed: %s\n", dump->path.string(), strError);
+        fs::remove(temppath);
+        for (const SnapshotChunk& chunk : chunks) {
+            if (!chunk.filename.empty()) fs::remove(dir / chunk.filename);
+        }
+    }
+
+    {
+        LOCK(dump->cs);
+        dump->error = strError;
+        dump->result = result;
+    }
+    dump->nEndTime = GetTime();
+    dump->in_progress = false;
+}
+
+/** Start writing a chunked snapshot in the background. */
+static UniValue StartTxOutSetDump(const fs::path& path, int nChunks)
+{
+    LOCK(g_txoutset_dump_mutex);
+    if (g_txoutset_dump && g_txoutset_dump->in_progress) {
+        throw JSONRPCError(RPC_MISC_ERROR, "A dumptxoutset is already in progress, see getdumptxoutsetinfo");
+    }
+    if (g_txoutset_dump) {
+        g_txoutset_dump->thread.join();
+    }
+
+    auto dump = MakeUnique<TxOutSetDump>();
+    dump->path = path;
+    dump->chunks = nChunks;
+    dump->nStartTime = GetTime();
+    dump->progress.reset(new std::atomic<uint32_t>[nChunks]);
+    for (int i = 0; i < nChunks; ++i) {
+        dump->progress[i] = 0;
+    }
+
+    std::vector<std::unique_ptr<CCoinsViewCursor>> cursors;
+    std::unique_ptr<CCoinsViewCursor> stats_cursor;
+    const CBlockIndex* tip;
+    {
+        // As in CreateUTXOSnapshot, flush and create all cursors under
+        // cs_main so that they iterate over the same state of the coinsdb.
+        LOCK(::cs_main);
+        FlushStateToDisk();
+        for (int i = 0; i < nChunks; ++i) {
+            uint256 start;
+            *start.begin() = TxOutSetDumpChunkStart(i, nChunks);
+            cursors.emplace_back(pcoinsdbview->Cursor(start));
+        }
+        stats_cursor.reset(pcoinsdbview->Cursor());
+        tip = LookupBlockIndex(stats_cursor->GetBestBlock());
+    }
+
+    LogPrint(BCLog::RPC, "writing UTXO snapshot at height %d (%s) to %d chunks with manifest %s\n",
+        tip->nHeight, tip->GetBlockHash().ToString(), nChunks, path.string());
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("path", path.string());
+    result.pushKV("chunks", nChunks);
+    result.pushKV("base_hash", tip->GetBlockHash().ToString());
+    result.pushKV("base_height", tip->nHeight);
+
+    dump->thread = std::thread(DumpTxOutSetChunks, dump.get(), std::move(cursors), std::move(stats_cursor), tip);
+    g_txoutset_dump = std::move(dump);
+    return result;
+}
+
+void StopTxOutSetDump()
+{
+    LOCK(g_txoutset_dump_mutex);
+    if (!g_txoutset_dump) return;
+    g_txoutset_dump->should_abort = true;
+    if (g_txoutset_dump->thread.joinable()) {
+        g_txoutset_dump->thread.join();
+    }
+    g_txoutset_dump.reset();
+}
+
+static UniValue getdumptxoutsetinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getdumptxoutsetinfo\n"
+            "\nReturns the status of the last chunked dumptxoutset, or null if none was started.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",      (string) The manifest path\n"
+            "  \"chunks\": n,         (numeric) The number of chunk files\n"
+            "  \"in_progress\": b,    (boolean) Whether the dump is still running\n"
+            "  \"progress\": n,       (numeric) Percentage of the UTXO set written\n"
+            "  \"elapsed\": n,        (numeric) Seconds since the dump was started, until it finished\n"
+            "  \"error\": \"msg\",      (string, optional) Why the dump failed\n"
+            "  \"result\": {...}      (object, optional) The dumptxoutset result once the dump succeeded,\n"
+            "                       with the file name, coin count and sha256 of each chunk in \"chunks\"\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdumptxoutsetinfo", "")
+            + HelpExampleRpc("getdumptxoutsetinfo", "")
+        );
+
+    LOCK(g_txoutset_dump_mutex);
+    if (!g_txoutset_dump) {
+        return NullUniValue;
+    }
+    TxOutSetDump& dump = *g_txoutset_dump;
+    const bool in_progress = dump.in_progress;
+    uint64_t nProgress = 0;
+    for (int i = 0; i < dump.chunks; ++i) {
+        nProgress += dump.progress[i];
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("path", dump.path.string());
+    ret.pushKV("chunks", dump.chunks);
+    ret.pushKV("in_progress", in_progress);
+    ret.pushKV("progress", (int)(nProgress * 100 / 65536));
+    ret.pushKV("elapsed", (in_progress ? GetTime() : dump.nEndTime.load()) - dump.nStartTime);
+    {
+        LOCK(dump.cs);
+        if (!dump.error.empty()) ret.pushKV("error", dump.error);
+        if (!dump.result.isNull()) ret.pushKV("result", dump.result);
+    }
+    return ret;
+}
+
+/**
+ * Serialize the UTXO set to a file for loading elsewhere.
+ *
+ * @see SnapshotMetadata
+ */
+static UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+        "dumptxoutset \"path\" ( chunks )"
+        "Write the serialized UTXO set to disk."
+        "\nArguments:\n"
+            "1. path     -   Path to the output file. If relative, will be prefixed by datadir.\n"
+            "2. chunks   -   (numeric, optional, default=1) Split the snapshot into this many chunk files (at most " + std::to_string(MAX_TXOUTSET_DUMP_CHUNKS) + ")\n"
+            "                written in parallel next to a manifest at path. The dump then runs in the background and\n"
+            "                this call returns immediately; use getdumptxoutsetinfo to follow it.\n"
+         "\nResult:\n"
+                "coins_written  - the number of coins written in the snapshot\n"
+                "base_hash  -  the hash of the base of the snapshot\n"
+                "base_height  - the height of the base of the snapshot\n"
+                "path  - the absolute path that the snapshot was written to\n"
+                "txoutset_hash  - the hash of the UTXO set contents\n"
+                "nchaintx  - the number of transactions in the chain up to and including the base block\n"
+         "\nResult (chunks > 1):\n"
+                "path  - the absolute path that the manifest will be written to\n"
+                "chunks  - the number of chunk files\n"
+                "base_hash  -  the hash of the base of the snapshot\n"
+                "base_height  - the height of the base of the snapshot\n");
+
+    const fs::path path = GetSnapshotPath(request.params[0].get_str());
+    const int nChunks = request.params[1].isNull() ? 1 : request.params[1].get_int();
+    if (nChunks < 1 || nChunks > MAX_TXOUTSET_DUMP_CHUNKS) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("chunks must be between 1 and %d", MAX_TXOUTSET_DUMP_CHUNKS));
+    }
     // Write to a temporary path and then move into `path` on completion
     // to avoid confusion due to an interruption.
     const fs::path temppath = fs::path(path.string() + ".incomplete");
 
-    if (fs::exists(path)) {
-        throw JSONRPCError(
-            RPC_INVALID_PARAMETER,
-            "path already exists. If you are sure this is what you want, move it out of the way first");
+    // Nothing is written unless the chunk files are new as well
+    std::vector<fs::path> paths{path};
+    for (int i = 0; nChunks > 1 && i < nChunks; ++i) {
+        paths.push_back(TxOutSetDumpChunkPath(path, i));
+    }
+    for (const fs::path& p : paths) {
+        if (fs::exists(p)) {
+            throw JSONRPCError(
+                RPC_INVALID_PARAMETER,
+                "path already exists. If you are sure this is what you want, move it out of the way first");
+        }
+    }
+
+    if (nChunks > 1) {
+        return StartTxOutSetDump(path, nChunks);
     }
 
     FILE* file{fsbridge::fopen(temppath, "wb")};
@@ -2326,6 +2726,52 @@ static UniValue dumptxoutset(const JSONRPCRequest& request)
     return result;
 }
 
+/**
+ * Load a serialized UTXO set from a file created by dumptxoutset.
+ *
+ * @see ActivateSnapshot
+ */
+static UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+        "loadtxoutset \"path\"\n"
+        "\nLoad a UTXO set snapshot written by dumptxoutset and make its base block the chain tip.\n"
+        "The active chain must still be at the genesis block, the header of the snapshot base block must be known\n"
+        "and the snapshot content hash must be trusted using -assumeutxo. Blocks below the base are not\n"
+        "downloaded or validated, so the node afterwards behaves like a pruned node for that part of the chain.\n"
+        "\nArguments:\n"
+            "1. path     -   Path to the snapshot file. If relative, will be prefixed by datadir.\n"
+        "\nResult:\n"
+                "coins_loaded  - the number of coins loaded from the snapshot\n"
+                "tip_hash  - the hash of the base of the snapshot, which is now the chain tip\n"
+                "base_height  - the height of the base of the snapshot\n"
+                "path  - the absolute path that the snapshot was loaded from\n"
+        "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\""));
+
+    const fs::path path = GetDataDir() / request.params[0].get_str();
+    if (!fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Snapshot file does not exist");
+    }
+
+    SnapshotMetadata metadata;
+    std::string strError;
+    if (!ActivateSnapshot(path, metadata, strError)) {
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    }
+
+    LOCK(cs_main);
+    const CBlockIndex* tip = chainActive.Tip();
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("coins_loaded", metadata.coins_count);
+    result.pushKV("tip_hash", tip->GetBlockHash().ToString());
+    result.pushKV("base_height", tip->nHeight);
+    result.pushKV("path", path.c_str());
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -2344,7 +2790,8 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type", "hash_or_height"} },
+    { "blockchain",         "gettokensupply",         &gettokensupply,         {"color", "hash_or_height"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
@@ -2352,7 +2799,9 @@ static const CRPCCommand commands[] =
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
     { "blockchain",         "scantxoutset",           &scantxoutset,           {"action", "scanobjects"} },
     { "blockchain",         "getcolor",                   &getcolor,               {"type","txid","index"} },
-    { "blockchain",         "dumptxoutset",           &dumptxoutset,               {"path"} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,               {"path","chunks"} },
+    { "blockchain",         "getdumptxoutsetinfo",    &getdumptxoutsetinfo,    {} },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,               {"path"} },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        {"blockhash"} },
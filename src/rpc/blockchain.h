@@ -35,6 +35,9 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 /** String name of Xfield in block header */
 std::string GetXFieldNameForRpc(TAPYRUS_XFIELDTYPES x);
 
+/** Abort a background dumptxoutset and wait for its threads to exit. */
+void StopTxOutSetDump();
+
 /** Used by getblockstats to get feerates at different percentiles by size  */
 void CalculatePercentilesBySize(CAmount result[NUM_GETBLOCKSTATS_PERCENTILES], std::vector<std::pair<CAmount, int64_t>>& scores, int64_t total_size);
 
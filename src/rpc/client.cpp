@@ -60,6 +60,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "sendmany", 3 , "replaceable" },
     { "sendmany", 4 , "conf_target" },
     { "scantxoutset", 1, "scanobjects" },
+    { "dumptxoutset", 1, "chunks" },
     { "addmultisigaddress", 0, "nrequired" },
     { "addmultisigaddress", 1, "keys" },
     { "createmultisig", 0, "nrequired" },
@@ -119,6 +120,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "verifychain", 1, "nblocks" },
     { "getblockstats", 0, "hash_or_height" },
     { "getblockstats", 1, "stats" },
+    { "gettxoutsetinfo", 1, "hash_or_height" },
+    { "gettokensupply", 1, "hash_or_height" },
     { "pruneblockchain", 0, "height" },
     { "keypoolrefill", 0, "newsize" },
     { "getrawmempool", 0, "verbose" },
@@ -159,6 +162,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "transfertoken", 1, "value"},
     { "submitpackage", 0, "rawtxs" },
     { "submitpackage", 1, "allowhighfees" },
+    { "submitpackage", 2, "atomic" },
 };
 
 class CRPCConvertTable
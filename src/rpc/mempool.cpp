@@ -125,20 +125,24 @@ static UniValue testmempoolaccept(const JSONRPCRequest& request)
 
 static UniValue submitpackage(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
     throw std::runtime_error(
-        "submitpackage \"[rawtx1, rawtx2]\" \n"
+        "submitpackage \"[rawtx1, rawtx2]\" ( allowhighfees atomic )\n"
         "\nSubmit a package of raw transactions (serialized, hex-encoded) to local node.\n"
         "\nTransactions are submitted to the mempool individually, in package order.\n"
         "\nPackage admission is NOT atomic: if an earlier transaction succeeds but a later\n"
         "\none fails, the admitted prefix remains in the mempool. Check per-transaction\n"
         "\nresults to determine which transactions were admitted.\n"
+        "\nWith atomic, either all the transactions are admitted or none is. The package is\n"
+        "\nvalidated as a whole, and the transactions not rejected themselves are rejected\n"
+        "\nwith \"package-not-accepted\".\n"
         "\nOnly valid transactions are successful. Transactions that violate consensus\n"
         "\nor policy rules are rejected.\n"
         "\nA valid package submission may fail or be evicted when the memory pool is full.\n"
         "\nArguments:\n"
         "1. transaction_hex                        (array, required) An array of hex strings of raw transactions.\n"
         "2. allowhighfees                            (boolean, optional, default=false) Allow high fees\n"
+        "3. atomic                                   (boolean, optional, default=false) Admit all the transactions or none\n"
         "\nResult:\n"
         "   {\n"
         "    \"allowed\"               (boolean) If submitting all transaction was successful \n"
@@ -149,7 +153,7 @@ static UniValue submitpackage(const JSONRPCRequest& request)
         + HelpExampleRpc("submitpackage", "[\"raw_tx1, raw_tx2\"]")
     );
 
-    RPCTypeCheck(request.params, {UniValue::VARR, UniValue::VBOOL});
+    RPCTypeCheck(request.params, {UniValue::VARR, UniValue::VBOOL, UniValue::VBOOL});
 
     const UniValue raw_transactions = request.params[0].get_array();
     if (raw_transactions.size() < 1 || raw_transactions.size() > MAX_PACKAGE_COUNT) {
@@ -183,7 +187,9 @@ static UniValue submitpackage(const JSONRPCRequest& request)
     opt.context = ValidationContext::PACKAGE;
     opt.nAbsurdFee = max_raw_tx_fee;
 
-    bool success = SubmitPackageToMempool(package, state, pkg_results, opt);
+    const bool atomic = !request.params[2].isNull() && request.params[2].get_bool();
+    bool success = atomic ? SubmitPackageToMempoolAtomic(package, state, pkg_results, opt)
+                          : SubmitPackageToMempool(package, state, pkg_results, opt);
 
     UniValue result(UniValue::VOBJ);
 
@@ -197,7 +203,7 @@ static const CRPCCommand commands[] =
 { //  category              name                            actor (function)            argNames
   //  --------------------- ------------------------        -----------------------     ----------
     { "packages",        "testmempoolaccept",           &testmempoolaccept,         {"rawtxs","allowhighfees"} },
-    { "packages",           "submitpackage",                    &submitpackage,             {"rawtxs","allowhighfees"} },
+    { "packages",           "submitpackage",                    &submitpackage,             {"rawtxs","allowhighfees","atomic"} },
 };
 
 void RegisterMempoolRPCCommands(CRPCTable &t)
@@ -46,6 +46,15 @@ unsigned int ParseConfirmTarget(const UniValue& value)
     return (unsigned int)target;
 }
 
+/** Assemble a block template, from the selection kept by the template builder if there is one */
+static std::unique_ptr<CBlockTemplate> CreateNewBlockTemplate(const CScript& scriptPubKeyIn, int required_age_in_secs = 0, CXField* pXField = nullptr)
+{
+    if (g_template_builder) {
+        return BlockAssembler(Params(), *g_template_builder).CreateNewBlock(scriptPubKeyIn, required_age_in_secs, pXField);
+    }
+    return BlockAssembler(Params()).CreateNewBlock(scriptPubKeyIn, required_age_in_secs, pXField);
+}
+
 UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGenerate, bool keepScript, const CKey& privKey)
 {
     uint32_t nHeightEnd = 0;
@@ -60,7 +69,7 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
     UniValue blockHashes(UniValue::VARR);
     while (nHeight < nHeightEnd && !ShutdownRequested())
     {
-        std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript->reserveScript));
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockTemplate(coinbaseScript->reserveScript));
         if (!pblocktemplate.get())
             throw JSONRPCError(RPC_INTERNAL_ERROR, "Couldn't create new block");
         CBlock *pblock = &pblocktemplate->block;
@@ -234,7 +243,7 @@ UniValue getnewblock(const JSONRPCRequest& request)
     }
     CScript coinbaseScript {GetScriptForDestination(destination)};
 
-    std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript, true, &xfield));
+    std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockTemplate(coinbaseScript, true, &xfield));
     if (!pblocktemplate.get())
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Wallet keypool empty");
     {
@@ -523,7 +532,7 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
 
         // Create new block
         CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
+        pblocktemplate = CreateNewBlockTemplate(scriptDummy, fSupportsSegwit);
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
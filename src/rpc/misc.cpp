@@ -5,9 +5,11 @@
 
 #include <chain.h>
 #include <clientversion.h>
+#include <dbwrapper.h>
 #include <key_io.h>
 #include <validation.h>
 #include <httpserver.h>
+#include <issuedcolorids.h>
 #include <net.h>
 #include <netbase.h>
 #include <outputtype.h>
@@ -277,6 +279,20 @@ static UniValue RPCLockedMemoryInfo()
     return obj;
 }
 
+static UniValue RPCIssuedColorIdsMemoryInfo()
+{
+    LOCK(cs_main);
+    if (!g_colorid_state) {
+        return NullUniValue;
+    }
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("usage", uint64_t(g_colorid_state->DynamicMemoryUsage()));
+    obj.pushKV("filter_size", uint64_t(g_colorid_state->FilterSize()));
+    obj.pushKV("pending_inserts", uint64_t(g_colorid_state->PendingInserts()));
+    obj.pushKV("pending_erases", uint64_t(g_colorid_state->PendingErases()));
+    return obj;
+}
+
 #ifdef HAVE_MALLOC_INFO
 static std::string RPCMallocInfo()
 {
@@ -318,6 +334,12 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
             "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
             "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
             "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
+            "  },\n"
+            "  \"colorids\": {             (json object) Information about the issued NON_REISSUABLE and NFT colorIds\n"
+            "    \"usage\": xxxxx,         (numeric) Number of bytes used by the filter and the changes not yet flushed\n"
+            "    \"filter_size\": xxxxx,   (numeric) Number of colorIds in the filter in front of the chainstate database\n"
+            "    \"pending_inserts\": xx,  (numeric) Number of issued colorIds not yet flushed\n"
+            "    \"pending_erases\": xx,   (numeric) Number of disconnected colorIds not yet flushed\n"
             "  }\n"
             "}\n"
             "\nResult (mode \"mallocinfo\"):\n"
@@ -331,6 +353,7 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
     if (mode == "stats") {
         UniValue obj(UniValue::VOBJ);
         obj.pushKV("locked", RPCLockedMemoryInfo());
+        obj.pushKV("colorids", RPCIssuedColorIdsMemoryInfo());
         return obj;
     } else if (mode == "mallocinfo") {
 #ifdef HAVE_MALLOC_INFO
@@ -343,6 +366,92 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
     }
 }
 
+static UniValue DBWrapperInfo(const CDBWrapper& db)
+{
+    const DBProfile& profile = db.GetProfile();
+    UniValue prof(UniValue::VOBJ);
+    prof.pushKV("compression", profile.compression);
+    prof.pushKV("bloom_bits", profile.bloom_bits);
+    prof.pushKV("block_size", profile.block_size);
+    prof.pushKV("max_file_size", profile.max_file_size);
+    prof.pushKV("write_buffer_size", profile.write_buffer_size);
+
+    UniValue levels(UniValue::VARR);
+    for (int level = 0; ; level++) {
+        std::string files;
+        if (!db.GetProperty(strprintf("leveldb.num-files-at-level%d", level), files))
+            break;
+        levels.push_back(atoi64(files));
+    }
+
+    const DBCounters counters = db.GetCounters();
+    std::string stats;
+    db.GetProperty(db.GetBackend() + ".stats", stats);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("backend", db.GetBackend());
+    obj.pushKV("path", db.GetPath().string());
+    obj.pushKV("profile", prof);
+    obj.pushKV("memory_usage", (uint64_t)db.DynamicMemoryUsage());
+    obj.pushKV("approximate_size", db.EstimateTotalSize());
+    obj.pushKV("files_per_level", levels);
+    obj.pushKV("compactions", counters.compactions);
+    obj.pushKV("trivial_moves", counters.trivial_moves);
+    obj.pushKV("memtable_flushes", counters.memtable_flushes);
+    obj.pushKV("write_stalls", counters.write_stalls);
+    obj.pushKV("stats", stats);
+    return obj;
+}
+
+static UniValue getdbinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw std::runtime_error(
+            "getdbinfo ( \"name\" )\n"
+            "Returns an object with information about each open database, keyed by its name.\n"
+            "Arguments:\n"
+            "1. \"name\"      (string, optional) Only return the database with this name, such as \"chainstate\", \"index\" or \"txindex\"\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {\n"
+            "    \"backend\": \"xxxx\",            (string) Storage engine of the database, see -dbbackend\n"
+            "    \"path\": \"xxxx\",               (string) Directory of the database\n"
+            "    \"profile\": {                  (json object) Settings the database was opened with, see -dbprofile\n"
+            "      \"compression\": true|false,  (boolean) Whether blocks are compressed with Snappy\n"
+            "      \"bloom_bits\": n,            (numeric) Bits per key of the bloom filter, 0 for none\n"
+            "      \"block_size\": n,            (numeric) Block size in bytes\n"
+            "      \"max_file_size\": n,         (numeric) Table file size in bytes\n"
+            "      \"write_buffer_size\": n,     (numeric) Memtable size in bytes\n"
+            "    },\n"
+            "    \"memory_usage\": n,            (numeric) Approximate memory used by the engine in bytes\n"
+            "    \"approximate_size\": n,        (numeric) Approximate size on disk in bytes\n"
+            "    \"files_per_level\": [n,...],   (array) Number of table files at each level\n"
+            "    \"compactions\": n,             (numeric) Compactions merging files since the database was opened\n"
+            "    \"trivial_moves\": n,           (numeric) Files moved to the next level without rewriting them\n"
+            "    \"memtable_flushes\": n,        (numeric) Memtables written to level-0 files\n"
+            "    \"write_stalls\": n,            (numeric) Times a write waited for a compaction\n"
+            "    \"stats\": \"xxxx\"               (string) The <backend>.stats property, for leveldb the per-level sizes and compaction totals\n"
+            "  }, ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbinfo", "")
+            + HelpExampleCli("getdbinfo", "\"chainstate\"")
+            + HelpExampleRpc("getdbinfo", "\"chainstate\"")
+        );
+
+    const std::string name = request.params[0].isNull() ? "" : request.params[0].get_str();
+    UniValue obj(UniValue::VOBJ);
+    ForEachDBWrapper([&](const CDBWrapper& db) {
+        if (name.empty() || db.GetName() == name) {
+            obj.pushKV(db.GetName(), DBWrapperInfo(db));
+        }
+    });
+    if (!name.empty() && obj.empty()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "No open database named " + name);
+    }
+    return obj;
+}
+
 static void EnableOrDisableLogCategories(UniValue cats, bool enable) {
     cats = cats.get_array();
     for (unsigned int i = 0; i < cats.size(); ++i) {
@@ -459,6 +568,7 @@ static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getmemoryinfo",          &getmemoryinfo,          {"mode"} },
+    { "control",            "getdbinfo",              &getdbinfo,              {"name"} },
     { "control",            "logging",                &logging,                {"include", "exclude"}},
     { "util",               "validateaddress",        &validateaddress,        {"address"} }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         {"nrequired","keys"} },
@@ -28,6 +28,7 @@ public:
 
     bool operator()();
 
+    unsigned int GetInputIndex() const { return nIn; }
     ScriptError GetScriptError() const { return error; }
     const ColorIdentifier& GetColorIdentifier() const { return colorid; }
 };
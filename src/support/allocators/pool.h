@@ -0,0 +1,248 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+/**
+ * A memory resource for node based containers that allocate one element at a
+ * time, such as std::unordered_map.
+ *
+ * Memory is taken from the system in chunks of a fixed size and carved into
+ * blocks. Freed blocks are kept in singly linked free lists, one per block
+ * size (in multiples of ELEM_ALIGN_BYTES), so that they can be reused by the
+ * next allocation of the same size. This avoids the per-allocation overhead
+ * of malloc and packs the nodes of a container densely.
+ *
+ * Allocations larger than MAX_BLOCK_SIZE_BYTES, or with a stricter alignment
+ * than ALIGN_BYTES, are passed through to operator new. This is what happens
+ * to the bucket array of an unordered_map.
+ *
+ * Chunks are only released when the resource is destroyed.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource final
+{
+    static_assert(ALIGN_BYTES > 0, "ALIGN_BYTES must be nonzero");
+    static_assert((ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+
+    /** In-place linked list of the free blocks of one size. */
+    struct ListNode {
+        ListNode* m_next;
+
+        explicit ListNode(ListNode* next) : m_next(next) {}
+    };
+    static_assert(std::is_trivially_destructible<ListNode>::value, "Make sure we don't need to manually call a destructor");
+
+    /** Internal alignment, so that a ListNode can be placed in every block. */
+    static constexpr std::size_t ELEM_ALIGN_BYTES = std::max(alignof(ListNode), ALIGN_BYTES);
+    static_assert((ELEM_ALIGN_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "ELEM_ALIGN_BYTES must be a power of two");
+    static_assert(sizeof(ListNode) <= ELEM_ALIGN_BYTES, "Units of size ELEM_SIZE_ALIGN need to be able to store a ListNode");
+    static_assert((MAX_BLOCK_SIZE_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "MAX_BLOCK_SIZE_BYTES needs to be a multiple of the alignment.");
+
+    const std::size_t m_chunk_size_bytes;
+
+    //! All chunks allocated from the system, freed in the destructor.
+    std::list<std::byte*> m_allocated_chunks{};
+
+    //! Free lists indexed by the number of ELEM_ALIGN_BYTES units of a block.
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1> m_free_lists{};
+
+    //! Not yet carved part of the newest chunk.
+    std::byte* m_available_memory_it = nullptr;
+    std::byte* m_available_memory_end = nullptr;
+
+    //! Bytes held in the free lists.
+    std::size_t m_free_list_bytes = 0;
+
+    static constexpr std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    static constexpr bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PlacementAddToList(void* p, ListNode*& node)
+    {
+        node = new (p) ListNode{node};
+    }
+
+    /** Give the rest of the current chunk to the free lists and allocate a new chunk. */
+    void AllocateChunk()
+    {
+        // Nothing is lost: the remainder is always a multiple of ELEM_ALIGN_BYTES.
+        if (m_available_memory_it != m_available_memory_end) {
+            const std::size_t remaining_units = static_cast<std::size_t>(m_available_memory_end - m_available_memory_it) / ELEM_ALIGN_BYTES;
+            PlacementAddToList(m_available_memory_it, m_free_lists[remaining_units]);
+            m_free_list_bytes += remaining_units * ELEM_ALIGN_BYTES;
+        }
+
+        m_available_memory_it = static_cast<std::byte*>(::operator new (m_chunk_size_bytes, std::align_val_t{ELEM_ALIGN_BYTES}));
+        m_available_memory_end = m_available_memory_it + m_chunk_size_bytes;
+        m_allocated_chunks.emplace_back(m_available_memory_it);
+    }
+
+public:
+    /** Construct a resource that takes memory from the system in chunks of about chunk_size_bytes. */
+    explicit PoolResource(std::size_t chunk_size_bytes)
+        : m_chunk_size_bytes(NumElemAlignBytes(chunk_size_bytes) * ELEM_ALIGN_BYTES)
+    {
+        assert(m_chunk_size_bytes >= MAX_BLOCK_SIZE_BYTES);
+        AllocateChunk();
+    }
+
+    /** Construct a resource with a default chunk size of 256 KiB. */
+    PoolResource() : PoolResource(262144) {}
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+    PoolResource(PoolResource&&) = delete;
+    PoolResource& operator=(PoolResource&&) = delete;
+
+    ~PoolResource()
+    {
+        for (std::byte* chunk : m_allocated_chunks) {
+            ::operator delete (static_cast<void*>(chunk), std::align_val_t{ELEM_ALIGN_BYTES});
+        }
+    }
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            const std::size_t num_alignments = NumElemAlignBytes(bytes);
+            if (m_free_lists[num_alignments] != nullptr) {
+                // reuse a previously freed block of the same size
+                ListNode* node = m_free_lists[num_alignments];
+                m_free_lists[num_alignments] = node->m_next;
+                m_free_list_bytes -= num_alignments * ELEM_ALIGN_BYTES;
+                return static_cast<void*>(node);
+            }
+
+            const std::size_t round_bytes = num_alignments * ELEM_ALIGN_BYTES;
+            if (round_bytes > static_cast<std::size_t>(m_available_memory_end - m_available_memory_it)) {
+                AllocateChunk();
+            }
+            void* p = m_available_memory_it;
+            m_available_memory_it += round_bytes;
+            return p;
+        }
+
+        return ::operator new (bytes, std::align_val_t{alignment});
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            const std::size_t num_alignments = NumElemAlignBytes(bytes);
+            PlacementAddToList(p, m_free_lists[num_alignments]);
+            m_free_list_bytes += num_alignments * ELEM_ALIGN_BYTES;
+        } else {
+            ::operator delete (p, std::align_val_t{alignment});
+        }
+    }
+
+    /** Number of chunks taken from the system so far. */
+    std::size_t NumAllocatedChunks() const
+    {
+        return m_allocated_chunks.size();
+    }
+
+    /** Size of each chunk taken from the system. */
+    std::size_t ChunkSizeBytes() const
+    {
+        return m_chunk_size_bytes;
+    }
+
+    /**
+     * Bytes of the allocated chunks that are not handed out: freed blocks
+     * and the uncarved rest of the newest chunk. They are reused before
+     * another chunk is taken from the system.
+     */
+    std::size_t UnusedBytes() const
+    {
+        return m_free_list_bytes + static_cast<std::size_t>(m_available_memory_end - m_available_memory_it);
+    }
+};
+
+
+/**
+ * Allocator that forwards to a PoolResource. The resource must outlive every
+ * container using the allocator.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+    PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>* m_resource;
+
+    template <typename U, std::size_t M, std::size_t A>
+    friend class PoolAllocator;
+
+public:
+    using value_type = T;
+    using ResourceType = PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>;
+
+    /** Not explicit, so a container can be constructed directly from a resource pointer. */
+    PoolAllocator(ResourceType* resource) noexcept
+        : m_resource(resource)
+    {
+    }
+
+    PoolAllocator(const PoolAllocator& other) noexcept = default;
+    PoolAllocator& operator=(const PoolAllocator& other) noexcept = default;
+
+    template <class U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept
+        : m_resource(other.resource())
+    {
+    }
+
+    /** Rebinding is required by node based containers, whose nodes are not a T. */
+    template <typename U>
+    struct rebind {
+        using other = PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>;
+    };
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept
+    {
+        return m_resource;
+    }
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -44,6 +44,7 @@
 #include <primitives/xfield.h>
 #include <uint256.h>
 #include <validation.h>
+#include <file_io.h>
 #include <streams.h>
 
 #include <boost/test/unit_test.hpp>
@@ -405,8 +406,7 @@ BOOST_AUTO_TEST_CASE(blockindex_get_block_header)
     index.hashMerkleRoot = InsecureRand256();
     index.hashImMerkleRoot = InsecureRand256();
     index.nTime = 1609459200;
-    index.proof = {0x01, 0x02, 0x03, 0x04};
-    index.xfield = CXField(XFieldAggPubKey({0x05, 0x06, 0x07, 0x08}));
+    index.SetHeaderExtra(CXField(XFieldAggPubKey({0x05, 0x06, 0x07, 0x08})), {0x01, 0x02, 0x03, 0x04});
 
     // Reconstruct header
     CBlockHeader header = index.GetBlockHeader();
@@ -417,8 +417,8 @@ BOOST_AUTO_TEST_CASE(blockindex_get_block_header)
     BOOST_CHECK(header.hashMerkleRoot == index.hashMerkleRoot);
     BOOST_CHECK(header.hashImMerkleRoot == index.hashImMerkleRoot);
     BOOST_CHECK_EQUAL(header.nTime, index.nTime);
-    BOOST_CHECK(header.proof == index.proof);
-    BOOST_CHECK(header.xfield == index.xfield);
+    BOOST_CHECK(header.proof == index.GetHeaderExtra()->proof);
+    BOOST_CHECK(header.xfield == index.GetHeaderExtra()->xfield);
 
     // Case 2: Block without parent (genesis)
     CBlockIndex genesisIndex;
@@ -453,10 +453,11 @@ BOOST_AUTO_TEST_CASE(diskblockindex_edge_cases)
     index.hashMerkleRoot = InsecureRand256();
     index.hashImMerkleRoot = InsecureRand256();
     index.nTime = 1609459200;
-    index.proof = {0x01, 0x02, 0x03};
+    index.SetHeaderExtra(CXField(), {0x01, 0x02, 0x03});
 
     CDiskBlockIndex diskIndex(&index);
     BOOST_CHECK(diskIndex.hashPrev == parentHash);
+    BOOST_CHECK(diskIndex.proof == index.GetHeaderExtra()->proof);
     BOOST_CHECK_EQUAL(diskIndex.nHeight, index.nHeight);
     BOOST_CHECK_EQUAL(diskIndex.nFeatures, index.nFeatures);
 
@@ -920,8 +921,9 @@ BOOST_AUTO_TEST_CASE(blockindex_initialization)
     BOOST_CHECK_EQUAL(index1.nFeatures, 0);
     BOOST_CHECK(index1.hashMerkleRoot.IsNull());
     BOOST_CHECK_EQUAL(index1.nTime, 0);
-    BOOST_CHECK(index1.xfield.xfieldType == TAPYRUS_XFIELDTYPES::NONE);
-    BOOST_CHECK(index1.proof.empty());
+    BOOST_CHECK(!index1.HasHeaderExtra());
+    BOOST_CHECK(index1.GetHeaderExtra()->xfield.xfieldType == TAPYRUS_XFIELDTYPES::NONE);
+    BOOST_CHECK(index1.GetHeaderExtra()->proof.empty());
 
     // Case 2: Constructor from CBlockHeader
     CBlockHeader header;
@@ -937,8 +939,9 @@ BOOST_AUTO_TEST_CASE(blockindex_initialization)
     BOOST_CHECK(index2.hashMerkleRoot == header.hashMerkleRoot);
     BOOST_CHECK(index2.hashImMerkleRoot == header.hashImMerkleRoot);
     BOOST_CHECK_EQUAL(index2.nTime, header.nTime);
-    BOOST_CHECK(index2.proof == header.proof);
-    BOOST_CHECK(index2.xfield.xfieldType == header.xfield.xfieldType);
+    BOOST_CHECK(index2.HasHeaderExtra());
+    BOOST_CHECK(index2.GetHeaderExtra()->proof == header.proof);
+    BOOST_CHECK(index2.GetHeaderExtra()->xfield.xfieldType == header.xfield.xfieldType);
 
     // Other fields should still be initialized to null/zero
     BOOST_CHECK(index2.phashBlock == nullptr);
@@ -1688,4 +1691,34 @@ BOOST_AUTO_TEST_CASE(diskblockpos_tostring)
     BOOST_CHECK(str1.back() == ')');
 }
 
+/**
+ * Test reading back released header extras
+ *
+ * Once an entry is written to the block tree database its xfield and proof
+ * are dropped from memory and read back through a cache. An entry that
+ * should be stored there but is not must not come back empty.
+ */
+BOOST_AUTO_TEST_CASE(blockindex_header_extra_cache)
+{
+    LOCK(cs_main);
+    CValidationState state;
+    BOOST_REQUIRE(FlushStateToDisk(state, FlushStateMode::ALWAYS));
+
+    CBlockIndex* pindex = chainActive.Tip();
+    BOOST_CHECK(!pindex->HasHeaderExtra());
+    std::shared_ptr<const CBlockHeaderExtra> extra = pindex->GetHeaderExtra();
+    BOOST_CHECK(extra->proof == FederationParams().GenesisBlock().proof);
+
+    // Case 1: the second read is served from the cache
+    BOOST_CHECK(pindex->GetHeaderExtra() == extra);
+    BOOST_CHECK(!pindex->HasHeaderExtra());
+
+    // Case 2: an entry missing from the database is not read back empty.
+    // GetHeaderExtra aborts the node on it, which would exit the test binary.
+    CBlockHeaderExtra missing;
+    BOOST_CHECK(!pblocktree->ReadBlockHeaderExtra(InsecureRand256(), missing));
+    BOOST_CHECK(pblocktree->ReadBlockHeaderExtra(pindex->GetBlockHash(), missing));
+    BOOST_CHECK(missing.proof == extra->proof);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
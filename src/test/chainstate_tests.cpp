@@ -32,6 +32,9 @@
 #include <issuedcolorids.h>
 #include <script/interpreter.h>
 #include <hash.h>
+#include <miner.h>
+#include <consensus/merkle.h>
+#include <utiltime.h>
 
 #include <boost/test/unit_test.hpp>
 
@@ -720,6 +723,185 @@ BOOST_AUTO_TEST_CASE(check_block_header_orphan_uses_latest_aggpubkey)
     }
 }
 
+/**
+ * -assumevalidproof skips the proof of ancestors of the assumed block, but only
+ * when it is on the best header chain and the block is older than two weeks.
+ */
+BOOST_AUTO_TEST_CASE(assumevalidproof_ancestors)
+{
+    LOCK(cs_main);
+    refillCoinbase(3);
+    CBlockIndex* pindexTip = chainActive.Tip();
+    BOOST_REQUIRE(pindexTip->nHeight >= 3);
+    const CBlockIndex* pindexAncestor = pindexTip->GetAncestor(2);
+
+    BOOST_CHECK(!IsBlockProofAssumedValid(pindexAncestor->GetBlockHash(), 2));
+
+    hashAssumeValidProof = pindexTip->GetBlockHash();
+    // too recent
+    BOOST_CHECK(!IsBlockProofAssumedValid(pindexAncestor->GetBlockHash(), 2));
+
+    const uint32_t nTimeSaved = pindexTip->nTime;
+    pindexTip->nTime = pindexAncestor->nTime + 60 * 60 * 24 * 7 * 3;
+    BOOST_CHECK(IsBlockProofAssumedValid(pindexAncestor->GetBlockHash(), 2));
+    BOOST_CHECK(!IsBlockProofAssumedValid(pindexAncestor->GetBlockHash(), 1));
+    BOOST_CHECK(!IsBlockProofAssumedValid(uint256S("01"), 2));
+    BOOST_CHECK(!IsBlockProofAssumedValid(pindexAncestor->GetBlockHash(), pindexTip->nHeight + 1));
+
+    // the proof of an assumed valid ancestor is not verified against the aggregate pubkey
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+    CTempXFieldHistory tempHistory;
+    tempHistory.Add(TAPYRUS_XFIELDTYPES::AGGPUBKEY, XFieldChange(XFieldAggPubKey(otherKey.GetPubKey()), 1, uint256()));
+    CBlock block;
+    BOOST_REQUIRE(ReadBlockFromDisk(block, pindexAncestor));
+    CValidationState state;
+    BOOST_CHECK(CheckBlockHeader(block.GetBlockHeader(), state, &tempHistory, 2, true, IsBlockProofAssumedValid(block.GetHash(), 2)));
+
+    hashAssumeValidProof.SetNull();
+    BOOST_CHECK(!CheckBlockHeader(block.GetBlockHeader(), state, &tempHistory, 2, true, IsBlockProofAssumedValid(block.GetHash(), 2)));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-proof");
+    pindexTip->nTime = nTimeSaved;
+}
+
+/** A block on prev_hash at nHeight, its proof signed by signer, or by the aggregate key if null */
+static std::shared_ptr<const CBlock> ProofTestBlock(const uint256& prev_hash, int nHeight, uint32_t nTime, const CKey* signer)
+{
+    CScript pubKey;
+    pubKey << nHeight << OP_TRUE;
+    auto pblock = std::make_shared<CBlock>(BlockAssembler(Params()).CreateNewBlock(pubKey)->block);
+    pblock->hashPrevBlock = prev_hash;
+    pblock->nTime = nTime;
+
+    CMutableTransaction txCoinbase(*pblock->vtx[0]);
+    txCoinbase.vout.resize(1);
+    txCoinbase.vin[0].prevout.n = nHeight;
+    txCoinbase.vin[0].scriptWitness.SetNull();
+    pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
+    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    pblock->hashImMerkleRoot = BlockMerkleRoot(*pblock, nullptr, true);
+
+    std::vector<unsigned char> proof;
+    if (signer) {
+        BOOST_REQUIRE(signer->Sign_Schnorr(pblock->GetHashForSign(), proof));
+        BOOST_REQUIRE(pblock->AbsorbBlockProof(proof, signer->GetPubKey()));
+    } else {
+        XFieldAggPubKey aggpubkeyChange;
+        CXFieldHistory().GetLatest(TAPYRUS_XFIELDTYPES::AGGPUBKEY, aggpubkeyChange);
+        createSignedBlockProof(*pblock, proof);
+        BOOST_REQUIRE(pblock->AbsorbBlockProof(proof, CPubKey(aggpubkeyChange.getPubKey())));
+    }
+    return pblock;
+}
+
+/**
+ * Headers below -assumevalidproofheight are synced before the -assumevalidproof
+ * block is known. A bad proof among them is only accepted if the header at that
+ * height is the assumed block; its block is then connected by ProcessNewBlock.
+ */
+BOOST_AUTO_TEST_CASE(assumevalidproof_header_sync)
+{
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+    uint256 hashTip;
+    int nTipHeight;
+    uint32_t nTime;
+    {
+        LOCK(cs_main);
+        hashTip = chainActive.Tip()->GetBlockHash();
+        nTipHeight = chainActive.Height();
+        nTime = chainActive.Tip()->nTime + 1;
+    }
+    const auto blockA = ProofTestBlock(hashTip, nTipHeight + 1, nTime, &otherKey);
+    const auto blockB = ProofTestBlock(blockA->GetHash(), nTipHeight + 2, nTime + 1, nullptr);
+    const auto blockC = ProofTestBlock(blockB->GetHash(), nTipHeight + 3, nTime + 60 * 60 * 24 * 7 * 3, nullptr);
+    SetMockTime(blockC->nTime);
+
+    // without -assumevalidproof the bad proof is rejected
+    CValidationState state;
+    BOOST_CHECK(!ProcessNewBlockHeaders({blockA->GetBlockHeader()}, state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-proof");
+
+    hashAssumeValidProof = blockC->GetHash();
+    nAssumeValidProofHeight = nTipHeight + 3;
+    state = CValidationState();
+    BOOST_CHECK(ProcessNewBlockHeaders({blockA->GetBlockHeader(), blockB->GetBlockHeader(), blockC->GetBlockHeader()}, state));
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexA = LookupBlockIndex(blockA->GetHash());
+        BOOST_REQUIRE(pindexA);
+        BOOST_CHECK(!(pindexA->nStatus & (BLOCK_PROOF_UNVERIFIED | BLOCK_FAILED_MASK)));
+        BOOST_CHECK(IsBlockProofAssumedValid(blockA->GetHash(), nTipHeight + 1));
+    }
+
+    BOOST_CHECK(ProcessNewBlock(blockA, true, nullptr));
+    BOOST_CHECK(ProcessNewBlock(blockB, true, nullptr));
+    BOOST_CHECK(ProcessNewBlock(blockC, true, nullptr));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == blockC->GetHash());
+    }
+
+    hashAssumeValidProof.SetNull();
+    nAssumeValidProofHeight = -1;
+    SetMockTime(0);
+}
+
+/**
+ * When the header at -assumevalidproofheight is not the assumed block, the
+ * proofs of the headers synced below it are verified, and a bad one fails
+ * them and their descendants.
+ */
+BOOST_AUTO_TEST_CASE(assumevalidproof_header_sync_wrong_chain)
+{
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+    uint256 hashTip;
+    int nTipHeight;
+    uint32_t nTime;
+    {
+        LOCK(cs_main);
+        hashTip = chainActive.Tip()->GetBlockHash();
+        nTipHeight = chainActive.Height();
+        nTime = chainActive.Tip()->nTime + 1;
+    }
+    const auto blockA = ProofTestBlock(hashTip, nTipHeight + 1, nTime, &otherKey);
+    const auto blockB = ProofTestBlock(blockA->GetHash(), nTipHeight + 2, nTime + 1, nullptr);
+    const auto blockC = ProofTestBlock(blockB->GetHash(), nTipHeight + 3, nTime + 60 * 60 * 24 * 7 * 3, nullptr);
+    SetMockTime(blockC->nTime);
+
+    hashAssumeValidProof = uint256S("01");
+    nAssumeValidProofHeight = nTipHeight + 3;
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlockHeaders({blockA->GetBlockHeader(), blockB->GetBlockHeader()}, state));
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexA = LookupBlockIndex(blockA->GetHash());
+        BOOST_REQUIRE(pindexA);
+        BOOST_CHECK(pindexA->nStatus & BLOCK_PROOF_UNVERIFIED);
+    }
+
+    BOOST_CHECK(!ProcessNewBlockHeaders({blockC->GetBlockHeader()}, state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-prevblk");
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(LookupBlockIndex(blockA->GetHash())->nStatus & BLOCK_FAILED_VALID);
+        BOOST_CHECK(LookupBlockIndex(blockB->GetHash())->nStatus & BLOCK_FAILED_CHILD);
+        BOOST_CHECK(!LookupBlockIndex(blockC->GetHash()));
+    }
+
+    // nor is the block of the failed header connected
+    BOOST_CHECK(!ProcessNewBlock(blockA, true, nullptr));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Height() == nTipHeight);
+    }
+
+    hashAssumeValidProof.SetNull();
+    nAssumeValidProofHeight = -1;
+    SetMockTime(0);
+}
+
 /**
  * Regression test: DisconnectBlock(fDryRun=true) must not erase from g_colorid_state.
  *
@@ -263,6 +263,29 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
     delete fail_queue;
 }
 
+// Test that the check which failed is handed back to the master
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Reports_Failure)
+{
+    auto fail_queue = new Failing_Queue{QUEUE_BATCH_SIZE, SCRIPT_CHECK_THREADS};
+
+    for (auto times = 0; times < 10; ++times) {
+        for (bool fails : {true, false}) {
+            CCheckQueueControl<FailingCheck> control(fail_queue);
+            {
+                std::vector<FailingCheck> vChecks;
+                vChecks.resize(100, false);
+                vChecks[InsecureRandRange(100)] = fails;
+                control.Add(std::move(vChecks));
+            }
+            FailingCheck failed(false);
+            bool r = control.Wait(&failed);
+            BOOST_REQUIRE(r != fails);
+            BOOST_REQUIRE(failed.fails == fails);
+        }
+    }
+    delete fail_queue;
+}
+
 // Test that unique checks are actually all called individually, rather than
 // just one check being called repeatedly. Test that checks are not called
 // more than once as well
@@ -11,6 +11,8 @@
 #include <test/test_tapyrus.h>
 #include <validation.h>
 #include <consensus/validation.h>
+#include <checkqueue.h>
+#include <coinfetch.h>
 
 #include <vector>
 #include <map>
@@ -51,7 +53,7 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool erase = true) override
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -62,7 +64,7 @@ public:
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
+            it = erase ? mapCoins.erase(it) : std::next(it);
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -605,7 +607,8 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map{0, CCoinsMap::hasher{}, CCoinsMap::key_equal{}, &resource};
     InsertCoinsMapEntry(map, value, flags);
     view.BatchWrite(map, {});
 }
@@ -874,4 +877,116 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_sync_evict)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    std::vector<COutPoint> oldCoins, newCoins;
+    for (int i = 0; i < 100; i++) {
+        oldCoins.emplace_back(InsecureRand256(), 0);
+        cache.AddCoin(oldCoins.back(), Coin(CTxOut(CENT, CScript() << OP_TRUE), 1, false), false);
+    }
+    cache.SetBestBlock(InsecureRand256());
+
+    // Sync writes the coins but keeps them cached and clean
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), oldCoins.size());
+    for (const COutPoint& outpoint : oldCoins) {
+        Coin coin;
+        BOOST_CHECK(base.GetCoin(outpoint, coin) && !coin.IsSpent());
+        BOOST_CHECK_EQUAL(cache.map().at(outpoint).flags, 0);
+    }
+    cache.SelfTest();
+
+    // spent coins are written and dropped from the cache
+    BOOST_CHECK(cache.SpendCoin(oldCoins.back()));
+    BOOST_CHECK(cache.Sync());
+    Coin spent;
+    BOOST_CHECK(!base.GetCoin(oldCoins.back(), spent) || spent.IsSpent());
+    BOOST_CHECK(!cache.HaveCoinInCache(oldCoins.back()));
+    oldCoins.pop_back();
+    cache.SelfTest();
+
+    // a write from a child cache starts a new access epoch
+    {
+        CCoinsViewCacheTest child(&cache);
+        child.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(child.Flush());
+    }
+    for (int i = 0; i < 100; i++) {
+        newCoins.emplace_back(InsecureRand256(), 0);
+        cache.AddCoin(newCoins.back(), Coin(CTxOut(CENT, CScript() << OP_TRUE), 2, false), false);
+    }
+    BOOST_CHECK(cache.AccessCoin(oldCoins.front()).out.nValue == CENT);
+
+    BOOST_CHECK(cache.Sync());
+
+    // the least recently used coins go first
+    BOOST_CHECK_EQUAL(cache.Evict(cache.DynamicMemoryUsage()), 0U);
+    size_t evicted = cache.Evict(cache.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(evicted > 0 && evicted < oldCoins.size());
+    BOOST_CHECK(cache.HaveCoinInCache(oldCoins.front()));
+    for (const COutPoint& outpoint : newCoins)
+        BOOST_CHECK(cache.HaveCoinInCache(outpoint));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), oldCoins.size() + newCoins.size() - evicted);
+    cache.SelfTest();
+
+    // modified coins are never evicted
+    COutPoint dirty(InsecureRand256(), 0);
+    cache.AddCoin(dirty, Coin(CTxOut(CENT, CScript() << OP_TRUE), 3, false), false);
+    cache.Evict(0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(cache.HaveCoinInCache(dirty));
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_prefetch)
+{
+    CCoinsViewTest base;
+    std::vector<COutPoint> outpoints;
+    {
+        CCoinsViewCacheTest writer(&base);
+        for (int i = 0; i < 200; i++) {
+            outpoints.emplace_back(InsecureRand256(), i);
+            writer.AddCoin(outpoints.back(), Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false), false);
+        }
+        writer.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(writer.Flush());
+    }
+    // not in the base
+    outpoints.emplace_back(InsecureRand256(), 0);
+
+    CCoinsViewCacheTest cache(&base);
+    // cached spends must not be replaced by the coins read from the base
+    BOOST_CHECK(cache.SpendCoin(outpoints[0]));
+
+    CCheckQueue<CCoinFetch> queue(16, 3, "coinfetch");
+    std::vector<Coin> coins(outpoints.size());
+    std::vector<CCoinFetch> fetches;
+    for (size_t i = 0; i < outpoints.size(); i++)
+        fetches.emplace_back(*cache.GetBackend(), outpoints[i], coins[i]);
+    {
+        CCheckQueueControl<CCoinFetch> control(&queue);
+        control.Add(std::move(fetches));
+        BOOST_CHECK(control.Wait());
+    }
+    for (size_t i = 0; i + 1 < outpoints.size(); i++)
+        BOOST_CHECK_EQUAL(coins[i].out.nValue, outpoints[i].n + 1);
+    BOOST_CHECK(coins.back().IsSpent());
+
+    size_t added = 0;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        if (!coins[i].IsSpent() && cache.EmplaceCoinFromBase(outpoints[i], std::move(coins[i])))
+            added++;
+    }
+    BOOST_CHECK_EQUAL(added, outpoints.size() - 2);
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[0]));
+    for (size_t i = 1; i + 1 < outpoints.size(); i++) {
+        BOOST_CHECK(cache.HaveCoinInCache(outpoints[i]));
+        BOOST_CHECK_EQUAL(cache.map().at(outpoints[i]).flags, 0);
+    }
+    cache.SelfTest();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
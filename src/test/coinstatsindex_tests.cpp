@@ -0,0 +1,158 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinstats.h>
+#include <consensus/validation.h>
+#include <index/coinstatsindex.h>
+#include <script/standard.h>
+#include <test/test_tapyrus.h>
+#include <txdb.h>
+#include <txmempool.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(coinstatsindex_tests)
+
+/** Check the statistics of the index at the tip against a scan of the UTXO set. */
+static void CheckAgainstScan(const CoinStatsIndex& index, CCoinsStats& index_stats)
+{
+    const CBlockIndex* tip;
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip();
+    }
+    BOOST_REQUIRE(index.LookUpStats(tip, index_stats));
+
+    CCoinsStats scan_stats;
+    FlushStateToDisk();
+    BOOST_REQUIRE(GetUTXOStats(pcoinsdbview.get(), scan_stats, CoinStatsHashType::MUHASH));
+
+    BOOST_CHECK_EQUAL(index_stats.nHeight, scan_stats.nHeight);
+    BOOST_CHECK(index_stats.hashBlock == scan_stats.hashBlock);
+    BOOST_CHECK(index_stats.hashSerialized == scan_stats.hashSerialized);
+    BOOST_CHECK_EQUAL(index_stats.nTransactionOutputs, scan_stats.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(index_stats.nBogoSize, scan_stats.nBogoSize);
+    BOOST_CHECK(index_stats.mTotalAmount == scan_stats.mTotalAmount);
+
+    // Only native coins are in the UTXO set of these tests.
+    CColorSupply supply;
+    CColorSupplyChange block_change;
+    BOOST_REQUIRE(index.LookUpColorSupply(tip, ColorIdentifier(), supply, block_change));
+    BOOST_CHECK_EQUAL(supply.amount, scan_stats.mTotalAmount[ColorIdentifier()]);
+    BOOST_CHECK_EQUAL(supply.utxos, scan_stats.nTransactionOutputs);
+}
+
+BOOST_FIXTURE_TEST_CASE(coinstatsindex_initial_sync, TestChainSetup)
+{
+    CoinStatsIndex coinstatsindex(1 << 20, true);
+
+    const CBlockIndex* tip;
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip();
+    }
+    CCoinsStats stats;
+
+    // Nothing is found in the index before it is started.
+    BOOST_CHECK(!coinstatsindex.LookUpStats(tip, stats));
+    BOOST_CHECK(!coinstatsindex.BlockUntilSyncedToCurrentChain());
+
+    coinstatsindex.Start();
+
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!coinstatsindex.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    CCoinsStats synced_stats;
+    CheckAgainstScan(coinstatsindex, synced_stats);
+    BOOST_CHECK_EQUAL(synced_stats.nTransactionOutputs, m_coinbase_txns.size());
+
+    // A block spending a coinbase output into two outputs.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.nFeatures = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHashMalFix(), 0);
+    spend.vout.resize(2);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    spend.vout[1].nValue = 12 * CENT;
+    spend.vout[1].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(coinbaseKey.Sign_Schnorr(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    const CBlock block = CreateAndProcessBlock({spend}, scriptPubKey);
+    BOOST_CHECK(coinstatsindex.BlockUntilSyncedToCurrentChain());
+    CCoinsStats spend_stats;
+    CheckAgainstScan(coinstatsindex, spend_stats);
+    BOOST_CHECK(block.GetHash() == spend_stats.hashBlock);
+    BOOST_CHECK_EQUAL(spend_stats.nTransactionOutputs, synced_stats.nTransactionOutputs + 2);
+    BOOST_CHECK(spend_stats.hashSerialized != synced_stats.hashSerialized);
+
+    // The block issued its coinbase output and added a net output by the spend.
+    CColorSupply supply;
+    CColorSupplyChange block_change;
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(coinstatsindex.LookUpColorSupply(chainActive.Tip(), ColorIdentifier(), supply, block_change));
+    }
+    BOOST_CHECK_EQUAL(block_change.amount, block.vtx[0]->GetValueOut(ColorIdentifier()) + block.vtx[1]->GetValueOut(ColorIdentifier()) - m_coinbase_txns[0]->vout[0].nValue);
+    BOOST_CHECK_EQUAL(block_change.utxos, 2);
+
+    // A color without unspent outputs has no supply.
+    std::vector<unsigned char> vColorId(33, 0x11);
+    vColorId[0] = (unsigned char)TokenTypes::REISSUABLE;
+    const ColorIdentifier token(vColorId);
+    BOOST_CHECK(coinstatsindex.LookUpColorSupply(tip, token, supply, block_change));
+    BOOST_CHECK_EQUAL(supply.amount, 0);
+    BOOST_CHECK_EQUAL(supply.utxos, 0U);
+    BOOST_CHECK_EQUAL(block_change.amount, 0);
+
+    // The statistics of past blocks are still available.
+    CCoinsStats past_stats;
+    BOOST_CHECK(coinstatsindex.LookUpStats(tip, past_stats));
+    BOOST_CHECK(past_stats.hashSerialized == synced_stats.hashSerialized);
+    BOOST_CHECK_EQUAL(past_stats.nTransactionOutputs, synced_stats.nTransactionOutputs);
+
+    // Replace the block in a reorg: the index continues from the fork point.
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, chainActive.Tip()));
+    }
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state));
+    // The spend is back in the mempool, and its fee would go to the coinbase
+    mempool.clear();
+    CScript other_script = CScript() << OP_TRUE;
+    const CBlock other_block = CreateAndProcessBlock({}, other_script);
+    BOOST_CHECK(coinstatsindex.BlockUntilSyncedToCurrentChain());
+    CCoinsStats reorg_stats;
+    CheckAgainstScan(coinstatsindex, reorg_stats);
+    BOOST_CHECK(other_block.GetHash() == reorg_stats.hashBlock);
+    BOOST_CHECK_EQUAL(reorg_stats.nTransactionOutputs, synced_stats.nTransactionOutputs + 1);
+
+    // The supply is no longer answered for the replaced block.
+    const CBlockIndex* stale_index;
+    {
+        LOCK(cs_main);
+        stale_index = LookupBlockIndex(block.GetHash());
+    }
+    BOOST_REQUIRE(stale_index);
+    BOOST_CHECK(!coinstatsindex.LookUpColorSupply(stale_index, ColorIdentifier(), supply, block_change));
+
+    coinstatsindex.Stop(); // Stop thread before calling destructor
+}
+
+BOOST_AUTO_TEST_SUITE_END()
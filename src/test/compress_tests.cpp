@@ -3,7 +3,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <coloridentifier.h>
 #include <compressor.h>
+#include <streams.h>
 #include <util.h>
 #include <test/test_tapyrus.h>
 
@@ -63,4 +65,80 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+static CScript ColoredScript(TokenTypes type, bool fScriptHash)
+{
+    ColorIdentifier colorId(COutPoint(InsecureRand256(), 0), type);
+    std::vector<unsigned char> hash(20);
+    GetRandBytes(hash.data(), hash.size());
+    CScript script = CScript() << colorId.toVector() << OP_COLOR;
+    if (fScriptHash)
+        return script << OP_HASH160 << hash << OP_EQUAL;
+    return script << OP_DUP << OP_HASH160 << hash << OP_EQUALVERIFY << OP_CHECKSIG;
+}
+
+static CDataStream SerializeCompressed(const CTxOut& txout)
+{
+    CDataStream ss(SER_DISK, 0);
+    ss << CTxOutCompressor(txout);
+    return ss;
+}
+
+BOOST_AUTO_TEST_CASE(compress_colored_scripts)
+{
+    for (TokenTypes type : {TokenTypes::REISSUABLE, TokenTypes::NON_REISSUABLE, TokenTypes::NFT}) {
+        for (bool fScriptHash : {false, true}) {
+            CTxOut txout(100, ColoredScript(type, fScriptHash));
+            BOOST_CHECK_EQUAL(txout.scriptPubKey.size(), fScriptHash ? 58U : 60U);
+
+            CDataStream ss = SerializeCompressed(txout);
+            // amount (1 byte) + size code (2 bytes) + payload (32 bytes) + hash (20 bytes)
+            BOOST_CHECK_EQUAL(ss.size(), 55U);
+
+            CTxOut decoded;
+            ss >> CTxOutCompressor(decoded);
+            BOOST_CHECK(ss.empty());
+            BOOST_CHECK(decoded == txout);
+        }
+    }
+
+    // A colored script with another layout is stored as is
+    CScript script = ColoredScript(TokenTypes::NFT, false);
+    script << OP_DROP;
+    CTxOut txout(1, script);
+    CDataStream ss = SerializeCompressed(txout);
+    BOOST_CHECK_EQUAL(ss.size(), 1U + 1U + script.size());
+    CTxOut decoded;
+    ss >> CTxOutCompressor(decoded);
+    BOOST_CHECK(decoded == txout);
+}
+
+BOOST_AUTO_TEST_CASE(compress_colored_scripts_legacy)
+{
+    // Coins written before the colored special scripts stored them uncompressed,
+    // with the size code of a regular script; they must still decode.
+    for (bool fScriptHash : {false, true}) {
+        CTxOut txout(50 * COIN, ColoredScript(TokenTypes::REISSUABLE, fScriptHash));
+        CDataStream ss(SER_DISK, 0);
+        uint64_t nVal = CompressAmount(txout.nValue);
+        unsigned int nSize = txout.scriptPubKey.size() + 6;
+        ss << VARINT(nVal) << VARINT(nSize);
+        ss.write((const char*)txout.scriptPubKey.data(), txout.scriptPubKey.size());
+
+        CTxOut decoded;
+        ss >> CTxOutCompressor(decoded);
+        BOOST_CHECK(ss.empty());
+        BOOST_CHECK(decoded == txout);
+    }
+
+    // Overly long scripts are stored as the OP_RETURN they decode to, so
+    // their size codes cannot be mistaken for colored special scripts.
+    std::vector<unsigned char> vch(MAX_SCRIPT_SIZE + 1, OP_NOP);
+    CTxOut txout(1, CScript(vch.begin(), vch.end()));
+    CDataStream ss = SerializeCompressed(txout);
+    CTxOut decoded;
+    ss >> CTxOutCompressor(decoded);
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(decoded.scriptPubKey == CScript() << OP_RETURN);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
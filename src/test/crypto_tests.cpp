@@ -11,6 +11,7 @@
 #include <crypto/sha512.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <crypto/muhash.h>
 #include <random.h>
 #include <utilstrencodings.h>
 #include <test/test_tapyrus.h>
@@ -561,4 +562,86 @@ BOOST_AUTO_TEST_CASE(sha256d64)
     }
 }
 
+static MuHash3072 FromInt(unsigned char i)
+{
+    unsigned char tmp[32] = {i, 0};
+    return MuHash3072(tmp, sizeof(tmp));
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    uint256 out;
+
+    for (int iter = 0; iter < 10; ++iter) {
+        uint256 res;
+        int table[4];
+        for (int i = 0; i < 4; ++i) {
+            table[i] = InsecureRandBits(3);
+        }
+        for (int order = 0; order < 4; ++order) {
+            MuHash3072 acc;
+            for (int i = 0; i < 4; ++i) {
+                int t = table[i ^ order];
+                if (t & 4) {
+                    acc /= FromInt(t & 3);
+                } else {
+                    acc *= FromInt(t & 3);
+                }
+            }
+            acc.Finalize(out);
+            if (order == 0) {
+                res = out;
+            } else {
+                BOOST_CHECK(res == out);
+            }
+        }
+
+        MuHash3072 x = FromInt(InsecureRandBits(4)); // x=X
+        MuHash3072 y = FromInt(InsecureRandBits(4)); // x=X, y=Y
+        MuHash3072 z;                                // x=X, y=Y, z=1
+        z *= x;                                      // x=X, y=Y, z=X
+        z *= y;                                      // x=X, y=Y, z=X*Y
+        y *= x;                                      // x=X, y=Y*X, z=X*Y
+        z /= y;                                      // x=X, y=Y*X, z=1
+        z.Finalize(out);
+
+        uint256 out2;
+        MuHash3072 a;
+        a.Finalize(out2);
+
+        BOOST_CHECK(out == out2);
+    }
+
+    // Known answer
+    MuHash3072 acc = FromInt(0);
+    acc *= FromInt(1);
+    acc /= FromInt(2);
+    acc.Finalize(out);
+    BOOST_CHECK_EQUAL(out, uint256S("10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863"));
+
+    // Inserting and removing the same bytes leaves the set unchanged
+    const unsigned char data[] = {1, 2, 3};
+    MuHash3072 acc2 = FromInt(0);
+    acc2.Insert(data, sizeof(data));
+    acc2.Remove(data, sizeof(data));
+    acc2.Finalize(out);
+    MuHash3072 acc3 = FromInt(0);
+    uint256 out3;
+    acc3.Finalize(out3);
+    BOOST_CHECK(out == out3);
+
+    // Serialization round trip of a non-normalized state
+    MuHash3072 serchk = FromInt(1);
+    serchk /= FromInt(2);
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << serchk;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 deserialized;
+    ss >> deserialized;
+    uint256 out4, out5;
+    serchk.Finalize(out4);
+    deserialized.Finalize(out5);
+    BOOST_CHECK(out4 == out5);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -198,6 +198,125 @@ BOOST_AUTO_TEST_CASE(existing_data_reindex)
     BOOST_CHECK_EQUAL(res3.ToString(), in2.ToString());
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_profile)
+{
+    std::string name, error;
+    DBProfile profile;
+    BOOST_CHECK(ParseDBProfileArg("chainstate:compression=1,bloombits=0,blocksize=16,maxfilesize=8,writebuffer=64", name, profile, error));
+    BOOST_CHECK_EQUAL(name, "chainstate");
+    BOOST_CHECK(profile.compression);
+    BOOST_CHECK_EQUAL(profile.bloom_bits, 0);
+    BOOST_CHECK_EQUAL(profile.block_size, 16U * 1024);
+    BOOST_CHECK_EQUAL(profile.max_file_size, 8U * 1024 * 1024);
+    BOOST_CHECK_EQUAL(profile.write_buffer_size, 64U * 1024 * 1024);
+
+    BOOST_CHECK(!ParseDBProfileArg("chainstate", name, profile, error));
+    BOOST_CHECK(!ParseDBProfileArg("wallet:bloombits=10", name, profile, error));
+    BOOST_CHECK(!ParseDBProfileArg("index:bloombits", name, profile, error));
+    BOOST_CHECK(!ParseDBProfileArg("index:bloombits=-1", name, profile, error));
+    BOOST_CHECK(!ParseDBProfileArg("index:compression=2", name, profile, error));
+    BOOST_CHECK(!ParseDBProfileArg("index:blocksize=0", name, profile, error));
+    BOOST_CHECK(!ParseDBProfileArg("index:cache=1", name, profile, error));
+
+    BOOST_CHECK(DefaultDBProfile("chainstate") == DBProfile());
+    BOOST_CHECK(DefaultDBProfile("txindex") != DBProfile());
+
+    // a non-default profile is recorded in the database, and removed again
+    // when the database is opened with the default one
+    fs::path ph = SetDataDir("dbwrapper_profile") / "chainstate";
+    gArgs.ForceSetArg("-dbprofile", "chainstate:bloombits=0,maxfilesize=4");
+    {
+        CDBWrapper dbw(ph, (1 << 20), false, true, false);
+        BOOST_CHECK_EQUAL(dbw.GetName(), "chainstate");
+        BOOST_CHECK_EQUAL(dbw.GetProfile().bloom_bits, 0);
+        BOOST_CHECK_EQUAL(dbw.GetProfile().max_file_size, 4U * 1024 * 1024);
+        BOOST_CHECK_EQUAL(dbw.GetProfile().write_buffer_size, (1U << 20) / 4);
+        BOOST_CHECK(!dbw.IsEmpty());
+        BOOST_CHECK(dbw.Write('k', InsecureRand256()));
+
+        std::string stats;
+        BOOST_CHECK(dbw.GetProperty("leveldb.stats", stats));
+        bool found = false;
+        ForEachDBWrapper([&](const CDBWrapper& db) { found |= &db == &dbw; });
+        BOOST_CHECK(found);
+    }
+    gArgs.ForceSetArg("-dbprofile", "chainstate:bloombits=10");
+    {
+        CDBWrapper dbw(ph, (1 << 20), false, false, false);
+        BOOST_CHECK(dbw.GetProfile().bloom_bits == 10);
+        BOOST_CHECK(dbw.Erase('k'));
+        BOOST_CHECK(dbw.IsEmpty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_backends)
+{
+    for (const std::string& backend : DB_BACKENDS) {
+        gArgs.ForceSetArg("-dbbackend", backend);
+        fs::path ph = SetDataDir("dbwrapper_backends_" + backend);
+        CDBWrapper dbw(ph, (1 << 20), true, false, false);
+        BOOST_CHECK_EQUAL(dbw.GetBackend(), backend);
+        BOOST_CHECK(dbw.IsEmpty());
+
+        for (uint8_t x = 0; x < 10; x++) {
+            BOOST_CHECK(dbw.Write(x, (uint32_t)x * 2));
+        }
+        uint32_t res;
+        BOOST_CHECK(dbw.Read((uint8_t)3, res));
+        BOOST_CHECK_EQUAL(res, 6U);
+        BOOST_CHECK(dbw.Exists((uint8_t)9));
+        BOOST_CHECK(dbw.Erase((uint8_t)9));
+        BOOST_CHECK(!dbw.Exists((uint8_t)9));
+
+        // a snapshot and its iterator are not affected by later writes
+        std::unique_ptr<CDBSnapshot> snapshot = dbw.NewSnapshot();
+        std::unique_ptr<CDBIterator> it(snapshot->NewIterator());
+        CDBBatch batch(dbw);
+        batch.Write((uint8_t)3, (uint32_t)100);
+        batch.Erase((uint8_t)4);
+        batch.Write((uint8_t)9, (uint32_t)18);
+        dbw.WriteBatch(batch);
+
+        BOOST_CHECK(snapshot->Read((uint8_t)3, res));
+        BOOST_CHECK_EQUAL(res, 6U);
+        BOOST_CHECK(snapshot->Read((uint8_t)4, res));
+        BOOST_CHECK(!snapshot->Read((uint8_t)9, res));
+        BOOST_CHECK(dbw.Read((uint8_t)3, res));
+        BOOST_CHECK_EQUAL(res, 100U);
+        BOOST_CHECK(!dbw.Exists((uint8_t)4));
+
+        uint8_t key;
+        it->Seek((uint8_t)2);
+        for (uint8_t x = 2; x < 9; x++) {
+            BOOST_REQUIRE(it->Valid());
+            BOOST_CHECK(it->GetKey(key));
+            BOOST_CHECK(it->GetValue(res));
+            BOOST_CHECK_EQUAL(key, x);
+            BOOST_CHECK_EQUAL(res, x * 2U);
+            it->Next();
+        }
+        BOOST_CHECK(!it->Valid());
+        it.reset();
+        snapshot.reset();
+
+        // a new iterator sees the writes
+        std::vector<uint8_t> keys;
+        it.reset(dbw.NewIterator());
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+            BOOST_CHECK(it->GetKey(key));
+            keys.push_back(key);
+        }
+        BOOST_CHECK(keys == std::vector<uint8_t>({0, 1, 2, 3, 5, 6, 7, 8, 9}));
+        it.reset();
+
+        dbw.CompactRange((uint8_t)0, (uint8_t)9);
+        BOOST_CHECK(dbw.Read((uint8_t)9, res));
+        BOOST_CHECK_EQUAL(res, 18U);
+        BOOST_CHECK(dbw.EstimateSize((uint8_t)0, (uint8_t)9) < 1000);
+    }
+    gArgs.ForceSetArg("-dbbackend", DEFAULT_DB_BACKEND);
+}
+
 BOOST_AUTO_TEST_CASE(iterator_ordering)
 {
     fs::path ph = SetDataDir("iterator_ordering");
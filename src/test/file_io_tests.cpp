@@ -8,6 +8,8 @@
 #include <primitives/block.h>
 #include <validation.h>
 #include <file_io.h>
+#include <fs.h>
+#include <util.h>
 #include <test/test_tapyrus.h>
 
 #include <boost/test/unit_test.hpp>
@@ -63,4 +65,55 @@ BOOST_AUTO_TEST_CASE(file_io_find_block_pos)
     // previous block data and all serialization headers.
 }
 
+BOOST_AUTO_TEST_CASE(file_io_block_import_pipeline)
+{
+    // A block file with junk before, between and after the blocks
+    std::vector<CBlock> blocks;
+    for (int i = 0; i < 20; i++) {
+        CBlock block(FederationParams().GenesisBlock());
+        block.nTime += i + 1;
+        blocks.push_back(block);
+    }
+    const fs::path path = GetDataDir() / "blk_import_test.dat";
+    std::vector<unsigned int> positions;
+    {
+        CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!fileout.IsNull());
+        std::vector<unsigned char> junk(3);
+        for (const CBlock& block : blocks) {
+            fileout.write((const char*)junk.data(), junk.size());
+            fileout << FederationParams().MessageStart() << (unsigned int)::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            positions.push_back(ftell(fileout.Get()));
+            fileout << block;
+            junk.push_back(0);
+        }
+        fileout.write((const char*)junk.data(), junk.size());
+    }
+
+    for (bool fWithPos : {false, true}) {
+        CDiskBlockPos pos(7, 0);
+        FILE* file = fsbridge::fopen(path, "rb");
+        BOOST_REQUIRE(file);
+        BlockImportPipeline pipeline(file, fWithPos ? &pos : nullptr, MAX_BLOCK_SIZE, MAX_BLOCK_SIZE, 3);
+        size_t i = 0;
+        while (std::shared_ptr<BlockImportFrame> frame = pipeline.Next()) {
+            BOOST_REQUIRE(i < blocks.size());
+            BOOST_REQUIRE(frame->pblock);
+            BOOST_CHECK(frame->pblock->GetHash() == blocks[i].GetHash());
+            BOOST_CHECK(frame->pblock->fCheckedMerkleRoot);
+            BOOST_CHECK(frame->pblock->fCheckedTransactions);
+            BOOST_CHECK_EQUAL(frame->pos.nPos, positions[i]);
+            BOOST_CHECK_EQUAL(frame->pos.nFile, fWithPos ? 7 : -1);
+            // the caller's position is updated while the file is still being read
+            pos.nPos = frame->pos.nPos;
+            i++;
+        }
+        BOOST_CHECK_EQUAL(i, blocks.size());
+        pipeline.Stop();
+        BOOST_CHECK(pipeline.strAbortReason.empty());
+        BOOST_CHECK_EQUAL(pipeline.nFrames, blocks.size());
+    }
+    fs::remove(path);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
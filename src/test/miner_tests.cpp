@@ -633,4 +633,221 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_required_age_in_secs)
     BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHashMalFix() == hashPastTimeTx);
 }
 
+/** Spend the first output of prev to key, paying fee. */
+static CTransactionRef SpendToKey(const CTransactionRef& prev, const CKey& key, CAmount fee)
+{
+    CScript script = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction tx;
+    tx.nFeatures = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(prev->GetHashMalFix(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = prev->vout[0].nValue - fee;
+    tx.vout[0].scriptPubKey = script;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(script, tx, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(key.Sign_Schnorr(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return MakeTransactionRef(std::move(tx));
+}
+
+static void AddToMempool(const CTransactionRef& tx)
+{
+    CTxMempoolAcceptanceOptions opt;
+    LOCK(cs_main);
+    BOOST_CHECK(AcceptToMemoryPool(tx, opt));
+}
+
+/** The transactions of a template, but the coinbase, in block order */
+static std::vector<uint256> TemplateTxids(const CBlockTemplate& blocktemplate)
+{
+    std::vector<uint256> txids;
+    for (size_t i = 1; i < blocktemplate.block.vtx.size(); ++i) {
+        txids.push_back(blocktemplate.block.vtx[i]->GetHashMalFix());
+    }
+    return txids;
+}
+
+BOOST_FIXTURE_TEST_CASE(BlockTemplateBuilder_incremental, TestChainSetup)
+{
+    const CScript script = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    BlockTemplateBuilder builder(scheduler);
+
+    const CTransactionRef parent = SpendToKey(m_coinbase_txns[0], coinbaseKey, 10000);
+    const CTransactionRef child = SpendToKey(parent, coinbaseKey, 10000);
+    const CTransactionRef other = SpendToKey(m_coinbase_txns[1], coinbaseKey, 10000);
+    AddToMempool(parent);
+    AddToMempool(child);
+
+    // The first template selects from the whole mempool.
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params(), builder).CreateNewBlock(script);
+    BOOST_CHECK(TemplateTxids(*pblocktemplate) == TemplateTxids(*BlockAssembler(Params()).CreateNewBlock(script)));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+
+    // A new transaction is appended.
+    AddToMempool(other);
+    pblocktemplate = BlockAssembler(Params(), builder).CreateNewBlock(script);
+    std::vector<uint256> expected{parent->GetHashMalFix(), child->GetHashMalFix(), other->GetHashMalFix()};
+    BOOST_CHECK(TemplateTxids(*pblocktemplate) == expected);
+
+    // Transactions under the required age are left out, with their descendants.
+    pblocktemplate = BlockAssembler(Params(), builder).CreateNewBlock(script, 60);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+
+    // Transactions confirmed on the tip are dropped. The block confirms the
+    // whole mempool, as its coinbase is paid the fees of the template.
+    CreateAndProcessBlock({CMutableTransaction(*parent), CMutableTransaction(*child), CMutableTransaction(*other)}, script);
+    const CTransactionRef late = SpendToKey(m_coinbase_txns[2], coinbaseKey, 10000);
+    AddToMempool(late);
+    pblocktemplate = BlockAssembler(Params(), builder).CreateNewBlock(script);
+    expected = {late->GetHashMalFix()};
+    BOOST_CHECK(TemplateTxids(*pblocktemplate) == expected);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+    }
+
+    // A reorg returning the transactions to the mempool selects from the whole mempool again.
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, chainActive.Tip()));
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 4U);
+    pblocktemplate = BlockAssembler(Params(), builder).CreateNewBlock(script);
+    BOOST_CHECK(TemplateTxids(*pblocktemplate) == TemplateTxids(*BlockAssembler(Params()).CreateNewBlock(script)));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 5U);
+}
+
+BOOST_FIXTURE_TEST_CASE(BlockTemplateBuilder_precompute, TestChainSetup)
+{
+    const CScript script = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    BlockTemplateBuilder builder(scheduler);
+
+    const CTransactionRef tx = SpendToKey(m_coinbase_txns[0], coinbaseKey, 10000);
+    AddToMempool(tx);
+    CreateAndProcessBlock({}, script);
+
+    CBlock block;
+    block.vtx.push_back(m_coinbase_txns.back());
+    block.vtx.push_back(tx);
+    const CBlockIndex* tip;
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip();
+    }
+    {
+        LOCK(mempool.cs);
+        BOOST_CHECK(!builder.IsValidated(tip, block));
+    }
+
+    // The candidate on top of the new tip is validated ahead of the templates.
+    builder.UpdatedBlockTip(tip, tip->pprev, false);
+    {
+        LOCK(mempool.cs);
+        BOOST_CHECK(builder.IsValidated(tip, block));
+        BOOST_CHECK(!builder.IsValidated(tip->pprev, block));
+
+        // The same txid with another scriptSig was not validated.
+        CMutableTransaction malleated(*tx);
+        malleated.vin[0].scriptSig << OP_0;
+        CBlock malleatedBlock(block);
+        malleatedBlock.vtx[1] = MakeTransactionRef(malleated);
+        BOOST_CHECK(malleatedBlock.vtx[1]->GetHashMalFix() == tx->GetHashMalFix());
+        BOOST_CHECK(!builder.IsValidated(tip, malleatedBlock));
+    }
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params(), builder).CreateNewBlock(script);
+    BOOST_CHECK(TemplateTxids(*pblocktemplate) == std::vector<uint256>{tx->GetHashMalFix()});
+    BOOST_CHECK(pblocktemplate->block.vtx[0]->vout[0].scriptPubKey == script);
+
+    // A coinbase that could make the block invalid is still validated.
+    std::vector<unsigned char> pubkeyHash(20);
+    const CPubKey pubkey = coinbaseKey.GetPubKey();
+    CHash160().Write(pubkey.data(), pubkey.size()).Finalize(pubkeyHash.data());
+    const ColorIdentifier colorId(COutPoint(tx->GetHashMalFix(), 0), TokenTypes::NON_REISSUABLE);
+    const CScript colored_script = CScript() << colorId.toVector() << OP_COLOR << OP_DUP << OP_HASH160 << pubkeyHash << OP_EQUALVERIFY << OP_CHECKSIG;
+    BOOST_CHECK_EXCEPTION(BlockAssembler(Params(), builder).CreateNewBlock(colored_script), std::runtime_error, HasReason("bad-cb-issuetoken"));
+}
+
+BOOST_FIXTURE_TEST_CASE(TestBlockValidity_result_reused, TestChainSetup)
+{
+    const CScript script = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const CTransactionRef tx = SpendToKey(m_coinbase_txns[0], coinbaseKey, 10000);
+    AddToMempool(tx);
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params()).CreateNewBlock(script);
+    CBlock& block = pblocktemplate->block;
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), 2U);
+    {
+        LOCK(cs_main);
+        unsigned int extraNonce = 0;
+        IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
+
+        // Without its merkle root checked, the result is not kept.
+        CValidationState state;
+        BOOST_CHECK(TestBlockValidity(state, block, chainActive.Tip(), false, false));
+        BOOST_CHECK(!g_chainstate.HaveValidatedBlock(block.GetHashForSign()));
+        BOOST_CHECK(TestBlockValidity(state, block, chainActive.Tip(), false, true));
+        BOOST_CHECK(g_chainstate.HaveValidatedBlock(block.GetHashForSign()));
+    }
+
+    // The signed block is connected from the result of its proposal.
+    XFieldAggPubKey aggpubkeyChange;
+    CXFieldHistory().GetLatest(TAPYRUS_XFIELDTYPES::AGGPUBKEY, aggpubkeyChange);
+    std::vector<unsigned char> blockProof;
+    createSignedBlockProof(block, blockProof);
+    BOOST_REQUIRE(block.AbsorbBlockProof(blockProof, CPubKey(aggpubkeyChange.getPubKey())));
+    BOOST_CHECK(ProcessNewBlock(std::make_shared<const CBlock>(block), true, nullptr));
+
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Tip();
+        BOOST_CHECK(pindex->GetBlockHash() == block.GetHash());
+        BOOST_CHECK(!g_chainstate.HaveValidatedBlock(block.GetHashForSign()));
+        BOOST_CHECK(!pcoinsTip->HaveCoin(tx->vin[0].prevout));
+        BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(tx->GetHashMalFix(), 0)));
+        BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(block.vtx[0]->GetHashMalFix(), 0)));
+        CBlockUndo blockundo;
+        BOOST_REQUIRE(UndoReadFromDisk(blockundo, pindex));
+        BOOST_REQUIRE_EQUAL(blockundo.vtxundo.size(), 1U);
+        BOOST_REQUIRE_EQUAL(blockundo.vtxundo[0].vprevout.size(), 1U);
+        BOOST_CHECK(blockundo.vtxundo[0].vprevout[0].out == m_coinbase_txns[0]->vout[0]);
+
+        // A result found on top of another parent is dropped: reconnecting the
+        // block checks its transactions again, or its empty undo data would fail.
+        CValidatedBlock validated;
+        validated.hashForSign = block.GetHashForSign();
+        validated.hashPrevBlock = block.GetHash();
+        g_chainstate.AddValidatedBlock(std::move(validated));
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, pindex));
+        ResetBlockFailureFlags(pindex);
+    }
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip() == pindex);
+        BOOST_CHECK(!g_chainstate.HaveValidatedBlock(block.GetHashForSign()));
+        BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(tx->GetHashMalFix(), 0)));
+
+        // A result on top of the same parent that does not apply to the UTXO
+        // set, here for its empty undo data, falls back to checking the block.
+        CValidatedBlock validated;
+        validated.hashForSign = block.GetHashForSign();
+        validated.hashPrevBlock = pindex->pprev->GetBlockHash();
+        g_chainstate.AddValidatedBlock(std::move(validated));
+        BOOST_CHECK(InvalidateBlock(state, pindex));
+        ResetBlockFailureFlags(pindex);
+    }
+    BOOST_CHECK(ActivateBestChain(state));
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip() == pindex);
+    BOOST_CHECK(!g_chainstate.HaveValidatedBlock(block.GetHashForSign()));
+    BOOST_CHECK(!pcoinsTip->HaveCoin(tx->vin[0].prevout));
+    BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(tx->GetHashMalFix(), 0)));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
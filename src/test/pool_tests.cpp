@@ -0,0 +1,80 @@
+// Copyright (c) 2024 Chaintope Inc.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coins.h>
+#include <memusage.h>
+#include <support/allocators/pool.h>
+
+#include <test/test_tapyrus.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <unordered_map>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pool_resource_reuse)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+
+    // blocks are carved from the chunk one after another
+    void* a = resource.Allocate(8, 8);
+    void* b = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(static_cast<char*>(b) - static_cast<char*>(a), 8);
+
+    // a freed block is handed out again for the same size only
+    resource.Deallocate(a, 8, 8);
+    void* c = resource.Allocate(16, 8);
+    BOOST_CHECK(c != a);
+    BOOST_CHECK(resource.Allocate(8, 8) == a);
+
+    // large allocations bypass the pool
+    void* big = resource.Allocate(128, 8);
+    resource.Deallocate(big, 128, 8);
+    resource.Deallocate(b, 8, 8);
+    resource.Deallocate(c, 16, 8);
+
+    // the chunk is used up before a new one is taken
+    std::vector<void*> blocks;
+    for (int i = 0; i < 1024 / 64 + 1; i++)
+        blocks.push_back(resource.Allocate(64, 8));
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    for (void* p : blocks)
+        resource.Deallocate(p, 64, 8);
+}
+
+BOOST_AUTO_TEST_CASE(pool_coins_map)
+{
+    // flags are stored in the padding of Coin
+    BOOST_CHECK_EQUAL(sizeof(CCoinsCacheEntry), sizeof(Coin));
+
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map{0, CCoinsMap::hasher{}, CCoinsMap::key_equal{}, &resource};
+    for (uint32_t i = 0; i < 10000; i++) {
+        CCoinsCacheEntry& entry = map[COutPoint(InsecureRand256(), i)];
+        entry.coin = Coin(CTxOut(i, CScript()), i, false);
+        entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+    }
+    for (const auto& entry : map) {
+        BOOST_CHECK_EQUAL(entry.second.coin.out.nValue, entry.first.n);
+        BOOST_CHECK_EQUAL(entry.second.flags, CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH);
+    }
+
+    // assigning a coin leaves the flags packed next to it untouched
+    CCoinsCacheEntry& entry = map.begin()->second;
+    entry.coin = Coin(CTxOut(1, CScript() << OP_TRUE), 1, true);
+    BOOST_CHECK_EQUAL(entry.flags, CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH);
+
+    // the usage charged for the map covers the blocks handed out by the pool
+    size_t usage = memusage::DynamicUsage(map);
+    BOOST_CHECK(usage >= map.size() * sizeof(CCoinsMap::value_type));
+    size_t chunks = resource.NumAllocatedChunks();
+    map.clear();
+    // erased nodes stay in the pool for reuse, but are no longer charged
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+    BOOST_CHECK(memusage::DynamicUsage(map) < usage / 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -56,8 +56,7 @@ std::ostream& operator<<(std::ostream& os, const uint256& num)
 // Reset the xfield history to the genesis block state.
 void CXFieldHistoryWithReset::Reset()
 {
-    xfieldHistory.find(TAPYRUS_XFIELDTYPES::AGGPUBKEY)->second.xfieldChanges.clear();
-    xfieldHistory.find(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE)->second.xfieldChanges.clear();
+    SetSnapshot(std::make_shared<const XFieldHistorySnapshot>());
     Add(TAPYRUS_XFIELDTYPES::AGGPUBKEY, XFieldChange(genesis.xfield.xfieldValue, 0, genesis.GetHash()));
     Add(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE, XFieldChange(MAX_BLOCK_SIZE, 0, genesis.GetHash()));
 }
@@ -2,9 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <issuedcolorids.h>
 #include <txdb.h>
 #include <test/test_tapyrus.h>
 
+#include <map>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(txdb_tests, BasicTestingSetup)
@@ -118,4 +121,181 @@ BOOST_AUTO_TEST_CASE(txdb_aggpubkey_serialize_tests)
     BOOST_CHECK_EQUAL(HexStr(stream2.begin(), stream2.end()).size(), len + 6);
 }
 
+BOOST_AUTO_TEST_CASE(txdb_issued_colorids_tests)
+{
+    LOCK(cs_main);
+    CCoinsViewDB view(1 << 20, true);
+    CIssuedColorIds state;
+    view.SetColorIdState(&state);
+
+    std::set<ColorIdentifier> issued;
+    for (int i = 0; i < 1000; i++)
+        issued.emplace(COutPoint(InsecureRand256(), i), i % 2 ? TokenTypes::NFT : TokenTypes::NON_REISSUABLE);
+    state.Insert(issued);
+    BOOST_CHECK_EQUAL(state.PendingInserts(), issued.size());
+
+    // Flushed colorIds are looked up in the database
+    CCoinsMapMemoryResource resource;
+    CCoinsMap coins{0, CCoinsMap::hasher{}, CCoinsMap::key_equal{}, &resource};
+    BOOST_CHECK(view.BatchWrite(coins, InsecureRand256()));
+    BOOST_CHECK_EQUAL(state.PendingInserts(), 0U);
+    for (const ColorIdentifier& id : issued)
+        BOOST_CHECK(state.IsIssued(id));
+
+    // The same outpoint with another token type is another colorId
+    const ColorIdentifier first = *issued.begin();
+    ColorIdentifier other = first;
+    other.type = first.type == TokenTypes::NFT ? TokenTypes::NON_REISSUABLE : TokenTypes::NFT;
+    BOOST_CHECK(!issued.count(other) && !state.IsIssued(other));
+    for (int i = 0; i < 1000; i++)
+        BOOST_CHECK(!state.IsIssued(ColorIdentifier(COutPoint(InsecureRand256(), i), TokenTypes::NFT)));
+
+    // Erases stay in the filter but not in the database
+    state.Erase(first);
+    BOOST_CHECK(!state.IsIssued(first));
+    std::unique_ptr<CIssuedColorIds> clone = state.Clone();
+    BOOST_CHECK(!clone->IsIssued(first));
+    BOOST_CHECK(clone->IsIssued(*issued.rbegin()));
+    BOOST_CHECK(view.BatchWrite(coins, InsecureRand256()));
+    BOOST_CHECK(!state.IsIssued(first));
+    BOOST_CHECK_EQUAL(state.FilterSize(), issued.size());
+    BOOST_CHECK(state.DynamicMemoryUsage() > 0);
+
+    // A new state loads the filter from the database
+    CIssuedColorIds loaded;
+    view.SetColorIdState(&loaded);
+    BOOST_CHECK(view.LoadIssuedColorIds(loaded));
+    BOOST_CHECK_EQUAL(loaded.FilterSize(), issued.size() - 1);
+    BOOST_CHECK(!loaded.IsIssued(first));
+    for (auto it = std::next(issued.begin()); it != issued.end(); ++it)
+        BOOST_CHECK(loaded.IsIssued(*it));
+}
+
+BOOST_AUTO_TEST_CASE(txdb_background_flush_tests)
+{
+    LOCK(cs_main);
+    CCoinsViewDB db(1 << 20, true);
+    CIssuedColorIds state;
+    db.SetColorIdState(&state);
+    CCoinsViewBackgroundFlush flush(&db);
+    CCoinsViewCache cache(&flush);
+
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 100; i++) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(outpoints.back(), Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false), false);
+    }
+    const ColorIdentifier id(outpoints.front(), TokenTypes::NFT);
+    state.Insert({id});
+    uint256 hashBlock = InsecureRand256();
+    cache.SetBestBlock(hashBlock);
+
+    // the dirty set is written in the background and served until it is in the database
+    int64_t nStart = GetTimeMicros();
+    std::shared_ptr<CCoinsDirtySet> dirty = cache.TakeDirty();
+    BOOST_CHECK_EQUAL(dirty->coins.size(), outpoints.size());
+    BOOST_CHECK(flush.Start(dirty, nStart));
+    BOOST_CHECK(flush.GetBestBlock() == hashBlock);
+    for (const COutPoint& outpoint : outpoints)
+        BOOST_CHECK(flush.HaveCoin(outpoint));
+    BOOST_CHECK(state.IsIssued(id));
+    BOOST_CHECK_EQUAL(state.PendingInserts(), 0U);
+
+    BOOST_CHECK(flush.Wait());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    for (const COutPoint& outpoint : outpoints) {
+        Coin coin;
+        BOOST_CHECK(db.GetCoin(outpoint, coin));
+        BOOST_CHECK_EQUAL(coin.out.nValue, outpoint.n + 1);
+    }
+    BOOST_CHECK(state.IsIssued(id));
+    CCoinsViewBackgroundFlush::Stats stats = flush.GetStats();
+    BOOST_CHECK(!stats.in_progress);
+    BOOST_CHECK_EQUAL(stats.last_coins, outpoints.size());
+
+    // the cache kept the coins, unmodified; a spend is written as an erase
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size());
+    BOOST_CHECK(cache.TakeDirty()->coins.empty());
+    BOOST_CHECK(!flush.Failed());
+    BOOST_CHECK(cache.SpendCoin(outpoints.back()));
+    cache.SetBestBlock(InsecureRand256());
+    dirty = cache.TakeDirty();
+    BOOST_CHECK_EQUAL(dirty->coins.size(), 1U);
+    BOOST_CHECK(flush.Start(dirty, GetTimeMicros()));
+    BOOST_CHECK(!cache.HaveCoin(outpoints.back()));
+    BOOST_CHECK(flush.Wait());
+    BOOST_CHECK(!db.HaveCoin(outpoints.back()));
+    BOOST_CHECK(db.GetBestBlock() == cache.GetBestBlock());
+
+    // a synchronous write goes through as before
+    cache.AddCoin(outpoints.back(), Coin(CTxOut(1, CScript() << OP_TRUE), 2, false), false);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.HaveCoin(outpoints.back()));
+}
+
+BOOST_AUTO_TEST_CASE(txdb_block_index_load_tests)
+{
+    CBlockTreeDB blocktree(1 << 20, true);
+
+    // a chain of entries spread over the whole key space
+    CBlockIndexArena arena;
+    std::vector<uint256> hashes;
+    hashes.reserve(500);
+    std::vector<const CBlockIndex*> entries;
+    for (int i = 0; i < 500; i++) {
+        CBlockIndex* pindex = arena.New();
+        pindex->pprev = entries.empty() ? nullptr : const_cast<CBlockIndex*>(entries.back());
+        pindex->nHeight = i;
+        pindex->nTime = InsecureRand32();
+        pindex->nTx = i + 1;
+        pindex->nStatus = BLOCK_VALID_TREE;
+        pindex->SetHeaderExtra(CXField(), std::vector<unsigned char>(64, i & 0xff));
+        hashes.push_back(CDiskBlockIndex(pindex).GetBlockHash());
+        pindex->phashBlock = &hashes.back();
+        entries.push_back(pindex);
+    }
+    BOOST_CHECK_EQUAL(arena.Size(), entries.size());
+    BOOST_CHECK(blocktree.WriteBatchSync({}, 0, entries));
+    for (const CBlockIndex* pindex : entries) {
+        CBlockHeaderExtra extra;
+        BOOST_CHECK(blocktree.ReadBlockHeaderExtra(pindex->GetBlockHash(), extra));
+        BOOST_CHECK(extra.proof == pindex->GetHeaderExtra()->proof);
+    }
+
+    for (int nThreads : {1, 3, MAX_BLOCK_INDEX_LOAD_THREADS}) {
+        CBlockIndexArena loaded;
+        std::map<uint256, CBlockIndex*> index;
+        size_t nReserved = 0;
+        auto insert = [&](const uint256& hash) -> CBlockIndex* {
+            if (hash.IsNull())
+                return nullptr;
+            auto it = index.find(hash);
+            if (it == index.end()) {
+                it = index.emplace(hash, loaded.New()).first;
+                it->second->phashBlock = &it->first;
+            }
+            return it->second;
+        };
+        BOOST_CHECK(blocktree.LoadBlockIndexGuts(insert, [&](size_t n) { nReserved = n; loaded.Reserve(n); }, nThreads));
+        BOOST_CHECK_EQUAL(nReserved, entries.size());
+        BOOST_CHECK_EQUAL(index.size(), entries.size());
+        BOOST_CHECK_EQUAL(loaded.Size(), entries.size());
+        for (const CBlockIndex* pindex : entries) {
+            auto it = index.find(pindex->GetBlockHash());
+            BOOST_REQUIRE(it != index.end());
+            BOOST_CHECK_EQUAL(it->second->nHeight, pindex->nHeight);
+            BOOST_CHECK_EQUAL(it->second->nTime, pindex->nTime);
+            BOOST_CHECK_EQUAL(it->second->nTx, pindex->nTx);
+            // the proof stays on disk until it is needed
+            BOOST_CHECK(!it->second->HasHeaderExtra());
+            if (pindex->pprev) {
+                BOOST_REQUIRE(it->second->pprev);
+                BOOST_CHECK(it->second->pprev->GetBlockHash() == pindex->pprev->GetBlockHash());
+            } else {
+                BOOST_CHECK(!it->second->pprev);
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
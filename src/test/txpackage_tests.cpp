@@ -783,4 +783,73 @@ BOOST_FIXTURE_TEST_CASE(testmempoolaccept_missing_inputs_no_overlay_leak, Packag
     BOOST_CHECK(validationState[mtx_child.GetHashMalFix()].missingInputs);
 }
 
+BOOST_FIXTURE_TEST_CASE(package_atomic_submission_tests, PackageTestSetup)
+{
+    CValidationState state;
+    PackageValidationState packageState;
+    CTxMempoolAcceptanceOptions opt;
+    opt.context = ValidationContext::PACKAGE;
+    opt.nAbsurdFee = 1 * COIN;
+    std::vector<unsigned char> vchSig;
+    const CScript op_true_eq = CScript() << OP_TRUE << OP_EQUAL;
+
+    auto make_parent_child = [&](size_t index_cb, const CScript& child_script_sig) {
+        COutPoint spend_cbase(m_coinbase_txns[index_cb]->GetHashMalFix(), 0);
+        CMutableTransaction mtx_parent = CreateValidTransaction(spend_cbase, CAmount(49.5 * COIN), {CScript() << OP_TRUE << OP_EQUAL});
+        Sign(vchSig, coinbaseKey, m_coinbase_txns[index_cb]->vout[0].scriptPubKey, 0, mtx_parent, 0);
+        mtx_parent.vin[0].scriptSig = CScript() << vchSig;
+        CTransactionRef tx_parent{MakeTransactionRef(mtx_parent)};
+
+        COutPoint spend_parent(tx_parent->GetHashMalFix(), 0);
+        CMutableTransaction mtx_child = CreateValidTransaction(spend_parent, CAmount(45 * COIN), {CScript() << OP_TRUE << OP_EQUAL});
+        mtx_child.vin[0].scriptSig = child_script_sig;
+        for (int x = 0; x < 4; ++x)
+            mtx_child.vout.push_back(CTxOut(CAmount(1 * COIN), op_true_eq));
+        return Package{tx_parent, MakeTransactionRef(mtx_child)};
+    };
+
+    // A child failing its script check rejects the package as a whole.
+    {
+        const Package package = make_parent_child(0, CScript() << OP_2);
+        const size_t mempool_size = mempool.size();
+        packageState.clear();
+        BOOST_CHECK(!SubmitPackageToMempoolAtomic(package, state, packageState, opt));
+        BOOST_CHECK(state.IsValid());
+        BOOST_CHECK_EQUAL(mempool.size(), mempool_size);
+        BOOST_CHECK_EQUAL(packageState[package[0]->GetHashMalFix()].GetRejectCode(), REJECT_PACKAGE_TX);
+        BOOST_CHECK_EQUAL(packageState[package[0]->GetHashMalFix()].GetRejectReason(), "package-not-accepted");
+        BOOST_CHECK_EQUAL(packageState[package[1]->GetHashMalFix()].GetRejectCode(), REJECT_INVALID);
+        BOOST_CHECK(packageState[package[1]->GetHashMalFix()].GetRejectReason().find("mandatory-script-verify-flag-failed") == 0);
+    }
+
+    // A valid package is added as a whole.
+    {
+        const Package package = make_parent_child(1, CScript() << OP_TRUE);
+        const size_t mempool_size = mempool.size();
+        packageState.clear();
+        BOOST_CHECK(SubmitPackageToMempoolAtomic(package, state, packageState, opt));
+        BOOST_CHECK(state.IsValid());
+        BOOST_CHECK_EQUAL(mempool.size(), mempool_size + 2);
+        BOOST_CHECK(ArePackageTransactionsAccepted(packageState));
+        BOOST_CHECK(mempool.exists(package[0]->GetHashMalFix()));
+        BOOST_CHECK(mempool.exists(package[1]->GetHashMalFix()));
+    }
+
+    // The package is limited as a unit: its transactions and in-mempool ancestors together.
+    {
+        const Package package = make_parent_child(2, CScript() << OP_TRUE);
+        gArgs.ForceSetArg("-limitancestorcount", "1");
+        packageState.clear();
+        BOOST_CHECK(!SubmitPackageToMempoolAtomic(package, state, packageState, opt));
+        gArgs.ForceSetArg("-limitancestorcount", std::to_string(DEFAULT_ANCESTOR_LIMIT));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "package-too-long-mempool-chain");
+        BOOST_CHECK(!mempool.exists(package[0]->GetHashMalFix()));
+        // Every transaction has a result.
+        BOOST_CHECK_EQUAL(packageState.size(), package.size());
+        for (const auto& tx : package) {
+            BOOST_CHECK_EQUAL(packageState[tx->GetHashMalFix()].GetRejectReason(), "package-not-accepted");
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1600,4 +1600,50 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_burn_script, TestChainSetup)
     testTx(this, MakeTransactionRef(spendChangeTx), true);
 }
 
+/**
+ * The inputs of a transaction spending several are checked on the script check
+ * threads, and a failing one is still reported with its own error.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_parallel_script_checks, TestChainSetup)
+{
+    BOOST_REQUIRE(nScriptCheckThreads > 0);
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    auto spend_coinbases = [&](size_t first, int bad_input) {
+        CMutableTransaction tx;
+        tx.nFeatures = 1;
+        tx.vin.resize(3);
+        tx.vout.resize(1);
+        CAmount amount = 0;
+        for (size_t i = 0; i < tx.vin.size(); i++) {
+            tx.vin[i].prevout = COutPoint(m_coinbase_txns[first + i]->GetHashMalFix(), 0);
+            amount += m_coinbase_txns[first + i]->vout[0].nValue;
+        }
+        tx.vout[0].nValue = amount - 10000;
+        tx.vout[0].scriptPubKey = scriptPubKey;
+        for (size_t i = 0; i < tx.vin.size(); i++) {
+            std::vector<unsigned char> vchSig;
+            uint256 hash = SignatureHash(scriptPubKey, tx, i, SIGHASH_ALL, 0, SigVersion::BASE);
+            BOOST_CHECK(coinbaseKey.Sign_Schnorr(hash, vchSig));
+            if ((int)i == bad_input) vchSig[10] ^= 1;
+            vchSig.push_back((unsigned char)SIGHASH_ALL);
+            tx.vin[i].scriptSig = CScript() << vchSig;
+        }
+        return MakeTransactionRef(tx);
+    };
+
+    LOCK(cs_main);
+    CTxMempoolAcceptanceOptions opt;
+    BOOST_CHECK(!AcceptToMemoryPool(spend_coinbases(0, 1), opt));
+    BOOST_CHECK(opt.state.IsInvalid());
+    BOOST_CHECK(opt.state.GetRejectReason().find("mandatory-script-verify-flag-failed") == 0);
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+
+    CTxMempoolAcceptanceOptions opt_valid;
+    const CTransactionRef tx = spend_coinbases(0, -1);
+    BOOST_CHECK(AcceptToMemoryPool(tx, opt_valid));
+    BOOST_CHECK(opt_valid.state.IsValid());
+    BOOST_CHECK(mempool.exists(tx->GetHashMalFix()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -45,18 +45,17 @@ BOOST_AUTO_TEST_CASE(xfieldhistory_size_and_temp)
     CTempXFieldHistory tempHistory;
 
     //verify that history1 and history2 share a map.
-    BOOST_CHECK(&history1.getXFieldHistoryMap() == &history2.getXFieldHistoryMap());
+    BOOST_CHECK(history1.getXFieldHistoryMap() == history2.getXFieldHistoryMap());
 
-    //but tempHistory uses a different map
-    BOOST_CHECK(&tempHistory.getXFieldHistoryMap() != &history1.getXFieldHistoryMap());
-    BOOST_CHECK(&tempHistory.getXFieldHistoryMap() != &history2.getXFieldHistoryMap());
+    //tempHistory shares it too until it is modified
+    BOOST_CHECK(tempHistory.getXFieldHistoryMap() == history1.getXFieldHistoryMap());
 
     //verify that tempHistory is initialized correctly
-    BOOST_CHECK_EQUAL(tempHistory.getXFieldHistoryMap().size(), 2);
+    BOOST_CHECK_EQUAL(tempHistory.getXFieldHistoryMap()->size(), 2);
     BOOST_CHECK_EQUAL(tempHistory.GetListSize(TAPYRUS_XFIELDTYPES::AGGPUBKEY), 4);
     BOOST_CHECK_EQUAL(tempHistory.GetListSize(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE), 4);
 
-    BOOST_CHECK_EQUAL(tempHistory.getXFieldHistoryMap().size(), history1.getXFieldHistoryMap().size());
+    BOOST_CHECK_EQUAL(tempHistory.getXFieldHistoryMap()->size(), history1.getXFieldHistoryMap()->size());
     BOOST_CHECK_EQUAL(tempHistory.GetListSize(TAPYRUS_XFIELDTYPES::AGGPUBKEY), history1.GetListSize(TAPYRUS_XFIELDTYPES::AGGPUBKEY));
     BOOST_CHECK_EQUAL(tempHistory.GetListSize(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE), history1.GetListSize(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE));
 
@@ -78,7 +77,10 @@ BOOST_AUTO_TEST_CASE(xfieldhistory_size_and_temp)
     history1.Add(TAPYRUS_XFIELDTYPES::AGGPUBKEY, XFieldChange(XFieldAggPubKey(CPubKey(ParseHex(ValidPubKeyStrings[14]))), 80, uint256()));
 
     //verify that the new history2 object uses the same map as history1
-    BOOST_CHECK(&history1.getXFieldHistoryMap() == &history2.getXFieldHistoryMap());
+    BOOST_CHECK(history1.getXFieldHistoryMap() == history2.getXFieldHistoryMap());
+
+    //but tempHistory keeps the map it started from
+    BOOST_CHECK(tempHistory.getXFieldHistoryMap() != history1.getXFieldHistoryMap());
     BOOST_CHECK_EQUAL(history1.GetListSize(TAPYRUS_XFIELDTYPES::AGGPUBKEY), history2.GetListSize(TAPYRUS_XFIELDTYPES::AGGPUBKEY));
     BOOST_CHECK_EQUAL(history1.GetListSize(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE), history2.GetListSize(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE));
 
@@ -91,14 +93,19 @@ BOOST_AUTO_TEST_CASE(xfieldhistory_size_and_temp)
     BOOST_CHECK(tempHistory1.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 91).height != history1.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 91).height);
 
     //verify that changes in tempHistory1 object are not reflected in history1(hisrory2)
+    const std::shared_ptr<const XFieldHistoryMapType> beforeAdd = tempHistory1.getXFieldHistoryMap();
+    const size_t nBeforeAdd = beforeAdd->find(TAPYRUS_XFIELDTYPES::AGGPUBKEY)->second.size();
     tempHistory1.Add(TAPYRUS_XFIELDTYPES::AGGPUBKEY, XFieldChange(XFieldAggPubKey(CPubKey(ParseHex(ValidPubKeyStrings[1]))), 100, uint256()));
+    BOOST_CHECK(tempHistory1.getXFieldHistoryMap() != history1.getXFieldHistoryMap());
+    //a map obtained before the change is still valid and unchanged
+    BOOST_CHECK_EQUAL(beforeAdd->find(TAPYRUS_XFIELDTYPES::AGGPUBKEY)->second.size(), nBeforeAdd);
     BOOST_CHECK(tempHistory1.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 101).height != history1.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 101).height);
 
     tempHistory1.Add(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE, XFieldChange(4000000, 91, uint256()));
     BOOST_CHECK(tempHistory1.Get(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE, 92).height != history1.Get(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE, 92).height);
 
     //verify that tempHistory is not affected
-    BOOST_CHECK_EQUAL(tempHistory.getXFieldHistoryMap().size(), 2);
+    BOOST_CHECK_EQUAL(tempHistory.getXFieldHistoryMap()->size(), 2);
     BOOST_CHECK_EQUAL(tempHistory.GetListSize(TAPYRUS_XFIELDTYPES::AGGPUBKEY), 4);
     BOOST_CHECK_EQUAL(tempHistory.GetListSize(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE), 4);
 
@@ -114,7 +121,7 @@ BOOST_AUTO_TEST_CASE(xfieldhistory_size_and_temp)
     BOOST_CHECK_EQUAL(HexStr(stream.begin(), stream.end()), "2103af80b90d25145da28c583359beb47b21796b2fe1a23c1511e443e7a64dfdb27d5a0000000000000000000000000000000000000000000000000000000000000000000000");
 
     stream.clear();
-    stream << history1.getXFieldHistoryMap().find(TAPYRUS_XFIELDTYPES::AGGPUBKEY)->second;
+    stream << history1.getXFieldHistoryMap()->find(TAPYRUS_XFIELDTYPES::AGGPUBKEY)->second;
 
     BOOST_CHECK_EQUAL(HexStr(stream.begin(), stream.end()), std::string("0821025700236c2890233592fcef262f4520d22af9160e3d9705855140eb2aa06c35d300000000" + HexStr(FederationParams().GenesisBlock().GetHash()) + "2103831a69b8009833ab5b0326012eaf489bfea35a7321b1ca15b11d88131423fafc1400000000000000000000000000000000000000000000000000000000000000000000002102bf2027c8455800c7626542219e6208b5fe787483689f1391d6d443ec85673ecf2800000000000000000000000000000000000000000000000000000000000000000000002103b44f1cfcf46aba8bc98e2fd39f137cc43d98ab7792e4848b09c06198b042ca8b3c00000000000000000000000000000000000000000000000000000000000000000000002102b9a609d6bec0fdc9ba690986013cf7bbd13c54ffc25e6cf30916b4732c4a952a4600000000000000000000000000000000000000000000000000000000000000000000002102e78cafe033b22bda5d7d1c8e82ee932930bf12e08489bc19769cbec765568be95000000000000000000000000000000000000000000000000000000000000000000000002102473757a955a23f75379820f3071abf5b3343b78eb54e52373d06259ffa6c550b5000000000000000000000000000000000000000000000000000000000000000000000002103af80b90d25145da28c583359beb47b21796b2fe1a23c1511e443e7a64dfdb27d5a0000000000000000000000000000000000000000000000000000000000000000000000"));
 
@@ -124,7 +131,7 @@ BOOST_AUTO_TEST_CASE(xfieldhistory_size_and_temp)
     std::string("40420f0000000000" + HexStr(FederationParams().GenesisBlock().GetHash())));
 
     stream.clear();
-    stream << history1.getXFieldHistoryMap().find(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE)->second;
+    stream << history1.getXFieldHistoryMap()->find(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE)->second;
 
     BOOST_CHECK_EQUAL(HexStr(stream.begin(), stream.end()), std::string("0440420f0000000000" + HexStr(FederationParams().GenesisBlock().GetHash()) + "00093d001e000000000000000000000000000000000000000000000000000000000000000000000000127a003200000000000000000000000000000000000000000000000000000000000000000000000024f400460000000000000000000000000000000000000000000000000000000000000000000000"));
 }
@@ -176,7 +183,7 @@ BOOST_AUTO_TEST_CASE(xfieldhistory_same_height_active_chain_wins)
     pxFieldHistory->Add(TAPYRUS_XFIELDTYPES::AGGPUBKEY, activeChange);
     BOOST_CHECK_EQUAL(pxFieldHistory->GetListSize(TAPYRUS_XFIELDTYPES::AGGPUBKEY), 6);
 
-    // Get(height) scans from the back: the most recently added (active-chain) entry wins
+    // Get(height) returns the last entry at or below height: the most recently added (active-chain) entry wins
     BOOST_CHECK_EQUAL(pxFieldHistory->Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 80).blockHash, hashActive);
     BOOST_CHECK_EQUAL(pxFieldHistory->Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 85).blockHash, hashActive);
     // Height below both entries still resolves to the previous rotation at 60
@@ -188,6 +195,36 @@ BOOST_AUTO_TEST_CASE(xfieldhistory_same_height_active_chain_wins)
     BOOST_CHECK_EQUAL(pxFieldHistory->Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 80).blockHash, hashOrphan);
 }
 
+BOOST_AUTO_TEST_CASE(xfieldhistory_out_of_order_heights)
+{
+    // Fixture: genesis(key0@0) + key10@20 + key11@40 + key12@60 = 4 entries
+    CXFieldHistory history;
+    CTempXFieldHistory tempHistory;
+
+    // An entry at 90 followed by one at 70 leaves the list out of height order
+    const XFieldChange change90(XFieldAggPubKey(CPubKey(ParseHex(ValidPubKeyStrings[13]))), 90, InsecureRand256());
+    const XFieldChange change70(XFieldAggPubKey(CPubKey(ParseHex(ValidPubKeyStrings[14]))), 70, InsecureRand256());
+    history.Add(TAPYRUS_XFIELDTYPES::AGGPUBKEY, change90);
+    history.Add(TAPYRUS_XFIELDTYPES::AGGPUBKEY, change70);
+
+    // The temp history started from a copy of the earlier snapshot and does not see the new entries
+    BOOST_CHECK_EQUAL(tempHistory.GetListSize(TAPYRUS_XFIELDTYPES::AGGPUBKEY), 4);
+    BOOST_CHECK_EQUAL(tempHistory.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 95).height, 60);
+    BOOST_CHECK_EQUAL(history.GetListSize(TAPYRUS_XFIELDTYPES::AGGPUBKEY), 6);
+
+    // The last added entry at or below the height wins
+    BOOST_CHECK_EQUAL(history.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 95).blockHash, change70.blockHash);
+    BOOST_CHECK_EQUAL(history.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 90).blockHash, change70.blockHash);
+    BOOST_CHECK_EQUAL(history.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 70).blockHash, change70.blockHash);
+    BOOST_CHECK_EQUAL(history.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 69).height, 60);
+    BOOST_CHECK_EQUAL(history.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 39).height, 20);
+    BOOST_CHECK_EQUAL(history.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 19).height, 0);
+
+    BOOST_CHECK(history.Remove(TAPYRUS_XFIELDTYPES::AGGPUBKEY, change70));
+    BOOST_CHECK_EQUAL(history.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 90).blockHash, change90.blockHash);
+    BOOST_CHECK_EQUAL(history.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, 89).height, 60);
+}
+
 // IsXFieldNew uses Get(nHeight) — the block's own effective height — so that
 // a block immediately following a rotation is not misidentified as "new".
 BOOST_AUTO_TEST_CASE(is_xfield_new_consecutive_same_value)
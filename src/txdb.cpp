@@ -8,6 +8,7 @@
 
 #include <issuedcolorids.h>
 #include <chainparams.h>
+#include <compressor.h>
 #include <hash.h>
 #include <random.h>
 #include <shutdown.h>
@@ -16,6 +17,9 @@
 #include <ui_interface.h>
 #include <xfieldhistory.h>
 
+#include <trace.h>
+
+#include <exception>
 #include <stdint.h>
 #include <thread>
 
@@ -30,6 +34,14 @@ static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 static const char DB_ISSUED_COLORID = 'I';
+static const char DB_COINS_VERSION = 'V';
+
+/**
+ * Format version of the coins in the chainstate database:
+ * 0 (no DB_COINS_VERSION record): colored P2PKH/P2SH scripts stored uncompressed
+ * 1: colored P2PKH/P2SH scripts use the colored special script codes of CScriptCompressor
+ */
+static const int COINS_DB_VERSION = 1;
 
 namespace {
 
@@ -82,7 +94,25 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) {
+    return WriteCoins(mapCoins, hashBlock, erase, [this](CDBBatch& batch) {
+        AssertLockHeld(cs_main);
+        m_colorid_state->CommitToBatch(batch);
+    });
+}
+
+void CCoinsViewDB::StageColorIds() {
+    if (m_colorid_state)
+        m_colorid_state->StageCommit();
+}
+
+bool CCoinsViewDB::WriteDirty(CCoinsDirtySet& dirty) {
+    return WriteCoins(dirty.coins, dirty.hashBlock, false, [this](CDBBatch& batch) {
+        m_colorid_state->CommitStagedToBatch(batch);
+    });
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase, const std::function<void(CDBBatch&)>& commitColorIds) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -118,7 +148,8 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
         }
         count++;
         CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (erase)
+            mapCoins.erase(itOld);
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -138,7 +169,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Erase(DB_HEAD_BLOCKS);
     batch.Write(DB_BEST_BLOCK, hashBlock);
     if (m_colorid_state)
-        m_colorid_state->CommitToBatch(batch);
+        commitColorIds(batch);
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
@@ -146,12 +177,143 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return ret;
 }
 
+CCoinsViewBackgroundFlush::CCoinsViewBackgroundFlush(CCoinsViewDB* db) : CCoinsViewBacked(db), m_db(*db) {}
+
+CCoinsViewBackgroundFlush::~CCoinsViewBackgroundFlush()
+{
+    Wait();
+}
+
+bool CCoinsViewBackgroundFlush::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    std::shared_ptr<const CCoinsDirtySet> pending;
+    {
+        LOCK(m_mutex);
+        pending = m_pending;
+    }
+    if (pending) {
+        CCoinsMap::const_iterator it = pending->coins.find(outpoint);
+        if (it != pending->coins.end()) {
+            coin = it->second.coin;
+            return !coin.IsSpent();
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoin(const COutPoint &outpoint) const
+{
+    std::shared_ptr<const CCoinsDirtySet> pending;
+    {
+        LOCK(m_mutex);
+        pending = m_pending;
+    }
+    if (pending) {
+        CCoinsMap::const_iterator it = pending->coins.find(outpoint);
+        if (it != pending->coins.end())
+            return !it->second.coin.IsSpent();
+    }
+    return base->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const
+{
+    std::shared_ptr<const CCoinsDirtySet> pending;
+    {
+        LOCK(m_mutex);
+        pending = m_pending;
+    }
+    return pending ? pending->hashBlock : base->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase)
+{
+    // A synchronous write must not be overtaken by an older one still in progress.
+    if (!Wait())
+        return false;
+    std::lock_guard<std::mutex> control(m_control_mutex);
+    return base->BatchWrite(mapCoins, hashBlock, erase);
+}
+
+bool CCoinsViewBackgroundFlush::Start(std::shared_ptr<CCoinsDirtySet> dirty, int64_t nStallStart)
+{
+    if (!Wait())
+        return false;
+    std::lock_guard<std::mutex> control(m_control_mutex);
+    m_db.StageColorIds();
+    {
+        LOCK(m_mutex);
+        m_pending = dirty;
+        m_stats.in_progress = true;
+        m_stats.last_coins = dirty->coins.size();
+        m_stats.last_stall = GetTimeMicros() - nStallStart;
+    }
+    m_thread = std::thread([this, dirty] {
+        RenameThread("tapyrus-coinsflush");
+        int64_t nStart = GetTimeMicros();
+        bool fOk = false;
+        try {
+            fOk = m_db.WriteDirty(*dirty);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        int64_t nDuration = GetTimeMicros() - nStart;
+        [[maybe_unused]] int64_t nStall;
+        {
+            LOCK(m_mutex);
+            // After a failure the coins stay visible here; the node shuts down anyway.
+            if (fOk)
+                m_pending.reset();
+            if (!fOk)
+                m_failed = true;
+            m_stats.in_progress = false;
+            m_stats.last_duration = nDuration;
+            nStall = m_stats.last_stall;
+        }
+        LogPrint(BCLog::COINDB, "Background flush of %u coins up to %s took %.2fms\n", dirty->coins.size(), dirty->hashBlock.ToString(), nDuration * 0.001);
+        TRACE4(utxocache, utxocache_flush_background,
+            (int64_t)nDuration,
+            (int64_t)nStall,
+            (uint64_t)dirty->coins.size(),
+            (bool)fOk);
+    });
+    return true;
+}
+
+bool CCoinsViewBackgroundFlush::Wait()
+{
+    std::lock_guard<std::mutex> control(m_control_mutex);
+    if (m_thread.joinable())
+        m_thread.join();
+    LOCK(m_mutex);
+    return !m_failed;
+}
+
+bool CCoinsViewBackgroundFlush::Failed() const
+{
+    LOCK(m_mutex);
+    return m_failed;
+}
+
+CCoinsViewBackgroundFlush::Stats CCoinsViewBackgroundFlush::GetStats() const
+{
+    LOCK(m_mutex);
+    return m_stats;
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-bool CCoinsViewDB::LoadIssuedColorIds(std::set<ColorIdentifier>& colorIds)
+void CCoinsViewDB::SetColorIdState(CIssuedColorIds* state)
+{
+    m_colorid_state = state;
+    if (m_colorid_state)
+        m_colorid_state->SetDB(&db);
+}
+
+bool CCoinsViewDB::LoadIssuedColorIds(CIssuedColorIds& state)
 {
     std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
     pcursor->Seek(std::make_pair(DB_ISSUED_COLORID, std::vector<unsigned char>{}));
@@ -164,7 +326,7 @@ bool CCoinsViewDB::LoadIssuedColorIds(std::set<ColorIdentifier>& colorIds)
             pcursor->Next();
             continue;
         }
-        colorIds.insert(cid);
+        state.AddConfirmed(cid);
         pcursor->Next();
     }
     return !pcursor->HasError();
@@ -227,12 +389,18 @@ bool CBlockTreeDB::RewriteXField(std::vector<XFieldChange>& xFieldChanges) {
 }
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
+{
+    return Cursor(uint256());
+}
+
+CCoinsViewCursor *CCoinsViewDB::Cursor(const uint256& hashStart) const
 {
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COIN);
+    const COutPoint start(hashStart, 0);
+    i->pcursor->Seek(CoinEntry(&start));
     // Cache key of first record
     if (i->pcursor->Valid()) {
         CoinEntry entry(&i->keyTmp.second);
@@ -292,6 +460,15 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadBlockHeaderExtra(const uint256& hash, CBlockHeaderExtra& extra) {
+    CDiskBlockIndex diskindex;
+    if (!Read(std::make_pair(DB_BLOCK_INDEX, hash), diskindex))
+        return false;
+    extra.xfield = diskindex.xfield;
+    extra.proof = std::move(diskindex.proof);
+    return true;
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -304,45 +481,91 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts(std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+bool CBlockTreeDB::LoadBlockIndexGuts(std::function<CBlockIndex*(const uint256&)> insertBlockIndex, std::function<void(size_t)> reserve, int nThreads)
 {
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-
-    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
-
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nFeatures      = diskindex.nFeatures;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->hashImMerkleRoot = diskindex.hashImMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->xfield         = diskindex.xfield;
-                pindexNew->proof          = diskindex.proof;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                // TODO: Check a proof of Signed Blocks in a block header in here
-
+    nThreads = std::max(1, std::min(nThreads, 256));
+    std::vector<std::vector<std::pair<uint256, CDiskBlockIndex>>> vParts(nThreads);
+    std::vector<std::exception_ptr> vErrors(nThreads);
+    std::vector<char> vFailed(nThreads, false);
+
+    // Deserialize the entries whose hash starts with a byte in [nThread * 256 / nThreads, (nThread + 1) * 256 / nThreads)
+    auto load_part = [&](int nThread) {
+        try {
+            const int nEnd = (nThread + 1) * 256 / nThreads;
+            uint256 hashStart;
+            *hashStart.begin() = nThread * 256 / nThreads;
+
+            std::unique_ptr<CDBIterator> pcursor(NewIterator());
+            pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, hashStart));
+            while (pcursor->Valid()) {
+                std::pair<char, uint256> key;
+                if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX || *key.second.begin() >= nEnd)
+                    break;
+                CDiskBlockIndex diskindex;
+                if (!pcursor->GetValue(diskindex)) {
+                    vFailed[nThread] = true;
+                    return;
+                }
+                const uint256 hash = diskindex.GetBlockHash();
+                vParts[nThread].emplace_back(hash, std::move(diskindex));
                 pcursor->Next();
-            } else {
-                return error("%s: failed to read value", __func__);
             }
-        } else {
-            break;
+        } catch (...) {
+            vErrors[nThread] = std::current_exception();
         }
+    };
+
+    int64_t nStart = GetTimeMicros();
+    std::vector<std::thread> vThreads;
+    for (int nThread = 1; nThread < nThreads; nThread++) {
+        vThreads.emplace_back(load_part, nThread);
+    }
+    load_part(0);
+    for (std::thread& thread : vThreads) {
+        thread.join();
+    }
+    for (int nThread = 0; nThread < nThreads; nThread++) {
+        if (vErrors[nThread])
+            std::rethrow_exception(vErrors[nThread]);
+        if (vFailed[nThread])
+            return error("%s: failed to read value", __func__);
     }
 
+    size_t nEntries = 0;
+    for (const auto& part : vParts) {
+        nEntries += part.size();
+    }
+    int64_t nRead = GetTimeMicros();
+    LogPrintf("%s: read %u block index entries in %.2fms using %d threads\n", __func__, nEntries, 0.001 * (nRead - nStart), nThreads);
+    if (reserve)
+        reserve(nEntries);
+
+    // Load mapBlockIndex. The xfield and proof of the headers are not kept
+    // in memory; CBlockIndex::GetHeaderExtra reads them back when needed.
+    for (auto& part : vParts) {
+        for (auto& entry : part) {
+            const CDiskBlockIndex& diskindex = entry.second;
+            // Construct block index object
+            CBlockIndex* pindexNew = insertBlockIndex(entry.first);
+            pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->nFeatures      = diskindex.nFeatures;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->hashImMerkleRoot = diskindex.hashImMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
+
+            // TODO: Check a proof of Signed Blocks in a block header in here
+        }
+        // release the deserialized entries of a part as soon as they are copied
+        std::vector<std::pair<uint256, CDiskBlockIndex>>().swap(part);
+    }
+    LogPrintf("%s: inserted block index entries in %.2fms\n", __func__, 0.001 * (GetTimeMicros() - nRead));
+
     return true;
 }
 
@@ -403,9 +626,14 @@ public:
 
 /** Upgrade the database from older formats.
  *
- * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout.
+ * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout,
+ * and from uncompressed to compressed colored P2PKH/P2SH scripts.
  */
 bool CCoinsViewDB::Upgrade() {
+    return UpgradePerTxCoins() && UpgradeColoredScripts();
+}
+
+bool CCoinsViewDB::UpgradePerTxCoins() {
     std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
     pcursor->Seek(std::make_pair(DB_COINS, uint256()));
     if (!pcursor->Valid()) {
@@ -468,3 +696,77 @@ bool CCoinsViewDB::Upgrade() {
     return !ShutdownRequested();
 }
 
+/** Rewrite the coins with colored P2PKH/P2SH scripts in their compressed form.
+ *
+ * Coins in the old format stay readable, so this only reclaims their space. It
+ * is idempotent and starts over if interrupted, until DB_COINS_VERSION is set.
+ */
+bool CCoinsViewDB::UpgradeColoredScripts() {
+    int nVersion = 0;
+    if (db.Read(DB_COINS_VERSION, nVersion)) {
+        if (nVersion > COINS_DB_VERSION) {
+            return error("%s: chainstate database version %d is newer than supported (%d)", __func__, nVersion, COINS_DB_VERSION);
+        }
+        if (nVersion == COINS_DB_VERSION) {
+            return true;
+        }
+    }
+
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    COutPoint outpoint;
+    pcursor->Seek(CoinEntry(&outpoint));
+
+    int64_t count = 0;
+    int64_t rewritten = 0;
+    LogPrintf("Compressing colored coins in utxo-set database...\n");
+    LogPrintf("[0%%]..."); /* Continued */
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0, true);
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(db);
+    int reportDone = 0;
+    CoinEntry entry(&outpoint);
+    while (pcursor->Valid()) {
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (!pcursor->GetKey(entry) || entry.key != DB_COIN) {
+            break;
+        }
+        if (count++ % 256 == 0) {
+            uint32_t high = 0x100 * *outpoint.hashMalFix.begin() + *(outpoint.hashMalFix.begin() + 1);
+            int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+            uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone, true);
+            if (reportDone < percentageDone/10) {
+                // report max. every 10% step
+                LogPrintf("[%d%%]...", percentageDone); /* Continued */
+                reportDone = percentageDone/10;
+            }
+        }
+        Coin coin;
+        if (!pcursor->GetValue(coin)) {
+            return error("%s: cannot parse coin record", __func__);
+        }
+        unsigned int nSize;
+        CompressedScript compr;
+        if (CompressColoredScript(coin.out.scriptPubKey, nSize, compr)) {
+            batch.Write(entry, coin);
+            rewritten++;
+        }
+        if (batch.SizeEstimate() > batch_size) {
+            db.WriteBatch(batch);
+            batch.Clear();
+        }
+        pcursor->Next();
+    }
+    if (!ShutdownRequested()) {
+        batch.Write(DB_COINS_VERSION, COINS_DB_VERSION);
+    }
+    db.WriteBatch(batch);
+    if (rewritten > 0) {
+        db.CompactRange(DB_COIN, DB_COINS_VERSION);
+    }
+    uiInterface.ShowProgress("", 100, false);
+    LogPrintf("[%s], %d coins rewritten.\n", ShutdownRequested() ? "CANCELLED" : "DONE", rewritten);
+    return !ShutdownRequested();
+}
+
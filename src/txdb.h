@@ -16,10 +16,13 @@
 #include <sync.h>
 #include <xfieldhistory.h>
 
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -82,8 +85,13 @@ static const int64_t nMaxBlockDBCache = 2;
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference: https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
 static const int64_t nMaxTxIndexCache = 1024;
+//! Max memory allocated to the coinstats index DB specific cache (MiB)
+// Entries are written once per block and read back mostly for recent blocks.
+static const int64_t nMaxCoinStatsIndexCache = 64;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! Maximum number of threads deserializing the block index at startup
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
 
 /** Tracks NON_REISSUABLE and NFT colorIds issued on-chain; see issuedcolorids.h. */
 class CIssuedColorIds;
@@ -101,18 +109,95 @@ public:
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     CCoinsViewCursor *Cursor() const override;
+    /** Cursor starting at the first coin whose txid is not below hashStart in database order */
+    CCoinsViewCursor *Cursor(const uint256& hashStart) const;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
 
     /** Connect the issued-colorId state object.  Call before ReplayBlocks. */
-    void SetColorIdState(CIssuedColorIds* state) { m_colorid_state = state; }
+    void SetColorIdState(CIssuedColorIds* state) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+    /** Add the colorIds issued according to the database to the filter of state */
+    bool LoadIssuedColorIds(CIssuedColorIds& state) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
-    bool LoadIssuedColorIds(std::set<ColorIdentifier>& colorIds);
+    /** Set the staged colorId changes aside for the next WriteDirty. */
+    void StageColorIds() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /**
+     * Write a dirty set taken from the coins cache together with the colorId
+     * changes set aside by StageColorIds, like BatchWrite does. Does not
+     * need cs_main; see CCoinsViewBackgroundFlush.
+     */
+    bool WriteDirty(CCoinsDirtySet& dirty);
+
+private:
+    bool UpgradePerTxCoins();
+    bool UpgradeColoredScripts();
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase, const std::function<void(CDBBatch&)>& commitColorIds);
+};
+
+/**
+ * CCoinsView between the coins cache and the coin database that writes the
+ * modified coins of the cache on a background thread, so that validation
+ * does not wait for LevelDB while holding cs_main.
+ *
+ * FlushStateToDisk hands the dirty set of the cache to Start and returns.
+ * Until the write has finished, lookups of the coins in the set are answered
+ * from it rather than from the database. Only one write runs at a time;
+ * Start and BatchWrite wait for the previous one first.
+ */
+class CCoinsViewBackgroundFlush final : public CCoinsViewBacked
+{
+public:
+    struct Stats {
+        bool in_progress = false;
+        //! Time the last finished write took, in microseconds
+        int64_t last_duration = 0;
+        //! Time cs_main was held for starting the last write, in microseconds
+        int64_t last_stall = 0;
+        //! Number of coins in the last started write
+        uint64_t last_coins = 0;
+    };
+
+    explicit CCoinsViewBackgroundFlush(CCoinsViewDB* db);
+    ~CCoinsViewBackgroundFlush();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
+
+    /**
+     * Start writing dirty to the database. nStallStart is when the caller
+     * started blocking validation for this flush, for the stall statistics.
+     * Returns false if the previous write failed.
+     */
+    bool Start(std::shared_ptr<CCoinsDirtySet> dirty, int64_t nStallStart) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /** Wait for the write in progress, if any. Returns false if a write failed. */
+    bool Wait();
+
+    /** Whether a write has failed, without waiting for the one in progress */
+    bool Failed() const;
+
+    Stats GetStats() const;
+
+private:
+    CCoinsViewDB& m_db;
+
+    //! Serializes Start, Wait and BatchWrite
+    std::mutex m_control_mutex;
+    std::thread m_thread;
+
+    mutable Mutex m_mutex;
+    //! Coins being written; kept after a failed write so they stay visible
+    std::shared_ptr<const CCoinsDirtySet> m_pending GUARDED_BY(m_mutex);
+    bool m_failed GUARDED_BY(m_mutex) = false;
+    Stats m_stats GUARDED_BY(m_mutex);
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -150,7 +235,16 @@ public:
     void ReadReindexing(bool &fReindexing);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /**
+     * Load all block index entries. The key space is split by the first byte
+     * of the block hash into nThreads ranges, which are read and deserialized
+     * in parallel. The entries are then passed to insertBlockIndex on the
+     * calling thread in key order, after their number was passed to reserve.
+     */
+    bool LoadBlockIndexGuts(std::function<CBlockIndex*(const uint256&)> insertBlockIndex, std::function<void(size_t)> reserve = nullptr, int nThreads = 1);
+
+    //! Read the xfield and proof of the block index entry of hash
+    bool ReadBlockHeaderExtra(const uint256& hash, CBlockHeaderExtra& extra);
 
     bool ReadXField(const char key, XFieldChangeListWrapper& xFieldList);
     bool WriteXField(const XFieldChange & xFieldChange);
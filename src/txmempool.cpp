@@ -629,14 +629,15 @@ void CTxMemPool::removeForScriptFlagChange(unsigned int newMempoolScriptFlags, i
         // Also evict txs that violate colored-coin consensus rules now active at
         // newBlockHeight (e.g. bad-txns-nonstandard-opcolor gated on SCRIPT_VERIFY_CP2SH_COLORED).
         // CheckInputs alone does not cover these rules.
+        CTxInputColors inputColors(tx, view);
         CValidationState colorState;
-        if (!CheckColorIdentifierValidity(tx, colorState, view, newBlockHeight)) {
+        if (!CheckColorIdentifierValidity(tx, colorState, inputColors, newBlockHeight)) {
             txToRemove.insert(it);
             continue;
         }
         CValidationState balanceState;
         const CAmount minFee = ::minRelayTxFee.GetFee(it->GetTxSize());
-        if (!VerifyTokenBalances(tx, balanceState, view, minFee, nullptr, newBlockHeight)) {
+        if (!VerifyTokenBalances(tx, balanceState, inputColors, minFee, nullptr, newBlockHeight)) {
             txToRemove.insert(it);
         }
     }
@@ -1174,4 +1175,4 @@ std::string RemovalReasonToString(const MemPoolRemovalReason& r) noexcept
         default:return "unknown";
     }
 }
-CTxMempoolAcceptanceOptions:: CTxMempoolAcceptanceOptions():context(ValidationContext::TRANSACTION), flags(MempoolAcceptanceFlags::NONE), nAbsurdFee(0), nAcceptTime(0), mempool_view(new CCoinsViewMemPool(pcoinsTip.get(), mempool)){}
+CTxMempoolAcceptanceOptions:: CTxMempoolAcceptanceOptions():context(ValidationContext::TRANSACTION), flags(MempoolAcceptanceFlags::NONE), nAbsurdFee(0), nAcceptTime(0), mempool_view(new CCoinsViewMemPool(pcoinsTip.get(), mempool)), pending(nullptr){}
@@ -847,6 +847,8 @@ enum class MempoolAcceptanceFlags
     TEST_ONLY = 2
 };
 
+struct CMempoolPendingTx;
+
 /* All configurable inputs and outputs of accept to mempool are consolidated here for ease of use*/
 struct CTxMempoolAcceptanceOptions {
     ValidationContext context;
@@ -858,6 +860,8 @@ struct CTxMempoolAcceptanceOptions {
     std::vector<CTransactionRef> txnReplaced;
     std::vector<COutPoint> coins_to_uncache;
     std::vector<COutPoint> missingInputs;
+    // If set, the transaction is validated without its script checks and not added, see CMempoolPendingTx
+    CMempoolPendingTx* pending;
 
     CTxMempoolAcceptanceOptions();
     ~CTxMempoolAcceptanceOptions() {
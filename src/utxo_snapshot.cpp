@@ -4,13 +4,421 @@
 
 #include <utxo_snapshot.h>
 
+#include <chainparams.h>
+#include <chainstate.h>
+#include <coinstats.h>
+#include <consensus/validation.h>
+#include <crypto/sha256.h>
+#include <file_io.h>
+#include <index/coinstatsindex.h>
+#include <index/txindex.h>
+#include <issuedcolorids.h>
+#include <shutdown.h>
 #include <streams.h>
+#include <txdb.h>
 #include <utilstrencodings.h>
+#include <validation.h>
 
 
-SnapshotMetadata::SnapshotMetadata(const uint256& base_blockhash, uint64_t coins_count) :
+SnapshotMetadata::SnapshotMetadata(const uint256& base_blockhash, uint64_t coins_count, uint16_t version) :
+    version(version),
     base_blockhash(base_blockhash),
     coins_count(coins_count) { 
         ParseUInt64(FederationParams().NetworkIDString(), &networkid);
         network_mode = gArgs.GetChainMode();
 }
+
+bool WriteSnapshotChunk(CCoinsViewCursor& cursor, unsigned int nEndPrefix, const fs::path& path, SnapshotChunk& chunk,
+                        const std::function<bool(const uint256&)>& fnProgress, std::string& strError)
+{
+    static constexpr size_t CHUNK_WRITE_BUFFER_SIZE = 1 << 20;
+
+    CAutoFile afile(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    if (afile.IsNull()) {
+        strError = strprintf("Couldn't open chunk file %s for writing", path.string());
+        return false;
+    }
+
+    // Coins are serialized into buf first so that the checksum can be
+    // computed over exactly the bytes written to the file.
+    CSHA256 hasher;
+    CDataStream buf(SER_DISK, CLIENT_VERSION);
+    std::vector<std::pair<uint32_t, Coin>> coins;
+    uint256 last_hash;
+    chunk.coins_count = 0;
+
+    auto write_buffer = [&]() {
+        hasher.Write((const unsigned char*)buf.data(), buf.size());
+        afile.write(buf.data(), buf.size());
+        buf.clear();
+    };
+    auto write_coins = [&]() {
+        buf << last_hash;
+        WriteCompactSize(buf, coins.size());
+        for (const auto& [n, coin] : coins) {
+            WriteCompactSize(buf, n);
+            buf << coin;
+        }
+        chunk.coins_count += coins.size();
+        if (buf.size() >= CHUNK_WRITE_BUFFER_SIZE) write_buffer();
+        coins.clear();
+        return fnProgress(last_hash);
+    };
+
+    try {
+        while (cursor.Valid()) {
+            COutPoint key;
+            Coin coin;
+            if (!cursor.GetKey(key) || !cursor.GetValue(coin)) {
+                strError = "Unable to read UTXO set";
+                return false;
+            }
+            if (*key.hashMalFix.begin() >= nEndPrefix) break;
+            if (!coins.empty() && key.hashMalFix != last_hash && !write_coins()) {
+                strError = "Aborted";
+                return false;
+            }
+            last_hash = key.hashMalFix;
+            coins.emplace_back(key.n, std::move(coin));
+            cursor.Next();
+        }
+        if (!coins.empty() && !write_coins()) {
+            strError = "Aborted";
+            return false;
+        }
+        write_buffer();
+    } catch (const std::ios_base::failure& e) {
+        strError = strprintf("Failed to write chunk file %s: %s", path.string(), e.what());
+        return false;
+    }
+    hasher.Finalize(chunk.checksum.begin());
+    return true;
+}
+
+/** Compute the SHA256 of the file at path. */
+static bool HashFile(const fs::path& path, uint256& hash)
+{
+    CAutoFile afile(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (afile.IsNull()) return false;
+    CSHA256 hasher;
+    std::vector<unsigned char> buf(1 << 20);
+    size_t nRead;
+    while ((nRead = fread(buf.data(), 1, buf.size(), afile.Get())) > 0) {
+        hasher.Write(buf.data(), nRead);
+    }
+    if (ferror(afile.Get())) return false;
+    hasher.Finalize(hash.begin());
+    return true;
+}
+
+/**
+ * Read the snapshot metadata, leaving afile positioned at the first coin.
+ * For a chunked snapshot the chunk list is read as well and, if
+ * fCheckChunks, the chunk files are checked against their checksums.
+ */
+static bool ReadSnapshotMetadata(CAutoFile& afile, const fs::path& path, SnapshotMetadata& metadata, std::vector<SnapshotChunk>& chunks, bool fCheckChunks, std::string& strError)
+{
+    if (afile.IsNull()) {
+        strError = strprintf("Couldn't open snapshot file %s for reading", path.string());
+        return false;
+    }
+    try {
+        afile >> metadata;
+        chunks.clear();
+        if (metadata.GetVersion() == SnapshotMetadata::CHUNKED_VERSION) {
+            afile >> chunks;
+        }
+    } catch (const std::ios_base::failure& e) {
+        strError = strprintf("Unable to parse snapshot metadata: %s", e.what());
+        return false;
+    }
+
+    uint64_t coins_count = 0;
+    for (const SnapshotChunk& chunk : chunks) {
+        // chunk files must sit next to the manifest
+        if (fs::path(chunk.filename).filename() != fs::path(chunk.filename)) {
+            strError = strprintf("Invalid chunk file name %s in snapshot manifest", chunk.filename);
+            return false;
+        }
+        coins_count += chunk.coins_count;
+        if (!fCheckChunks) continue;
+        uint256 checksum;
+        if (!HashFile(path.parent_path() / chunk.filename, checksum)) {
+            strError = strprintf("Couldn't read snapshot chunk file %s", chunk.filename);
+            return false;
+        }
+        if (checksum != chunk.checksum) {
+            strError = strprintf("Snapshot chunk file %s is corrupted: expected checksum %s, got %s",
+                chunk.filename, chunk.checksum.ToString(), checksum.ToString());
+            return false;
+        }
+    }
+    if (metadata.GetVersion() == SnapshotMetadata::CHUNKED_VERSION && coins_count != metadata.coins_count) {
+        strError = "Snapshot chunks do not add up to the number of coins in the manifest";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read the coins of a snapshot in file order and pass the outputs of each
+ * transaction to fn. dumptxoutset writes a leading group without coins,
+ * which is skipped.
+ */
+template <typename Fn>
+static bool ReadSnapshotCoins(CAutoFile& afile, uint64_t coins_count, int nBaseHeight, Fn fn, std::string& strError)
+{
+    uint64_t coins_read = 0;
+    std::map<uint32_t, Coin> outputs;
+    try {
+        while (coins_read < coins_count) {
+            if (ShutdownRequested()) {
+                strError = "Shutdown requested";
+                return false;
+            }
+            uint256 txid;
+            afile >> txid;
+            const uint64_t coins_per_txid = ReadCompactSize(afile);
+            if (coins_per_txid > coins_count - coins_read) {
+                strError = "Snapshot contains more coins than its metadata states";
+                return false;
+            }
+            outputs.clear();
+            for (uint64_t i = 0; i < coins_per_txid; ++i) {
+                const uint32_t n = static_cast<uint32_t>(ReadCompactSize(afile));
+                Coin coin;
+                afile >> coin;
+                if (coin.nHeight > static_cast<uint32_t>(nBaseHeight)) {
+                    strError = strprintf("Bad snapshot data: coin %s:%d has height %d above the base block", txid.ToString(), n, coin.nHeight);
+                    return false;
+                }
+                if (!outputs.emplace(n, std::move(coin)).second) {
+                    strError = strprintf("Bad snapshot data: duplicate coin %s:%d", txid.ToString(), n);
+                    return false;
+                }
+                ++coins_read;
+            }
+            if (!outputs.empty() && !fn(txid, outputs)) {
+                return false;
+            }
+        }
+    } catch (const std::ios_base::failure& e) {
+        strError = strprintf("Bad snapshot data after reading %d coins: %s", coins_read, e.what());
+        return false;
+    }
+
+    bool out_of_coins = false;
+    try {
+        uint8_t trailing;
+        afile >> trailing;
+    } catch (const std::ios_base::failure&) {
+        out_of_coins = true;
+    }
+    if (!out_of_coins) {
+        strError = "Snapshot contains more coins than its metadata states";
+        return false;
+    }
+    return true;
+}
+
+/** Read all coins of the snapshot or chunked snapshot at path, see ReadSnapshotCoins. */
+template <typename Fn>
+static bool ForEachSnapshotCoin(const fs::path& path, int nBaseHeight, Fn fn, std::string& strError)
+{
+    CAutoFile afile(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    SnapshotMetadata metadata;
+    std::vector<SnapshotChunk> chunks;
+    if (!ReadSnapshotMetadata(afile, path, metadata, chunks, false, strError)) {
+        return false;
+    }
+    if (metadata.GetVersion() != SnapshotMetadata::CHUNKED_VERSION) {
+        return ReadSnapshotCoins(afile, metadata.coins_count, nBaseHeight, fn, strError);
+    }
+    for (const SnapshotChunk& chunk : chunks) {
+        CAutoFile chunk_file(fsbridge::fopen(path.parent_path() / chunk.filename, "rb"), SER_DISK, CLIENT_VERSION);
+        if (chunk_file.IsNull()) {
+            strError = strprintf("Couldn't open snapshot chunk file %s for reading", chunk.filename);
+            return false;
+        }
+        if (!ReadSnapshotCoins(chunk_file, chunk.coins_count, nBaseHeight, fn, strError)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Check that the snapshot can be based on its block with the chain in its current state. */
+static bool CheckSnapshotBase(const SnapshotMetadata& metadata, CBlockIndex*& pindexBase, std::string& strError) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (chainActive.Height() != 0) {
+        strError = "A snapshot can only be loaded while the active chain is at the genesis block";
+        return false;
+    }
+    pindexBase = LookupBlockIndex(metadata.base_blockhash);
+    if (!pindexBase) {
+        strError = strprintf("The base block header %s of the snapshot is not known. Wait for headers to sync and try again", metadata.base_blockhash.ToString());
+        return false;
+    }
+    if (pindexBase->nStatus & BLOCK_FAILED_MASK) {
+        strError = strprintf("The base block %s of the snapshot is invalid", metadata.base_blockhash.ToString());
+        return false;
+    }
+    return true;
+}
+
+bool ActivateSnapshot(const fs::path& path, SnapshotMetadata& metadata, std::string& strError)
+{
+    {
+        CAutoFile afile(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        std::vector<SnapshotChunk> chunks;
+        if (!ReadSnapshotMetadata(afile, path, metadata, chunks, true, strError)) {
+            return false;
+        }
+    }
+
+    uint64_t networkid = 0;
+    ParseUInt64(FederationParams().NetworkIDString(), &networkid);
+    if (metadata.networkid != networkid || metadata.network_mode != gArgs.GetChainMode()) {
+        strError = strprintf("Snapshot was created on network %d (%s) which is not this network",
+            metadata.networkid, TAPYRUS_MODES::GetChainName(metadata.network_mode));
+        return false;
+    }
+    if (g_txindex) {
+        strError = "A snapshot cannot be loaded while -txindex is enabled";
+        return false;
+    }
+    if (g_coinstatsindex) {
+        strError = "A snapshot cannot be loaded while -coinstatsindex is enabled";
+        return false;
+    }
+
+    const auto au_data = Params().Assumeutxo().find(metadata.base_blockhash);
+    if (au_data == Params().Assumeutxo().end()) {
+        strError = strprintf("No trusted txoutset hash for a snapshot based on block %s (see -assumeutxo)", metadata.base_blockhash.ToString());
+        return false;
+    }
+
+    CBlockIndex* pindexBase = nullptr;
+    {
+        LOCK(cs_main);
+        if (!CheckSnapshotBase(metadata, pindexBase, strError)) {
+            return false;
+        }
+    }
+
+    LogPrintf("[snapshot] verifying %d coins based on block %s (height %d)\n",
+        metadata.coins_count, pindexBase->GetBlockHash().ToString(), pindexBase->nHeight);
+
+    // First pass: compute the hash_serialized of the snapshot the same way
+    // gettxoutsetinfo does. Nothing here touches the chainstate, so it runs
+    // without cs_main and block processing carries on meanwhile.
+    CCoinsStats stats;
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << metadata.base_blockhash;
+    if (!ForEachSnapshotCoin(path, pindexBase->nHeight, [&](const uint256& txid, std::map<uint32_t, Coin>& outputs) {
+            ApplyStats(stats, ss, txid, outputs);
+            return true;
+        }, strError)) {
+        return false;
+    }
+    stats.hashSerialized = ss.GetHash();
+    if (stats.hashSerialized != au_data->second.hash_serialized) {
+        strError = strprintf("Bad snapshot content hash: expected %s, got %s",
+            au_data->second.hash_serialized.ToString(), stats.hashSerialized.ToString());
+        return false;
+    }
+
+    // The chain may have moved while the lock was released.
+    LOCK(cs_main);
+    if (!CheckSnapshotBase(metadata, pindexBase, strError)) {
+        return false;
+    }
+
+    // Second pass: write the coins. From here on a failure leaves a partially
+    // written chainstate, so the node is shut down, and the startup check of
+    // this flag refuses to use it until -reindex.
+    LogPrintf("[snapshot] loading %d coins into the chainstate\n", metadata.coins_count);
+    if (!pblocktree->WriteFlag(SNAPSHOT_LOADING_FLAG, true)) {
+        strError = "Failed to write to block index database";
+        return false;
+    }
+
+    // NON_REISSUABLE and NFT colorIds are derived from the outpoint spent by
+    // their issuance, so every colorId of those types found in the snapshot
+    // was issued at or below the base block. Ids whose tokens were all burned
+    // are not recoverable from the UTXO set, but the outpoint they were
+    // derived from is spent so they cannot be issued again either.
+    std::set<ColorIdentifier> issuedColorIds;
+    uint64_t coins_loaded = 0;
+    // The files are hashed again while loading: a snapshot replaced after
+    // the first pass leaves the loading flag set and the node unusable
+    // until -reindex rather than with an unverified UTXO set.
+    CCoinsStats loadStats;
+    CHashWriter loadHash(SER_GETHASH, PROTOCOL_VERSION);
+    loadHash << metadata.base_blockhash;
+    if (!ForEachSnapshotCoin(path, pindexBase->nHeight, [&](const uint256& txid, std::map<uint32_t, Coin>& outputs) {
+            ApplyStats(loadStats, loadHash, txid, outputs);
+            for (auto& output : outputs) {
+                const ColorIdentifier colorId = GetColorIdFromScript(output.second.out.scriptPubKey);
+                if (colorId.type == TokenTypes::NON_REISSUABLE || colorId.type == TokenTypes::NFT) {
+                    issuedColorIds.insert(colorId);
+                }
+                pcoinsTip->AddCoin(COutPoint(txid, output.first), std::move(output.second), false);
+                ++coins_loaded;
+            }
+            if (pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) {
+                LogPrintf("[snapshot] flushing coins cache (%d/%d coins loaded)\n", coins_loaded, metadata.coins_count);
+                pcoinsTip->SetBestBlock(metadata.base_blockhash);
+                if (!pcoinsTip->Flush()) {
+                    strError = "Failed to write coins to the chainstate database";
+                    return false;
+                }
+            }
+            return true;
+        }, strError)) {
+        return AbortNode(strError);
+    }
+    if (loadHash.GetHash() != stats.hashSerialized) {
+        strError = "Snapshot changed while it was being loaded";
+        return AbortNode(strError);
+    }
+    g_colorid_state->Insert(issuedColorIds);
+    pcoinsTip->SetBestBlock(metadata.base_blockhash);
+
+    // Rebuild the xfield history from the headers below the base, as
+    // ConnectTip would have recorded it.
+    CXFieldHistory xfieldHistory;
+    for (int nHeight = 1; nHeight <= pindexBase->nHeight; ++nHeight) {
+        const CBlockIndex* pindex = pindexBase->GetAncestor(nHeight);
+        std::shared_ptr<const CBlockHeaderExtra> extra = pindex->GetHeaderExtra();
+        if (extra->xfield.IsValid() && IsXFieldNew(extra->xfield, &xfieldHistory, static_cast<uint32_t>(nHeight))) {
+            XFieldChange newChange(extra->xfield.xfieldValue, nHeight + 1, pindex->GetBlockHash());
+            xfieldHistory.Add(extra->xfield.xfieldType, newChange);
+            pblocktree->WriteXField(newChange);
+        }
+    }
+
+    // Blocks below the base are missing as if they had been pruned. Both
+    // flags must be set before the base becomes the tip, as CheckBlockIndex
+    // relies on them for ancestors without BLOCK_HAVE_DATA.
+    fHavePruned = true;
+    fSnapshotChainstate = true;
+    if (!g_chainstate.ActivateSnapshotBase(pindexBase)) {
+        strError = "Failed to make the snapshot base block the chain tip";
+        return AbortNode(strError);
+    }
+
+    CValidationState state;
+    if (!FlushStateToDisk(state, FlushStateMode::ALWAYS)) {
+        strError = strprintf("Failed to flush the chainstate: %s", FormatStateMessage(state));
+        return AbortNode(strError);
+    }
+    if (!pblocktree->WriteFlag(SNAPSHOT_CHAINSTATE_FLAG, true) || !pblocktree->WriteFlag(SNAPSHOT_LOADING_FLAG, false)) {
+        strError = "Failed to write to block index database";
+        return AbortNode(strError);
+    }
+
+    LogPrintf("[snapshot] loaded %d coins, chain tip is now %s (height %d)\n",
+        coins_loaded, pindexBase->GetBlockHash().ToString(), pindexBase->nHeight);
+    return true;
+}
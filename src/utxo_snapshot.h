@@ -8,21 +8,35 @@
 
 #include <serialize.h>
 #include <sync.h>
+#include <tinyformat.h>
 #include <uint256.h>
 #include <fs.h>
 #include <xfieldhistory.h>
 
+#include <functional>
+#include <set>
+#include <string>
+
 
 // UTXO set snapshot magic bytes
 static constexpr std::array<uint8_t, 5> SNAPSHOT_MAGIC_BYTES = {'u', 't', 'x', 'o', 0xff};
 
+//! Block tree DB flag set while a snapshot is being written to the chainstate
+static const std::string SNAPSHOT_LOADING_FLAG = "utxosnapshotloading";
+//! Block tree DB flag set once the chainstate has been loaded from a snapshot
+static const std::string SNAPSHOT_CHAINSTATE_FLAG = "utxosnapshot";
+
 //! Metadata describing a serialized version of a UTXO set from which a  new chainstate can be constructed.
 class SnapshotMetadata
 {
-    const uint16_t version{1};
-    const std::set<uint16_t> supported_versions{1};
+    uint16_t version{1};
+    const std::set<uint16_t> supported_versions{1, 2};
 
 public:
+    //! Version of a manifest listing the chunk files that hold the coins,
+    //! written by a parallel dumptxoutset. See SnapshotChunk.
+    static constexpr uint16_t CHUNKED_VERSION = 2;
+
     //! The network id associated with this snapshot
     uint64_t networkid;
 
@@ -38,7 +52,9 @@ public:
 
     SnapshotMetadata() { };
 
-    SnapshotMetadata(const uint256& base_blockhash, uint64_t coins_count);
+    SnapshotMetadata(const uint256& base_blockhash, uint64_t coins_count, uint16_t version = 1);
+
+    uint16_t GetVersion() const { return version; }
 
     template <typename Stream>
     inline void Serialize(Stream& s) const {
@@ -49,6 +65,82 @@ public:
         s << base_blockhash;
         s << VARINT(coins_count);
     }
+
+    template <typename Stream>
+    inline void Unserialize(Stream& s) {
+        std::array<uint8_t, 5> magic;
+        s >> magic;
+        if (magic != SNAPSHOT_MAGIC_BYTES) {
+            throw std::ios_base::failure("Invalid UTXO set snapshot magic bytes. Please check if this is indeed a snapshot file.");
+        }
+        s >> version;
+        if (!supported_versions.count(version)) {
+            throw std::ios_base::failure(strprintf("Version of snapshot %d does not match any of the supported versions.", version));
+        }
+        s >> networkid;
+        std::string chain_name;
+        s >> chain_name;
+        if (chain_name == TAPYRUS_MODES::PROD) {
+            network_mode = TAPYRUS_OP_MODE::PROD;
+        } else if (chain_name == TAPYRUS_MODES::DEV) {
+            network_mode = TAPYRUS_OP_MODE::DEV;
+        } else {
+            throw std::ios_base::failure(strprintf("Unknown network mode %s in snapshot.", chain_name));
+        }
+        s >> base_blockhash;
+        s >> VARINT(coins_count);
+    }
 };
 
+/**
+ * One chunk file of a chunked snapshot. The manifest holds the metadata
+ * (with CHUNKED_VERSION) followed by the list of chunks. Each chunk holds
+ * the coins of a range of txid first bytes, grouped per txid exactly as in
+ * a single-file snapshot, so reading the chunks in order yields the same
+ * coins in the same order.
+ */
+struct SnapshotChunk
+{
+    //! File name, relative to the directory of the manifest
+    std::string filename;
+    uint64_t coins_count = 0;
+    //! SHA256 of the chunk file
+    uint256 checksum;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(filename);
+        READWRITE(VARINT(coins_count));
+        READWRITE(checksum);
+    }
+};
+
+class CCoinsViewCursor;
+
+/**
+ * Write the coins of cursor whose txid has a first byte below nEndPrefix to
+ * a chunk file at path, filling in chunk's count and checksum. fnProgress is
+ * called after every transaction with its txid and may return false to abort.
+ */
+bool WriteSnapshotChunk(CCoinsViewCursor& cursor, unsigned int nEndPrefix, const fs::path& path, SnapshotChunk& chunk,
+                        const std::function<bool(const uint256&)>& fnProgress, std::string& strError);
+
+/**
+ * Load the UTXO set snapshot (or chunked snapshot manifest) at path into
+ * the chainstate of a node whose active chain is still at genesis, and make
+ * the snapshot base block the chain tip. The snapshot is first read in full and its txoutset hash
+ * compared against the value trusted in chainparams (see -assumeutxo);
+ * nothing is written unless it matches. That first pass runs without cs_main;
+ * the lock is only held while the coins are loaded.
+ *
+ * Blocks below the base are not downloaded or validated: the node behaves
+ * like a pruned node for that part of the chain.
+ *
+ * @param[out] metadata   header of the loaded snapshot
+ * @param[out] strError   reason for the failure, if false is returned
+ */
+bool ActivateSnapshot(const fs::path& path, SnapshotMetadata& metadata, std::string& strError);
+
 #endif // BITCOIN_UTXO_SNAPSHOT_H
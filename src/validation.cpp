@@ -31,10 +31,13 @@
 #include <trace.h>
 #include <ui_interface.h>
 #include <utilmoneystr.h>
+#include <utxo_snapshot.h>
 #include <warnings.h>
 #include <xfieldhistory.h>
 
 #include <future>
+#include <optional>
+#include <shared_mutex>
 #include <thread>
 #include <sstream>
 
@@ -60,7 +63,9 @@ std::unique_ptr<CIssuedColorIds> g_colorid_state;
 int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
+std::atomic_bool fSnapshotPending(false);
 bool fHavePruned = false;
+bool fSnapshotChainstate = false;
 bool fPruneMode = false;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
@@ -73,6 +78,8 @@ bool acceptnonstdtxn = false;
 #endif
 
 uint256 hashAssumeValid;
+uint256 hashAssumeValidProof;
+int nAssumeValidProofHeight = -1;
 
 CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
 CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
@@ -179,9 +186,22 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+std::unique_ptr<CCoinsViewBackgroundFlush> pcoinsflush;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
 
+bool ReadBlockHeaderExtra(const CBlockIndex& index, CBlockHeaderExtra& extra)
+{
+    if (!pblocktree)
+        return false;
+    if (!pblocktree->ReadBlockHeaderExtra(index.GetBlockHash(), extra)) {
+        const std::string strError = strprintf("Failed to read the header of block %s from the block index database", index.GetBlockHash().ToString());
+        AbortNode(strError);
+        throw std::runtime_error(strError);
+    }
+    return true;
+}
+
 bool CheckFinalTx(const CTransaction &tx, int flags)
 {
     AssertLockHeld(cs_main);
@@ -337,14 +357,9 @@ static bool IsCurrentForFeeEstimation()
 
 // Used to avoid mempool polluting consensus critical paths if CCoinsViewMempool
 // were somehow broken and returning the wrong scriptPubKeys
-static bool CheckInputsFromMempoolAndCache(ValidationContext context, const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, const CTxMemPool& pool,
-                 unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata) {
+static bool CheckInputCoinsFromMempool(ValidationContext context, const CTransaction& tx, const CCoinsViewCache& view, const CTxMemPool& pool) {
     AssertLockHeld(cs_main);
-
-    // pool.cs should be locked already, but go ahead and re-take the lock here
-    // to enforce that mempool doesn't change between when we check the view
-    // and when we actually call through to CheckInputs
-    LOCK(pool.cs);
+    AssertLockHeld(pool.cs);
 
     assert(!tx.IsCoinBase());
     for (const CTxIn& txin : tx.vin) {
@@ -367,7 +382,20 @@ static bool CheckInputsFromMempoolAndCache(ValidationContext context, const CTra
                 assert(coinFromDisk.out == coin.out);
         }
     }
+    return true;
+}
 
+static bool CheckInputsFromMempoolAndCache(ValidationContext context, const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, const CTxMemPool& pool,
+                 unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata) {
+    AssertLockHeld(cs_main);
+
+    // pool.cs should be locked already, but go ahead and re-take the lock here
+    // to enforce that mempool doesn't change between when we check the view
+    // and when we actually call through to CheckInputs
+    LOCK(pool.cs);
+
+    if (!CheckInputCoinsFromMempool(context, tx, view, pool))
+        return false;
     return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, txdata);
 }
 
@@ -439,10 +467,86 @@ static bool DoAllInputsExist(const CTransaction& tx, CValidationState& state, CT
     return true;
 }
 
+CTxInputColors::CTxInputColors(const CTransaction& tx, const CCoinsViewCache& inputs) :
+    m_tx(tx), m_view(inputs), m_first_nonstandard(tx.vin.size())
+{
+    m_inputs.reserve(tx.vin.size());
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        const Coin& coin = inputs.AccessCoin(tx.vin[i].prevout);
+        Input input;
+        input.colorId = GetColorIdFromScript(coin.out.scriptPubKey);
+        input.nValue = coin.out.nValue;
+        input.fNonStandard = input.colorId.type == TokenTypes::NONE && coin.out.scriptPubKey.IsColoredScript();
+        input.fAvailable = !coin.IsSpent() && !input.fNonStandard;
+        if (input.fNonStandard && m_first_nonstandard == tx.vin.size())
+            m_first_nonstandard = i;
+        if (input.fAvailable && input.colorId.type != TokenTypes::NONE)
+            m_colored.emplace(input.colorId, i);
+        m_inputs.push_back(input);
+    }
+}
+
+const std::map<ColorIdentifier, size_t>& CTxInputColors::GetIssuable(TokenTypes type)
+{
+    const int nIndex = TokenToUint(type) - TokenToUint(TokenTypes::REISSUABLE);
+    assert(nIndex >= 0 && nIndex < 3);
+    std::map<ColorIdentifier, size_t>& issuable = m_issuable[nIndex];
+    if (m_issuable_built[nIndex])
+        return issuable;
+    m_issuable_built[nIndex] = true;
+
+    for (size_t i = 0; i < m_inputs.size(); i++) {
+        if (m_inputs[i].colorId.type != TokenTypes::NONE)
+            continue;
+        if (type == TokenTypes::REISSUABLE) {
+            // Reissuable colorIds hash the script, which several inputs may share.
+            if (m_inputs[i].fAvailable)
+                issuable.emplace(ColorIdentifier(m_view.AccessCoin(m_tx.vin[i].prevout).out.scriptPubKey), i);
+        } else {
+            issuable.emplace(ColorIdentifier(m_tx.vin[i].prevout, type), i);
+        }
+    }
+    return issuable;
+}
+
+size_t CTxInputColors::FindInput(const ColorIdentifier& colorId, bool& fIssuance)
+{
+    size_t nInput = m_inputs.size();
+    fIssuance = false;
+    if (colorId.type == TokenTypes::NONE)
+        return nInput;
+
+    auto it = m_colored.find(colorId);
+    if (it != m_colored.end())
+        nInput = it->second;
+
+    const std::map<ColorIdentifier, size_t>& issuable = GetIssuable(colorId.type);
+    auto jt = issuable.find(colorId);
+    if (jt != issuable.end() && jt->second < nInput && m_inputs[jt->second].fAvailable) {
+        nInput = jt->second;
+        fIssuance = true;
+    }
+    return nInput;
+}
+
+bool CTxInputColors::IsIssuedByInput(const ColorIdentifier& colorId)
+{
+    if (colorId.type != TokenTypes::NON_REISSUABLE && colorId.type != TokenTypes::NFT)
+        return false;
+    return GetIssuable(colorId.type).count(colorId) > 0;
+}
+
 bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& state, CCoinsViewCache &inputs, int32_t blockHeight)
+{
+    CTxInputColors inputColors(tx, inputs);
+    return CheckColorIdentifierValidity(tx, state, inputColors, blockHeight);
+}
+
+bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& state, CTxInputColors& inputColors, int32_t blockHeight)
 {
     // Track NFT colorId output count across the whole tx (must be exactly 1).
     std::map<ColorIdentifier, unsigned int> nftOutputCount;
+    const bool fColoredSoftfork = GetSoftForkManager().IsActive(SCRIPT_VERIFY_CP2SH_COLORED, blockHeight);
 
     for(const auto& txout : tx.vout)
     {
@@ -454,7 +558,7 @@ bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& stat
         // outColorId is NONE: IsColoredPayToPubkeyHash / IsColoredPayToScriptHash
         // check both structure and type byte; reaching here means neither matched.
         if (outColorId.type == TokenTypes::NONE) {
-            if (GetSoftForkManager().IsActive(SCRIPT_VERIFY_CP2SH_COLORED, blockHeight))
+            if (fColoredSoftfork)
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-nonstandard-opcolor");
             continue;
         }
@@ -466,52 +570,16 @@ bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& stat
         if(outColorId.type == TokenTypes::NFT)
             nftOutputCount[outColorId]++;
 
-        bool matchFound = false;
+        // The inputs are matched in order: a non-standard colored input before
+        // the first one providing this colorId is rejected once the softfork is
+        // active, and skipped before.
         bool isIssuance = false;
+        const size_t nInput = inputColors.FindInput(outColorId, isIssuance);
 
-        for(auto txin : tx.vin)
-        {
-            const Coin& coin = inputs.AccessCoin(txin.prevout);
-            ColorIdentifier coinColorId;
-            ColorIdentifier cid = GetColorIdFromScript(coin.out.scriptPubKey);
-
-            if (cid.type == TokenTypes::NONE && coin.out.scriptPubKey.IsColoredScript()) {
-                if (GetSoftForkManager().IsActive(SCRIPT_VERIFY_CP2SH_COLORED, blockHeight))
-                    return state.DoS(100, false, REJECT_INVALID, "bad-txns-nonstandard-opcolor");
-                continue;
-            }
-
-            switch(cid.type)
-            {
-                case TokenTypes::NONE:
-                    // TPC input — this is a token issuance.
-                    if(outColorId.type == TokenTypes::REISSUABLE)
-                        coinColorId = ColorIdentifier(coin.out.scriptPubKey);
-                    else {
-                        COutPoint prevout = txin.prevout;
-                        coinColorId = ColorIdentifier(prevout, outColorId.type);
-                    }
-                    break;
-
-                case TokenTypes::REISSUABLE:
-                case TokenTypes::NON_REISSUABLE:
-                case TokenTypes::NFT:
-                    coinColorId = GetColorIdFromScript(coin.out.scriptPubKey);
-                    break;
-
-                default:
-                    continue;
-            }
-
-            if(coinColorId == outColorId && !coin.IsSpent())
-            {
-                matchFound = true;
-                isIssuance = (cid.type == TokenTypes::NONE);
-                break;
-            }
-        }
+        if (fColoredSoftfork && inputColors.FirstNonStandard() < nInput)
+            return state.DoS(100, false, REJECT_INVALID, "bad-txns-nonstandard-opcolor");
 
-        if(!matchFound)
+        if(nInput == tx.vin.size())
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-token-noinput");
 
         // NFT value must always be exactly 1.
@@ -540,25 +608,25 @@ bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& stat
 
 bool VerifyTokenBalances(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, CAmount minrelayFee, std::set<ColorIdentifier>* newIssuances, int32_t blockHeight)
 {
-    // Build input balance map from the UTXO view.
-    // Simultaneously collect TPC input outpoints for issuance detection.
+    CTxInputColors inputColors(tx, inputs);
+    return VerifyTokenBalances(tx, state, inputColors, minrelayFee, newIssuances, blockHeight);
+}
+
+bool VerifyTokenBalances(const CTransaction& tx, CValidationState& state, CTxInputColors& inputColors, CAmount minrelayFee, std::set<ColorIdentifier>* newIssuances, int32_t blockHeight)
+{
+    // Build input balance map from the input colors.
     TxColoredCoinBalancesMap inColoredCoinBalances;
-    std::vector<COutPoint> tpcInputOutpoints;
-    for (const auto& txin : tx.vin) {
-        const Coin& coin = inputs.AccessCoin(txin.prevout);
-        ColorIdentifier cid = GetColorIdFromScript(coin.out.scriptPubKey);
+    const bool fColoredSoftfork = GetSoftForkManager().IsActive(SCRIPT_VERIFY_CP2SH_COLORED, blockHeight);
+    for (const CTxInputColors::Input& input : inputColors.GetInputs()) {
         // A legacy non-standard OP_COLOR UTXO (colorId resolves to NONE) is rejected
         // post-activation.  Pre-activation its nValue falls through to the TPC bucket.
-        if (cid.type == TokenTypes::NONE && coin.out.scriptPubKey.IsColoredScript() &&
-            GetSoftForkManager().IsActive(SCRIPT_VERIFY_CP2SH_COLORED, blockHeight))
+        if (input.fNonStandard && fColoredSoftfork)
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-nonstandard-opcolor");
-        auto it = inColoredCoinBalances.find(cid);
+        auto it = inColoredCoinBalances.find(input.colorId);
         if (it == inColoredCoinBalances.end())
-            inColoredCoinBalances.emplace(cid, coin.out.nValue);
+            inColoredCoinBalances.emplace(input.colorId, input.nValue);
         else
-            it->second += coin.out.nValue;
-        if (newIssuances && cid.type == TokenTypes::NONE)
-            tpcInputOutpoints.push_back(txin.prevout);
+            it->second += input.nValue;
     }
 
     //for every output eliminate a matching input.
@@ -613,16 +681,9 @@ bool VerifyTokenBalances(const CTransaction& tx, CValidationState& state, const
     // Detect issuances: a NON_REISSUABLE or NFT output whose colorId was
     // derived from one of the TPC inputs in this transaction.
     if (newIssuances) {
-        for (const auto& tx_out : tx.vout) {
-            ColorIdentifier outColorId(GetColorIdFromScript(tx_out.scriptPubKey));
-            if (outColorId.type != TokenTypes::NON_REISSUABLE && outColorId.type != TokenTypes::NFT)
-                continue;
-            for (const auto& prevout : tpcInputOutpoints) {
-                if (ColorIdentifier(prevout, outColorId.type) == outColorId) {
-                    newIssuances->insert(outColorId);
-                    break;
-                }
-            }
+        for (const auto& out : outColoredCoinBalances) {
+            if (inputColors.IsIssuedByInput(out.first))
+                newIssuances->insert(out.first);
         }
     }
 
@@ -709,7 +770,8 @@ static bool AcceptToMemoryPoolWorker(const CTransactionRef &ptx, CTxMempoolAccep
             return false;
 
         //if there are colored coins in the output verify their colorids
-        if(!CheckColorIdentifierValidity(tx, state, view, chainActive.Tip()->nHeight + 1))
+        CTxInputColors inputColors(tx, view);
+        if(!CheckColorIdentifierValidity(tx, state, inputColors, chainActive.Tip()->nHeight + 1))
             return false;
 
         // Bring the best block into scope
@@ -940,7 +1002,6 @@ static bool AcceptToMemoryPoolWorker(const CTransactionRef &ptx, CTxMempoolAccep
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
         // Query flags for the *next* block (tip+1), not the tip, so that softfork
         // activation at height H is enforced by the mempool at tip == H-1.
         // Using tip height here would admit txs that are valid pre-activation but
@@ -948,23 +1009,58 @@ static bool AcceptToMemoryPoolWorker(const CTransactionRef &ptx, CTxMempoolAccep
         const int32_t nextBlockHeight = chainActive.Tip()->nHeight + 1;
         const unsigned int tipScriptFlags = GetBlockScriptFlags(nextBlockHeight);
         const unsigned int mempoolScriptFlags = STANDARD_SCRIPT_VERIFY_FLAGS | tipScriptFlags;
-        // Pass tipScriptFlags as mandatoryFlags so that softfork flags active at
-        // nextBlockHeight are treated as mandatory even when they also appear in
-        // STANDARD_SCRIPT_VERIFY_FLAGS (e.g. SCRIPT_VERIFY_CP2SH_COLORED).
-        if (!CheckInputs(tx, state, view, true, mempoolScriptFlags, true, false, txdata, nullptr, tipScriptFlags)) {
-            return false; // state filled in by CheckInputs
-        }
+        if (opt.pending) {
+            // The caller runs the checks. The standard flags include tipScriptFlags,
+            // so their success is then cached for tipScriptFlags, as below.
+            opt.pending->txdata = MakeUnique<PrecomputedTransactionData>(tx);
+            opt.pending->vChecks.clear();
+            if (!CheckInputs(tx, state, view, true, mempoolScriptFlags, true, false, *opt.pending->txdata, &opt.pending->vChecks, tipScriptFlags))
+                return false;
+            // The checks run on the coins of the view, which must match the mempool and the chainstate
+            if (!CheckInputCoinsFromMempool(opt.context, tx, view, pool)) {
+                return error("%s: BUG! PLEASE REPORT THIS! Inputs of %s do not match the mempool or the chainstate",
+                        __func__, hash.ToString());
+            }
+        } else {
+            PrecomputedTransactionData txdata(tx);
+            // Pass tipScriptFlags as mandatoryFlags so that softfork flags active at
+            // nextBlockHeight are treated as mandatory even when they also appear in
+            // STANDARD_SCRIPT_VERIFY_FLAGS (e.g. SCRIPT_VERIFY_CP2SH_COLORED).
+            if (nScriptCheckThreads && tx.vin.size() > 1) {
+                // The inputs of a transaction spending several are checked in parallel
+                // on the script check threads, which report the failing check if any.
+                std::vector<CScriptCheck> vChecks;
+                if (!CheckInputs(tx, state, view, true, mempoolScriptFlags, true, false, txdata, &vChecks, tipScriptFlags))
+                    return false;
+                CCheckQueueControl<CScriptCheck> control(g_chainstate.scriptcheckqueue.get());
+                control.Add(std::move(vChecks));
+                CScriptCheck failed;
+                if (!control.Wait(&failed))
+                    return ScriptCheckFailed(tx, state, view, failed, mempoolScriptFlags, true, txdata, tipScriptFlags);
+            } else if (!CheckInputs(tx, state, view, true, mempoolScriptFlags, true, false, txdata, nullptr, tipScriptFlags)) {
+                return false; // state filled in by CheckInputs
+            }
 
-        // Cache script execution results using the same next-block flags so the
-        // cache entries are valid when ConnectBlock runs at height nextBlockHeight.
-        if (!CheckInputsFromMempoolAndCache(opt.context, tx, opt.state, view, pool, tipScriptFlags, true, txdata)) {
-            return error("%s: BUG! PLEASE REPORT THIS! CheckInputs failed against latest-block but not STANDARD flags %s, %s",
-                    __func__, hash.ToString(), FormatStateMessage(state));
+            // Cache script execution results using the same next-block flags so the
+            // cache entries are valid when ConnectBlock runs at height nextBlockHeight.
+            if (!CheckInputsFromMempoolAndCache(opt.context, tx, opt.state, view, pool, tipScriptFlags, true, txdata)) {
+                return error("%s: BUG! PLEASE REPORT THIS! CheckInputs failed against latest-block but not STANDARD flags %s, %s",
+                        __func__, hash.ToString(), FormatStateMessage(state));
+            }
         }
 
-        if (!VerifyTokenBalances(tx, opt.state, view, ::minRelayTxFee.GetFee(nSize), nullptr, chainActive.Tip()->nHeight + 1))
+        if (!VerifyTokenBalances(tx, opt.state, inputColors, ::minRelayTxFee.GetFee(nSize), nullptr, chainActive.Tip()->nHeight + 1))
             return false;
 
+        if (opt.pending) {
+            opt.pending->entry = MakeUnique<CTxMemPoolEntry>(entry);
+            opt.pending->setAncestors = std::move(setAncestors);
+            opt.pending->allConflicting = std::move(allConflicting);
+            opt.pending->validForFeeEstimation = !fReplacementTransaction && (opt.flags != MempoolAcceptanceFlags::BYPASSS_LIMITS) && IsCurrentForFeeEstimation();
+            opt.pending->tipScriptFlags = tipScriptFlags;
+            return true;
+        }
+
 
         if (opt.flags == MempoolAcceptanceFlags::TEST_ONLY) {
             // Tx was accepted, but not added
@@ -1168,6 +1264,52 @@ void InitScriptExecutionCache() {
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+static uint256 GetScriptExecutionCacheEntry(const CTransaction& tx, unsigned int flags)
+{
+    uint256 hashCacheEntry;
+    // We only use the first 19 bytes of nonce to avoid a second SHA
+    // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
+    static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
+    CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+    return hashCacheEntry;
+}
+
+void CacheScriptExecution(const CTransaction& tx, unsigned int flags)
+{
+    AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
+    scriptExecutionCache.insert(GetScriptExecutionCacheEntry(tx, flags));
+}
+
+bool ScriptCheckFailed(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, const CScriptCheck& check, unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata, unsigned int mandatoryFlags)
+{
+    // Flags that are in STANDARD but not in the mandatory block flags
+    // for this height are truly non-mandatory (policy-only).
+    // Flags present in mandatoryFlags are consensus-mandatory even if
+    // they also appear in STANDARD_SCRIPT_VERIFY_FLAGS (e.g.
+    // SCRIPT_VERIFY_CP2SH_COLORED after softfork activation).
+    const unsigned int nonMandatory = STANDARD_NOT_MANDATORY_VERIFY_FLAGS & ~mandatoryFlags;
+    if (flags & nonMandatory) {
+        // Check whether the failure was caused by a
+        // non-mandatory script verification check, such as
+        // push only script_sig if so, don't trigger DoS protection to
+        // avoid splitting the network between upgraded and
+        // non-upgraded nodes.
+        const unsigned int nIn = check.GetInputIndex();
+        CScriptCheck check2(inputs.AccessCoin(tx.vin[nIn].prevout).out, tx, nIn,
+                flags & ~nonMandatory, cacheSigStore, &txdata);
+        if (check2())
+            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
+    }
+    // Failures of other flags indicate a transaction that is
+    // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
+    // such nodes as they are not following the protocol. That
+    // said during an upgrade careful thought should be taken
+    // as to the correct behavior - we may want to continue
+    // peering with non-upgraded nodes even after soft-fork
+    // super-majority signaling has occurred.
+    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+}
+
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks, unsigned int mandatoryFlags)
 {
     if (!tx.IsCoinBase())
@@ -1190,11 +1332,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             // correct (ie that the transaction hash which is in tx's prevouts
             // properly commits to the scriptPubKey in the inputs view of that
             // transaction).
-            uint256 hashCacheEntry;
-            // We only use the first 19 bytes of nonce to avoid a second SHA
-            // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
-            static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
-            CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+            uint256 hashCacheEntry = GetScriptExecutionCacheEntry(tx, flags);
             AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
             if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
                 return true;
@@ -1216,31 +1354,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                 if (pvChecks) {
                     pvChecks->emplace_back(std::move(check));
                 } else if (!check()) {
-                    // Flags that are in STANDARD but not in the mandatory block flags
-                    // for this height are truly non-mandatory (policy-only).
-                    // Flags present in mandatoryFlags are consensus-mandatory even if
-                    // they also appear in STANDARD_SCRIPT_VERIFY_FLAGS (e.g.
-                    // SCRIPT_VERIFY_CP2SH_COLORED after softfork activation).
-                    const unsigned int nonMandatory = STANDARD_NOT_MANDATORY_VERIFY_FLAGS & ~mandatoryFlags;
-                    if (flags & nonMandatory) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // push only script_sig if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check2(coin.out, tx, i,
-                                flags & ~nonMandatory, cacheSigStore, &txdata);
-                        if (check2())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after soft-fork
-                    // super-majority signaling has occurred.
-                    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+                    return ScriptCheckFailed(tx, state, inputs, check, flags, cacheSigStore, txdata, mandatoryFlags);
                 }
             }
 
@@ -1278,6 +1392,11 @@ void StartScriptCheckWorkerThreads(int threads_num)
     g_chainstate.scriptcheckqueue = std::make_unique< CCheckQueue<CScriptCheck> >(128, threads_num);
 }
 
+void StartCoinFetchWorkerThreads(int threads_num)
+{
+    g_chainstate.coinfetchqueue = std::make_unique< CCheckQueue<CCoinFetch> >(16, threads_num, "coinfetch");
+}
+
 void FlushStateToDisk() {
     CValidationState state;
     if (!FlushStateToDisk(state, FlushStateMode::ALWAYS)) {
@@ -1310,7 +1429,157 @@ void ResetBlockFailureFlags(CBlockIndex *pindex) {
     return g_chainstate.ResetBlockFailureFlags(pindex);
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, CXFieldHistoryMap* pxfieldHistory, int nHeight, bool fCheckPOW)
+namespace {
+/**
+ * Valid block proof cache. A header is checked when it is first received and
+ * again when its block is, and the proofs of a headers message are verified
+ * before cs_main is taken to accept the headers one by one. Entries are
+ * SHA256(nonce || hash for sign || aggregate pubkey || proof).
+ */
+class CBlockProofCache
+{
+private:
+    uint256 nonce;
+    CuckooCache::cache<uint256, SignatureCacheHasher> setValid;
+    std::shared_mutex cs_proofcache;
+
+public:
+    CBlockProofCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+        setValid.setup_bytes(BLOCK_PROOF_CACHE_BYTES);
+    }
+
+    uint256 ComputeEntry(const uint256& hash, const CPubKey& pubkey, const std::vector<unsigned char>& proof) const
+    {
+        uint256 entry;
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(pubkey.data(), pubkey.size()).Write(proof.data(), proof.size()).Finalize(entry.begin());
+        return entry;
+    }
+
+    bool Get(const uint256& entry)
+    {
+        std::shared_lock<std::shared_mutex> lock(cs_proofcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(uint256 entry)
+    {
+        std::unique_lock<std::shared_mutex> lock(cs_proofcache);
+        setValid.insert(entry);
+    }
+};
+
+CBlockProofCache blockProofCache;
+} // namespace
+
+bool IsBlockProofAssumedValid(const uint256& hash, int nHeight)
+{
+    AssertLockHeld(cs_main);
+    if (hashAssumeValidProof.IsNull() || nHeight < 0)
+        return false;
+
+    const CBlockIndex* pindexAssumed = LookupBlockIndex(hashAssumeValidProof);
+    if (!pindexAssumed || !pindexBestHeader || pindexAssumed->nHeight < nHeight)
+        return false;
+    // The assumed block must be an ancestor of the best header, and the block
+    // an ancestor of the assumed block. As for -assumevalid, the last two weeks
+    // of blocks before the best header are always verified.
+    if (pindexBestHeader->GetAncestor(pindexAssumed->nHeight) != pindexAssumed)
+        return false;
+    const CBlockIndex* pindex = pindexAssumed->GetAncestor(nHeight);
+    return pindex && pindex->GetBlockHash() == hash
+        && pindexBestHeader->GetBlockTime() - pindex->GetBlockTime() > 60 * 60 * 24 * 7 * 2;
+}
+
+bool IsBlockProofDeferred(const CBlockHeader& header, const uint256& hash, int nHeight)
+{
+    AssertLockHeld(cs_main);
+    if (hashAssumeValidProof.IsNull() || nHeight <= 0 || nHeight > nAssumeValidProofHeight)
+        return false;
+    // Once the assumed block is known, IsBlockProofAssumedValid decides
+    if (LookupBlockIndex(hashAssumeValidProof))
+        return false;
+    if (nHeight == nAssumeValidProofHeight && hash != hashAssumeValidProof)
+        return false;
+    return header.GetBlockTime() < GetAdjustedTime() - 60 * 60 * 24 * 7 * 2;
+}
+
+void PreVerifyBlockProofs(const std::vector<CBlockHeader>& headers, CXFieldHistoryMap* pxfieldHistory)
+{
+    AssertLockNotHeld(cs_main);
+    if (headers.size() < 2)
+        return;
+
+    // A proof to verify, with the aggregate pubkey CheckBlockHeader is expected to use
+    struct ProofCheck {
+        uint256 hash;
+        CPubKey pubkey;
+        const std::vector<unsigned char>* proof;
+    };
+    std::vector<ProofCheck> checks;
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexPrev = LookupBlockIndex(headers[0].hashPrevBlock);
+        if (!pindexPrev)
+            return;
+
+        CXFieldHistory globalHistory;
+        CXFieldHistoryMap& history = pxfieldHistory ? *pxfieldHistory : globalHistory;
+
+        // Predict the aggregate pubkey CheckBlockHeader will use for each header:
+        // the xfield history at the header's height, until a header in this run
+        // changes it. A wrong prediction only costs the work, as cache entries
+        // commit to the pubkey.
+        std::optional<XFieldAggPubKey> runAggPubKey;
+        uint256 hashPrev = headers[0].hashPrevBlock;
+        uint32_t nHeight = pindexPrev->nHeight + 1;
+        for (const CBlockHeader& header : headers) {
+            if (header.hashPrevBlock != hashPrev
+                || header.nFeatures != CBlock::TAPYRUS_BLOCK_FEATURES
+                || !header.xfield.IsValid()
+                || header.proof.size() != CPubKey::SCHNORR_SIGNATURE_SIZE)
+                break;
+            hashPrev = header.GetHash();
+            if (LookupBlockIndex(hashPrev) == nullptr && !IsBlockProofDeferred(header, hashPrev, nHeight)) {
+                const XFieldAggPubKey aggregatePubkeyObj = runAggPubKey ? *runAggPubKey
+                    : std::get<XFieldAggPubKey>(history.Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, nHeight).xfieldValue);
+                checks.push_back(ProofCheck{header.GetHashForSign(), aggregatePubkeyObj.getPubKey(), &header.proof});
+
+                // AcceptBlockHeader records changes of known headers, so only new ones move the key
+                if (header.xfield.xfieldType == TAPYRUS_XFIELDTYPES::AGGPUBKEY)
+                    runAggPubKey = std::get<XFieldAggPubKey>(header.xfield.xfieldValue);
+            }
+            nHeight++;
+        }
+    }
+    if (checks.size() < 2)
+        return;
+
+    // Verified without cs_main. Verification stops at the first invalid proof:
+    // CheckBlockHeader reports it and the headers after it are not accepted.
+    int64_t nTimeStart = GetTimeMicros();
+    size_t nValid = 0;
+    for (const ProofCheck& check : checks) {
+        if (!check.pubkey.Verify_Schnorr(check.hash, *check.proof))
+            break;
+        blockProofCache.Set(blockProofCache.ComputeEntry(check.hash, check.pubkey, *check.proof));
+        nValid++;
+    }
+
+    LogPrint(BCLog::BENCH, "    - Pre-verify %u block proofs (%u valid): %.2fms\n", (unsigned)checks.size(), (unsigned)nValid, 0.001 * (GetTimeMicros() - nTimeStart));
+}
+
+void PreVerifyBlockProof(const CBlockHeader& header, const CPubKey& aggregatePubkey)
+{
+    if (header.proof.size() != CPubKey::SCHNORR_SIGNATURE_SIZE || !aggregatePubkey.IsValid())
+        return;
+    const uint256 hash = header.GetHashForSign();
+    if (aggregatePubkey.Verify_Schnorr(hash, header.proof))
+        blockProofCache.Set(blockProofCache.ComputeEntry(hash, aggregatePubkey, header.proof));
+}
+
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, CXFieldHistoryMap* pxfieldHistory, int nHeight, bool fCheckPOW, bool fProofAssumedValid)
 {
     //check block features
     if(block.nFeatures != CBlock::TAPYRUS_BLOCK_FEATURES)
@@ -1348,40 +1617,57 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, CXFiel
         aggregatePubkeyObj = std::get<XFieldAggPubKey>(CXFieldHistory().Get(TAPYRUS_XFIELDTYPES::AGGPUBKEY, uHeight).xfieldValue);
     CPubKey aggregatePubkey(aggregatePubkeyObj.getPubKey());
 
+    // Ancestors of the -assumevalidproof block skip the proof verification, but
+    // the aggregate pubkey in effect at their height must still be a valid key.
+    if (fProofAssumedValid) {
+        if (!aggregatePubkeyObj.IsValid())
+            return state.Invalid(false, REJECT_INVALID, "bad-aggpubkey", strprintf("Invalid aggregate pubkey at height [%d]", nHeight));
+        return true;
+    }
+
     const uint256 blockHash = block.GetHashForSign();
 
-    //verify signature
+    //verify signature, unless this proof was already verified with the same aggregate pubkey
+    const uint256 entry = blockProofCache.ComputeEntry(blockHash, aggregatePubkey, block.proof);
+    if (blockProofCache.Get(entry))
+        return true;
     if(!aggregatePubkey.Verify_Schnorr(blockHash, block.proof))
         return state.Invalid(false, REJECT_INVALID, "bad-proof", strprintf("Proof verification failed at height [%d]", nHeight));
+    blockProofCache.Set(entry);
 
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, CXFieldHistoryMap* pxfieldHistory, int nHeight)
+bool CheckBlockMerkleRoot(const CBlock& block, CValidationState& state)
 {
-    // These are checks that are independent of context.
+    bool mutated;
+    uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
+    if (block.hashMerkleRoot != hashMerkleRoot2)
+        return state.DoS(100, false, REJECT_INVALID, "bad-txnmrklroot", true, "hashMerkleRoot mismatch");
 
-    if (block.fChecked)
-        return true;
+    uint256 hashImMerkleRoot2 = BlockMerkleRoot(block, &mutated, true);
 
-    // Check the merkle root.
-    if (fCheckMerkleRoot) {
-        bool mutated;
-        uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
-        if (block.hashMerkleRoot != hashMerkleRoot2)
-            return state.DoS(100, false, REJECT_INVALID, "bad-txnmrklroot", true, "hashMerkleRoot mismatch");
+    if (block.hashImMerkleRoot != hashImMerkleRoot2)
+        return state.DoS(100, false, REJECT_INVALID, "bad-txnimmrklroot", true, "hashImMerkleRoot mismatch");
 
-        uint256 hashImMerkleRoot2 = BlockMerkleRoot(block, &mutated, true);
+    // Check for merkle tree malleability (CVE-2012-2459): repeating sequences
+    // of transactions in a block without affecting the merkle root of a block,
+    // while still invalidating it.
+    if (mutated)
+        return state.DoS(100, false, REJECT_INVALID, "bad-txns-duplicate", true, "duplicate transaction");
+    return true;
+}
 
-        if (block.hashImMerkleRoot != hashImMerkleRoot2)
-            return state.DoS(100, false, REJECT_INVALID, "bad-txnimmrklroot", true, "hashImMerkleRoot mismatch");
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, CXFieldHistoryMap* pxfieldHistory, int nHeight, bool fProofAssumedValid)
+{
+    // These are checks that are independent of context.
 
-        // Check for merkle tree malleability (CVE-2012-2459): repeating sequences
-        // of transactions in a block without affecting the merkle root of a block,
-        // while still invalidating it.
-        if (mutated)
-            return state.DoS(100, false, REJECT_INVALID, "bad-txns-duplicate", true, "duplicate transaction");
-    }
+    if (block.fChecked)
+        return true;
+
+    // Check the merkle root. Blocks pre-checked by the import pipeline skip this.
+    if (fCheckMerkleRoot && !block.fCheckedMerkleRoot && !CheckBlockMerkleRoot(block, state))
+        return false;
 
     // First transaction must be coinbase,
     if (block.vtx.empty() || !block.vtx[0]->IsCoinBase())
@@ -1427,7 +1713,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, pxfieldHistory, height, fCheckPOW))
+    if (!CheckBlockHeader(block, state, pxfieldHistory, height, fCheckPOW, fProofAssumedValid))
         return false;
 
     //the rest must not be coinbase
@@ -1435,12 +1721,14 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         if (block.vtx[i]->IsCoinBase())
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
-    // Check transactions
-    for (const auto& tx : block.vtx)
-    {
-        if (!CheckTransaction(*tx, state, true))
-            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx->GetHashMalFix().ToString(), state.GetDebugMessage()));
+    // Check transactions. Blocks pre-checked by the import pipeline skip this.
+    if (!block.fCheckedTransactions) {
+        for (const auto& tx : block.vtx)
+        {
+            if (!CheckTransaction(*tx, state, true))
+                return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", tx->GetHashMalFix().ToString(), state.GetDebugMessage()));
+        }
     }
     unsigned int nSigOps = 0;
     for (const auto& tx : block.vtx)
@@ -1450,7 +1738,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     if (nSigOps > maxBlockSizeChange.GetMaxBlockSigops())
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, strprintf("out-of-bounds SigOpCount [%d]", nSigOps));
 
-    if (fCheckPOW && fCheckMerkleRoot)
+    // A block whose proof was assumed valid is checked again where it is not
+    if (fCheckPOW && fCheckMerkleRoot && !fProofAssumedValid)
         block.fChecked = true;
 
     return true;
@@ -1527,6 +1816,7 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidatio
     // temp list is used until we finish processing this headers message
     CTempXFieldHistory tempFieldHistory;
     if (first_invalid != nullptr) first_invalid->SetNull();
+    PreVerifyBlockProofs(headers, &tempFieldHistory);
     {
         LOCK(cs_main);
         for (const CBlockHeader& header : headers) {
@@ -1553,8 +1843,19 @@ bool ProcessNewBlock(const std::shared_ptr<const CBlock> pblock, bool fForceProc
         if (fNewBlock) *fNewBlock = false;
         CValidationState state;
         // Ensure that CheckBlock() passes before calling AcceptBlock, as
-        // belt-and-suspenders.
-        bool ret = CheckBlock(*pblock, state);
+        // belt-and-suspenders. The proof is checked without cs_main, at the
+        // height of a known parent.
+        int nHeight = -1;
+        bool fProofAssumedValid = false;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexPrev = LookupBlockIndex(pblock->hashPrevBlock);
+            if (pindexPrev) {
+                nHeight = pindexPrev->nHeight + 1;
+                fProofAssumedValid = IsBlockProofAssumedValid(pblock->GetHash(), nHeight);
+            }
+        }
+        bool ret = CheckBlock(*pblock, state, true, true, nullptr, nHeight, fProofAssumedValid);
 
         LOCK(cs_main);
 
@@ -1595,10 +1896,16 @@ bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
     if (!ContextualCheckBlock(block, state, pindexPrev))
         return error("%s: Consensus::ContextualCheckBlock: %s", __func__, FormatStateMessage(state));
-    if (!g_chainstate.ConnectBlock(block, state, &indexDummy, viewNew, true))
+    CValidatedBlock validated;
+    if (!g_chainstate.ConnectBlock(block, state, &indexDummy, viewNew, true, fCheckMerkleRoot ? &validated : nullptr))
         return false;
     assert(state.IsValid());
 
+    // Only with the merkle root checked does the result hold for every block
+    // with the same hash for signing, as the signed block will be
+    if (fCheckMerkleRoot)
+        g_chainstate.AddValidatedBlock(std::move(validated));
+
     return true;
 }
 
@@ -1656,6 +1963,14 @@ bool static LoadBlockIndexDB() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
+    // Check whether the chainstate was loaded from a UTXO snapshot. Blocks
+    // below the snapshot base are missing exactly as if they had been pruned.
+    pblocktree->ReadFlag(SNAPSHOT_CHAINSTATE_FLAG, fSnapshotChainstate);
+    if (fSnapshotChainstate) {
+        LogPrintf("LoadBlockIndexDB(): Chainstate was loaded from a UTXO snapshot\n");
+        fHavePruned = true;
+    }
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -1736,11 +2051,9 @@ void UnloadBlockIndex()
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
     fHavePruned = false;
+    fSnapshotChainstate = false;
 
     g_chainstate.UnloadBlockIndex();
 }
@@ -1826,7 +2139,7 @@ bool isBlockHeightInCoinbase(const CBlock& block)
         return false;
     else if(block.GetBlockHeader().hashPrevBlock == pindex->GetBlockHash() && blockHeight != (uint32_t)pindex->nHeight + 1)
         return false;
-    else if(pindex->GetBlockHeader().hashPrevBlock == block.GetHash() && blockHeight != (uint32_t)pindex->nHeight - 1)
+    else if(pindex->pprev && pindex->pprev->GetBlockHash() == block.GetHash() && blockHeight != (uint32_t)pindex->nHeight - 1)
         return false;
 
     else // if the two blocks are unrelated, we assume the block height is valid.
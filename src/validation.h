@@ -34,6 +34,7 @@
 class CBlockIndex;
 class CBlockTreeDB;
 class CChainParams;
+class CCoinsViewBackgroundFlush;
 class CCoinsViewDB;
 class CInv;
 class CConnman;
@@ -85,6 +86,10 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads reading block inputs ahead of ConnectBlock */
+static const int MAX_PREFETCH_THREADS = 16;
+/** -prefetchthreads default (number of input reading threads, 0 = disabled) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -121,6 +126,7 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_COINSTATSINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
@@ -157,6 +163,8 @@ class CIssuedColorIds;
 extern std::unique_ptr<CIssuedColorIds> g_colorid_state;
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
+/** True while a -loadsnapshot UTXO snapshot waits for its base block header; block download is held back meanwhile. */
+extern std::atomic_bool fSnapshotPending;
 extern int nScriptCheckThreads;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
@@ -172,6 +180,12 @@ extern bool fEnableReplacement;
 /** Block hash whose ancestors we will assume to have valid scripts without checking them. */
 extern uint256 hashAssumeValid;
 
+/** Block whose ancestors' block proofs are assumed valid (-assumevalidproof) */
+extern uint256 hashAssumeValidProof;
+
+/** Height of the -assumevalidproof block, for header sync before it is known (-assumevalidproofheight, -1 if unknown) */
+extern int nAssumeValidProofHeight;
+
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
 
@@ -187,6 +201,9 @@ extern CChain& chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 
+/** Global variable that points to the view writing the coins cache to pcoinsdbview in the background (protected by cs_main) */
+extern std::unique_ptr<CCoinsViewBackgroundFlush> pcoinsflush;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
@@ -198,6 +215,8 @@ extern CBlockIndex *&pindexBestInvalid;
 /** Pruning-related variables and constants */
 /** True if any block files have ever been pruned. */
 extern bool fHavePruned;
+/** True if the chainstate was bootstrapped from a UTXO snapshot, so blocks below the snapshot base were never stored. */
+extern bool fSnapshotChainstate;
 /** True if we're running in -prune mode. */
 extern bool fPruneMode;
 /** Number of MiB of block files that we're trying to stay below. */
@@ -273,6 +292,8 @@ bool LoadChainTip();
 void UnloadBlockIndex();
 /** Run instances of script checking worker threads */
 void StartScriptCheckWorkerThreads(int threads_num);
+/** Run threads that read the inputs of blocks into pcoinsTip before they are connected */
+void StartCoinFetchWorkerThreads(int threads_num);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -296,6 +317,27 @@ void PruneAndFlush();
 /** Prune block files up to a given height */
 void PruneBlockFilesManual(int nManualPruneHeight);
 
+/**
+ * A transaction validated by AcceptToMemoryPool with opt.pending set, which is
+ * not added to the mempool. Its script checks are not run but collected in
+ * vChecks, for the caller to run before adding entry.
+ */
+struct CMempoolPendingTx
+{
+    std::unique_ptr<CTxMemPoolEntry> entry;
+    //! In-mempool ancestors of the transaction
+    CTxMemPool::setEntries setAncestors;
+    //! In-mempool transactions replaced by the transaction, with their descendants
+    CTxMemPool::setEntries allConflicting;
+    //! False if the transaction is not to be counted for fee estimation, whatever its inputs
+    bool validForFeeEstimation = false;
+    //! Script flags of the next block, to cache the script execution with
+    unsigned int tipScriptFlags = 0;
+    //! Referenced by vChecks
+    std::unique_ptr<PrecomputedTransactionData> txdata;
+    std::vector<CScriptCheck> vChecks;
+};
+
 /** (try to) add transaction to memory pool
  * plTxnReplaced will be appended to with all transactions replaced from mempool **/
 bool AcceptToMemoryPool(const CTransactionRef &tx, CTxMempoolAcceptanceOptions &opt);
@@ -356,6 +398,18 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags,  CCoinsViewMemPool& v
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr, unsigned int mandatoryFlags = 0);
 
+/**
+ * Fill in state for the failed script check of one input of tx, run with flags, the way
+ * CheckInputs does: a failure only caused by the non-mandatory flags is not punished.
+ */
+bool ScriptCheckFailed(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, const CScriptCheck& check, unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata, unsigned int mandatoryFlags);
+
+/**
+ * Record in the script execution cache that all the scripts of tx passed with flags.
+ * For the script checks CheckInputs pushed onto pvChecks, once they have all succeeded.
+ */
+void CacheScriptExecution(const CTransaction& tx, unsigned int flags) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -378,11 +432,52 @@ bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& sta
  */
 bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindexPrev);
 
-/** Context-independent header validity checks */
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, CXFieldHistoryMap* pxfieldHistory = nullptr, int nHeight = -1, bool fCheckPOW = true);
+/**
+ * Whether the proof of the block with this hash at nHeight is assumed valid
+ * because the block is an ancestor of the -assumevalidproof block on the best
+ * header chain, more than two weeks older than the best header. The result is
+ * passed to CheckBlockHeader by the callers that hold cs_main.
+ */
+bool IsBlockProofAssumedValid(const uint256& hash, int nHeight) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/**
+ * Whether the proof check of a new header at nHeight is deferred during header
+ * sync, before the -assumevalidproof block is known: headers more than two
+ * weeks old at or below -assumevalidproofheight are accepted without verifying
+ * their proof. AcceptBlockHeader marks them BLOCK_PROOF_UNVERIFIED and verifies
+ * them once a header at that height other than the assumed block connects to
+ * them. Their blocks are checked in full unless IsBlockProofAssumedValid.
+ */
+bool IsBlockProofDeferred(const CBlockHeader& header, const uint256& hash, int nHeight) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/** Size of the cache of verified block proofs (about 32k entries) */
+static const size_t BLOCK_PROOF_CACHE_BYTES = 1 << 20;
+
+/**
+ * Verify the proofs of a run of connected new headers without holding cs_main,
+ * before they are accepted one at a time. The run starts at a child of a known
+ * block and ends at the first header that does not connect. Valid proofs are
+ * cached so that CheckBlockHeader does not verify them again under cs_main.
+ */
+void PreVerifyBlockProofs(const std::vector<CBlockHeader>& headers, CXFieldHistoryMap* pxfieldHistory) LOCKS_EXCLUDED(cs_main);
+
+/**
+ * Verify the proof of one header against a predicted aggregate pubkey and
+ * cache it if valid. Needs no lock; the block import workers call it.
+ */
+void PreVerifyBlockProof(const CBlockHeader& header, const CPubKey& aggregatePubkey);
+
+/**
+ * Context-independent header validity checks. With fProofAssumedValid (see
+ * IsBlockProofAssumedValid) the proof itself is not verified.
+ */
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, CXFieldHistoryMap* pxfieldHistory = nullptr, int nHeight = -1, bool fCheckPOW = true, bool fProofAssumedValid = false);
+
+/** Check the merkle roots of a block and that its transaction list is not mutated */
+bool CheckBlockMerkleRoot(const CBlock& block, CValidationState& state);
 
 /** Context-independent validity checks */
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, CXFieldHistoryMap* pxfieldHistory = nullptr, int nHeight = -1);
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, CXFieldHistoryMap* pxfieldHistory = nullptr, int nHeight = -1, bool fProofAssumedValid = false);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block) */
 bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
@@ -390,13 +485,62 @@ bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex
 /** When there are blocks in the active chain with missing data, rewind the chainstate and remove them from the block index */
 bool RewindBlockIndex();
 
+/**
+ * Colors of the inputs of a transaction, read from the coins view once and
+ * shared by CheckColorIdentifierValidity and VerifyTokenBalances. The colorIds
+ * that TPC inputs can issue are only hashed for the token types that outputs
+ * ask for. The view must keep the input coins for the lifetime of this object.
+ */
+class CTxInputColors
+{
+public:
+    struct Input {
+        //! NONE for TPC, missing and non-standard colored coins
+        ColorIdentifier colorId;
+        CAmount nValue;
+        //! Unspent coin which is not non-standard colored, i.e. it can provide tokens
+        bool fAvailable;
+        //! OP_COLOR script which is neither CP2PKH nor CP2SH
+        bool fNonStandard;
+    };
+
+    CTxInputColors(const CTransaction& tx, const CCoinsViewCache& inputs);
+
+    const std::vector<Input>& GetInputs() const { return m_inputs; }
+
+    /** Index of the first non-standard colored input, or the number of inputs */
+    size_t FirstNonStandard() const { return m_first_nonstandard; }
+
+    /** Index of the first available input providing tokens of colorId, either by
+     *  holding them or by issuing them from TPC, or the number of inputs if none does. */
+    size_t FindInput(const ColorIdentifier& colorId, bool& fIssuance);
+
+    /** Whether a NON_REISSUABLE or NFT colorId is derived from the outpoint of a TPC input */
+    bool IsIssuedByInput(const ColorIdentifier& colorId);
+
+private:
+    const std::map<ColorIdentifier, size_t>& GetIssuable(TokenTypes type);
+
+    const CTransaction& m_tx;
+    const CCoinsViewCache& m_view;
+    std::vector<Input> m_inputs;
+    size_t m_first_nonstandard;
+    //! First available input holding each colorId
+    std::map<ColorIdentifier, size_t> m_colored;
+    //! Per token type, the colorIds issued by TPC inputs and the first input issuing each
+    std::map<ColorIdentifier, size_t> m_issuable[3];
+    bool m_issuable_built[3] = {false, false, false};
+};
+
 /** Verify coloured coin type related consensus rules.
  *  blockHeight is used to query the softfork manager; pass INT32_MAX to always enforce. */
 bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& state, CCoinsViewCache &inputs, int32_t blockHeight = INT32_MAX);
+bool CheckColorIdentifierValidity(const CTransaction& tx, CValidationState& state, CTxInputColors& inputColors, int32_t blockHeight = INT32_MAX);
 
 /** Check token input and output amounts within a transaction.
  *  blockHeight is used to query the softfork manager; pass INT32_MAX to always enforce. */
 bool VerifyTokenBalances(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, CAmount minrelayFee, std::set<ColorIdentifier>* newIssuances = nullptr, int32_t blockHeight = INT32_MAX);
+bool VerifyTokenBalances(const CTransaction& tx, CValidationState& state, CTxInputColors& inputColors, CAmount minrelayFee, std::set<ColorIdentifier>* newIssuances = nullptr, int32_t blockHeight = INT32_MAX);
 
 /** Replay blocks that aren't fully applied to the database. */
 bool ReplayBlocks(CCoinsView* view);
@@ -197,7 +197,7 @@ static int64_t AddTx(CWallet& wallet, uint32_t lockTime, int64_t mockTime, int64
     CBlockIndex* block = nullptr;
     if (blockTime > 0) {
         LOCK(cs_main);
-        auto inserted = mapBlockIndex.emplace(GetRandHash(), new CBlockIndex);
+        auto inserted = mapBlockIndex.emplace(GetRandHash(), g_chainstate.m_blockindex_arena.New());
         assert(inserted.second);
         const uint256& hash = inserted.first->first;
         block = inserted.first->second;
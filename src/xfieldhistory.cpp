@@ -7,49 +7,72 @@
 #include <txdb.h>
 #include <univalue.h>
 #include <sync.h>
-#include <shared_mutex>
 
-XFieldHistoryMapType CXFieldHistoryMap::xfieldHistory;
-std::shared_mutex CXFieldHistoryMap::xfieldHistoryMutex;
+#include <algorithm>
 
+std::shared_ptr<const XFieldHistorySnapshot> CXFieldHistoryMap::xfieldHistory;
+std::mutex CXFieldHistoryMap::xfieldHistoryWriteMutex;
+
+XFieldHistorySnapshot::XFieldHistorySnapshot()
+{
+    lists.emplace(TAPYRUS_XFIELDTYPES::AGGPUBKEY, XFieldChangeListWrapper(XFieldAggPubKey::BLOCKTREE_DB_KEY));
+    lists.emplace(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE, XFieldChangeListWrapper(XFieldMaxBlockSize::BLOCKTREE_DB_KEY));
+    for(const auto& item : lists)
+        minHeightFrom.emplace(item.first, std::vector<uint32_t>());
+}
+
+void XFieldHistorySnapshot::Reindex(TAPYRUS_XFIELDTYPES type)
+{
+    const XFieldChangeList& list = lists.find(type)->second.xfieldChanges;
+    std::vector<uint32_t>& minHeight = minHeightFrom.find(type)->second;
+    minHeight.resize(list.size());
+    for(int i = (int)list.size() - 1; i >= 0; i--)
+        minHeight[i] = (i + 1 == (int)list.size()) ? list[i].height : std::min(list[i].height, minHeight[i + 1]);
+}
 
 bool CXFieldHistoryMap::Remove(TAPYRUS_XFIELDTYPES type, const XFieldChange& xFieldChange) {
-    std::unique_lock<std::shared_mutex> lock(xfieldHistoryMutex);
-    auto& list = (isTemp ? this->getXFieldHistoryMap() : xfieldHistory).find(type)->second;
-    if (list.size() > 1 && list.back() == xFieldChange) {
-        list.xfieldChanges.pop_back();
-        return true;
-    }
-    return false;
+    std::lock_guard<std::mutex> lock(xfieldHistoryWriteMutex);
+    const std::shared_ptr<const XFieldHistorySnapshot> snapshot = GetSnapshot();
+    const auto& list = snapshot->lists.find(type)->second;
+    if (list.size() <= 1 || !(list.back() == xFieldChange))
+        return false;
+
+    auto updated = std::make_shared<XFieldHistorySnapshot>(*snapshot);
+    updated->lists.find(type)->second.xfieldChanges.pop_back();
+    updated->Reindex(type);
+    SetSnapshot(std::move(updated));
+    return true;
 }
 
 void CXFieldHistoryMap::Add(TAPYRUS_XFIELDTYPES type, const XFieldChange& xFieldChange) {
-    std::unique_lock<std::shared_mutex> lock(xfieldHistoryMutex);
+    std::lock_guard<std::mutex> lock(xfieldHistoryWriteMutex);
+    const std::shared_ptr<const XFieldHistorySnapshot> snapshot = GetSnapshot();
 
     // Check if new
-    auto& listofXfieldChanges = (isTemp ? this->getXFieldHistoryMap() : xfieldHistory).find(type)->second;
+    const auto& listofXfieldChanges = snapshot->lists.find(type)->second.xfieldChanges;
     for(const auto& xfieldItem : listofXfieldChanges)
         if( xfieldItem == xFieldChange )
             return;
 
-    listofXfieldChanges.push_back(xFieldChange);
+    auto updated = std::make_shared<XFieldHistorySnapshot>(*snapshot);
+    updated->lists.find(type)->second.push_back(xFieldChange);
+    updated->Reindex(type);
+    SetSnapshot(std::move(updated));
 }
 
 size_t CXFieldHistoryMap::GetListSize(TAPYRUS_XFIELDTYPES type) const {
-    std::shared_lock<std::shared_mutex> lock(xfieldHistoryMutex);
-    auto& listofXfieldChanges = (isTemp ? this->getXFieldHistoryMap() : xfieldHistory).find(type)->second;
-    return listofXfieldChanges.size();
+    const std::shared_ptr<const XFieldHistorySnapshot> snapshot = GetSnapshot();
+    return snapshot->lists.find(type)->second.size();
 }
 
 XFieldChangeList CXFieldHistoryMap::GetListCopy(TAPYRUS_XFIELDTYPES type) const {
-    std::shared_lock<std::shared_mutex> lock(xfieldHistoryMutex);
-    auto& listofXfieldChanges = (isTemp ? this->getXFieldHistoryMap() : xfieldHistory).find(type)->second;
-    return listofXfieldChanges.xfieldChanges;
+    const std::shared_ptr<const XFieldHistorySnapshot> snapshot = GetSnapshot();
+    return snapshot->lists.find(type)->second.xfieldChanges;
 }
 
 XFieldChange CXFieldHistoryMap::Get(TAPYRUS_XFIELDTYPES type, uint32_t height) {
-    std::shared_lock<std::shared_mutex> lock(xfieldHistoryMutex);
-    auto& listofXfieldChanges = (isTemp ? this->getXFieldHistoryMap() : xfieldHistory).find(type)->second;
+    const std::shared_ptr<const XFieldHistorySnapshot> snapshot = GetSnapshot();
+    const auto& listofXfieldChanges = snapshot->lists.find(type)->second;
 
     if(height == 0 || listofXfieldChanges.size() == 1)
         return listofXfieldChanges[0];
@@ -57,14 +80,15 @@ XFieldChange CXFieldHistoryMap::Get(TAPYRUS_XFIELDTYPES type, uint32_t height) {
     if(height > listofXfieldChanges.back().height)
         return listofXfieldChanges.back();
 
-    // Scan from the end so that when multiple entries share the same height
-    // (e.g. an orphan entry followed by the active-chain entry after reorg),
-    // the most recently added (active-chain) entry is returned first.
-    for(int i = (int)listofXfieldChanges.size() - 1; i >= 0; i--) {
-        if(listofXfieldChanges.at(i).height <= height)
-            return listofXfieldChanges.at(i);
-    }
-    return listofXfieldChanges[0];
+    // Return the last entry at or below height, so that when multiple entries
+    // share the same height (e.g. an orphan entry followed by the active-chain
+    // entry after reorg), the most recently added (active-chain) entry is returned.
+    // That is the last position whose minHeightFrom is at or below height.
+    const std::vector<uint32_t>& minHeight = snapshot->minHeightFrom.find(type)->second;
+    auto it = std::upper_bound(minHeight.begin(), minHeight.end(), height);
+    if(it == minHeight.begin())
+        return listofXfieldChanges[0];
+    return listofXfieldChanges[it - minHeight.begin() - 1];
 }
 
 
@@ -82,11 +106,11 @@ void CXFieldHistory::ToUniValue(TAPYRUS_XFIELDTYPES type, UniValue* xFieldChange
 
 int32_t CXFieldHistoryMap::GetReorgHeight()
 {
-    std::shared_lock<std::shared_mutex> lock(xfieldHistoryMutex);
+    const std::shared_ptr<const XFieldHistorySnapshot> snapshot = GetSnapshot();
     std::vector<uint32_t> changeHeights;
     for(auto x : XFIELDTYPES_INIT_LIST)
     {
-        changeHeights.push_back((isTemp ? this->getXFieldHistoryMap() : xfieldHistory).find(x)->second.xfieldChanges.rbegin()->height);
+        changeHeights.push_back(snapshot->lists.find(x)->second.xfieldChanges.rbegin()->height);
     }
     return *std::max_element(changeHeights.begin(), changeHeights.end());
 }
@@ -8,7 +8,9 @@
 #include <policy/policy.h>
 #include <federationparams.h>
 #include <sync.h>
-#include <shared_mutex>
+
+#include <memory>
+#include <mutex>
 /*
  * struct to store xfieldValue, block hash and height for every xfield update in the blockchain.
  */
@@ -115,35 +117,62 @@ class CBlockTreeDB;
 class UniValue;
 
 typedef std::map< TAPYRUS_XFIELDTYPES, XFieldChangeListWrapper > XFieldHistoryMapType;
+
+/*
+ * Immutable state of the xfield history. It is never modified once published:
+ * Add and Remove publish a modified copy instead, so readers can use it without locks.
+ */
+struct XFieldHistorySnapshot {
+    XFieldHistoryMapType lists;
+
+    /* For each xfield type, the minimum height of the changes from each position
+     * to the end of the list. It is non-decreasing, which lets Get find the last
+     * change at or below a height with a binary search even when reorgs left the
+     * list out of height order. */
+    std::map< TAPYRUS_XFIELDTYPES, std::vector<uint32_t> > minHeightFrom;
+
+    XFieldHistorySnapshot();
+    void Reindex(TAPYRUS_XFIELDTYPES type);
+};
+
 /*  This map is used instead of the list in federation params after v0.5.2
  *
  * XFieldHistoryMapType is a Global map to store all xfield changes.
  *
- * class CXFieldHistoryMap contains a static map of XFieldHistoryMapType.
- * (All objects of this class read and write to the same map.) 
+ * class CXFieldHistoryMap contains a static snapshot of XFieldHistoryMapType.
+ * (All objects of this class read and write to the same snapshot.)
  * This is the full list of xfield change in the active chain.
- * When the isTemp flag is set in the constructor, all methods access the temp map.
+ * Readers atomically load the current snapshot and never block; writers are
+ * serialized by xfieldHistoryWriteMutex and atomically publish a new snapshot.
+ * CTempXFieldHistory keeps its own snapshot instead.
  *
  * Note that this class is pure virtual. It is always accessed via CXFieldHistory or CTempXFieldHistory.
  */
 class CXFieldHistoryMap{
 
-    const bool isTemp;
-
 protected:
-    static XFieldHistoryMapType xfieldHistory;
-    static std::shared_mutex xfieldHistoryMutex; 
-    inline CXFieldHistoryMap(bool temp):isTemp(temp) { }
+    //! Only accessed with std::atomic_load and std::atomic_store
+    static std::shared_ptr<const XFieldHistorySnapshot> xfieldHistory;
+    static std::mutex xfieldHistoryWriteMutex;
+    inline CXFieldHistoryMap() { }
+
+    virtual std::shared_ptr<const XFieldHistorySnapshot> GetSnapshot() const = 0;
+    virtual void SetSnapshot(std::shared_ptr<const XFieldHistorySnapshot> snapshot) = 0;
 
 public:
     virtual ~CXFieldHistoryMap(){}
-    virtual XFieldHistoryMapType& getXFieldHistoryMap() const = 0;
+
+    /* The lists of xfield changes. The returned pointer keeps the snapshot alive,
+     * so the lists stay valid, and unchanged, after a later Add or Remove. */
+    std::shared_ptr<const XFieldHistoryMapType> getXFieldHistoryMap() const {
+        const std::shared_ptr<const XFieldHistorySnapshot> snapshot = GetSnapshot();
+        return std::shared_ptr<const XFieldHistoryMapType>(snapshot, &snapshot->lists);
+    }
 
     template <typename T>
     void GetLatest(TAPYRUS_XFIELDTYPES type, T & xfieldval) const {
-        std::shared_lock<std::shared_mutex> lock(xfieldHistoryMutex);
-        auto& listofXfieldChanges = (isTemp ? this->getXFieldHistoryMap() : xfieldHistory).find(type)->second;
-        xfieldval = std::get<T>(listofXfieldChanges.rbegin()->xfieldValue);
+        const std::shared_ptr<const XFieldHistorySnapshot> snapshot = GetSnapshot();
+        xfieldval = std::get<T>(snapshot->lists.find(type)->second.back().xfieldValue);
     }
 
     // Thread-safe methods to access xfield history data
@@ -167,23 +196,30 @@ public:
  */
 class CXFieldHistory : public CXFieldHistoryMap{
 
+protected:
+    std::shared_ptr<const XFieldHistorySnapshot> GetSnapshot() const override {
+        return std::atomic_load(&xfieldHistory);
+    }
+
+    void SetSnapshot(std::shared_ptr<const XFieldHistorySnapshot> snapshot) override {
+        std::atomic_store(&xfieldHistory, std::move(snapshot));
+    }
+
 public:
-    CXFieldHistory():CXFieldHistoryMap(false) {}
+    CXFieldHistory() {}
     virtual ~CXFieldHistory(){}
 
     //constructor to initialize the confirmed global map
-    inline explicit CXFieldHistory(const CBlock& genesis):CXFieldHistoryMap(false) {
-        xfieldHistory.emplace(TAPYRUS_XFIELDTYPES::AGGPUBKEY, XFieldChangeListWrapper(XFieldAggPubKey::BLOCKTREE_DB_KEY));
-        xfieldHistory.emplace(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE, XFieldChangeListWrapper(XFieldMaxBlockSize::BLOCKTREE_DB_KEY));
-
+    inline explicit CXFieldHistory(const CBlock& genesis) {
+        {
+            std::lock_guard<std::mutex> lock(xfieldHistoryWriteMutex);
+            if (!GetSnapshot())
+                SetSnapshot(std::make_shared<const XFieldHistorySnapshot>());
+        }
         Add(TAPYRUS_XFIELDTYPES::AGGPUBKEY, XFieldChange(genesis.xfield.xfieldValue, 0, genesis.GetHash()));
         Add(TAPYRUS_XFIELDTYPES::MAXBLOCKSIZE, XFieldChange(MAX_BLOCK_SIZE, 0, genesis.GetHash()));
     }
 
-    XFieldHistoryMapType& getXFieldHistoryMap() const override {
-        return xfieldHistory;
-    }
-
     void ToUniValue(TAPYRUS_XFIELDTYPES type, UniValue* xfieldChanges);
 };
 
@@ -196,29 +232,28 @@ public:
  * This temp map used to store the xfield change encountered during processing
  * until the method completes. When the block is confirmed after AcceptBlock the xfield change
  * is added to the global list in CXFieldHistory.
- * IT uses RAII idiom and deallocates the memory when the object goes out of scope.
+ * It starts from the global snapshot, which it shares until its first Add or Remove
+ * publishes a modified copy of its own. It is not shared with other threads.
  */
 class CTempXFieldHistory : public CXFieldHistoryMap{
 
-    XFieldHistoryMapType* xfieldHistoryTemp;
-public:
-    //constructor to initialize the temp map
-    inline explicit CTempXFieldHistory():CXFieldHistoryMap(true){
-        xfieldHistoryTemp = new XFieldHistoryMapType;
-        std::shared_lock<std::shared_mutex> lock(xfieldHistoryMutex);
-        for(const auto& item : xfieldHistory)
-            xfieldHistoryTemp->insert(item);
-    }
+    std::shared_ptr<const XFieldHistorySnapshot> xfieldHistoryTemp;
 
-    virtual ~CTempXFieldHistory(){
-        delete xfieldHistoryTemp;
-        xfieldHistoryTemp = nullptr;
+protected:
+    std::shared_ptr<const XFieldHistorySnapshot> GetSnapshot() const override {
+        return xfieldHistoryTemp;
     }
 
-    XFieldHistoryMapType& getXFieldHistoryMap() const override {
-        return *xfieldHistoryTemp;
+    void SetSnapshot(std::shared_ptr<const XFieldHistorySnapshot> snapshot) override {
+        xfieldHistoryTemp = std::move(snapshot);
     }
 
+public:
+    //constructor to initialize the temp map
+    inline explicit CTempXFieldHistory():
+        xfieldHistoryTemp(std::atomic_load(&xfieldHistory)) { }
+
+    virtual ~CTempXFieldHistory(){}
 };
 
 class IsXFieldLastInHistoryVisitor
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+# Copyright (c) 2024 Chaintope Inc.
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the -coinstatsindex option, and gettxoutsetinfo and gettokensupply answered from the index.
+
+Node 0 scans its UTXO set, node 1 answers from its coinstats index.
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_rpc_error, connect_nodes, wait_until
+
+
+class CoinStatsIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [[], ["-coinstatsindex"]]
+
+    def wait_for_index(self, node):
+        tip = node.getbestblockhash()
+        wait_until(lambda: self.index_has(node, tip), timeout=30)
+
+    def index_has(self, node, blockhash):
+        try:
+            node.gettxoutsetinfo("none", blockhash)
+            return True
+        except Exception:
+            return False
+
+    def assert_same_stats(self, scanned, indexed):
+        for key in ["height", "bestblock", "txouts", "bogosize", "total_amount"]:
+            assert_equal(scanned[key], indexed[key])
+
+    def run_test(self):
+        node, index_node = self.nodes
+
+        node.generate(5, self.signblockprivkey_wif)
+        self.sync_all()
+        past = node.gettxoutsetinfo("muhash")
+
+        node.generate(5, self.signblockprivkey_wif)
+        node.sendtoaddress(node.getnewaddress(), 11)
+        node.generate(1, self.signblockprivkey_wif)
+        self.sync_all()
+        self.wait_for_index(index_node)
+
+        self.log.info("the index matches a scan of the UTXO set")
+        scanned = node.gettxoutsetinfo("muhash")
+        indexed = index_node.gettxoutsetinfo("muhash")
+        self.assert_same_stats(scanned, indexed)
+        assert_equal(scanned["muhash"], indexed["muhash"])
+        assert "transactions" not in indexed
+        assert "disk_size" not in indexed
+        assert "hash_serialized_3" not in indexed
+
+        self.log.info("hash_serialized_3 is still computed by a scan")
+        scanned = node.gettxoutsetinfo()
+        legacy = index_node.gettxoutsetinfo("hash_serialized_3")
+        assert_equal(scanned["hash_serialized_3"], legacy["hash_serialized_3"])
+        assert_equal(scanned["transactions"], legacy["transactions"])
+        assert "muhash" not in legacy
+
+        self.log.info("past blocks are answered by height and by hash")
+        at_height = index_node.gettxoutsetinfo("muhash", 5)
+        self.assert_same_stats(past, at_height)
+        assert_equal(past["muhash"], at_height["muhash"])
+        at_hash = index_node.gettxoutsetinfo("muhash", past["bestblock"])
+        assert_equal(at_height, at_hash)
+        genesis = index_node.gettxoutsetinfo("none", 0)
+        assert_equal(genesis["txouts"], 0)
+        assert "muhash" not in genesis
+
+        self.log.info("invalid requests are rejected")
+        assert_raises_rpc_error(-8, "Querying specific block heights requires -coinstatsindex", node.gettxoutsetinfo, "muhash", 5)
+        assert_raises_rpc_error(-8, "hash_serialized_3 hash type cannot be queried for a specific block", index_node.gettxoutsetinfo, "hash_serialized_3", 5)
+        assert_raises_rpc_error(-8, "foo is not a valid hash_type", index_node.gettxoutsetinfo, "foo")
+        assert_raises_rpc_error(-8, "Target block height 100 after current tip 11", index_node.gettxoutsetinfo, "muhash", 100)
+
+        self.log.info("gettokensupply answers from the index")
+        indexed = index_node.gettxoutsetinfo("none")
+        supply = index_node.gettokensupply("TPC")
+        assert_equal(supply["height"], indexed["height"])
+        assert_equal(supply["bestblock"], indexed["bestblock"])
+        assert_equal(supply["supply"], indexed["total_amount"]["TPC"])
+        assert_equal(supply["utxos"], indexed["txouts"])
+        past_supply = index_node.gettokensupply("TPC", 5)
+        assert_equal(past_supply["supply"], past["total_amount"]["TPC"])
+        assert_equal(past_supply["utxos"], past["txouts"])
+        assert_equal(past_supply["block_utxo_change"], 1)
+        token = "c1" + "11" * 32
+        assert_equal(index_node.gettokensupply(token)["supply"], 0)
+        assert_equal(index_node.gettokensupply(token)["utxos"], 0)
+        assert_raises_rpc_error(-1, "gettokensupply requires -coinstatsindex", node.gettokensupply, "TPC")
+        assert_raises_rpc_error(-8, "Invalid color parameter.", index_node.gettokensupply, "00" * 33)
+        assert_raises_rpc_error(-8, "Invalid color parameter.", index_node.gettokensupply, "c1")
+
+        self.log.info("dumptxoutset hashes the coins while writing them")
+        scanned = node.gettxoutsetinfo()
+        dump = index_node.dumptxoutset("utxo.dat")
+        assert_equal(dump["coins_written"], scanned["txouts"])
+        assert_equal(dump["txoutset_hash"], scanned["hash_serialized_3"])
+
+        self.log.info("the index continues after a restart")
+        self.restart_node(1)
+        connect_nodes(node, 1)
+        node.generate(1, self.signblockprivkey_wif)
+        self.sync_all()
+        self.wait_for_index(index_node)
+        self.assert_same_stats(node.gettxoutsetinfo("muhash"), index_node.gettxoutsetinfo("muhash"))
+        assert_equal(index_node.gettxoutsetinfo("muhash", 5)["muhash"], past["muhash"])
+
+        self.log.info("the index is incompatible with pruning")
+        self.stop_node(1)
+        index_node.assert_start_raises_init_error(["-coinstatsindex", "-prune=550"], "Error: Prune mode is incompatible with -coinstatsindex.")
+
+
+if __name__ == '__main__':
+    CoinStatsIndexTest().main()
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+# Copyright (c) 2024 Chaintope Inc.
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the -dbprofile and -dbbackend options and the getdbinfo RPC.
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.test_node import ErrorMatch
+from test_framework.util import assert_equal, assert_raises_rpc_error
+
+
+class DBProfileTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [["-txindex", "-dbprofile=chainstate:bloombits=12,maxfilesize=4", "-dbprofile=index:writebuffer=1"], ["-txindex", "-dbbackend=memory"]]
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(10, self.signblockprivkey_wif)
+        self.sync_all()
+
+        self.log.info("getdbinfo reports every open database")
+        info = node.getdbinfo()
+        assert_equal(sorted(info.keys()), ["chainstate", "index", "txindex"])
+        for db in info.values():
+            assert_equal(db["backend"], "leveldb")
+            assert db["approximate_size"] >= 0
+            assert db["memory_usage"] >= 0
+            assert len(db["files_per_level"]) > 0
+            for counter in ["compactions", "trivial_moves", "memtable_flushes", "write_stalls"]:
+                assert db[counter] >= 0
+            assert "Compactions" in db["stats"]
+
+        self.log.info("the configured profiles are used")
+        chainstate = node.getdbinfo("chainstate")
+        assert_equal(list(chainstate.keys()), ["chainstate"])
+        assert_equal(chainstate["chainstate"]["profile"]["bloom_bits"], 12)
+        assert_equal(chainstate["chainstate"]["profile"]["max_file_size"], 4 * 1024 * 1024)
+        assert_equal(chainstate["chainstate"]["profile"]["compression"], False)
+        assert_equal(info["index"]["profile"]["write_buffer_size"], 1024 * 1024)
+        assert_equal(info["txindex"]["profile"]["block_size"], 16 * 1024)
+        assert_raises_rpc_error(-8, "No open database named wallet", node.getdbinfo, "wallet")
+
+        self.log.info("the memory backend keeps the databases of a syncing node")
+        memory_node = self.nodes[1]
+        assert_equal(memory_node.getblockcount(), 10)
+        assert_equal(memory_node.getbestblockhash(), node.getbestblockhash())
+        info = memory_node.getdbinfo()
+        assert_equal(sorted(info.keys()), ["chainstate", "index", "txindex"])
+        for db in info.values():
+            assert_equal(db["backend"], "memory")
+            assert db["memory_usage"] > 0
+            assert "keys=" in db["stats"]
+        self.stop_node(1)
+
+        self.log.info("the memory backend does not reuse existing block files")
+        memory_node.assert_start_raises_init_error(["-txindex", "-dbbackend=memory"], "Error: The blocks directory .* is not empty. -dbbackend=memory needs an empty one", match=ErrorMatch.PARTIAL_REGEX)
+
+        self.log.info("a profile can be changed on restart")
+        self.restart_node(0, ["-txindex"])
+        info = node.getdbinfo()
+        assert_equal(info["chainstate"]["profile"]["bloom_bits"], 10)
+        assert_equal(info["chainstate"]["profile"]["max_file_size"], 2 * 1024 * 1024)
+        assert_equal(node.getblockcount(), 10)
+
+        self.log.info("invalid profiles are rejected")
+        self.stop_node(0)
+        node.assert_start_raises_init_error(["-dbprofile=chainstate"], "Error: Invalid -dbprofile 'chainstate': expected <db>:<setting>=<value>[,...]")
+        node.assert_start_raises_init_error(["-dbprofile=wallet:bloombits=1"], "Error: Invalid -dbprofile 'wallet:bloombits=1': unknown database 'wallet'")
+        node.assert_start_raises_init_error(["-dbprofile=chainstate:compression=2"], "Error: Invalid -dbprofile 'chainstate:compression=2': unknown setting or value out of range 'compression=2'")
+        node.assert_start_raises_init_error(["-dbbackend=rocksdb"], "Error: Unknown database backend -dbbackend=rocksdb (available: leveldb, memory)")
+
+
+if __name__ == '__main__':
+    DBProfileTest().main()
@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+# Copyright (c) 2024 Chaintope Inc.
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test bootstrapping a node from a UTXO snapshot.
+
+- Node0 mines 100 blocks and writes a snapshot with dumptxoutset, both as a
+  single file and as a manifest with chunk files written in the background.
+- loadtxoutset errors: node beyond genesis, missing file, unknown base header.
+- Node1 is restarted with -assumeutxo and -loadsnapshot and connected to node0.
+  It syncs headers only, loads the chunked snapshot and has the base block as its tip
+  with the same UTXO set as node0, without the blocks below the base.
+- Node1 then follows new blocks from node0 and keeps its chainstate on restart.
+"""
+import os
+import shutil
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes,
+    get_datadir_path,
+    sync_blocks,
+    wait_until,
+    NetworkDirName,
+)
+
+FILENAME = "utxo.dat"
+MANIFEST = "utxo_chunked.dat"
+CHUNKS = 4
+
+
+class LoadTxOutSetTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        # node1 must not download blocks from node0 before the snapshot is loaded
+        self.setup_nodes()
+
+    def run_test(self):
+        node0, node1 = self.nodes
+
+        node0.generate(100, self.signblockprivkey_wif)
+        out = node0.dumptxoutset(FILENAME)
+        assert_equal(out['base_height'], 100)
+
+        self.log.info("Write a chunked snapshot in the background")
+        assert_equal(node0.getdumptxoutsetinfo(), None)
+        assert_raises_rpc_error(-8, "chunks must be between 1 and 256", node0.dumptxoutset, MANIFEST, 0)
+        node0_datadir = os.path.join(get_datadir_path(self.options.tmpdir, 0), NetworkDirName())
+        chunk_path = os.path.join(node0_datadir, MANIFEST + ".%03d" % (CHUNKS - 1))
+        with open(chunk_path, 'wb') as f:
+            f.write(b'not a chunk')
+        assert_raises_rpc_error(-8, "path already exists", node0.dumptxoutset, MANIFEST, CHUNKS)
+        assert not os.path.exists(os.path.join(node0_datadir, MANIFEST))
+        with open(chunk_path, 'rb') as f:
+            assert_equal(f.read(), b'not a chunk')
+        os.remove(chunk_path)
+        started = node0.dumptxoutset(MANIFEST, CHUNKS)
+        assert_equal(started['chunks'], CHUNKS)
+        assert_equal(started['base_hash'], out['base_hash'])
+        wait_until(lambda: not node0.getdumptxoutsetinfo()['in_progress'])
+        info = node0.getdumptxoutsetinfo()
+        assert 'error' not in info
+        assert_equal(info['progress'], 100)
+        chunked = info['result']
+        assert_equal(chunked['txoutset_hash'], out['txoutset_hash'])
+        assert_equal(chunked['coins_written'], out['coins_written'])
+        assert_equal(len(chunked['chunks']), CHUNKS)
+        assert_equal(sum(c['coins'] for c in chunked['chunks']), out['coins_written'])
+
+        self.log.info("Test loadtxoutset errors")
+        assert_raises_rpc_error(-1, "only be loaded while the active chain is at the genesis block", node0.loadtxoutset, FILENAME)
+        assert_raises_rpc_error(-8, "Snapshot file does not exist", node1.loadtxoutset, FILENAME)
+
+        node1_datadir = os.path.join(get_datadir_path(self.options.tmpdir, 1), NetworkDirName())
+        shutil.copyfile(out['path'], os.path.join(node1_datadir, FILENAME))
+        assert_raises_rpc_error(-1, "is not known", node1.loadtxoutset, FILENAME)
+        node0_datadir = os.path.dirname(chunked['path'])
+        shutil.copyfile(chunked['path'], os.path.join(node1_datadir, MANIFEST))
+        for chunk in chunked['chunks']:
+            shutil.copyfile(os.path.join(node0_datadir, chunk['file']), os.path.join(node1_datadir, chunk['file']))
+        assert_equal(node1.getblockcount(), 0)
+
+        self.log.info("Load the snapshot on startup")
+        self.restart_node(1, extra_args=[
+            "-assumeutxo=%s:%s" % (out['base_hash'], out['txoutset_hash']),
+            "-loadsnapshot=%s" % MANIFEST,
+        ])
+        connect_nodes(node1, 0)
+        wait_until(lambda: node1.getblockcount() == 100)
+        assert_equal(node1.getbestblockhash(), out['base_hash'])
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_3'], out['txoutset_hash'])
+        assert_raises_rpc_error(-1, "Block not available (pruned data)", node1.getblock, node1.getblockhash(50))
+
+        self.log.info("Sync blocks above the snapshot base")
+        node0.generate(5, self.signblockprivkey_wif)
+        sync_blocks(self.nodes)
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_3'], node0.gettxoutsetinfo()['hash_serialized_3'])
+
+        self.log.info("Restart keeps the snapshot chainstate")
+        self.restart_node(1)
+        assert_equal(node1.getblockcount(), 105)
+        assert_equal(node1.getbestblockhash(), node0.getbestblockhash())
+
+
+if __name__ == '__main__':
+    LoadTxOutSetTest().main()
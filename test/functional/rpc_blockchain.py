@@ -68,6 +68,7 @@ class BlockchainTest(BitcoinTestFramework):
             'bestblockhash',
             'blocks',
             'chain',
+            'coinsflush',
             'headers',
             'initialblockdownload',
             'maxBlockSizes',
@@ -100,6 +101,13 @@ class BlockchainTest(BitcoinTestFramework):
         # should have exact keys
         assert_equal(sorted(res.keys()), keys)
 
+        # gettxoutsetinfo flushes the coins cache and waits for the write
+        self.nodes[0].gettxoutsetinfo()
+        coinsflush = self.nodes[0].getblockchaininfo()['coinsflush']
+        assert not coinsflush['in_progress']
+        assert_greater_than_or_equal(coinsflush['last_duration'], 0)
+        assert_greater_than_or_equal(coinsflush['last_stall'], 0)
+
         self.restart_node(0, ['-stopatheight=107', '-prune=550'])
         res = self.nodes[0].getblockchaininfo()
         # result should have these additional pruning keys if prune=550
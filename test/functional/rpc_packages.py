@@ -225,6 +225,30 @@ class RPCPackageTest(BitcoinTestFramework):
             allowhighfees=True
         )
 
+        self.log.info('Test atomic package submission')
+        # a package with an invalid transaction is rejected as a whole
+        package = self.create_package(3)
+        package[2].vin[0].prevout.n = 6
+        package[2].rehash()
+        raw_package = [bytes_to_hex_str(x.serialize()) for x in package]
+        pre_size = node.getmempoolinfo()['size']
+        result = node.submitpackage(rawtxs=raw_package, allowhighfees=True, atomic=True)
+        assert_equal(result, { package[0].hashMalFix: {'allowed': False, 'reject-reason': '70: package-not-accepted'},
+                               package[1].hashMalFix: {'allowed': False, 'reject-reason': '70: package-not-accepted'},
+                               package[2].hashMalFix: {'allowed': False, 'reject-reason': 'missing-inputs'}})
+        assert_equal(node.getmempoolinfo()['size'], pre_size)
+
+        # a valid package is admitted as a whole
+        package = self.create_package(3)
+        raw_package = [bytes_to_hex_str(x.serialize()) for x in package]
+        self.check_submit_mempool_result(
+            result_expected={ package[0].hashMalFix: {'allowed': True},
+                                            package[1].hashMalFix: {'allowed': True},
+                                            package[2].hashMalFix: {'allowed': True}},
+            rawtxs=raw_package,
+            allowhighfees=True,
+            atomic=True
+        )
 
         # package is accepted
         package = self.create_package(1)
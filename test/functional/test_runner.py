@@ -176,6 +176,8 @@ BASE_SCRIPTS = [
     'feature_tokencreation.py  --usecli',
     'feature_logging.py',
     'feature_blocksdir.py',
+    'feature_dbprofile.py',
+    'feature_coinstatsindex.py',
     'feature_config_args.py',
     'rpc_help.py',
     'p2p_getdata.py',
@@ -184,6 +186,7 @@ BASE_SCRIPTS = [
     'feature_coloredcoin.py',
     'feature_cp2sh_softfork.py',
     'rpc_dumptxoutset.py',
+    'feature_loadtxoutset.py',
     'feature_reindex_outoforder_block.py'
     # Don't append tests at the end to avoid merge conflicts
     # Put them in a random line within the section that fits their approximate run-time